@@ -2,21 +2,54 @@
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
-layout (location = 3) in mat4 aInstanceMatrix;
+// CompactInstance: translation and uniform scale, rotation as a unit quaternion
+layout (location = 3) in vec4 aInstancePositionScale;
+layout (location = 4) in vec4 aInstanceRotation;
 
 out vec3 FragPos;
 out vec3 Normal;
 out vec2 TexCoords;
 
-uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 
+#ifdef IMPOSTOR_FADE
+// share of the instance already handed over to its impostor, see impostor.vert
+flat out float Fade;
+
+uniform vec3 cameraPos;
+uniform float boundsRadius;
+uniform vec2 impostorFade;  // start and end, distance per unit of sphere radius
+#endif
+
+#ifdef PACKED_VERTICES
+// positions are quantized to the mesh bounds, see packMeshVertices()
+uniform vec3 positionScale;
+uniform vec3 positionOffset;
+#define POSITION (aPos * positionScale + positionOffset)
+#else
+#define POSITION aPos
+#endif
+
+vec3 rotate(vec4 q, vec3 v)
+{
+    return v + 2.0 * cross(q.xyz, cross(q.xyz, v) + q.w * v);
+}
+
 void main()
 {
-    FragPos = vec3(model * vec4(aPos, 1.0));
-    Normal = mat3(transpose(inverse(model))) * aNormal;
+    // snorm16 leaves the quaternion slightly off unit length
+    vec4 rotation = normalize(aInstanceRotation);
+    vec3 worldPos = aInstancePositionScale.xyz + aInstancePositionScale.w * rotate(rotation, POSITION);
+
+    FragPos = worldPos;
+    Normal = rotate(rotation, aNormal);
     TexCoords = aTexCoords;
+#ifdef IMPOSTOR_FADE
+    float radius = aInstancePositionScale.w * boundsRadius;
+    float distance = length(cameraPos - aInstancePositionScale.xyz) - radius;
+    Fade = clamp((distance / radius - impostorFade.x) / (impostorFade.y - impostorFade.x), 0.0, 1.0);
+#endif
 
-    gl_Position = projection * view * aInstanceMatrix * vec4(aPos, 1.0);
+    gl_Position = projection * view * vec4(worldPos, 1.0);
 }
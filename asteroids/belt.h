@@ -0,0 +1,119 @@
+#ifndef _BELT_H_
+#define _BELT_H_
+
+#include <stdint.h>
+#include <math.h>
+
+#include <cglm/cglm.h>
+
+#include "jobs.h"
+#include "orbit.h"
+
+// Placement of the asteroid belt. Every random number is a pure function of
+// the seed, the instance index and which number of that instance it is
+// (a counter based generator), so any split of the instances over threads or
+// lanes produces the same belt, and a seed always produces the same belt.
+
+// The SplitMix64 finalizer, a full avalanche bijection of 64-bit values
+static inline uint64_t mixRandom(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    x ^= x >> 31;
+    return x;
+}
+
+#define BELT_STREAMS 3  // pairs per instance
+
+// Two independent uniform floats in [0, 1), pair `stream` of instance `index`.
+// The counters of one seed are spaced like the SplitMix64 sequence.
+static inline void randomPair(uint64_t key, unsigned int index, unsigned int stream, float *a, float *b)
+{
+    uint64_t bits = mixRandom(key + ((uint64_t) index * BELT_STREAMS + stream) * 0x9e3779b97f4a7c15ull);
+    *a = (uint32_t) (bits >> 40) * 0x1.0p-24f;
+    *b = (uint32_t) (bits >> 8 & 0xffffff) * 0x1.0p-24f;
+}
+
+typedef struct {
+    uint64_t key;        // derived from the seed
+    unsigned int count;  // instances in the whole belt, they are spread by index
+    float radius;        // of the belt
+    float offset;        // largest displacement from the circle
+    float lapTime;       // seconds per orbit at `radius`
+} BeltParams;
+
+void initBeltParams(BeltParams *params, uint64_t seed, unsigned int count)
+{
+    // a nearby seed must not give overlapping counters
+    params->key = mixRandom(seed ^ 0x6a09e667f3bcc909ull);
+    params->count = count;
+    params->radius = 50.0f;
+    params->offset = 2.5f;
+    params->lapTime = 120.0f;
+}
+
+// Orbits of instances [first, end)
+void generateBelt(const BeltParams *params, unsigned int first, unsigned int end, Orbits *orbits)
+{
+    float radius = params->radius, offset = params->offset;
+
+    for (unsigned int i = first; i < end; i++) {
+        float dx, dy, dz, scale, spin, spinSpeed;
+        randomPair(params->key, i, 0, &dx, &dy);
+        randomPair(params->key, i, 1, &dz, &scale);
+        randomPair(params->key, i, 2, &spin, &spinSpeed);
+
+        // 1. translation: displace along circle with 'radius' in range [-offset, offset]
+        float angle = (float) i / (float) params->count * 360.0f;
+        float x = sinf(angle) * radius + dx * 2.0f * offset - offset;
+        float y = (dy * 2.0f * offset - offset) * 0.4f; // keep height of field smaller compared to width of x and z
+        float z = cosf(angle) * radius + dz * 2.0f * offset - offset;
+        vec3 t = {x, y, z};
+
+        // 2. scale: scale between 0.05 and 0.25f
+        scale = scale * 0.2f + 0.05f;
+
+        // 3. rotation: random start angle, spinning either way at up to a radian per second
+        spin *= 2.0f * GLM_PIf;
+        spinSpeed = spinSpeed * 2.0f - 1.0f;
+
+        // 4. Kepler: the angular speed falls off with radius^1.5
+        float orbitRadius = sqrtf(x * x + z * z);
+        float ratio = radius / orbitRadius;
+        float angularSpeed = 2.0f * GLM_PIf / params->lapTime * ratio * sqrtf(ratio);
+
+        setOrbit(orbits, i, t, scale, spin, angularSpeed, spinSpeed);
+    }
+}
+
+// Parallel generation in chunks of BELT_CHUNK_SIZE instances on the job system
+#define BELT_CHUNK_SIZE 16384
+
+typedef struct {
+    const BeltParams *params;
+    Orbits *orbits;
+} ParallelBelt;
+
+void generateBeltJob(void *data, unsigned int chunk)
+{
+    ParallelBelt *job = data;
+    unsigned int first = chunk * BELT_CHUNK_SIZE;
+    unsigned int end = first + BELT_CHUNK_SIZE < job->orbits->count ? first + BELT_CHUNK_SIZE : job->orbits->count;
+
+    generateBelt(job->params, first, end, job->orbits);
+}
+
+// Orbits of the whole belt, `orbits` holds params->count of them
+void generateBeltParallel(const BeltParams *params, Orbits *orbits)
+{
+    ParallelBelt job = {
+        .params = params,
+        .orbits = orbits,
+    };
+
+    parallelFor((orbits->count + BELT_CHUNK_SIZE - 1) / BELT_CHUNK_SIZE, generateBeltJob, &job);
+}
+
+#endif // _BELT_H_
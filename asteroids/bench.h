@@ -0,0 +1,560 @@
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "model.h"
+#include "frustum_cull.h"
+#include "orbit.h"
+#include "belt.h"
+#include "collision.h"
+#include "hash.h"
+
+// Monotonic wall clock in seconds, usable before (or without) GLFW
+double benchNow ()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Print current and peak resident set size, in KiB
+void printMemoryUsage (const char *label)
+{
+    long pages = 0, residentPages = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f) {
+        if (fscanf(f, "%ld %ld", &pages, &residentPages) != 2) {
+            residentPages = 0;
+        }
+        fclose(f);
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    printf("%s: RSS %ld KiB, peak RSS %ld KiB\n", label,
+        residentPages * (sysconf(_SC_PAGESIZE) / 1024), usage.ru_maxrss);
+}
+
+// Compare a cold import (Assimp + cache write) against a warm start served
+// from the binary mesh cache. Both runs include texture decode and GL upload.
+void benchModelStartup (const char *path, unsigned int flags, unsigned int iterations)
+{
+    char cachePath[PATH_MAX];
+    getMeshCachePath(path, cachePath, sizeof(cachePath));
+
+    double coldTotal = 0.0, warmTotal = 0.0;
+
+    for (unsigned int i = 0; i < iterations; i++) {
+        remove(cachePath);
+
+        double start = benchNow();
+        Model cold = createModel(path, flags);
+        finishTextureUploads();
+        coldTotal += benchNow() - start;
+        destroyModel(&cold);
+
+        start = benchNow();
+        Model warm = createModel(path, flags);
+        finishTextureUploads();
+        warmTotal += benchNow() - start;
+        destroyModel(&warm);
+    }
+
+    printf("%-32s cold import: %8.2f ms  cache hit: %8.2f ms  speedup: %.2fx\n", path,
+        coldTotal * 1000.0 / iterations, warmTotal * 1000.0 / iterations, coldTotal / warmTotal);
+}
+
+// Time the parallel CPU half of the import (vertex conversion, index flattening,
+// material lookup) with 1..N threads. The Assimp import is done once up front
+// and the GL upload is left out, so only the part that scales is measured.
+void benchModelThreads (const char *path, unsigned int iterations)
+{
+    const struct aiScene *scene = aiImportFile(path, MODEL_IMPORT_FLAGS);
+    if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
+        printf("ERROR::ASSIMP::%s\n", aiGetErrorString());
+        exit(EXIT_FAILURE);
+    }
+
+    unsigned int maxThreads = getNumCores();
+    unsigned int numMeshes = 0;
+    double serial = 0.0;
+
+    for (unsigned int threads = 1; threads <= maxThreads; threads++) {
+        shutdownJobSystem();
+        initJobSystem(threads - 1); // the calling thread runs jobs too
+
+        double start = benchNow();
+        for (unsigned int i = 0; i < iterations; i++) {
+            Model model = { 0 };
+            processScene(&model, scene);
+
+            numMeshes = model.numMeshes;
+            for (unsigned int m = 0; m < model.numMeshes; m++) {
+                releaseMeshData(&model.meshes[m]);
+                freeMeshTextures(&model.meshes[m]);
+            }
+            free(model.meshes);
+        }
+        double elapsed = (benchNow() - start) / iterations;
+
+        if (threads == 1) {
+            serial = elapsed;
+        }
+        printf("%s (%u meshes) %2u threads: %8.3f ms  speedup: %.2fx\n", path, numMeshes, threads,
+            elapsed * 1000.0, serial / elapsed);
+    }
+
+    aiReleaseImport(scene);
+}
+
+// The per-model texture list the cache replaced: a linear strcmp scan over
+// fixed size records, grown one element at a time
+typedef struct {
+    unsigned int id;
+    char type[50];
+    char path[PATH_MAX];
+} LegacyTexture;
+
+// Stands in for loadTextureAsync(), hands out fake texture names
+unsigned int benchTextureId;
+
+unsigned int benchLoadTexture (const char *path)
+{
+    (void) path;
+    return ++benchTextureId;
+}
+
+// Lookup cost of `numRefs` texture references spread over `numUnique` paths,
+// linear scan against acquireTexture(), whose misses include the realpath().
+// Fake texture names are used so no GL context or image file is needed.
+void benchTextureCache (unsigned int numUnique, unsigned int numRefs)
+{
+    char (*paths)[64] = malloc(numUnique * sizeof(*paths));
+    for (unsigned int i = 0; i < numUnique; i++) {
+        snprintf(paths[i], sizeof(paths[i]), "resources/textures/texture_%05u.png", i);
+    }
+
+    // linear scan
+    LegacyTexture *loaded = NULL;
+    unsigned int numLoaded = 0;
+    unsigned long checksum = 0;
+
+    double start = benchNow();
+    for (unsigned int r = 0; r < numRefs; r++) {
+        const char *path = paths[(r * 7919u) % numUnique];
+
+        unsigned int found = numLoaded;
+        for (unsigned int j = 0; j < numLoaded; j++) {
+            if (strcmp(loaded[j].path, path) == 0) {
+                found = j;
+                break;
+            }
+        }
+        if (found == numLoaded) {
+            loaded = realloc(loaded, (numLoaded + 1) * sizeof(LegacyTexture));
+            loaded[numLoaded].id = numLoaded + 1;
+            snprintf(loaded[numLoaded].type, sizeof(loaded[numLoaded].type), "texture_diffuse");
+            snprintf(loaded[numLoaded].path, sizeof(loaded[numLoaded].path), "%s", path);
+            numLoaded++;
+        }
+        checksum += loaded[found].id;
+    }
+    double linear = benchNow() - start;
+    free(loaded);
+
+    // acquireTexture() with its miss path, on a scratch cache so the real one is
+    // left alone and with the GL load stubbed out like the scan's above
+    TextureCache saved = textureCache;
+    memset(&textureCache, 0, sizeof(textureCache));
+    textureCache.load = benchLoadTexture;
+    benchTextureId = 0;
+
+    start = benchNow();
+    for (unsigned int r = 0; r < numRefs; r++) {
+        checksum -= acquireTexture(paths[(r * 7919u) % numUnique]);
+    }
+    double hashed = benchNow() - start;
+
+    for (unsigned int i = 0; i < textureCache.numRecords; i++) {
+        freeTextureRecordPaths(&textureCache.records[i]);
+    }
+    free(textureCache.records);
+    free(textureCache.freeRecords);
+    freeHashMap(&textureCache.byPath);
+    freeHashMap(&textureCache.byId);
+    textureCache = saved;
+    free(paths);
+
+    printf("texture lookup, %u refs over %5u textures: linear %8.3f ms  hashed %8.3f ms  speedup: %.1fx%s\n",
+        numRefs, numUnique, linear * 1000.0, hashed * 1000.0, linear / hashed,
+        checksum == 0 ? "" : " (MISMATCH)");
+}
+
+// `count` random spheres in a ring like the asteroid field, scaled up with the
+// count so roughly the same share stays visible, and a camera looking at it
+void createCullBenchScene(unsigned int count, SphereBounds *bounds, Frustum *frustum)
+{
+    initSphereBounds(bounds, count);
+
+    float ring = 50.0f * sqrtf(count / 100000.0f);
+    srand(1);
+    for (unsigned int i = 0; i < count; i++) {
+        float angle = (float) i / (float) count * 2.0f * GLM_PIf;
+        vec3 center = {
+            sinf(angle) * ring + (rand() % 500) / 100.0f - 2.5f,
+            (rand() % 500) / 250.0f - 1.0f,
+            cosf(angle) * ring + (rand() % 500) / 100.0f - 2.5f,
+        };
+        setSphereBounds(bounds, i, center, (rand() % 20) / 100.0f + 0.05f);
+    }
+
+    mat4 view, projection;
+    vec3 eye = {0.0f, 10.0f, ring + 5.0f}, target = {0.0f, 0.0f, 0.0f}, up = {0.0f, 1.0f, 0.0f};
+    glm_lookat(eye, target, up, view);
+    glm_perspective(glm_rad(45.0f), 800.0f / 600.0f, 0.1f, 4.0f * ring, projection);
+    extractFrustum(projection, view, frustum);
+}
+
+// Cull kernel alone over `count` spheres, the scalar loop against the SSE and
+// (if available) AVX kernels
+void benchFrustumCull(unsigned int count, unsigned int iterations)
+{
+    SphereBounds bounds;
+    Frustum frustum;
+    createCullBenchScene(count, &bounds, &frustum);
+
+    unsigned int *visible = malloc(bounds.capacity * sizeof(unsigned int));
+
+    const char *simdName;
+    struct {
+        const char *name;
+        CullFunction cull;
+    } kernels[] = {
+        {"scalar", cullSpheresScalar},
+        {"sse", cullSpheresSSE},
+        {NULL, selectCullFunction(&simdName)},
+    };
+    kernels[2].name = simdName;
+    unsigned int numKernels = strcmp(simdName, "avx") == 0 ? 3 : 2;
+
+    double scalarTime = 0.0;
+    unsigned int scalarVisible = 0;
+    for (unsigned int k = 0; k < numKernels; k++) {
+        unsigned int numVisible = kernels[k].cull(&frustum, &bounds, 0, count, visible);  // warm up
+
+        double start = benchNow();
+        for (unsigned int i = 0; i < iterations; i++) {
+            numVisible = kernels[k].cull(&frustum, &bounds, 0, count, visible);
+        }
+        double time = (benchNow() - start) / iterations;
+
+        if (k == 0) {
+            scalarTime = time;
+            scalarVisible = numVisible;
+        }
+        printf("cull %8u spheres, %-6s: %8.3f ms  %6.2f ns/sphere  %8u visible  speedup: %5.2fx%s\n",
+            count, kernels[k].name, time * 1000.0, time * 1e9 / count, numVisible, scalarTime / time,
+            numVisible == scalarVisible ? "" : " (MISMATCH)");
+    }
+
+    free(visible);
+    freeSphereBounds(&bounds);
+}
+
+// Cull plus compaction of the instance matrices on the job system with 1..N
+// threads, the full per frame cost of the CPU culling stage
+void benchFrustumCullThreads(unsigned int count, unsigned int iterations)
+{
+    SphereBounds bounds;
+    Frustum frustum;
+    createCullBenchScene(count, &bounds, &frustum);
+
+    mat4 *matrices = aligned_alloc(CULL_ALIGNMENT, bounds.capacity * sizeof(mat4));
+    mat4 *instances = aligned_alloc(CULL_ALIGNMENT, bounds.capacity * sizeof(mat4));
+    for (unsigned int i = 0; i < count; i++) {
+        glm_mat4_identity(matrices[i]);
+        matrices[i][3][0] = bounds.x[i];
+        matrices[i][3][1] = bounds.y[i];
+        matrices[i][3][2] = bounds.z[i];
+    }
+    unsigned int *visible = malloc(bounds.capacity * sizeof(unsigned int));
+    unsigned int *chunkCounts = malloc(cullNumChunks(count) * sizeof(unsigned int));
+    unsigned int *chunkOffsets = malloc(cullNumChunks(count) * sizeof(unsigned int));
+
+    const char *kernel;
+    CullFunction cull = selectCullFunction(&kernel);
+
+    unsigned int maxThreads = getNumCores();
+    double serial = 0.0;
+
+    for (unsigned int threads = 1; threads <= maxThreads; threads++) {
+        shutdownJobSystem();
+        initJobSystem(threads - 1); // the calling thread runs jobs too
+
+        unsigned int numVisible = cullInstancesParallel(cull, &frustum, &bounds, matrices, instances, sizeof(mat4),
+            visible, chunkCounts, chunkOffsets);  // warm up
+
+        double start = benchNow();
+        for (unsigned int i = 0; i < iterations; i++) {
+            numVisible = cullInstancesParallel(cull, &frustum, &bounds, matrices, instances, sizeof(mat4),
+                visible, chunkCounts, chunkOffsets);
+        }
+        double elapsed = (benchNow() - start) / iterations;
+
+        if (threads == 1) {
+            serial = elapsed;
+        }
+        printf("cull + compact %8u instances (%s, %u chunks) %2u threads: %8.3f ms  %8u visible  speedup: %5.2fx  efficiency: %3.0f%%\n",
+            count, kernel, cullNumChunks(count), threads, elapsed * 1000.0, numVisible, serial / elapsed,
+            100.0 * serial / elapsed / threads);
+    }
+
+    free(matrices);
+    free(instances);
+    free(visible);
+    free(chunkCounts);
+    free(chunkOffsets);
+    freeSphereBounds(&bounds);
+}
+
+// Per frame orbit update of `count` rocks: the scalar loop against the SIMD
+// kernels on one thread, then the widest one on the job system. The output is
+// plain memory, the frame loop writes the same records into the instance ring.
+void benchOrbitUpdate(unsigned int count, unsigned int iterations)
+{
+    Orbits orbits;
+    vec3 axis = {0.4f, 0.6f, 0.8f};
+    initOrbits(&orbits, count, axis);
+    srand(1);
+    for (unsigned int i = 0; i < count; i++) {
+        float angle = (float) i / (float) count * 2.0f * GLM_PIf;
+        vec3 position = {sinf(angle) * 50.0f, (rand() % 500) / 250.0f - 1.0f, cosf(angle) * 50.0f};
+        setOrbit(&orbits, i, position, (rand() % 20) / 100.0f + 0.05f, rand() % 360,
+            0.05f + (rand() % 100) / 10000.0f, (rand() % 200) / 100.0f - 1.0f);
+    }
+
+    SphereBounds bounds;
+    initSphereBounds(&bounds, count);
+    CompactInstance *reference = malloc((count ? count : 1) * sizeof(CompactInstance));
+    CompactInstance *instances = malloc((count ? count : 1) * sizeof(CompactInstance));
+
+    const char *simdName;
+    struct {
+        const char *name;
+        OrbitFunction update;
+    } kernels[] = {
+        {"scalar", updateOrbitsScalar},
+        {"sse", updateOrbitsSSE},
+        {NULL, selectOrbitFunction(&simdName)},
+    };
+    kernels[2].name = simdName;
+    unsigned int numKernels = strcmp(simdName, "avx2") == 0 ? 3 : 2;
+
+    // a time far into the run, so the argument reduction is exercised as well
+    float t = 600.0f;
+    double scalarTime = 0.0;
+    for (unsigned int k = 0; k < numKernels + 1; k++) {
+        bool parallel = k == numKernels;
+        OrbitFunction update = kernels[parallel ? numKernels - 1 : k].update;
+        CompactInstance *out = k == 0 ? reference : instances;
+
+        double start = 0.0;
+        for (unsigned int i = 0; i <= iterations; i++) {
+            if (i == 1) {
+                start = benchNow();  // after a warm up round
+            }
+            if (parallel) {
+                updateOrbitsParallel(update, &orbits, t + i * 0.016f, out, &bounds);
+            }
+            else {
+                update(&orbits, t + i * 0.016f, 0, count, out, &bounds);
+            }
+        }
+        double time = (benchNow() - start) / iterations;
+
+        // largest difference to the scalar kernel, in position units and snorm16 steps
+        float maxPosition = 0.0f;
+        int maxRotation = 0;
+        for (unsigned int i = 0; i < count; i++) {
+            for (int c = 0; c < 3; c++) {
+                maxPosition = fmaxf(maxPosition, fabsf(out[i].position[c] - reference[i].position[c]));
+            }
+            for (int c = 0; c < 4; c++) {
+                int difference = abs(out[i].rotation[c] - reference[i].rotation[c]);
+                maxRotation = difference > maxRotation ? difference : maxRotation;
+            }
+        }
+
+        if (k == 0) {
+            scalarTime = time;
+        }
+        char name[32];
+        snprintf(name, sizeof(name), parallel ? "%s x%u" : "%s", kernels[parallel ? numKernels - 1 : k].name,
+            jobSystem.numThreads + 1);
+        printf("orbit update %8u rocks, %-8s: %8.3f ms per frame  %6.2f ns/rock  speedup: %5.2fx  max error %.2g, %d\n",
+            count, name, time * 1000.0, time * 1e9 / count, scalarTime / time, maxPosition, maxRotation);
+    }
+
+    free(reference);
+    free(instances);
+    freeSphereBounds(&bounds);
+    freeOrbits(&orbits);
+}
+
+// Hash of every orbit parameter, equal for equal belts
+uint64_t hashOrbits(const Orbits *orbits)
+{
+    const float *arrays[] = {orbits->radius, orbits->angle, orbits->angularSpeed, orbits->height,
+        orbits->scale, orbits->spin, orbits->spinSpeed};
+    uint64_t hash = HASH_SEED;
+    for (unsigned int a = 0; a < sizeof(arrays) / sizeof(arrays[0]); a++) {
+        hash = hashBytes(hash, arrays[a], orbits->count * sizeof(float));
+    }
+    return hash;
+}
+
+// Belt placement with the serial rand() loop it replaced, then with the counter
+// based generator on 1..N threads. Every thread count has to give the same belt.
+void benchBeltGeneration(uint64_t seed, unsigned int count, unsigned int iterations)
+{
+    Orbits orbits;
+    vec3 axis = {0.4f, 0.6f, 0.8f};
+    initOrbits(&orbits, count, axis);
+
+    double start = benchNow();
+    for (unsigned int n = 0; n < iterations; n++) {
+        srand(seed);
+        for (unsigned int i = 0; i < count; i++) {
+            float angle = (float) i / (float) count * 360.0f;
+            float x = sinf(angle) * 50.0f + (rand() % 500) / 100.0f - 2.5f;
+            float y = ((rand() % 500) / 100.0f - 2.5f) * 0.4f;
+            float z = cosf(angle) * 50.0f + (rand() % 500) / 100.0f - 2.5f;
+            vec3 position = {x, y, z};
+            float scale = (rand() % 20) / 100.0f + 0.05f;
+            float spin = rand() % 360;
+            float spinSpeed = (rand() % 200) / 100.0f - 1.0f;
+            float angularSpeed = 2.0f * GLM_PIf / 120.0f * powf(50.0f / sqrtf(x * x + z * z), 1.5f);
+            setOrbit(&orbits, i, position, scale, spin, angularSpeed, spinSpeed);
+        }
+    }
+    double serial = (benchNow() - start) / iterations;
+    printf("belt %8u rocks, rand() serial: %8.2f ms  %6.2f ns/rock\n", count, serial * 1000.0, serial * 1e9 / count);
+
+    BeltParams params;
+    initBeltParams(&params, seed, count);
+    unsigned int maxThreads = getNumCores();
+    uint64_t reference = 0;
+
+    for (unsigned int threads = 1; threads <= maxThreads; threads++) {
+        shutdownJobSystem();
+        initJobSystem(threads - 1); // the calling thread runs jobs too
+
+        memset(orbits.radius, 0, orbits.capacity * sizeof(float));
+        start = benchNow();
+        for (unsigned int n = 0; n < iterations; n++) {
+            generateBeltParallel(&params, &orbits);
+        }
+        double elapsed = (benchNow() - start) / iterations;
+
+        uint64_t hash = hashOrbits(&orbits);
+        if (threads == 1) {
+            reference = hash;
+        }
+        printf("belt %8u rocks, counter %2u threads: %8.2f ms  %6.2f ns/rock  speedup: %5.2fx  hash %016llx %s\n",
+            count, threads, elapsed * 1000.0, elapsed * 1e9 / count, serial / elapsed,
+            (unsigned long long) hash, hash == reference ? "same" : "DIFFERENT");
+    }
+
+    freeOrbits(&orbits);
+}
+
+
+// Collision grid rebuild and contact query over a generated belt of `count`
+// rocks, with the scalar contact kernel and then the selected one on 1..N
+// threads. The belt is widened to about the density of the default 100000
+// rocks, so the contacts grow with the count rather than with its square.
+// `rockRadius` is the bounding radius of a rock of scale 1. Small belts are
+// checked against brute force.
+void benchCollisions(unsigned int count, float rockRadius, unsigned int iterations)
+{
+    Orbits orbits;
+    vec3 axis = {0.4f, 0.6f, 0.8f};
+    initOrbits(&orbits, count, axis);
+    BeltParams params;
+    initBeltParams(&params, 1, count);
+    params.offset *= sqrtf(count / 100000.0f);
+    generateBeltParallel(&params, &orbits);
+
+    SphereBounds bounds;
+    initSphereBounds(&bounds, count);
+    float maxRadius = 0.0f;
+    for (unsigned int i = 0; i < count; i++) {
+        vec3 center = {0.0f, 0.0f, 0.0f};
+        setSphereBounds(&bounds, i, center, orbits.scale[i] * rockRadius);
+        maxRadius = fmaxf(maxRadius, bounds.radius[i]);
+    }
+    CompactInstance *instances = malloc((count ? count : 1) * sizeof(CompactInstance));
+    updateOrbitsParallel(updateOrbitsScalar, &orbits, 0.0f, instances, &bounds);
+
+    CollisionGrid grid;
+    initCollisionGrid(&grid, count, maxRadius);
+
+    const char *kernel;
+    ContactFunction findSphereContacts = selectContactFunction(&kernel);
+    unsigned int maxThreads = getNumCores();
+    double serial = 0.0;
+
+    // the scalar kernel on one thread first, then the selected one on 1..N threads
+    for (unsigned int run = 0; run <= maxThreads; run++) {
+        unsigned int threads = run ? run : 1;
+        ContactFunction findContactsKernel = run ? findSphereContacts : findSphereContactsScalar;
+        shutdownJobSystem();
+        initJobSystem(threads - 1); // the calling thread runs jobs too
+
+        buildCollisionGrid(&grid, &bounds);  // warm up
+        findContacts(findContactsKernel, &grid, &bounds);
+
+        double buildTime = 0.0, start = benchNow();
+        unsigned int numContacts = 0;
+        for (unsigned int i = 0; i < iterations; i++) {
+            double buildStart = benchNow();
+            buildCollisionGrid(&grid, &bounds);
+            buildTime += benchNow() - buildStart;
+            numContacts = findContacts(findContactsKernel, &grid, &bounds);
+        }
+        double elapsed = (benchNow() - start) / iterations;
+        buildTime /= iterations;
+
+        if (run == 0) {
+            serial = elapsed;
+        }
+        printf("collide %8u rocks, %-6s %2u threads: rebuild %8.3f ms  query %8.3f ms  %8u contacts  speedup: %5.2fx\n",
+            count, run ? kernel : "scalar", threads, buildTime * 1000.0, (elapsed - buildTime) * 1000.0, numContacts,
+            serial / elapsed);
+
+        if (run == 0 && count <= 20000) {
+            unsigned int numBrute = 0;
+            for (unsigned int i = 0; i < count; i++) {
+                for (unsigned int j = i + 1; j < count; j++) {
+                    float dx = bounds.x[j] - bounds.x[i], dy = bounds.y[j] - bounds.y[i], dz = bounds.z[j] - bounds.z[i];
+                    float reach = bounds.radius[i] + bounds.radius[j];
+                    numBrute += dx * dx + dy * dy + dz * dz < reach * reach;
+                }
+            }
+            printf("collide %8u rocks, brute force: %8u contacts %s\n", count, numBrute,
+                numBrute == numContacts ? "match" : "MISMATCH");
+        }
+    }
+
+    freeCollisionGrid(&grid);
+    free(instances);
+    freeSphereBounds(&bounds);
+    freeOrbits(&orbits);
+}
+
+#endif // _BENCH_H_
@@ -0,0 +1,464 @@
+#ifndef _COLLISION_H_
+#define _COLLISION_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <math.h>
+#include <immintrin.h>
+
+#include <cglm/cglm.h>
+
+#include "jobs.h"
+#include "frustum_cull.h"
+
+// Broad phase for sphere collisions on a uniform grid. Cells are as wide as the
+// largest sphere, so two spheres can only touch when their centers lie in the
+// same or in neighbouring cells. The cells are hashed into a power of two table
+// and every frame the spheres are counting sorted into it: a parallel pass
+// hashes the centers and counts per slot, a parallel prefix sum gives every
+// slot its range and a second pass scatters the spheres and their indices into the
+// ranges. Different cells may share a slot, the narrow phase filters those out
+// along with the neighbours that do not touch.
+typedef struct {
+    unsigned int a, b;  // a < b
+    float depth;        // overlap of the two spheres
+} Contact;
+
+#define COLLISION_CHUNK_SIZE 16384
+#define COLLISION_SCAN_BLOCK 65536
+#define COLLISION_MIN_RADIUS 1e-3f  // cell size floor, for a grid of points or of nothing
+
+typedef struct {
+    float cellSize, inverseCellSize;
+    unsigned int numSlots;     // power of two
+    unsigned int capacity;     // spheres
+
+    unsigned int *slotOf;      // slot of every sphere
+    atomic_uint *slotCounts;   // spheres per slot, then the scatter cursor of each slot
+    unsigned int *slotStart;   // numSlots + 1 entries, the spheres of slot s are entries[slotStart[s], slotStart[s + 1])
+    unsigned int *entries;     // sphere indices sorted by slot
+    float *x, *y, *z, *radius; // the spheres in the same order, so neighbours are read from adjacent memory
+    unsigned int *blockSums;   // per COLLISION_SCAN_BLOCK slots
+
+    // pairs found by the chunks of the last query, kept between frames
+    Contact **chunkContacts;
+    unsigned int *chunkNumContacts, *chunkContactCapacity;
+    Contact *contacts;
+    unsigned int numContacts, contactCapacity;
+} CollisionGrid;
+
+static inline int collisionCell(const CollisionGrid *grid, float x)
+{
+    return (int) floorf(x * grid->inverseCellSize);
+}
+
+static inline unsigned int collisionSlot(const CollisionGrid *grid, int x, int y, int z)
+{
+    unsigned int hash = (unsigned int) x * 73856093u ^ (unsigned int) y * 19349663u ^ (unsigned int) z * 83492791u;
+    return hash & (grid->numSlots - 1);
+}
+
+unsigned int collisionNumChunks(unsigned int count)
+{
+    return (count + COLLISION_CHUNK_SIZE - 1) / COLLISION_CHUNK_SIZE;
+}
+
+// Grid for up to `capacity` spheres with radii up to `maxRadius`
+void initCollisionGrid(CollisionGrid *grid, unsigned int capacity, float maxRadius)
+{
+    memset(grid, 0, sizeof(*grid));
+    // with --count 0 the radius is 0, a finite cell keeps the cell coordinates in int range
+    grid->cellSize = 2.0f * fmaxf(maxRadius, COLLISION_MIN_RADIUS);
+    grid->inverseCellSize = 1.0f / grid->cellSize;
+    grid->capacity = capacity;
+    // about two slots per sphere keeps unrelated cells from sharing a slot
+    grid->numSlots = 1024;
+    while (grid->numSlots < 2 * capacity) {
+        grid->numSlots *= 2;
+    }
+
+    unsigned int numChunks = collisionNumChunks(capacity) ? collisionNumChunks(capacity) : 1;
+    unsigned int numBlocks = (grid->numSlots + COLLISION_SCAN_BLOCK - 1) / COLLISION_SCAN_BLOCK;
+    grid->slotOf = malloc((capacity ? capacity : 1) * sizeof(unsigned int));
+    grid->slotCounts = malloc(grid->numSlots * sizeof(atomic_uint));
+    grid->slotStart = malloc((grid->numSlots + 1) * sizeof(unsigned int));
+    grid->entries = malloc((capacity ? capacity : 1) * sizeof(unsigned int));
+    grid->x = malloc((capacity ? capacity : 1) * sizeof(float));
+    grid->y = malloc((capacity ? capacity : 1) * sizeof(float));
+    grid->z = malloc((capacity ? capacity : 1) * sizeof(float));
+    grid->radius = malloc((capacity ? capacity : 1) * sizeof(float));
+    grid->blockSums = malloc(numBlocks * sizeof(unsigned int));
+    grid->chunkContacts = calloc(numChunks, sizeof(Contact *));
+    grid->chunkNumContacts = calloc(numChunks, sizeof(unsigned int));
+    grid->chunkContactCapacity = calloc(numChunks, sizeof(unsigned int));
+    if (!grid->slotOf || !grid->slotCounts || !grid->slotStart || !grid->entries || !grid->blockSums ||
+        !grid->x || !grid->y || !grid->z || !grid->radius ||
+        !grid->chunkContacts || !grid->chunkNumContacts || !grid->chunkContactCapacity) {
+        printf("ERROR::COLLISION::OUT_OF_MEMORY %u spheres\n", capacity);
+        exit(EXIT_FAILURE);
+    }
+}
+
+void freeCollisionGrid(CollisionGrid *grid)
+{
+    for (unsigned int c = 0; c < collisionNumChunks(grid->capacity); c++) {
+        free(grid->chunkContacts[c]);
+    }
+    free(grid->slotOf);
+    free(grid->slotCounts);
+    free(grid->slotStart);
+    free(grid->entries);
+    free(grid->x);
+    free(grid->y);
+    free(grid->z);
+    free(grid->radius);
+    free(grid->blockSums);
+    free(grid->chunkContacts);
+    free(grid->chunkNumContacts);
+    free(grid->chunkContactCapacity);
+    free(grid->contacts);
+    memset(grid, 0, sizeof(*grid));
+}
+
+typedef struct {
+    CollisionGrid *grid;
+    const SphereBounds *bounds;
+} ParallelCollision;
+
+void clearSlotsJob(void *data, unsigned int block)
+{
+    CollisionGrid *grid = ((ParallelCollision *) data)->grid;
+    unsigned int first = block * COLLISION_SCAN_BLOCK;
+    unsigned int end = first + COLLISION_SCAN_BLOCK < grid->numSlots ? first + COLLISION_SCAN_BLOCK : grid->numSlots;
+
+    for (unsigned int s = first; s < end; s++) {
+        atomic_init(&grid->slotCounts[s], 0);
+    }
+}
+
+void countSlotsJob(void *data, unsigned int chunk)
+{
+    ParallelCollision *job = data;
+    CollisionGrid *grid = job->grid;
+    const SphereBounds *bounds = job->bounds;
+    unsigned int first = chunk * COLLISION_CHUNK_SIZE;
+    unsigned int end = first + COLLISION_CHUNK_SIZE < bounds->count ? first + COLLISION_CHUNK_SIZE : bounds->count;
+
+    for (unsigned int i = first; i < end; i++) {
+        unsigned int slot = collisionSlot(grid, collisionCell(grid, bounds->x[i]), collisionCell(grid, bounds->y[i]),
+            collisionCell(grid, bounds->z[i]));
+        grid->slotOf[i] = slot;
+        atomic_fetch_add_explicit(&grid->slotCounts[slot], 1, memory_order_relaxed);
+    }
+}
+
+void sumSlotsJob(void *data, unsigned int block)
+{
+    CollisionGrid *grid = ((ParallelCollision *) data)->grid;
+    unsigned int first = block * COLLISION_SCAN_BLOCK;
+    unsigned int end = first + COLLISION_SCAN_BLOCK < grid->numSlots ? first + COLLISION_SCAN_BLOCK : grid->numSlots;
+
+    unsigned int sum = 0;
+    for (unsigned int s = first; s < end; s++) {
+        sum += atomic_load_explicit(&grid->slotCounts[s], memory_order_relaxed);
+    }
+    grid->blockSums[block] = sum;
+}
+
+// Exclusive prefix sum of the block, starting at the total of the blocks before.
+// The counts turn into the scatter cursors.
+void scanSlotsJob(void *data, unsigned int block)
+{
+    CollisionGrid *grid = ((ParallelCollision *) data)->grid;
+    unsigned int first = block * COLLISION_SCAN_BLOCK;
+    unsigned int end = first + COLLISION_SCAN_BLOCK < grid->numSlots ? first + COLLISION_SCAN_BLOCK : grid->numSlots;
+
+    unsigned int start = grid->blockSums[block];
+    for (unsigned int s = first; s < end; s++) {
+        unsigned int count = atomic_load_explicit(&grid->slotCounts[s], memory_order_relaxed);
+        grid->slotStart[s] = start;
+        atomic_store_explicit(&grid->slotCounts[s], start, memory_order_relaxed);
+        start += count;
+    }
+}
+
+void scatterSlotsJob(void *data, unsigned int chunk)
+{
+    ParallelCollision *job = data;
+    CollisionGrid *grid = job->grid;
+    const SphereBounds *bounds = job->bounds;
+    unsigned int first = chunk * COLLISION_CHUNK_SIZE;
+    unsigned int end = first + COLLISION_CHUNK_SIZE < bounds->count ? first + COLLISION_CHUNK_SIZE : bounds->count;
+
+    for (unsigned int i = first; i < end; i++) {
+        unsigned int at = atomic_fetch_add_explicit(&grid->slotCounts[grid->slotOf[i]], 1, memory_order_relaxed);
+        grid->entries[at] = i;
+        grid->x[at] = bounds->x[i];
+        grid->y[at] = bounds->y[i];
+        grid->z[at] = bounds->z[i];
+        grid->radius[at] = bounds->radius[i];
+    }
+}
+
+// Sort the centers of `bounds` into the grid, bounds->count <= capacity
+void buildCollisionGrid(CollisionGrid *grid, const SphereBounds *bounds)
+{
+    ParallelCollision job = {
+        .grid = grid,
+        .bounds = bounds,
+    };
+    unsigned int numChunks = collisionNumChunks(bounds->count);
+    unsigned int numBlocks = (grid->numSlots + COLLISION_SCAN_BLOCK - 1) / COLLISION_SCAN_BLOCK;
+
+    parallelFor(numBlocks, clearSlotsJob, &job);
+    parallelFor(numChunks, countSlotsJob, &job);
+    parallelFor(numBlocks, sumSlotsJob, &job);
+    unsigned int total = 0;
+    for (unsigned int b = 0; b < numBlocks; b++) {
+        unsigned int sum = grid->blockSums[b];
+        grid->blockSums[b] = total;
+        total += sum;
+    }
+    parallelFor(numBlocks, scanSlotsJob, &job);
+    grid->slotStart[grid->numSlots] = total;
+    parallelFor(numChunks, scatterSlotsJob, &job);
+}
+
+// Slots of the 3x3x3 cells around a cell, each slot once. Returns how many.
+static inline unsigned int neighbourSlots(const CollisionGrid *grid, int x, int y, int z, unsigned int slots[27])
+{
+    unsigned int numSlots = 0;
+    for (int dz = -1; dz <= 1; dz++) {
+        for (int dy = -1; dy <= 1; dy++) {
+            for (int dx = -1; dx <= 1; dx++) {
+                unsigned int slot = collisionSlot(grid, x + dx, y + dy, z + dz);
+                unsigned int k = 0;
+                while (k < numSlots && slots[k] != slot) {
+                    k++;
+                }
+                if (k == numSlots) {
+                    slots[numSlots++] = slot;
+                }
+            }
+        }
+    }
+    return numSlots;
+}
+
+void pushContact(CollisionGrid *grid, unsigned int chunk, Contact contact)
+{
+    if (grid->chunkNumContacts[chunk] == grid->chunkContactCapacity[chunk]) {
+        unsigned int capacity = grid->chunkContactCapacity[chunk] ? grid->chunkContactCapacity[chunk] * 2 : 256;
+        Contact *contacts = realloc(grid->chunkContacts[chunk], capacity * sizeof(Contact));
+        if (!contacts) {
+            printf("ERROR::COLLISION::OUT_OF_MEMORY %u contacts\n", capacity);
+            exit(EXIT_FAILURE);
+        }
+        grid->chunkContacts[chunk] = contacts;
+        grid->chunkContactCapacity[chunk] = capacity;
+    }
+    grid->chunkContacts[chunk][grid->chunkNumContacts[chunk]++] = contact;
+}
+
+// A contact kernel tests sorted sphere `e` against the spheres of `slots` and
+// pushes its contacts to the list of `chunk`. A pair is reported by its lower
+// index only.
+typedef void (*ContactFunction)(CollisionGrid *grid, unsigned int chunk, unsigned int e,
+    const unsigned int *slots, unsigned int numSlots);
+
+void findSphereContactsScalar(CollisionGrid *grid, unsigned int chunk, unsigned int e,
+    const unsigned int *slots, unsigned int numSlots)
+{
+    // locals, so the stores of pushContact() do not force reloads of the arrays
+    const unsigned int *entries = grid->entries, *slotStart = grid->slotStart;
+    const float *sx = grid->x, *sy = grid->y, *sz = grid->z, *sradius = grid->radius;
+    unsigned int i = entries[e];
+    float x = sx[e], y = sy[e], z = sz[e], radius = sradius[e];
+
+    for (unsigned int k = 0; k < numSlots; k++) {
+        unsigned int slotEnd = slotStart[slots[k] + 1];
+        for (unsigned int f = slotStart[slots[k]]; f < slotEnd; f++) {
+            float dx = sx[f] - x, dy = sy[f] - y, dz = sz[f] - z;
+            float reach = radius + sradius[f];
+            float distance2 = dx * dx + dy * dy + dz * dz;
+            if (distance2 < reach * reach && entries[f] > i) {
+                Contact contact = {i, entries[f], reach - sqrtf(distance2)};
+                pushContact(grid, chunk, contact);
+            }
+        }
+    }
+}
+
+// Eight neighbours per test, the few hits are picked out of the mask
+__attribute__((target("avx")))
+void findSphereContactsAVX(CollisionGrid *grid, unsigned int chunk, unsigned int e,
+    const unsigned int *slots, unsigned int numSlots)
+{
+    const unsigned int *entries = grid->entries, *slotStart = grid->slotStart;
+    const float *sx = grid->x, *sy = grid->y, *sz = grid->z, *sradius = grid->radius;
+    unsigned int i = entries[e];
+    float x = sx[e], y = sy[e], z = sz[e], radius = sradius[e];
+    __m256 x8 = _mm256_set1_ps(x), y8 = _mm256_set1_ps(y), z8 = _mm256_set1_ps(z), radius8 = _mm256_set1_ps(radius);
+
+    for (unsigned int k = 0; k < numSlots; k++) {
+        unsigned int f = slotStart[slots[k]], slotEnd = slotStart[slots[k] + 1];
+        for (; f + 8 <= slotEnd; f += 8) {
+            __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(sx + f), x8);
+            __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(sy + f), y8);
+            __m256 dz = _mm256_sub_ps(_mm256_loadu_ps(sz + f), z8);
+            __m256 reach = _mm256_add_ps(_mm256_loadu_ps(sradius + f), radius8);
+            __m256 distance2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)),
+                _mm256_mul_ps(dz, dz));
+            unsigned int mask = _mm256_movemask_ps(_mm256_cmp_ps(distance2, _mm256_mul_ps(reach, reach), _CMP_LT_OQ));
+            while (mask) {
+                unsigned int g = f + __builtin_ctz(mask);
+                mask &= mask - 1;
+                if (entries[g] > i) {
+                    float gx = sx[g] - x, gy = sy[g] - y, gz = sz[g] - z;
+                    Contact contact = {i, entries[g], radius + sradius[g] - sqrtf(gx * gx + gy * gy + gz * gz)};
+                    pushContact(grid, chunk, contact);
+                }
+            }
+        }
+        for (; f < slotEnd; f++) {
+            float dx = sx[f] - x, dy = sy[f] - y, dz = sz[f] - z;
+            float reach = radius + sradius[f];
+            float distance2 = dx * dx + dy * dy + dz * dz;
+            if (distance2 < reach * reach && entries[f] > i) {
+                Contact contact = {i, entries[f], reach - sqrtf(distance2)};
+                pushContact(grid, chunk, contact);
+            }
+        }
+    }
+}
+
+ContactFunction selectContactFunction(const char **name)
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx")) {
+        *name = "avx";
+        return findSphereContactsAVX;
+    }
+    *name = "scalar";
+    return findSphereContactsScalar;
+}
+
+typedef struct {
+    ContactFunction findSphereContacts;
+    CollisionGrid *grid;
+    unsigned int count;
+} ParallelContacts;
+
+// Narrow phase of one chunk of the sorted spheres. Walking them in slot order
+// keeps the neighbouring slots in cache from one sphere to the next, and the
+// neighbours are only looked up again when the cell changes.
+void findContactsJob(void *data, unsigned int chunk)
+{
+    ParallelContacts *job = data;
+    CollisionGrid *grid = job->grid;
+    unsigned int first = chunk * COLLISION_CHUNK_SIZE;
+    unsigned int end = first + COLLISION_CHUNK_SIZE < job->count ? first + COLLISION_CHUNK_SIZE : job->count;
+
+    grid->chunkNumContacts[chunk] = 0;
+    unsigned int slots[27], numSlots = 0;
+    int cell[3] = {0, 0, 0};
+    for (unsigned int e = first; e < end; e++) {
+        int cx = collisionCell(grid, grid->x[e]), cy = collisionCell(grid, grid->y[e]), cz = collisionCell(grid, grid->z[e]);
+        if (e == first || cx != cell[0] || cy != cell[1] || cz != cell[2]) {
+            numSlots = neighbourSlots(grid, cx, cy, cz, slots);
+            cell[0] = cx;
+            cell[1] = cy;
+            cell[2] = cz;
+        }
+        job->findSphereContacts(grid, chunk, e, slots, numSlots);
+    }
+}
+
+// Every pair of overlapping spheres of `bounds`, after buildCollisionGrid() on
+// the same bounds. The pairs end up in grid->contacts. Returns how many there are.
+unsigned int findContacts(ContactFunction findSphereContacts, CollisionGrid *grid, const SphereBounds *bounds)
+{
+    ParallelContacts job = {
+        .findSphereContacts = findSphereContacts,
+        .grid = grid,
+        .count = bounds->count,
+    };
+    unsigned int numChunks = collisionNumChunks(bounds->count);
+    parallelFor(numChunks, findContactsJob, &job);
+
+    unsigned int total = 0;
+    for (unsigned int c = 0; c < numChunks; c++) {
+        total += grid->chunkNumContacts[c];
+    }
+    if (total > grid->contactCapacity) {
+        free(grid->contacts);
+        grid->contactCapacity = total * 2;
+        grid->contacts = malloc(grid->contactCapacity * sizeof(Contact));
+        if (!grid->contacts) {
+            printf("ERROR::COLLISION::OUT_OF_MEMORY %u contacts\n", total);
+            exit(EXIT_FAILURE);
+        }
+    }
+    grid->numContacts = 0;
+    for (unsigned int c = 0; c < numChunks; c++) {
+        memcpy(grid->contacts + grid->numContacts, grid->chunkContacts[c], grid->chunkNumContacts[c] * sizeof(Contact));
+        grid->numContacts += grid->chunkNumContacts[c];
+    }
+    return grid->numContacts;
+}
+
+// Spheres of the last build overlapping the sphere at `center`, which may be larger
+// than the cells. `push` gets the sum of the moves that would separate the
+// sphere from each of them. Returns how many there are.
+unsigned int collideSphere(const CollisionGrid *grid, vec3 center, float radius, vec3 push)
+{
+    glm_vec3_zero(push);
+    if (grid->slotStart[grid->numSlots] == 0) {
+        return 0;  // nothing to hit, and the cells of an empty grid are far smaller than the sphere
+    }
+    // a sphere of the grid is at most half a cell in radius
+    int reach = (int) ceilf(radius * grid->inverseCellSize + 0.5f);
+    int cx = collisionCell(grid, center[0]), cy = collisionCell(grid, center[1]), cz = collisionCell(grid, center[2]);
+    if (reach > 4) {
+        printf("ERROR::COLLISION::SPHERE_TOO_LARGE %f\n", radius);
+        exit(EXIT_FAILURE);
+    }
+
+    // distinct slots of the covered cells, at most 9^3
+    unsigned int slots[729], numSlots = 0;
+    for (int z = cz - reach; z <= cz + reach; z++) {
+        for (int y = cy - reach; y <= cy + reach; y++) {
+            for (int x = cx - reach; x <= cx + reach; x++) {
+                unsigned int slot = collisionSlot(grid, x, y, z);
+                unsigned int k = 0;
+                while (k < numSlots && slots[k] != slot) {
+                    k++;
+                }
+                if (k == numSlots) {
+                    slots[numSlots++] = slot;
+                }
+            }
+        }
+    }
+
+    unsigned int numContacts = 0;
+    for (unsigned int k = 0; k < numSlots; k++) {
+        for (unsigned int e = grid->slotStart[slots[k]]; e < grid->slotStart[slots[k] + 1]; e++) {
+            vec3 offset = {center[0] - grid->x[e], center[1] - grid->y[e], center[2] - grid->z[e]};
+            float reachJ = radius + grid->radius[e];
+            float distance = glm_vec3_norm(offset);
+            if (distance < reachJ) {
+                if (distance > 0.0f) {
+                    glm_vec3_scale(offset, (reachJ - distance) / distance, offset);
+                    glm_vec3_add(push, offset, push);
+                }
+                numContacts++;
+            }
+        }
+    }
+    return numContacts;
+}
+
+#endif // _COLLISION_H_
@@ -0,0 +1,25 @@
+#version 330 core
+layout (location = 0) in vec4 aInstancePositionScale;
+layout (location = 1) in uvec2 aInstanceRotation;  // snorm16 quaternion, copied as is
+
+out vec4 vInstancePositionScale;
+flat out uvec2 vInstanceRotation;
+flat out int vVisible;
+
+// normalized, pointing inside, see extractFrustum()
+uniform vec4 planes[6];
+// bounding sphere of the model around its origin, scaled with the instance
+uniform float boundsRadius;
+
+void main()
+{
+    float radius = aInstancePositionScale.w * boundsRadius;
+    vVisible = 1;
+    for (int i = 0; i < 6; i++) {
+        if (dot(planes[i].xyz, aInstancePositionScale.xyz) + planes[i].w < -radius) {
+            vVisible = 0;
+        }
+    }
+    vInstancePositionScale = aInstancePositionScale;
+    vInstanceRotation = aInstanceRotation;
+}
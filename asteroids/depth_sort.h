@@ -0,0 +1,200 @@
+#ifndef _DEPTH_SORT_H_
+#define _DEPTH_SORT_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cglm/cglm.h>
+
+#include "jobs.h"
+#include "frustum_cull.h"
+
+// Front to back order for the visible instances. Every instance gets a 16-bit
+// key from its quantized view depth, with the draw bucket above it, and an LSD
+// radix sort in 8-bit digits orders them. Each pass is a parallel counting
+// sort: the chunks count their digits, a prefix sum over (digit, chunk) gives
+// every chunk its place per digit and the chunks scatter in order, so the
+// passes are stable and the last one, on the bucket, leaves every bucket
+// sorted by depth. The last pass scatters the instance records themselves.
+#define DEPTH_SORT_BITS 16
+#define DEPTH_SORT_RADIX 256
+
+typedef struct {
+    vec3 eye, forward;
+    float scale;  // key steps per unit of depth
+
+    unsigned int *keys[2], *indices[2];  // ping pong, capacity entries each
+    unsigned int *chunkHistograms;       // DEPTH_SORT_RADIX per chunk
+    unsigned int capacity;
+} DepthSort;
+
+void initDepthSort(DepthSort *sort, unsigned int capacity)
+{
+    memset(sort, 0, sizeof(*sort));
+    sort->capacity = capacity ? capacity : 1;
+    for (int i = 0; i < 2; i++) {
+        sort->keys[i] = malloc(sort->capacity * sizeof(unsigned int));
+        sort->indices[i] = malloc(sort->capacity * sizeof(unsigned int));
+    }
+    sort->chunkHistograms = malloc(cullNumChunks(sort->capacity) * DEPTH_SORT_RADIX * sizeof(unsigned int));
+    if (!sort->keys[0] || !sort->keys[1] || !sort->indices[0] || !sort->indices[1] || !sort->chunkHistograms) {
+        printf("ERROR::DEPTH_SORT::OUT_OF_MEMORY %u instances\n", capacity);
+        exit(EXIT_FAILURE);
+    }
+}
+
+void freeDepthSort(DepthSort *sort)
+{
+    for (int i = 0; i < 2; i++) {
+        free(sort->keys[i]);
+        free(sort->indices[i]);
+    }
+    free(sort->chunkHistograms);
+    memset(sort, 0, sizeof(*sort));
+}
+
+// Camera of this frame, depths past `far` share the last key
+void setDepthSortView(DepthSort *sort, vec3 eye, vec3 forward, float far)
+{
+    glm_vec3_copy(eye, sort->eye);
+    glm_vec3_normalize_to(forward, sort->forward);
+    sort->scale = ((1 << DEPTH_SORT_BITS) - 1) / far;
+}
+
+static inline unsigned int depthSortKey(const DepthSort *sort, float x, float y, float z)
+{
+    float depth = (x - sort->eye[0]) * sort->forward[0] + (y - sort->eye[1]) * sort->forward[1] +
+        (z - sort->eye[2]) * sort->forward[2];
+    float key = depth * sort->scale;
+    if (key <= 0.0f) {
+        return 0;
+    }
+    return key < (1 << DEPTH_SORT_BITS) - 1 ? (unsigned int) key : (1 << DEPTH_SORT_BITS) - 1;
+}
+
+// One pass over the digit at `shift`. The input is either compact, `count`
+// entries, or chunked like the cull output when `chunkCounts` is set, with
+// chunk c at c * CULL_CHUNK_SIZE. Without `output` the keys and indices are
+// written to outKeys and outIndices, with it the records the indices point to.
+typedef struct {
+    const unsigned int *keys, *indices;
+    const unsigned int *chunkCounts;
+    unsigned int count;
+    unsigned int shift;
+    unsigned int *histograms;
+
+    unsigned int *outKeys, *outIndices;
+    const void *instances;
+    void *output;
+    size_t instanceSize;
+} RadixPass;
+
+static inline unsigned int radixChunkCount(const RadixPass *pass, unsigned int chunk)
+{
+    if (pass->chunkCounts) {
+        return pass->chunkCounts[chunk];
+    }
+    unsigned int first = chunk * CULL_CHUNK_SIZE;
+    return first + CULL_CHUNK_SIZE < pass->count ? CULL_CHUNK_SIZE : pass->count - first;
+}
+
+void radixCountJob(void *data, unsigned int chunk)
+{
+    RadixPass *pass = data;
+    const unsigned int *keys = pass->keys + chunk * CULL_CHUNK_SIZE;
+    unsigned int *histogram = pass->histograms + chunk * DEPTH_SORT_RADIX;
+
+    memset(histogram, 0, DEPTH_SORT_RADIX * sizeof(unsigned int));
+    for (unsigned int i = 0; i < radixChunkCount(pass, chunk); i++) {
+        histogram[(keys[i] >> pass->shift) & (DEPTH_SORT_RADIX - 1)]++;
+    }
+}
+
+void radixScatterJob(void *data, unsigned int chunk)
+{
+    RadixPass *pass = data;
+    const unsigned int *keys = pass->keys + chunk * CULL_CHUNK_SIZE;
+    const unsigned int *indices = pass->indices + chunk * CULL_CHUNK_SIZE;
+    unsigned int *next = pass->histograms + chunk * DEPTH_SORT_RADIX;
+
+    for (unsigned int i = 0; i < radixChunkCount(pass, chunk); i++) {
+        unsigned int at = next[(keys[i] >> pass->shift) & (DEPTH_SORT_RADIX - 1)]++;
+        if (pass->output) {
+            memcpy((char *) pass->output + (size_t) at * pass->instanceSize,
+                (const char *) pass->instances + (size_t) indices[i] * pass->instanceSize, pass->instanceSize);
+        }
+        else {
+            pass->outKeys[at] = keys[i];
+            pass->outIndices[at] = indices[i];
+        }
+    }
+}
+
+// Run one pass over `numChunks` chunks, digit d ends up at [digitFirst[d], digitFirst[d + 1])
+void radixSortPass(RadixPass *pass, unsigned int numChunks, unsigned int digitFirst[DEPTH_SORT_RADIX + 1])
+{
+    parallelFor(numChunks, radixCountJob, pass);
+
+    unsigned int total = 0;
+    for (unsigned int digit = 0; digit < DEPTH_SORT_RADIX; digit++) {
+        digitFirst[digit] = total;
+        for (unsigned int c = 0; c < numChunks; c++) {
+            unsigned int count = pass->histograms[c * DEPTH_SORT_RADIX + digit];
+            pass->histograms[c * DEPTH_SORT_RADIX + digit] = total;
+            total += count;
+        }
+    }
+    digitFirst[DEPTH_SORT_RADIX] = total;
+
+    parallelFor(numChunks, radixScatterJob, pass);
+}
+
+// Sort the chunked entries of keys[0] and indices[0], `chunkCounts` per chunk
+// of CULL_CHUNK_SIZE, and write the records of `instances` to `output` in key
+// order. The key is (bucket << DEPTH_SORT_BITS) | depth, bucket d ends up at
+// [bucketFirst[d], bucketFirst[d + 1]). Returns how many records there are.
+unsigned int depthSortInstances(DepthSort *sort, const unsigned int *chunkCounts, unsigned int numChunks,
+    const void *instances, void *output, size_t instanceSize, unsigned int bucketFirst[DEPTH_SORT_RADIX + 1])
+{
+    unsigned int digitFirst[DEPTH_SORT_RADIX + 1];
+    RadixPass pass = {
+        .keys = sort->keys[0],
+        .indices = sort->indices[0],
+        .chunkCounts = chunkCounts,
+        .shift = 0,
+        .histograms = sort->chunkHistograms,
+        .outKeys = sort->keys[1],
+        .outIndices = sort->indices[1],
+    };
+    radixSortPass(&pass, numChunks, digitFirst);
+    unsigned int count = digitFirst[DEPTH_SORT_RADIX];
+    unsigned int numCompactChunks = cullNumChunks(count);
+
+    RadixPass high = {
+        .keys = sort->keys[1],
+        .indices = sort->indices[1],
+        .count = count,
+        .shift = 8,
+        .histograms = sort->chunkHistograms,
+        .outKeys = sort->keys[0],
+        .outIndices = sort->indices[0],
+    };
+    radixSortPass(&high, numCompactChunks, digitFirst);
+
+    RadixPass bucket = {
+        .keys = sort->keys[0],
+        .indices = sort->indices[0],
+        .count = count,
+        .shift = DEPTH_SORT_BITS,
+        .histograms = sort->chunkHistograms,
+        .instances = instances,
+        .output = output,
+        .instanceSize = instanceSize,
+    };
+    radixSortPass(&bucket, numCompactChunks, bucketFirst);
+
+    return count;
+}
+
+#endif // _DEPTH_SORT_H_
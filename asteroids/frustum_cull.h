@@ -0,0 +1,294 @@
+#ifndef _FRUSTUM_CULL_H_
+#define _FRUSTUM_CULL_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <immintrin.h>
+
+#include <cglm/cglm.h>
+
+#include "jobs.h"
+
+// Instance bounding spheres stored as structure of arrays, so the kernels load
+// 4 (SSE) or 8 (AVX) centers per component with a single aligned load
+typedef struct {
+    float *x, *y, *z, *radius;
+    unsigned int count;     // real spheres
+    unsigned int capacity;  // count rounded up to CULL_LANES, the tail never passes the test
+} SphereBounds;
+
+#define CULL_LANES 8      // widest kernel, arrays are padded and aligned for it
+#define CULL_ALIGNMENT 32
+
+typedef struct {
+    vec4 planes[6];  // a, b, c, d with the normal pointing inside, normalized
+} Frustum;
+
+// Gribb/Hartmann plane extraction from the combined matrix
+void extractFrustum(mat4 projection, mat4 view, Frustum *frustum)
+{
+    mat4 viewProjection;
+    glm_mat4_mul(projection, view, viewProjection);
+    glm_frustum_planes(viewProjection, frustum->planes);
+}
+
+unsigned int cullPaddedCount(unsigned int count)
+{
+    return (count + CULL_LANES - 1) / CULL_LANES * CULL_LANES;
+}
+
+void initSphereBounds(SphereBounds *bounds, unsigned int count)
+{
+    bounds->count = count;
+    bounds->capacity = cullPaddedCount(count ? count : 1);
+
+    size_t bytes = bounds->capacity * sizeof(float);
+    bounds->x = aligned_alloc(CULL_ALIGNMENT, bytes);
+    bounds->y = aligned_alloc(CULL_ALIGNMENT, bytes);
+    bounds->z = aligned_alloc(CULL_ALIGNMENT, bytes);
+    bounds->radius = aligned_alloc(CULL_ALIGNMENT, bytes);
+    if (!bounds->x || !bounds->y || !bounds->z || !bounds->radius) {
+        printf("ERROR::CULL::OUT_OF_MEMORY %u spheres\n", count);
+        exit(EXIT_FAILURE);
+    }
+
+    // -inf radius fails every plane, so the padding needs no special case in the kernels
+    for (unsigned int i = 0; i < bounds->capacity; i++) {
+        bounds->x[i] = bounds->y[i] = bounds->z[i] = 0.0f;
+        bounds->radius[i] = -INFINITY;
+    }
+}
+
+void setSphereBounds(SphereBounds *bounds, unsigned int i, vec3 center, float radius)
+{
+    bounds->x[i] = center[0];
+    bounds->y[i] = center[1];
+    bounds->z[i] = center[2];
+    bounds->radius[i] = radius;
+}
+
+// World space sphere of a local sphere under `transform`, scaled by the largest axis
+void transformSphere(mat4 transform, vec3 center, float radius, vec3 outCenter, float *outRadius)
+{
+    vec4 local = {center[0], center[1], center[2], 1.0f}, world;
+    glm_mat4_mulv(transform, local, world);
+    glm_vec3_copy(world, outCenter);
+
+    float scale = 0.0f;
+    for (int c = 0; c < 3; c++) {
+        float length = glm_vec3_norm(transform[c]);
+        scale = length > scale ? length : scale;
+    }
+    *outRadius = radius * scale;
+}
+
+void freeSphereBounds(SphereBounds *bounds)
+{
+    free(bounds->x);
+    free(bounds->y);
+    free(bounds->z);
+    free(bounds->radius);
+    memset(bounds, 0, sizeof(*bounds));
+}
+
+// A cull kernel tests spheres [first, end) and writes the indices of the visible
+// ones to `visible` in ascending order, returning how many there are. `first`
+// must be a multiple of CULL_LANES and `end` one as well unless it is the count.
+// `visible` needs room for end - first entries rounded up to CULL_LANES.
+typedef unsigned int (*CullFunction)(const Frustum *frustum, const SphereBounds *bounds,
+    unsigned int first, unsigned int end, unsigned int *visible);
+
+unsigned int cullSpheresScalar(const Frustum *frustum, const SphereBounds *bounds,
+    unsigned int first, unsigned int end, unsigned int *visible)
+{
+    unsigned int numVisible = 0;
+
+    for (unsigned int i = first; i < end; i++) {
+        bool inside = true;
+        for (int p = 0; p < 6 && inside; p++) {
+            const float *plane = frustum->planes[p];
+            // same evaluation order as the SIMD kernels, so all of them agree on the boundary
+            float distance = (plane[0] * bounds->x[i] + plane[1] * bounds->y[i]) + (plane[2] * bounds->z[i] + plane[3]);
+            inside = distance >= -bounds->radius[i];
+        }
+        if (inside) {
+            visible[numVisible++] = i;
+        }
+    }
+
+    return numVisible;
+}
+
+// Branch free compaction: every lane is written, only the visible ones advance.
+// Neighbouring instances tend to be culled together, so empty blocks are skipped.
+#define CULL_COMPACT(lanes, mask, base) \
+    if (mask) { \
+        for (unsigned int lane = 0; lane < (lanes); lane++) { \
+            visible[numVisible] = (base) + lane; \
+            numVisible += ((mask) >> lane) & 1; \
+        } \
+    }
+
+unsigned int cullSpheresSSE(const Frustum *frustum, const SphereBounds *bounds,
+    unsigned int first, unsigned int end, unsigned int *visible)
+{
+    __m128 planes[6][4];
+    for (int p = 0; p < 6; p++) {
+        for (int c = 0; c < 4; c++) {
+            planes[p][c] = _mm_set1_ps(frustum->planes[p][c]);
+        }
+    }
+
+    unsigned int numVisible = 0;
+    end = (end + 3) & ~3u;
+
+    for (unsigned int i = first; i < end; i += 4) {
+        __m128 x = _mm_load_ps(bounds->x + i);
+        __m128 y = _mm_load_ps(bounds->y + i);
+        __m128 z = _mm_load_ps(bounds->z + i);
+        __m128 negativeRadius = _mm_xor_ps(_mm_load_ps(bounds->radius + i), _mm_set1_ps(-0.0f));
+
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (int p = 0; p < 6; p++) {
+            __m128 distance = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(planes[p][0], x), _mm_mul_ps(planes[p][1], y)),
+                _mm_add_ps(_mm_mul_ps(planes[p][2], z), planes[p][3]));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negativeRadius));
+        }
+
+        unsigned int mask = _mm_movemask_ps(inside);
+        CULL_COMPACT(4, mask, i);
+    }
+
+    return numVisible;
+}
+
+__attribute__((target("avx")))
+unsigned int cullSpheresAVX(const Frustum *frustum, const SphereBounds *bounds,
+    unsigned int first, unsigned int end, unsigned int *visible)
+{
+    __m256 planes[6][4];
+    for (int p = 0; p < 6; p++) {
+        for (int c = 0; c < 4; c++) {
+            planes[p][c] = _mm256_set1_ps(frustum->planes[p][c]);
+        }
+    }
+
+    unsigned int numVisible = 0;
+    end = cullPaddedCount(end);
+
+    for (unsigned int i = first; i < end; i += 8) {
+        __m256 x = _mm256_load_ps(bounds->x + i);
+        __m256 y = _mm256_load_ps(bounds->y + i);
+        __m256 z = _mm256_load_ps(bounds->z + i);
+        __m256 negativeRadius = _mm256_xor_ps(_mm256_load_ps(bounds->radius + i), _mm256_set1_ps(-0.0f));
+
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (int p = 0; p < 6; p++) {
+            __m256 distance = _mm256_add_ps(
+                _mm256_add_ps(_mm256_mul_ps(planes[p][0], x), _mm256_mul_ps(planes[p][1], y)),
+                _mm256_add_ps(_mm256_mul_ps(planes[p][2], z), planes[p][3]));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, negativeRadius, _CMP_GE_OQ));
+        }
+
+        unsigned int mask = _mm256_movemask_ps(inside);
+        CULL_COMPACT(8, mask, i);
+    }
+
+    return numVisible;
+}
+
+// Widest kernel the CPU runs, SSE is part of x86-64 so it is always there
+CullFunction selectCullFunction(const char **name)
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx")) {
+        *name = "avx";
+        return cullSpheresAVX;
+    }
+    *name = "sse";
+    return cullSpheresSSE;
+}
+
+// Parallel cull and compaction. Chunks are culled independently into their own
+// slice of the scratch index array, an exclusive prefix sum over the chunk counts
+// then gives every chunk its place in the output, so the scatter needs no locks.
+#define CULL_CHUNK_SIZE 16384  // multiple of CULL_LANES
+
+typedef struct {
+    CullFunction cull;
+    const Frustum *frustum;
+    const SphereBounds *bounds;
+
+    unsigned int *visible;       // bounds->capacity entries, chunk c starts at c * CULL_CHUNK_SIZE
+    unsigned int *chunkCounts;
+    unsigned int *chunkOffsets;
+
+    const void *instances;       // per instance records of instanceSize bytes, indexed like the spheres
+    void *output;                // compacted records
+    size_t instanceSize;
+} ParallelCull;
+
+void cullChunkJob(void *data, unsigned int chunk)
+{
+    ParallelCull *job = data;
+    unsigned int first = chunk * CULL_CHUNK_SIZE;
+    unsigned int end = first + CULL_CHUNK_SIZE < job->bounds->count ? first + CULL_CHUNK_SIZE : job->bounds->count;
+
+    job->chunkCounts[chunk] = job->cull(job->frustum, job->bounds, first, end, job->visible + first);
+}
+
+void scatterChunkJob(void *data, unsigned int chunk)
+{
+    ParallelCull *job = data;
+    const unsigned int *visible = job->visible + chunk * CULL_CHUNK_SIZE;
+    const char *instances = job->instances;
+    char *out = (char *) job->output + (size_t) job->chunkOffsets[chunk] * job->instanceSize;
+
+    for (unsigned int i = 0; i < job->chunkCounts[chunk]; i++) {
+        memcpy(out + i * job->instanceSize, instances + (size_t) visible[i] * job->instanceSize, job->instanceSize);
+    }
+}
+
+unsigned int cullNumChunks(unsigned int count)
+{
+    return (count + CULL_CHUNK_SIZE - 1) / CULL_CHUNK_SIZE;
+}
+
+// Cull on the job system and copy the records of the visible instances to
+// `output` in index order. `visible` needs bounds->capacity entries and the
+// two chunk arrays cullNumChunks(bounds->count) each. Returns the visible count.
+unsigned int cullInstancesParallel(CullFunction cull, const Frustum *frustum, const SphereBounds *bounds,
+    const void *instances, void *output, size_t instanceSize,
+    unsigned int *visible, unsigned int *chunkCounts, unsigned int *chunkOffsets)
+{
+    ParallelCull job = {
+        .cull = cull,
+        .frustum = frustum,
+        .bounds = bounds,
+        .visible = visible,
+        .chunkCounts = chunkCounts,
+        .chunkOffsets = chunkOffsets,
+        .instances = instances,
+        .output = output,
+        .instanceSize = instanceSize,
+    };
+
+    unsigned int numChunks = cullNumChunks(bounds->count);
+    parallelFor(numChunks, cullChunkJob, &job);
+
+    unsigned int numVisible = 0;
+    for (unsigned int c = 0; c < numChunks; c++) {
+        chunkOffsets[c] = numVisible;
+        numVisible += chunkCounts[c];
+    }
+
+    parallelFor(numChunks, scatterChunkJob, &job);
+
+    return numVisible;
+}
+
+#endif // _FRUSTUM_CULL_H_
@@ -0,0 +1,461 @@
+#ifndef _GEOMETRY_ARENA_H_
+#define _GEOMETRY_ARENA_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <glad/glad.h>
+
+#include "vertex_format.h"
+
+// Shared vertex and index storage. One arena per vertex format owns a single
+// VBO, EBO and VAO. Meshes are sub-allocated as base vertex / first index ranges
+// and drawn with glDrawElementsBaseVertex, so a whole model needs one VAO bind.
+// Growing re-specifies the same buffer names (the contents go through a scratch
+// buffer), so VAOs built on top of an arena never go stale. Freed ranges are
+// merged with their neighbours, compactGeometryArena() closes the remaining holes.
+
+#define GEOMETRY_ARENA_INITIAL_VERTICES (64 * 1024)
+#define GEOMETRY_ARENA_INITIAL_INDEX_BYTES (256 * 1024)
+#define GEOMETRY_ARENA_INDEX_ALIGNMENT 4  // GL_UNSIGNED_INT ranges must start 4 byte aligned
+
+typedef struct {
+    unsigned int offset, size;
+} ArenaRange;
+
+// First fit allocator over [0, capacity), the unit is up to the caller
+typedef struct {
+    unsigned int capacity, used;
+
+    ArenaRange *freeRanges;  // sorted by offset, adjacent ranges are always merged
+    unsigned int numFreeRanges, maxFreeRanges;
+} RangeAllocator;
+
+void insertFreeRange(RangeAllocator *allocator, unsigned int position, ArenaRange range)
+{
+    if (allocator->numFreeRanges == allocator->maxFreeRanges) {
+        allocator->maxFreeRanges = allocator->maxFreeRanges ? allocator->maxFreeRanges * 2 : 16;
+        allocator->freeRanges = realloc(allocator->freeRanges, allocator->maxFreeRanges * sizeof(ArenaRange));
+    }
+
+    memmove(&allocator->freeRanges[position + 1], &allocator->freeRanges[position],
+        (allocator->numFreeRanges - position) * sizeof(ArenaRange));
+    allocator->freeRanges[position] = range;
+    allocator->numFreeRanges++;
+}
+
+void removeFreeRange(RangeAllocator *allocator, unsigned int position)
+{
+    allocator->numFreeRanges--;
+    memmove(&allocator->freeRanges[position], &allocator->freeRanges[position + 1],
+        (allocator->numFreeRanges - position) * sizeof(ArenaRange));
+}
+
+bool allocateRange(RangeAllocator *allocator, unsigned int size, unsigned int *offset)
+{
+    for (unsigned int i = 0; i < allocator->numFreeRanges; i++) {
+        ArenaRange *range = &allocator->freeRanges[i];
+        if (range->size < size) {
+            continue;
+        }
+
+        *offset = range->offset;
+        range->offset += size;
+        range->size -= size;
+        if (range->size == 0) {
+            removeFreeRange(allocator, i);
+        }
+        allocator->used += size;
+
+        return true;
+    }
+
+    return false;
+}
+
+void freeRange(RangeAllocator *allocator, unsigned int offset, unsigned int size)
+{
+    if (size == 0) {
+        return;
+    }
+
+    unsigned int position = 0;
+    while (position < allocator->numFreeRanges && allocator->freeRanges[position].offset < offset) {
+        position++;
+    }
+
+    ArenaRange *prev = position > 0 ? &allocator->freeRanges[position - 1] : NULL;
+    ArenaRange *next = position < allocator->numFreeRanges ? &allocator->freeRanges[position] : NULL;
+    bool mergePrev = prev && prev->offset + prev->size == offset;
+    bool mergeNext = next && offset + size == next->offset;
+
+    if (mergePrev && mergeNext) {
+        prev->size += size + next->size;
+        removeFreeRange(allocator, position);
+    }
+    else if (mergePrev) {
+        prev->size += size;
+    }
+    else if (mergeNext) {
+        next->offset = offset;
+        next->size += size;
+    }
+    else {
+        ArenaRange range = {offset, size};
+        insertFreeRange(allocator, position, range);
+    }
+
+    allocator->used -= size;
+}
+
+// Extend the space to `capacity`, the new tail becomes (or joins) the last free range
+void growRangeAllocator(RangeAllocator *allocator, unsigned int capacity)
+{
+    unsigned int oldCapacity = allocator->capacity;
+    allocator->capacity = capacity;
+
+    allocator->used += capacity - oldCapacity; // freeRange() takes it back off
+    freeRange(allocator, oldCapacity, capacity - oldCapacity);
+}
+
+// Everything below `used` is taken, the rest is a single free range
+void resetRangeAllocator(RangeAllocator *allocator, unsigned int used)
+{
+    allocator->numFreeRanges = 0;
+    allocator->used = used;
+    if (used < allocator->capacity) {
+        ArenaRange range = {used, allocator->capacity - used};
+        insertFreeRange(allocator, 0, range);
+    }
+}
+
+unsigned int largestFreeRange(RangeAllocator *allocator)
+{
+    unsigned int largest = 0;
+    for (unsigned int i = 0; i < allocator->numFreeRanges; i++) {
+        if (allocator->freeRanges[i].size > largest) {
+            largest = allocator->freeRanges[i].size;
+        }
+    }
+    return largest;
+}
+
+// Share of the free space that is not in the largest hole: 0 is a single hole,
+// close to 1 means the free space is scattered in small pieces
+float rangeFragmentation(RangeAllocator *allocator)
+{
+    unsigned int free = allocator->capacity - allocator->used;
+    return free ? 1.0f - (float) largestFreeRange(allocator) / free : 0.0f;
+}
+
+typedef struct {
+    unsigned int firstVertex, numVertices;
+    unsigned int indexOffset, indexSize;  // in bytes, indexSize is padded to the alignment
+    bool live;
+} GeometryAllocation;
+
+typedef struct GeometryArena {
+    VertexFormat format;
+    unsigned int VAO, VBO, EBO;
+
+    RangeAllocator vertices;  // in vertices
+    RangeAllocator indices;   // in bytes
+
+    GeometryAllocation *allocations;
+    unsigned int numAllocations, maxAllocations;
+    unsigned int *freeHandles;
+    unsigned int numFreeHandles;
+
+    // counters
+    unsigned int numGrows, numCompactions;
+    size_t bytesMoved;
+} GeometryArena;
+
+GeometryArena geometryArenas[VERTEX_FORMAT_COUNT];
+
+// Re-specify `buffer` with `newSize` bytes, keeping the first `keepSize` bytes
+void resizeArenaBuffer(unsigned int buffer, size_t keepSize, size_t newSize)
+{
+    // only the copy targets are used, GL_ELEMENT_ARRAY_BUFFER would change the bound VAO
+    unsigned int scratch = 0;
+    if (keepSize > 0) {
+        glGenBuffers(1, &scratch);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, scratch);
+        glBufferData(GL_COPY_WRITE_BUFFER, keepSize, NULL, GL_STREAM_COPY);
+        glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, keepSize);
+    }
+
+    glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+    glBufferData(GL_COPY_READ_BUFFER, newSize, NULL, GL_STATIC_DRAW);
+
+    if (keepSize > 0) {
+        glCopyBufferSubData(GL_COPY_WRITE_BUFFER, GL_COPY_READ_BUFFER, 0, 0, keepSize);
+        glDeleteBuffers(1, &scratch);
+    }
+}
+
+void initGeometryArena(GeometryArena *arena, VertexFormat format)
+{
+    memset(arena, 0, sizeof(*arena));
+    arena->format = format;
+
+    glGenVertexArrays(1, &arena->VAO);
+    glGenBuffers(1, &arena->VBO);
+    glGenBuffers(1, &arena->EBO);
+
+    glBindVertexArray(arena->VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, arena->VBO);
+    glBufferData(GL_ARRAY_BUFFER, GEOMETRY_ARENA_INITIAL_VERTICES * vertexFormatSize(format), NULL, GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, arena->EBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, GEOMETRY_ARENA_INITIAL_INDEX_BYTES, NULL, GL_STATIC_DRAW);
+    setupVertexAttributes(format);
+    glBindVertexArray(0);
+
+    arena->vertices.capacity = GEOMETRY_ARENA_INITIAL_VERTICES;
+    resetRangeAllocator(&arena->vertices, 0);
+    arena->indices.capacity = GEOMETRY_ARENA_INITIAL_INDEX_BYTES;
+    resetRangeAllocator(&arena->indices, 0);
+}
+
+// The arena of a vertex format, created on first use (needs a current context)
+GeometryArena * getGeometryArena(VertexFormat format)
+{
+    GeometryArena *arena = &geometryArenas[format];
+    if (!arena->VAO) {
+        initGeometryArena(arena, format);
+    }
+    return arena;
+}
+
+// Another VAO over the arena buffers, for callers that add their own attributes
+// (e.g. per instance data). Owned by the caller.
+unsigned int createGeometryArenaVertexArray(GeometryArena *arena)
+{
+    unsigned int VAO;
+    glGenVertexArrays(1, &VAO);
+    glBindVertexArray(VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, arena->VBO);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, arena->EBO);
+    setupVertexAttributes(arena->format);
+    glBindVertexArray(0);
+
+    return VAO;
+}
+
+unsigned int grownCapacity(unsigned int capacity, unsigned int needed)
+{
+    unsigned int grown = capacity ? capacity : 1;
+    while (grown - capacity < needed) {
+        grown *= 2;
+    }
+    return grown;
+}
+
+// Copy `numVertices` vertices in the arena format and `indexBytes` bytes of
+// indices into the arena, returns the allocation handle
+unsigned int uploadGeometry(GeometryArena *arena, const void *vertexData, unsigned int numVertices,
+    const void *indexData, unsigned int indexBytes)
+{
+    size_t stride = vertexFormatSize(arena->format);
+    unsigned int indexSize = (indexBytes + GEOMETRY_ARENA_INDEX_ALIGNMENT - 1) & ~(GEOMETRY_ARENA_INDEX_ALIGNMENT - 1);
+
+    GeometryAllocation allocation = {
+        .numVertices = numVertices,
+        .indexSize = indexSize,
+        .live = true,
+    };
+
+    if (!allocateRange(&arena->vertices, numVertices, &allocation.firstVertex)) {
+        unsigned int capacity = grownCapacity(arena->vertices.capacity, numVertices);
+        resizeArenaBuffer(arena->VBO, arena->vertices.capacity * stride, capacity * stride);
+        growRangeAllocator(&arena->vertices, capacity);
+        arena->numGrows++;
+        allocateRange(&arena->vertices, numVertices, &allocation.firstVertex);
+    }
+    if (!allocateRange(&arena->indices, indexSize, &allocation.indexOffset)) {
+        unsigned int capacity = grownCapacity(arena->indices.capacity, indexSize);
+        resizeArenaBuffer(arena->EBO, arena->indices.capacity, capacity);
+        growRangeAllocator(&arena->indices, capacity);
+        arena->numGrows++;
+        allocateRange(&arena->indices, indexSize, &allocation.indexOffset);
+    }
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, arena->VBO);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, allocation.firstVertex * stride, numVertices * stride, vertexData);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, arena->EBO);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, allocation.indexOffset, indexBytes, indexData);
+
+    unsigned int handle;
+    if (arena->numFreeHandles > 0) {
+        handle = arena->freeHandles[--arena->numFreeHandles];
+    }
+    else {
+        if (arena->numAllocations == arena->maxAllocations) {
+            arena->maxAllocations = arena->maxAllocations ? arena->maxAllocations * 2 : 64;
+            arena->allocations = realloc(arena->allocations, arena->maxAllocations * sizeof(GeometryAllocation));
+            arena->freeHandles = realloc(arena->freeHandles, arena->maxAllocations * sizeof(unsigned int));
+        }
+        handle = arena->numAllocations++;
+    }
+    arena->allocations[handle] = allocation;
+
+    return handle;
+}
+
+void freeGeometry(GeometryArena *arena, unsigned int handle)
+{
+    GeometryAllocation *allocation = &arena->allocations[handle];
+
+    freeRange(&arena->vertices, allocation->firstVertex, allocation->numVertices);
+    freeRange(&arena->indices, allocation->indexOffset, allocation->indexSize);
+    allocation->live = false;
+
+    arena->freeHandles[arena->numFreeHandles++] = handle;
+}
+
+typedef struct {
+    unsigned int offset;
+    unsigned int handle;
+} ArenaMove;
+
+int compareArenaMoves(const void *a, const void *b)
+{
+    const ArenaMove *ma = a, *mb = b;
+    return (ma->offset > mb->offset) - (ma->offset < mb->offset);
+}
+
+unsigned int * allocationOffset(GeometryAllocation *allocation, bool indices)
+{
+    return indices ? &allocation->indexOffset : &allocation->firstVertex;
+}
+
+unsigned int allocationSize(GeometryAllocation *allocation, bool indices)
+{
+    return indices ? allocation->indexSize : allocation->numVertices;
+}
+
+// Slide the live ranges of the vertex or index buffer down to offset 0, keeping
+// their order. `unit` is the size in bytes of one allocator unit. Returns the units in use.
+unsigned int compactArenaBuffer(GeometryArena *arena, bool indices, size_t unit)
+{
+    unsigned int buffer = indices ? arena->EBO : arena->VBO;
+    RangeAllocator *allocator = indices ? &arena->indices : &arena->vertices;
+
+    ArenaMove *moves = malloc((arena->numAllocations ? arena->numAllocations : 1) * sizeof(ArenaMove));
+    unsigned int numMoves = 0;
+    for (unsigned int i = 0; i < arena->numAllocations; i++) {
+        if (arena->allocations[i].live) {
+            ArenaMove move = {*allocationOffset(&arena->allocations[i], indices), i};
+            moves[numMoves++] = move;
+        }
+    }
+    qsort(moves, numMoves, sizeof(ArenaMove), compareArenaMoves);
+
+    unsigned int scratch;
+    glGenBuffers(1, &scratch);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, scratch);
+    glBufferData(GL_COPY_WRITE_BUFFER, (allocator->used ? allocator->used : 1) * unit, NULL, GL_STREAM_COPY);
+    glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+
+    unsigned int packed = 0;
+    for (unsigned int i = 0; i < numMoves; i++) {
+        GeometryAllocation *allocation = &arena->allocations[moves[i].handle];
+        unsigned int *offset = allocationOffset(allocation, indices);
+        unsigned int size = allocationSize(allocation, indices);
+
+        if (size > 0) {
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, *offset * unit, packed * unit, size * unit);
+        }
+        *offset = packed;
+        packed += size;
+    }
+
+    if (packed > 0) {
+        glBindBuffer(GL_COPY_READ_BUFFER, scratch);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, packed * unit);
+    }
+    glDeleteBuffers(1, &scratch);
+    free(moves);
+
+    arena->bytesMoved += 2 * (size_t) packed * unit;
+    resetRangeAllocator(allocator, packed);
+
+    return packed;
+}
+
+// Remove every hole by moving the live geometry to the front of the buffers.
+// Allocation handles stay valid, their offsets change.
+void compactGeometryArena(GeometryArena *arena)
+{
+    compactArenaBuffer(arena, false, vertexFormatSize(arena->format));
+    compactArenaBuffer(arena, true, 1);
+
+    arena->numCompactions++;
+}
+
+// Compact the arenas whose vertex or index space is fragmented beyond `threshold`.
+// Anything holding copies of mesh offsets (e.g. indirect draw commands) has to
+// re-read them once the arena's numCompactions changes.
+void compactGeometryArenas(float threshold)
+{
+    for (unsigned int i = 0; i < VERTEX_FORMAT_COUNT; i++) {
+        GeometryArena *arena = &geometryArenas[i];
+        if (arena->VAO && (rangeFragmentation(&arena->vertices) > threshold ||
+                           rangeFragmentation(&arena->indices) > threshold)) {
+            compactGeometryArena(arena);
+        }
+    }
+}
+
+void printRangeAllocatorStats(RangeAllocator *allocator, const char *unit)
+{
+    printf("%u/%u %s used, %u free ranges, largest %u, fragmentation %.1f%%\n",
+        allocator->used, allocator->capacity, unit, allocator->numFreeRanges,
+        largestFreeRange(allocator), rangeFragmentation(allocator) * 100.0f);
+}
+
+void printGeometryArenaStats()
+{
+    static const char *formatNames[VERTEX_FORMAT_COUNT] = {"float", "packed"};
+
+    for (unsigned int i = 0; i < VERTEX_FORMAT_COUNT; i++) {
+        GeometryArena *arena = &geometryArenas[i];
+        if (!arena->VAO) {
+            continue;
+        }
+
+        printf("geometry arena (%s): %u meshes, %u grows, %u compactions, %zu KiB moved\n", formatNames[i],
+            arena->numAllocations - arena->numFreeHandles, arena->numGrows, arena->numCompactions,
+            arena->bytesMoved / 1024);
+        printf("  vertices: ");
+        printRangeAllocatorStats(&arena->vertices, "vertices");
+        printf("  indices:  ");
+        printRangeAllocatorStats(&arena->indices, "bytes");
+    }
+}
+
+void destroyGeometryArenas()
+{
+    for (unsigned int i = 0; i < VERTEX_FORMAT_COUNT; i++) {
+        GeometryArena *arena = &geometryArenas[i];
+        if (!arena->VAO) {
+            continue;
+        }
+
+        glDeleteVertexArrays(1, &arena->VAO);
+        glDeleteBuffers(1, &arena->VBO);
+        glDeleteBuffers(1, &arena->EBO);
+        free(arena->vertices.freeRanges);
+        free(arena->indices.freeRanges);
+        free(arena->allocations);
+        free(arena->freeHandles);
+        memset(arena, 0, sizeof(*arena));
+    }
+}
+
+#endif // _GEOMETRY_ARENA_H_
@@ -0,0 +1,266 @@
+#ifndef _GPU_CULL_H_
+#define _GPU_CULL_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <glad/glad.h>
+#include <cglm/cglm.h>
+
+#include "shader.h"
+#include "mesh.h"
+#include "model.h"
+#include "geometry_arena.h"
+#include "frustum_cull.h"
+#include "instance_format.h"
+
+// GPU instance culling: a vertex shader tests every instance sphere against the
+// frustum with rasterization off, a geometry shader emits the visible instances,
+// transform feedback compacts them into an instance buffer and a primitive
+// query counts them. With query buffer objects (GL 4.4 or
+// ARB_query_buffer_object) the count is written by the GPU into indirect draw
+// commands and the CPU never sees it. Without, the results go round a ring of
+// GPU_CULL_BUFFERS instance buffers and the draw uses the newest one whose
+// count the GPU has finished, polled so that reading it never stalls; until a
+// newer one is ready the last drawn buffer and count are kept. That path draws
+// instances culled one or two frames earlier, so with the orbits animated the
+// rocks trail their current positions and pop at the frustum edges. Culling
+// and drawing the same frame would need the count on the CPU right away, a
+// stall every frame.
+
+#define GPU_CULL_BUFFERS 3
+
+#ifndef GL_QUERY_BUFFER
+#define GL_QUERY_BUFFER 0x9192
+#endif
+
+// layout of glDrawElementsIndirect() commands
+typedef struct {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+} DrawElementsIndirectCommand;
+
+typedef struct {
+    unsigned int program;
+    GLint planesLocation;
+
+    unsigned int count;
+    unsigned int sourceVAO;
+
+    // [current] is written this frame, [drawn] is the one drawn. With a query
+    // buffer only [0] is used and both are always 0.
+    unsigned int instanceBuffers[GPU_CULL_BUFFERS], drawVAOs[GPU_CULL_BUFFERS], queries[GPU_CULL_BUFFERS];
+    unsigned int current, drawn;
+    bool haveResult[GPU_CULL_BUFFERS];
+
+    bool queryBuffer;
+    unsigned int indirectBuffer;
+    unsigned int numCommands;
+    Model *model;                     // the commands hold the arena offsets of its meshes
+    unsigned int commandCompactions;  // arena numCompactions when they were written
+    unsigned int lastCount;  // instances in [drawn], fallback path only
+} GpuCull;
+
+bool hasGLExtension(const char *name)
+{
+    GLint numExtensions = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions);
+    for (GLint i = 0; i < numExtensions; i++) {
+        if (strcmp((const char *) glGetStringi(GL_EXTENSIONS, i), name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool hasGLVersion(int major, int minor)
+{
+    GLint contextMajor = 0, contextMinor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &contextMajor);
+    glGetIntegerv(GL_MINOR_VERSION, &contextMinor);
+    return contextMajor > major || (contextMajor == major && contextMinor >= minor);
+}
+
+// Write the draw commands from the current arena offsets of the meshes. The
+// instance counts start at 0, runGpuCull() fills them in.
+void writeGpuCullCommands(GpuCull *cull)
+{
+    Model *model = cull->model;
+    DrawElementsIndirectCommand *commands = calloc(cull->numCommands ? cull->numCommands : 1, sizeof(*commands));
+    for (unsigned int i = 0; i < cull->numCommands; i++) {
+        Mesh *mesh = &model->meshes[i];
+        commands[i].count = mesh->numIndices;
+        commands[i].firstIndex = (uintptr_t) meshIndexOffset(mesh) / indexTypeSize(mesh->indexType);
+        commands[i].baseVertex = meshBaseVertex(mesh);
+    }
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, cull->indirectBuffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, cull->numCommands * sizeof(*commands), commands, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    free(commands);
+    cull->commandCompactions = model->meshes[0].arena->numCompactions;
+}
+
+// Culling for `count` instances of `model`, whose spheres are centered on the
+// instance positions with radius instance scale * `boundsRadius`
+void initGpuCull(GpuCull *cull, Model *model, float boundsRadius, unsigned int count)
+{
+    memset(cull, 0, sizeof(*cull));
+    cull->count = count;
+
+    // captured in the CompactInstance layout, so the draw reads them like the CPU path's buffer
+    const char *varyings[] = {"instancePositionScale", "instanceRotation"};
+    cull->program = createTransformFeedbackProgram("asteroids/cull.vert", "asteroids/cull.geom", varyings, 2);
+    cull->planesLocation = uniformLocation(cull->program, "planes[0]");
+    glUseProgram(cull->program);
+    glUniform1f(uniformLocation(cull->program, "boundsRadius"), boundsRadius);
+    glUseProgram(0);
+
+    // the source instances change every frame, runGpuCull() points this at them
+    glGenVertexArrays(1, &cull->sourceVAO);
+
+    glGenBuffers(GPU_CULL_BUFFERS, cull->instanceBuffers);
+    glGenQueries(GPU_CULL_BUFFERS, cull->queries);
+    for (unsigned int i = 0; i < GPU_CULL_BUFFERS; i++) {
+        glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, cull->instanceBuffers[i]);
+        glBufferData(GL_TRANSFORM_FEEDBACK_BUFFER, count * sizeof(CompactInstance), NULL, GL_DYNAMIC_COPY);
+        cull->drawVAOs[i] = createInstancedVertexArray(model->meshes[0].arena, cull->instanceBuffers[i]);
+    }
+    glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, 0);
+
+    // every mesh of the model draws the same instances, one indirect command each
+    cull->queryBuffer = hasGLVersion(4, 0) && (hasGLVersion(4, 4) || hasGLExtension("GL_ARB_query_buffer_object"));
+    if (cull->queryBuffer) {
+        cull->model = model;
+        cull->numCommands = model->numMeshes;
+        glGenBuffers(1, &cull->indirectBuffer);
+        writeGpuCullCommands(cull);
+    }
+
+    printf("gpu cull: %u instances, instance count through %s\n", count,
+        cull->queryBuffer ? "query buffer + indirect draw" : "polled query ring, drawn 1-2 frames late");
+}
+
+// Point the source vertex array at the CompactInstance records `offset` bytes into `buffer`
+void setGpuCullSource(GpuCull *cull, unsigned int buffer, size_t offset)
+{
+    glBindVertexArray(cull->sourceVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(CompactInstance), (void *) offset);
+    // passed through untouched, as the raw bits of the snorm16 quaternion
+    glEnableVertexAttribArray(1);
+    glVertexAttribIPointer(1, 2, GL_UNSIGNED_INT, sizeof(CompactInstance), (void *) (offset + offsetof(CompactInstance, rotation)));
+}
+
+// Cull the instances `offset` bytes into `buffer` into the instance buffer of
+// this frame. Leaves the GL state as it found it apart from the bound program,
+// vertex array and array buffer.
+void runGpuCull(GpuCull *cull, const Frustum *frustum, unsigned int buffer, size_t offset)
+{
+    // with a query buffer the draw consumes the result on the GPU, one buffer is enough
+    if (!cull->queryBuffer) {
+        cull->current = (cull->current + 1) % GPU_CULL_BUFFERS;
+    }
+    unsigned int current = cull->current;
+
+    glUseProgram(cull->program);
+    glUniform4fv(cull->planesLocation, 6, (const float *) frustum->planes);
+
+    setGpuCullSource(cull, buffer, offset);
+    glEnable(GL_RASTERIZER_DISCARD);
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, cull->instanceBuffers[current]);
+
+    glBeginQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN, cull->queries[current]);
+    glBeginTransformFeedback(GL_POINTS);
+    glDrawArrays(GL_POINTS, 0, cull->count);
+    glEndTransformFeedback();
+    glEndQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN);
+
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+    glDisable(GL_RASTERIZER_DISCARD);
+    cull->haveResult[current] = true;
+
+    if (cull->queryBuffer) {
+        // compaction moved the meshes since the commands were written
+        if (cull->model->meshes[0].arena->numCompactions != cull->commandCompactions) {
+            writeGpuCullCommands(cull);
+        }
+        // the GPU copies the count into every command, nothing comes back to us
+        glBindBuffer(GL_QUERY_BUFFER, cull->indirectBuffer);
+        for (unsigned int i = 0; i < cull->numCommands; i++) {
+            glGetQueryObjectuiv(cull->queries[current], GL_QUERY_RESULT,
+                (GLuint *) (i * sizeof(DrawElementsIndirectCommand) + offsetof(DrawElementsIndirectCommand, instanceCount)));
+        }
+        glBindBuffer(GL_QUERY_BUFFER, 0);
+    }
+    else {
+        // the newest finished result, without waiting for any
+        for (unsigned int age = 1; age < GPU_CULL_BUFFERS; age++) {
+            unsigned int slot = (current + GPU_CULL_BUFFERS - age) % GPU_CULL_BUFFERS;
+            GLuint available = GL_FALSE;
+            if (cull->haveResult[slot]) {
+                glGetQueryObjectuiv(cull->queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+            }
+            if (available) {
+                glGetQueryObjectuiv(cull->queries[slot], GL_QUERY_RESULT, &cull->lastCount);
+                cull->drawn = slot;
+                return;
+            }
+            if (slot == cull->drawn) {
+                break;  // nothing newer than what is drawn yet, keep it
+            }
+        }
+        // the GPU is a whole ring behind and the drawn buffer was just rewritten, wait for the oldest
+        if (cull->drawn == current) {
+            unsigned int oldest = (current + 1) % GPU_CULL_BUFFERS;
+            cull->lastCount = 0;
+            if (cull->haveResult[oldest]) {
+                glGetQueryObjectuiv(cull->queries[oldest], GL_QUERY_RESULT, &cull->lastCount);
+            }
+            cull->drawn = oldest;
+        }
+    }
+}
+
+// Bind the vertex array holding the culled instances, before drawGpuCulledMesh()
+void bindGpuCulledInstances(GpuCull *cull)
+{
+    glBindVertexArray(cull->drawVAOs[cull->drawn]);
+    if (cull->queryBuffer) {
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, cull->indirectBuffer);
+    }
+}
+
+// Draw mesh `index` of the culled model, the per mesh uniforms have to be set
+void drawGpuCulledMesh(GpuCull *cull, Mesh *mesh, unsigned int index)
+{
+    if (cull->queryBuffer) {
+        glDrawElementsIndirect(GL_TRIANGLES, mesh->indexType,
+            (void *) (uintptr_t) (index * sizeof(DrawElementsIndirectCommand)));
+    }
+    else {
+        glDrawElementsInstancedBaseVertex(GL_TRIANGLES, mesh->numIndices, mesh->indexType,
+            meshIndexOffset(mesh), cull->lastCount, meshBaseVertex(mesh));
+    }
+}
+
+void destroyGpuCull(GpuCull *cull)
+{
+    glDeleteProgram(cull->program);
+    glDeleteVertexArrays(1, &cull->sourceVAO);
+    glDeleteVertexArrays(GPU_CULL_BUFFERS, cull->drawVAOs);
+    glDeleteBuffers(GPU_CULL_BUFFERS, cull->instanceBuffers);
+    glDeleteQueries(GPU_CULL_BUFFERS, cull->queries);
+    if (cull->indirectBuffer) {
+        glDeleteBuffers(1, &cull->indirectBuffer);
+    }
+    memset(cull, 0, sizeof(*cull));
+}
+
+#endif // _GPU_CULL_H_
@@ -0,0 +1,167 @@
+#ifndef _HASH_H_
+#define _HASH_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define HASH_SEED 0xcbf29ce484222325ull
+
+// 64-bit FNV-1a
+uint64_t hashBytes(uint64_t hash, const void *data, size_t size)
+{
+    const unsigned char *bytes = data;
+
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+
+    return hash;
+}
+
+uint64_t hashString(const char *string)
+{
+    return hashBytes(HASH_SEED, string, strlen(string));
+}
+
+bool hashFile(const char *path, uint64_t *hash, uint64_t *size)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return false;
+    }
+
+    unsigned char buffer[64 * 1024];
+    size_t read;
+
+    *hash = HASH_SEED;
+    *size = 0;
+    while ((read = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+        *hash = hashBytes(*hash, buffer, read);
+        *size += read;
+    }
+    fclose(f);
+
+    return true;
+}
+
+// Open addressing map from 64-bit hashes to indices. Keys are the hashes
+// themselves: hashMapPut() and hashMapGet() treat two inputs with the same
+// 64-bit hash as equal, hashMapAdd() and hashMapNext() keep them apart for
+// callers that compare the inputs themselves.
+typedef struct {
+    uint64_t *keys;  // 0 marks an empty slot
+    unsigned int *values;
+    unsigned int capacity, count;  // capacity is zero or a power of two
+} HashMap;
+
+uint64_t hashMapKey(uint64_t hash)
+{
+    return hash ? hash : 1;
+}
+
+// Walk every value stored under `hash`, starting with *position = 0
+bool hashMapNext(HashMap *map, uint64_t hash, unsigned int *position, unsigned int *value)
+{
+    if (map->count == 0) {
+        return false;
+    }
+
+    uint64_t key = hashMapKey(hash);
+    unsigned int mask = map->capacity - 1;
+    for (unsigned int i = (key + *position) & mask; map->keys[i] && *position < map->capacity; i = (i + 1) & mask) {
+        ++*position;
+        if (map->keys[i] == key) {
+            *value = map->values[i];
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool hashMapGet(HashMap *map, uint64_t hash, unsigned int *value)
+{
+    unsigned int position = 0;
+    return hashMapNext(map, hash, &position, value);
+}
+
+void hashMapAdd(HashMap *map, uint64_t hash, unsigned int value);
+
+void hashMapResize(HashMap *map, unsigned int capacity)
+{
+    HashMap old = *map;
+
+    map->keys = calloc(capacity, sizeof(uint64_t));
+    map->values = malloc(capacity * sizeof(unsigned int));
+    map->capacity = capacity;
+    map->count = 0;
+
+    for (unsigned int i = 0; i < old.capacity; i++) {
+        if (old.keys[i]) {
+            hashMapAdd(map, old.keys[i], old.values[i]);
+        }
+    }
+
+    free(old.keys);
+    free(old.values);
+}
+
+// Store `value` under `hash` next to any value already there
+void hashMapAdd(HashMap *map, uint64_t hash, unsigned int value)
+{
+    // keep the load factor under 1/2 so probe sequences stay short
+    if ((map->count + 1) * 2 > map->capacity) {
+        hashMapResize(map, map->capacity ? map->capacity * 2 : 64);
+    }
+
+    uint64_t key = hashMapKey(hash);
+    unsigned int i = key & (map->capacity - 1);
+    while (map->keys[i]) {
+        i = (i + 1) & (map->capacity - 1);
+    }
+
+    map->keys[i] = key;
+    map->values[i] = value;
+    map->count++;
+}
+
+// Store `value` under `hash`, replacing the value already there
+void hashMapPut(HashMap *map, uint64_t hash, unsigned int value)
+{
+    if (map->count > 0) {
+        uint64_t key = hashMapKey(hash);
+        for (unsigned int i = key & (map->capacity - 1); map->keys[i]; i = (i + 1) & (map->capacity - 1)) {
+            if (map->keys[i] == key) {
+                map->values[i] = value;
+                return;
+            }
+        }
+    }
+    hashMapAdd(map, hash, value);
+}
+
+// Drop every key mapping to `value`. Rebuilds the table, meant for rare removals.
+void hashMapRemoveValue(HashMap *map, unsigned int value)
+{
+    for (unsigned int i = 0; i < map->capacity; i++) {
+        if (map->keys[i] && map->values[i] == value) {
+            map->keys[i] = 0;
+            map->count--;
+        }
+    }
+
+    hashMapResize(map, map->capacity);
+}
+
+void freeHashMap(HashMap *map)
+{
+    free(map->keys);
+    free(map->values);
+    memset(map, 0, sizeof(*map));
+}
+
+#endif // _HASH_H_
@@ -0,0 +1,23 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 TexCoords;
+flat in float Fade;
+
+uniform sampler2D atlas;
+
+// same threshold as shader.frag, so mesh and impostor never cover the same pixel
+float dither()
+{
+    return fract(52.9829189 * fract(dot(gl_FragCoord.xy, vec2(0.06711056, 0.00583715))));
+}
+
+void main()
+{
+    vec4 texel = texture(atlas, TexCoords);
+    if (texel.a < 0.5 || dither() >= Fade) {
+        discard;
+    }
+    // the views were baked over transparent black, undo the darkening the filtering did at the edges
+    FragColor = vec4(texel.rgb / texel.a, 1.0);
+}
@@ -0,0 +1,215 @@
+#ifndef _IMPOSTOR_H_
+#define _IMPOSTOR_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <glad/glad.h>
+#include <cglm/cglm.h>
+
+#include "shader.h"
+#include "mesh.h"
+#include "model.h"
+#include "instance_format.h"
+#include "lod.h"
+
+// Billboard impostors for far away instances. At startup the model is rendered
+// from IMPOSTOR_GRID x IMPOSTOR_GRID directions spread over the sphere with an
+// octahedral mapping, each view into its own tile of one atlas texture. A far
+// instance is then a single quad: the vertex shader turns the camera direction
+// into the frame of the rock, snaps it to the closest baked view and orients
+// the quad like the camera of that view was, so spinning rocks keep showing
+// the right side. The quads take the instances from the same records the meshes
+// use and are drawn with one instanced call.
+
+#define IMPOSTOR_GRID 8    // views per side, 64 in total
+#define IMPOSTOR_TILE 64   // pixels per view
+
+typedef struct {
+    unsigned int texture;
+    unsigned int program, vao;
+    float radius;  // of the local sphere the views were framed on
+
+    ProgramReflection *uniforms;
+    GLint cameraPosLocation, fadeLocation;
+} Impostors;
+
+static inline float impostorSignNotZero(float v)
+{
+    return v >= 0.0f ? 1.0f : -1.0f;
+}
+
+// Unit direction of an atlas position in [0, 1]^2, the inverse of the
+// encoding in impostor.vert
+void octahedronDecode(float u, float v, vec3 direction)
+{
+    float x = u * 2.0f - 1.0f, y = v * 2.0f - 1.0f;
+    float z = 1.0f - fabsf(x) - fabsf(y);
+    if (z < 0.0f) {
+        float foldedX = (1.0f - fabsf(y)) * impostorSignNotZero(x);
+        float foldedY = (1.0f - fabsf(x)) * impostorSignNotZero(y);
+        x = foldedX;
+        y = foldedY;
+    }
+    vec3 n = {x, y, z};
+    glm_vec3_normalize_to(n, direction);
+}
+
+// Render the views of `model` into the atlas. `program` and `vao` are the
+// instanced mesh program and vertex array, drawn with one instance at the origin.
+void bakeImpostorAtlas(Impostors *impostors, Model *model, unsigned int program, ProgramReflection *uniforms,
+    unsigned int vao, GLint cameraPosLocation, GLint fadeLocation)
+{
+    unsigned int size = IMPOSTOR_GRID * IMPOSTOR_TILE;
+    float radius = impostors->radius;
+
+    glGenTextures(1, &impostors->texture);
+    glBindTexture(GL_TEXTURE_2D, impostors->texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    // the coarser mips would blend neighbouring views
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 3);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    // headless, the frames go to a framebuffer object rather than 0
+    GLint previousFramebuffer;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+    unsigned int framebuffer, depth;
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, impostors->texture, 0);
+    glGenRenderbuffers(1, &depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, size, size);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        printf("ERROR::IMPOSTOR::FRAMEBUFFER_INCOMPLETE\n");
+        exit(EXIT_FAILURE);
+    }
+
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    // a single unrotated instance of scale 1 at the origin
+    vec3 origin = {0.0f, 0.0f, 0.0f}, axis = {0.0f, 1.0f, 0.0f};
+    CompactInstance instance = packInstance(origin, 1.0f, axis, 0.0f);
+    unsigned int instanceBuffer;
+    glGenBuffers(1, &instanceBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(instance), &instance, GL_STATIC_DRAW);
+
+    glUseProgram(program);
+    glBindVertexArray(vao);
+    setupInstanceAttributes(instanceBuffer, 0);
+
+    mat4 projection;
+    glm_ortho(-radius, radius, -radius, radius, radius, 3.0f * radius, projection);
+    glUniformMatrix4fv(uniforms->projection, 1, GL_FALSE, (float *) projection);
+    // the baked views are the whole mesh, nothing fades
+    glUniform2f(fadeLocation, LOD_NO_IMPOSTORS, LOD_NO_IMPOSTORS * LOD_IMPOSTOR_FADE);
+
+    for (unsigned int y = 0; y < IMPOSTOR_GRID; y++) {
+        for (unsigned int x = 0; x < IMPOSTOR_GRID; x++) {
+            // the same view and up vector impostor.vert derives for this tile
+            vec3 direction, eye, up = {0.0f, 1.0f, 0.0f};
+            octahedronDecode((x + 0.5f) / IMPOSTOR_GRID, (y + 0.5f) / IMPOSTOR_GRID, direction);
+            if (fabsf(direction[1]) > 0.999f) {
+                up[1] = 0.0f;
+                up[2] = 1.0f;
+            }
+            glm_vec3_scale(direction, 2.0f * radius, eye);
+
+            mat4 view;
+            glm_lookat(eye, origin, up, view);
+            glUniformMatrix4fv(uniforms->view, 1, GL_FALSE, (float *) view);
+            glUniform3fv(cameraPosLocation, 1, eye);
+
+            glViewport(x * IMPOSTOR_TILE, y * IMPOSTOR_TILE, IMPOSTOR_TILE, IMPOSTOR_TILE);
+            for (unsigned int i = 0; i < model->numMeshes; i++) {
+                Mesh *mesh = &model->meshes[i];
+                glActiveTexture(GL_TEXTURE0 + materialTextureUnit(TEXTURE_DIFFUSE, 0));
+                glBindTexture(GL_TEXTURE_2D, mesh->textures[0].id);
+                glUniform3fv(uniforms->positionScale, 1, mesh->positionScale);
+                glUniform3fv(uniforms->positionOffset, 1, mesh->positionOffset);
+                glDrawElementsInstancedBaseVertex(GL_TRIANGLES, mesh->numIndices, mesh->indexType,
+                    meshIndexOffset(mesh), 1, meshBaseVertex(mesh));
+            }
+        }
+    }
+
+    glBindVertexArray(0);
+    glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    glDeleteRenderbuffers(1, &depth);
+    glDeleteFramebuffers(1, &framebuffer);
+    glDeleteBuffers(1, &instanceBuffer);
+
+    glBindTexture(GL_TEXTURE_2D, impostors->texture);
+    glGenerateMipmap(GL_TEXTURE_2D);
+}
+
+// Impostors of `model`, framed on the origin centered sphere of `radius` the
+// instance spheres are scaled from. The views are rendered with the instanced
+// mesh program, built with IMPOSTOR_FADE, whose camera and fade uniforms are
+// given. The model textures have to be uploaded.
+void initImpostors(Impostors *impostors, Model *model, float radius, unsigned int meshProgram,
+    ProgramReflection *meshUniforms, unsigned int meshVAO, GLint meshCameraPosLocation, GLint meshFadeLocation)
+{
+    memset(impostors, 0, sizeof(*impostors));
+    impostors->radius = radius;
+
+    impostors->program = createProgram("asteroids/impostor.vert", "asteroids/impostor.frag");
+    impostors->uniforms = getProgramReflection(impostors->program);
+    impostors->cameraPosLocation = uniformLocation(impostors->program, "cameraPos");
+    impostors->fadeLocation = uniformLocation(impostors->program, "impostorFade");
+    glUseProgram(impostors->program);
+    glUniform1f(uniformLocation(impostors->program, "boundsRadius"), radius);
+    glUniform1f(uniformLocation(impostors->program, "impostorGrid"), IMPOSTOR_GRID);
+    glUniform1i(uniformLocation(impostors->program, "atlas"), 0);
+
+    // the quads have no vertex data, only the instance attributes
+    glGenVertexArrays(1, &impostors->vao);
+
+    bakeImpostorAtlas(impostors, model, meshProgram, meshUniforms, meshVAO, meshCameraPosLocation, meshFadeLocation);
+}
+
+// Per frame state, the fade range is the one the instances were bucketed with
+void setImpostorView(Impostors *impostors, mat4 view, mat4 projection, vec3 cameraPos, float fadeStart, float fadeEnd)
+{
+    glUseProgram(impostors->program);
+    glUniformMatrix4fv(impostors->uniforms->view, 1, GL_FALSE, (float *) view);
+    glUniformMatrix4fv(impostors->uniforms->projection, 1, GL_FALSE, (float *) projection);
+    glUniform3fv(impostors->cameraPosLocation, 1, cameraPos);
+    glUniform2f(impostors->fadeLocation, fadeStart, fadeEnd);
+}
+
+// One quad for each of `count` instances at `offset` in `buffer`
+void drawImpostors(Impostors *impostors, unsigned int buffer, size_t offset, unsigned int count)
+{
+    if (count == 0) {
+        return;
+    }
+    glUseProgram(impostors->program);
+    glBindVertexArray(impostors->vao);
+    setupInstanceAttributes(buffer, offset);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, impostors->texture);
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, count);
+    glBindVertexArray(0);
+}
+
+void destroyImpostors(Impostors *impostors)
+{
+    glDeleteTextures(1, &impostors->texture);
+    glDeleteVertexArrays(1, &impostors->vao);
+    glDeleteProgram(impostors->program);
+    memset(impostors, 0, sizeof(*impostors));
+}
+
+#endif // _IMPOSTOR_H_
@@ -0,0 +1,72 @@
+#version 330 core
+// CompactInstance, see asteroids_shader.vert; the quad corners come from gl_VertexID
+layout (location = 3) in vec4 aInstancePositionScale;
+layout (location = 4) in vec4 aInstanceRotation;
+
+out vec2 TexCoords;
+flat out float Fade;
+
+uniform mat4 view;
+uniform mat4 projection;
+
+uniform vec3 cameraPos;
+uniform float boundsRadius;
+uniform vec2 impostorFade;  // start and end, distance per unit of sphere radius
+uniform float impostorGrid; // views per side of the atlas
+
+vec3 rotate(vec4 q, vec3 v)
+{
+    return v + 2.0 * cross(q.xyz, cross(q.xyz, v) + q.w * v);
+}
+
+vec2 signNotZero(vec2 v)
+{
+    return vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+// octahedral mapping between unit directions and [0, 1]^2, as in impostor.h
+vec2 octahedronEncode(vec3 n)
+{
+    vec2 p = n.xy / (abs(n.x) + abs(n.y) + abs(n.z));
+    if (n.z < 0.0) {
+        p = (1.0 - abs(p.yx)) * signNotZero(p);
+    }
+    return p * 0.5 + 0.5;
+}
+
+vec3 octahedronDecode(vec2 uv)
+{
+    vec2 p = uv * 2.0 - 1.0;
+    vec3 n = vec3(p, 1.0 - abs(p.x) - abs(p.y));
+    if (n.z < 0.0) {
+        n.xy = (1.0 - abs(n.yx)) * signNotZero(n.xy);
+    }
+    return normalize(n);
+}
+
+void main()
+{
+    vec4 rotation = normalize(aInstanceRotation);
+    vec3 center = aInstancePositionScale.xyz;
+    float radius = aInstancePositionScale.w * boundsRadius;
+
+    // the baked view closest to the camera, in the frame of the rock
+    vec4 inverseRotation = vec4(-rotation.xyz, rotation.w);
+    vec3 toCamera = rotate(inverseRotation, normalize(cameraPos - center));
+    vec2 cell = clamp(floor(octahedronEncode(toCamera) * impostorGrid), 0.0, impostorGrid - 1.0);
+    vec3 direction = octahedronDecode((cell + 0.5) / impostorGrid);
+
+    // the quad faces that view, with the axes the bake camera had
+    vec3 up = abs(direction.y) > 0.999 ? vec3(0.0, 0.0, 1.0) : vec3(0.0, 1.0, 0.0);
+    vec3 right = normalize(cross(up, direction));
+    up = cross(direction, right);
+
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2.0 - 1.0;
+    vec3 worldPos = center + radius * rotate(rotation, corner.x * right + corner.y * up);
+
+    float distance = length(cameraPos - center) - radius;
+    Fade = clamp((distance / radius - impostorFade.x) / (impostorFade.y - impostorFade.x), 0.0, 1.0);
+    TexCoords = (cell + corner * 0.5 + 0.5) / impostorGrid;
+
+    gl_Position = projection * view * vec4(worldPos, 1.0);
+}
@@ -0,0 +1,79 @@
+#ifndef _INSTANCE_FORMAT_H_
+#define _INSTANCE_FORMAT_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <glad/glad.h>
+#include <cglm/cglm.h>
+
+#include "vertex_packing.h"
+#include "geometry_arena.h"
+
+// 24 byte per instance transform: translation, uniform scale and a rotation.
+// The asteroid matrices are only ever T * S * R, so the vertex shader rebuilds
+// them from this instead of fetching 64 bytes of mat4 per instance.
+typedef struct {
+    float position[3];
+    float scale;
+    int16_t rotation[4];  // unit quaternion x, y, z, w as snorm16
+} CompactInstance;
+
+// Quaternion rotating by `angle` radians around `axis` (need not be normalized)
+CompactInstance packInstance(vec3 position, float scale, vec3 axis, float angle)
+{
+    versor rotation;
+    glm_quatv(rotation, angle, axis);
+
+    CompactInstance instance = {
+        .position = {position[0], position[1], position[2]},
+        .scale = scale,
+    };
+    for (int c = 0; c < 4; c++) {
+        instance.rotation[c] = packSnorm16(rotation[c]);
+    }
+    return instance;
+}
+
+// The matrix the vertex shader builds, for CPU side bounds
+void instanceMatrix(const CompactInstance *instance, mat4 matrix)
+{
+    versor rotation;
+    for (int c = 0; c < 4; c++) {
+        rotation[c] = instance->rotation[c] / 32767.0f;
+    }
+    glm_quat_normalize(rotation);
+
+    glm_quat_mat4(rotation, matrix);
+    for (int column = 0; column < 3; column++) {
+        glm_vec3_scale(matrix[column], instance->scale, matrix[column]);
+    }
+    matrix[3][0] = instance->position[0];
+    matrix[3][1] = instance->position[1];
+    matrix[3][2] = instance->position[2];
+}
+
+// Per instance attributes 3 (position, scale) and 4 (rotation) of the bound VAO,
+// read from `buffer` starting `offset` bytes in
+void setupInstanceAttributes(unsigned int buffer, size_t offset)
+{
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    glEnableVertexAttribArray(3);
+    glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(CompactInstance), (void *) offset);
+    glVertexAttribDivisor(3, 1);
+    glEnableVertexAttribArray(4);
+    glVertexAttribPointer(4, 4, GL_SHORT, GL_TRUE, sizeof(CompactInstance), (void *) (offset + offsetof(CompactInstance, rotation)));
+    glVertexAttribDivisor(4, 1);
+}
+
+// Arena geometry plus instances from `instanceBuffer`
+unsigned int createInstancedVertexArray(GeometryArena *arena, unsigned int instanceBuffer)
+{
+    unsigned int VAO = createGeometryArenaVertexArray(arena);
+    glBindVertexArray(VAO);
+    setupInstanceAttributes(instanceBuffer, 0);
+    glBindVertexArray(0);
+    return VAO;
+}
+
+#endif // _INSTANCE_FORMAT_H_
@@ -0,0 +1,128 @@
+#ifndef _INSTANCE_RING_H_
+#define _INSTANCE_RING_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include <glad/glad.h>
+
+// Per frame instance data streamed through one buffer split in
+// INSTANCE_RING_SEGMENTS segments. Every frame maps the next segment
+// unsynchronized, so the driver neither waits for the GPU nor copies, and a
+// fence placed after the last draw reading a segment tells when it may be
+// written again. With three segments the CPU can run two frames ahead before
+// it ever has to wait, and the wait is counted when it happens.
+// Persistent mapping would save the map calls but needs GL 4.4 buffer storage.
+
+#define INSTANCE_RING_SEGMENTS 3
+
+typedef struct {
+    unsigned int buffer;
+    size_t segmentSize;
+    unsigned int current;  // segment of this frame
+    bool mapped;
+    GLsync fences[INSTANCE_RING_SEGMENTS];
+
+    unsigned long numFrames, numStalls;
+    double stallTime;  // seconds spent waiting on fences
+} InstanceRing;
+
+double instanceRingNow ()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void initInstanceRing (InstanceRing *ring, size_t segmentSize)
+{
+    memset(ring, 0, sizeof(*ring));
+    ring->segmentSize = segmentSize ? segmentSize : 1;
+    ring->current = INSTANCE_RING_SEGMENTS - 1;  // the first map moves to segment 0
+
+    glGenBuffers(1, &ring->buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, ring->buffer);
+    glBufferData(GL_ARRAY_BUFFER, INSTANCE_RING_SEGMENTS * ring->segmentSize, NULL, GL_STREAM_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// Byte offset of this frame's segment, for the attribute pointers of the draws
+size_t instanceRingOffset (InstanceRing *ring)
+{
+    return ring->current * ring->segmentSize;
+}
+
+// Move to the next segment and map it for writing, after the GPU let go of it
+void * mapInstanceRing (InstanceRing *ring)
+{
+    ring->current = (ring->current + 1) % INSTANCE_RING_SEGMENTS;
+    ring->numFrames++;
+
+    GLsync fence = ring->fences[ring->current];
+    if (fence) {
+        GLenum status = glClientWaitSync(fence, 0, 0);
+        if (status == GL_TIMEOUT_EXPIRED) {
+            // the GPU is more than INSTANCE_RING_SEGMENTS - 1 frames behind
+            double start = instanceRingNow();
+            ring->numStalls++;
+            do {
+                status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+            } while (status == GL_TIMEOUT_EXPIRED);
+            ring->stallTime += instanceRingNow() - start;
+        }
+        if (status == GL_WAIT_FAILED) {
+            printf("ERROR::INSTANCE_RING::WAIT_FAILED\n");
+            exit(EXIT_FAILURE);
+        }
+        glDeleteSync(fence);
+        ring->fences[ring->current] = NULL;
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, ring->buffer);
+    void *data = glMapBufferRange(GL_ARRAY_BUFFER, instanceRingOffset(ring), ring->segmentSize,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    if (!data) {
+        printf("ERROR::INSTANCE_RING::MAP_FAILED %zu bytes\n", ring->segmentSize);
+        exit(EXIT_FAILURE);
+    }
+    ring->mapped = true;
+    return data;
+}
+
+void unmapInstanceRing (InstanceRing *ring)
+{
+    glBindBuffer(GL_ARRAY_BUFFER, ring->buffer);
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+    ring->mapped = false;
+}
+
+// After the last command reading this frame's segment
+void fenceInstanceRing (InstanceRing *ring)
+{
+    ring->fences[ring->current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void printInstanceRingStats (InstanceRing *ring)
+{
+    printf("instance ring: %d x %.2f MiB, %lu frames, %lu waited on the GPU (%.3f ms in total)\n",
+        INSTANCE_RING_SEGMENTS, ring->segmentSize / 1048576.0, ring->numFrames, ring->numStalls, ring->stallTime * 1000.0);
+}
+
+void destroyInstanceRing (InstanceRing *ring)
+{
+    if (ring->mapped) {
+        unmapInstanceRing(ring);
+    }
+    for (unsigned int i = 0; i < INSTANCE_RING_SEGMENTS; i++) {
+        if (ring->fences[i]) {
+            glDeleteSync(ring->fences[i]);
+        }
+    }
+    glDeleteBuffers(1, &ring->buffer);
+    memset(ring, 0, sizeof(*ring));
+}
+
+#endif // _INSTANCE_RING_H_
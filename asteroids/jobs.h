@@ -0,0 +1,343 @@
+#ifndef _JOBS_H_
+#define _JOBS_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sched.h>
+
+// Small process-wide job system with work stealing. Every worker, and the
+// thread that called initJobSystem(), owns a Chase-Lev deque: jobs are pushed
+// and popped at the bottom by the owner and stolen from the top by everyone
+// else, so the common path takes no lock. Callers waiting on a JobCounter help
+// run jobs instead of sleeping, so parallelFor() also makes progress with zero
+// workers. Threads without a deque run what they submit inline.
+
+#define JOB_QUEUE_SIZE 4096 // per deque, must be a power of two
+#define JOB_CACHE_LINE 64
+
+typedef void (*JobFunction)(void *data, unsigned int index);
+
+typedef struct {
+    atomic_uint pending;
+} JobCounter;
+
+typedef struct {
+    JobFunction function;
+    void *data;
+    unsigned int index;
+    JobCounter *counter;
+} Job;
+
+// A thief may read a slot while the owner reuses it; its steal then fails and
+// the value is dropped. Atomic fields keep that read well defined.
+typedef struct {
+    _Atomic(JobFunction) function;
+    _Atomic(void *) data;
+    atomic_uint index;
+    _Atomic(JobCounter *) counter;
+} JobSlot;
+
+typedef struct {
+    _Alignas(JOB_CACHE_LINE) atomic_long top;       // thieves
+    _Alignas(JOB_CACHE_LINE) atomic_long bottom;    // owner
+    _Alignas(JOB_CACHE_LINE) JobSlot slots[JOB_QUEUE_SIZE];
+} JobDeque;
+
+typedef struct {
+    pthread_t *threads;
+    unsigned int numThreads;
+
+    JobDeque *deques;  // [0] is the thread that called initJobSystem(), [1..] the workers
+    unsigned int numDeques;
+
+    // idle workers sleep here, submitJob() only takes the lock when someone does
+    pthread_mutex_t mutex;
+    pthread_cond_t workAvailable;
+    atomic_uint numSleeping;
+
+    atomic_bool quit;
+} JobSystem;
+
+JobSystem jobSystem = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .workAvailable = PTHREAD_COND_INITIALIZER,
+};
+
+// Deque owned by the current thread, -1 if it has none
+_Thread_local int jobThreadIndex = -1;
+
+unsigned int getNumCores ()
+{
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return cores > 0 ? cores : 1;
+}
+
+void runJob (Job *job)
+{
+    job->function(job->data, job->index);
+    if (job->counter) {
+        atomic_fetch_sub_explicit(&job->counter->pending, 1, memory_order_release);
+    }
+}
+
+void writeJobSlot (JobSlot *slot, Job *job)
+{
+    atomic_store_explicit(&slot->function, job->function, memory_order_relaxed);
+    atomic_store_explicit(&slot->data, job->data, memory_order_relaxed);
+    atomic_store_explicit(&slot->index, job->index, memory_order_relaxed);
+    atomic_store_explicit(&slot->counter, job->counter, memory_order_relaxed);
+}
+
+void readJobSlot (JobSlot *slot, Job *job)
+{
+    job->function = atomic_load_explicit(&slot->function, memory_order_relaxed);
+    job->data = atomic_load_explicit(&slot->data, memory_order_relaxed);
+    job->index = atomic_load_explicit(&slot->index, memory_order_relaxed);
+    job->counter = atomic_load_explicit(&slot->counter, memory_order_relaxed);
+}
+
+// Owner only. Returns false when the deque is full.
+bool pushJob (JobDeque *deque, Job *job)
+{
+    long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    if (bottom - top >= JOB_QUEUE_SIZE) {
+        return false;
+    }
+
+    writeJobSlot(&deque->slots[bottom & (JOB_QUEUE_SIZE - 1)], job);
+    atomic_thread_fence(memory_order_release);
+    // seq_cst pairs with the numSleeping check in submitJob() and the work check in jobWorker()
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_seq_cst);
+    return true;
+}
+
+// Owner only, newest job first
+bool popJob (JobDeque *deque, Job *job)
+{
+    long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+    if (top > bottom) { // empty
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+        return false;
+    }
+
+    readJobSlot(&deque->slots[bottom & (JOB_QUEUE_SIZE - 1)], job);
+    if (top == bottom) {
+        // last job, race the thieves for it
+        bool won = atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+            memory_order_seq_cst, memory_order_relaxed);
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+        return won;
+    }
+    return true;
+}
+
+// Any thread, oldest job first
+bool stealJob (JobDeque *deque, Job *job)
+{
+    long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+
+    if (top >= bottom) {
+        return false;
+    }
+
+    readJobSlot(&deque->slots[top & (JOB_QUEUE_SIZE - 1)], job);
+    return atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+        memory_order_seq_cst, memory_order_relaxed);
+}
+
+bool anyJobsQueued ()
+{
+    for (unsigned int i = 0; i < jobSystem.numDeques; i++) {
+        JobDeque *deque = &jobSystem.deques[i];
+        if (atomic_load_explicit(&deque->bottom, memory_order_seq_cst) >
+            atomic_load_explicit(&deque->top, memory_order_seq_cst)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Take a job without blocking: from our own deque first, then steal from the
+// others starting at a rotating victim. Returns false when nothing was found.
+bool tryPopJob (Job *job)
+{
+    if (jobSystem.numDeques == 0) {
+        return false;
+    }
+
+    if (jobThreadIndex >= 0 && popJob(&jobSystem.deques[jobThreadIndex], job)) {
+        return true;
+    }
+
+    static atomic_uint nextVictim;
+    unsigned int start = atomic_fetch_add_explicit(&nextVictim, 1, memory_order_relaxed);
+    for (unsigned int i = 0; i < jobSystem.numDeques; i++) {
+        unsigned int victim = (start + i) % jobSystem.numDeques;
+        if ((int) victim != jobThreadIndex && stealJob(&jobSystem.deques[victim], job)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+#define JOB_SPINS_BEFORE_SLEEP 64
+
+void * jobWorker (void *arg)
+{
+    jobThreadIndex = (int) (intptr_t) arg;
+
+    unsigned int idleSpins = 0;
+    for (;;) {
+        Job job;
+        if (tryPopJob(&job)) {
+            runJob(&job);
+            idleSpins = 0;
+            continue;
+        }
+
+        if (++idleSpins < JOB_SPINS_BEFORE_SLEEP) {
+            sched_yield();
+            continue;
+        }
+        idleSpins = 0;
+
+        pthread_mutex_lock(&jobSystem.mutex);
+        atomic_fetch_add_explicit(&jobSystem.numSleeping, 1, memory_order_seq_cst);
+        // a push that raced the increment is either seen here or sees us sleeping
+        while (!anyJobsQueued() && !atomic_load(&jobSystem.quit)) {
+            pthread_cond_wait(&jobSystem.workAvailable, &jobSystem.mutex);
+        }
+        atomic_fetch_sub_explicit(&jobSystem.numSleeping, 1, memory_order_relaxed);
+        bool done = atomic_load(&jobSystem.quit) && !anyJobsQueued();
+        pthread_mutex_unlock(&jobSystem.mutex);
+
+        if (done) { // quit requested and nothing left to run
+            return NULL;
+        }
+    }
+}
+
+// Start `numThreads` workers. The calling thread is not counted, it gets the
+// first deque and joins in whenever it waits on a counter.
+void initJobSystem (unsigned int numThreads)
+{
+    atomic_store(&jobSystem.quit, false);
+    atomic_store(&jobSystem.numSleeping, 0);
+    jobSystem.numThreads = numThreads;
+    jobSystem.threads = malloc((numThreads ? numThreads : 1) * sizeof(pthread_t));
+
+    jobSystem.numDeques = numThreads + 1;
+    jobSystem.deques = aligned_alloc(JOB_CACHE_LINE, jobSystem.numDeques * sizeof(JobDeque));
+    for (unsigned int i = 0; i < jobSystem.numDeques; i++) {
+        atomic_init(&jobSystem.deques[i].top, 0);
+        atomic_init(&jobSystem.deques[i].bottom, 0);
+    }
+    jobThreadIndex = 0;
+
+    for (unsigned int i = 0; i < numThreads; i++) {
+        if (pthread_create(&jobSystem.threads[i], NULL, jobWorker, (void *) (intptr_t) (i + 1)) != 0) {
+            printf("Failed to create job worker thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+// Drain the deques and join the workers
+void shutdownJobSystem ()
+{
+    pthread_mutex_lock(&jobSystem.mutex);
+    atomic_store(&jobSystem.quit, true);
+    pthread_cond_broadcast(&jobSystem.workAvailable);
+    pthread_mutex_unlock(&jobSystem.mutex);
+
+    for (unsigned int i = 0; i < jobSystem.numThreads; i++) {
+        pthread_join(jobSystem.threads[i], NULL);
+    }
+
+    // with zero workers nobody else drains our own deque
+    Job job;
+    while (tryPopJob(&job)) {
+        runJob(&job);
+    }
+
+    free(jobSystem.threads);
+    free(jobSystem.deques);
+    jobSystem.threads = NULL;
+    jobSystem.deques = NULL;
+    jobSystem.numThreads = 0;
+    jobSystem.numDeques = 0;
+    jobThreadIndex = -1;
+}
+
+void submitJob (JobFunction function, void *data, unsigned int index, JobCounter *counter)
+{
+    Job job = {
+        .function = function,
+        .data = data,
+        .index = index,
+        .counter = counter,
+    };
+
+    if (counter) {
+        atomic_fetch_add_explicit(&counter->pending, 1, memory_order_relaxed);
+    }
+
+    // no workers, no deque of our own, or a full one: run it right here
+    if (jobSystem.numThreads == 0 || jobThreadIndex < 0 || !pushJob(&jobSystem.deques[jobThreadIndex], &job)) {
+        runJob(&job);
+        return;
+    }
+
+    if (atomic_load_explicit(&jobSystem.numSleeping, memory_order_seq_cst) > 0) {
+        pthread_mutex_lock(&jobSystem.mutex);
+        pthread_cond_signal(&jobSystem.workAvailable);
+        pthread_mutex_unlock(&jobSystem.mutex);
+    }
+}
+
+bool jobsDone (JobCounter *counter)
+{
+    return atomic_load_explicit(&counter->pending, memory_order_acquire) == 0;
+}
+
+// Block until every job attached to `counter` has finished, running queued
+// jobs on this thread in the meantime
+void waitForJobs (JobCounter *counter)
+{
+    while (!jobsDone(counter)) {
+        Job job;
+        if (tryPopJob(&job)) {
+            runJob(&job);
+        }
+        else {
+            sched_yield();
+        }
+    }
+}
+
+// Run function(data, i) for i in [0, count) across the workers and wait for all of them
+void parallelFor (unsigned int count, JobFunction function, void *data)
+{
+    JobCounter counter = { 0 };
+
+    for (unsigned int i = 0; i < count; i++) {
+        submitJob(function, data, i, &counter);
+    }
+
+    waitForJobs(&counter);
+}
+
+#endif // _JOBS_H_
@@ -0,0 +1,265 @@
+#ifndef _LOD_H_
+#define _LOD_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+
+#include <cglm/cglm.h>
+
+#include "jobs.h"
+#include "mesh.h"
+#include "frustum_cull.h"
+#include "occlusion.h"
+#include "depth_sort.h"
+
+// Screen space level of detail selection. A level is good enough for an
+// instance when its simplification error, projected at the distance of the
+// instance, covers less than `tolerance` pixels. The error of a level is in
+// model units, so it scales with the instance just like its bounding sphere
+// does, and the test reduces to distance >= radius * factor with one factor
+// per level. The closest point of the sphere is used as the distance, so a
+// rock never gets coarser while any of it is nearer than its threshold.
+//
+// Past the mesh levels come two impostor buckets: instances fading from a mesh
+// to a billboard are drawn as both, and the ones further out as billboards
+// only. The fading instances are drawn at `fadeLod`, the coarsest level good
+// enough where the fade starts. Every level above it needs a larger distance
+// than that, so those buckets are empty. The fading bucket therefore directly
+// follows the `fadeLod` bucket and precedes the billboards, and each draw still
+// reads one contiguous range.
+#define LOD_BUCKET_FADE MESH_MAX_LODS
+#define LOD_BUCKET_IMPOSTOR (MESH_MAX_LODS + 1)
+#define LOD_NUM_BUCKETS (MESH_MAX_LODS + 2)
+
+#define LOD_IMPOSTOR_FADE 1.5f    // the fade ends this much further out than it starts
+#define LOD_NO_IMPOSTORS 1e30f    // start of the fade when there are no impostors
+
+typedef struct {
+    unsigned int numLods;
+    float factors[MESH_MAX_LODS];  // minimum distance per unit of sphere radius, increasing
+    float impostorStart, impostorEnd;  // the fade between mesh and impostor, in the same units
+    unsigned int fadeLod;
+    vec3 eye;
+} LodSelector;
+
+// `errors` are the model errors per level, `boundsRadius` the local sphere
+// radius the instance spheres are scaled from, `fovy` in radians. Instances
+// whose sphere covers less than `impostorPixels` across fade to impostors, 0
+// keeps every instance a mesh.
+void initLodSelector(LodSelector *selector, const float *errors, unsigned int numLods, float boundsRadius,
+    float fovy, float viewportHeight, float tolerance, float impostorPixels, vec3 eye)
+{
+    float pixelsPerUnit = viewportHeight / (2.0f * tanf(fovy * 0.5f));
+
+    selector->numLods = numLods < MESH_MAX_LODS ? numLods : MESH_MAX_LODS;
+    selector->factors[0] = 0.0f;
+    for (unsigned int lod = 1; lod < selector->numLods; lod++) {
+        float factor = errors[lod] / boundsRadius * pixelsPerUnit / tolerance;
+        // errors grow with the level, keep the thresholds ordered even if one does not
+        selector->factors[lod] = factor > selector->factors[lod - 1] ? factor : selector->factors[lod - 1];
+    }
+
+    selector->impostorStart = impostorPixels > 0.0f ? 2.0f * pixelsPerUnit / impostorPixels : LOD_NO_IMPOSTORS;
+    selector->impostorEnd = selector->impostorStart * LOD_IMPOSTOR_FADE;
+    selector->fadeLod = 0;
+    while (selector->fadeLod + 1 < selector->numLods && selector->factors[selector->fadeLod + 1] <= selector->impostorStart) {
+        selector->fadeLod++;
+    }
+    glm_vec3_copy(eye, selector->eye);
+}
+
+// Bucket of an instance: its mesh level, LOD_BUCKET_FADE or LOD_BUCKET_IMPOSTOR
+static inline unsigned int selectLod(const LodSelector *selector, float x, float y, float z, float radius)
+{
+    float dx = x - selector->eye[0], dy = y - selector->eye[1], dz = z - selector->eye[2];
+    float distance = sqrtf(dx * dx + dy * dy + dz * dz) - radius;
+
+    if (distance >= radius * selector->impostorStart) {
+        return distance >= radius * selector->impostorEnd ? LOD_BUCKET_IMPOSTOR : LOD_BUCKET_FADE;
+    }
+    unsigned int lod = 0;
+    while (lod + 1 < selector->numLods && distance >= radius * selector->factors[lod + 1]) {
+        lod++;
+    }
+    return lod;
+}
+
+// Parallel cull that also buckets the visible instances by level. The chunks
+// are culled as in cullInstancesParallel() and count their instances per bucket,
+// the prefix sum then runs bucket major, so every bucket ends up in one
+// contiguous range of the output that a single instanced draw can read.
+typedef struct {
+    ParallelCull cull;
+    const LodSelector *selector;
+    OcclusionBuffer *occlusion;    // NULL to skip the occlusion test
+    DepthSort *sort;               // NULL to keep the instances in index order
+
+    unsigned char *levels;         // bucket of every entry of cull.visible
+    unsigned int *chunkLodCounts;  // LOD_NUM_BUCKETS entries per chunk
+    unsigned int *chunkLodOffsets;
+} ParallelLodCull;
+
+void cullLodChunkJob(void *data, unsigned int chunk)
+{
+    ParallelLodCull *job = data;
+    cullChunkJob(&job->cull, chunk);
+
+    const SphereBounds *bounds = job->cull.bounds;
+    unsigned int *visible = job->cull.visible + chunk * CULL_CHUNK_SIZE;
+    if (job->occlusion) {
+        job->cull.chunkCounts[chunk] = cullOccludedSpheres(job->occlusion, bounds->x, bounds->y, bounds->z,
+            bounds->radius, visible, job->cull.chunkCounts[chunk]);
+    }
+    unsigned char *levels = job->levels + chunk * CULL_CHUNK_SIZE;
+    unsigned int *counts = job->chunkLodCounts + chunk * LOD_NUM_BUCKETS;
+
+    memset(counts, 0, LOD_NUM_BUCKETS * sizeof(unsigned int));
+    for (unsigned int i = 0; i < job->cull.chunkCounts[chunk]; i++) {
+        unsigned int s = visible[i];
+        unsigned int lod = selectLod(job->selector, bounds->x[s], bounds->y[s], bounds->z[s], bounds->radius[s]);
+        levels[i] = lod;
+        counts[lod]++;
+    }
+
+    if (job->sort) {
+        unsigned int *keys = job->sort->keys[0] + chunk * CULL_CHUNK_SIZE;
+        unsigned int *indices = job->sort->indices[0] + chunk * CULL_CHUNK_SIZE;
+        for (unsigned int i = 0; i < job->cull.chunkCounts[chunk]; i++) {
+            unsigned int s = visible[i];
+            keys[i] = levels[i] << DEPTH_SORT_BITS | depthSortKey(job->sort, bounds->x[s], bounds->y[s], bounds->z[s]);
+            indices[i] = s;
+        }
+    }
+}
+
+void scatterLodChunkJob(void *data, unsigned int chunk)
+{
+    ParallelLodCull *job = data;
+    const unsigned int *visible = job->cull.visible + chunk * CULL_CHUNK_SIZE;
+    const unsigned char *levels = job->levels + chunk * CULL_CHUNK_SIZE;
+    const char *instances = job->cull.instances;
+    size_t size = job->cull.instanceSize;
+
+    unsigned int next[LOD_NUM_BUCKETS];
+    memcpy(next, job->chunkLodOffsets + chunk * LOD_NUM_BUCKETS, sizeof(next));
+
+    for (unsigned int i = 0; i < job->cull.chunkCounts[chunk]; i++) {
+        char *out = (char *) job->cull.output + (size_t) next[levels[i]]++ * size;
+        memcpy(out, instances + (size_t) visible[i] * size, size);
+    }
+}
+
+// Like cullInstancesParallel(), with the records of bucket b written to
+// [lodFirst[b], lodFirst[b] + lodCount[b]) of `output`. The instances in the
+// frustum are also tested against `occlusion` when it is not NULL. With a
+// `sort` every bucket is ordered front to back. `levels` needs
+// bounds->capacity entries and the two chunk arrays LOD_NUM_BUCKETS entries per
+// chunk. Buckets the selector does not use get a count of 0.
+unsigned int cullInstancesLodParallel(CullFunction cull, const Frustum *frustum, const SphereBounds *bounds,
+    const LodSelector *selector, OcclusionBuffer *occlusion, DepthSort *sort, const void *instances, void *output, size_t instanceSize,
+    unsigned int *visible, unsigned char *levels, unsigned int *chunkCounts,
+    unsigned int *chunkLodCounts, unsigned int *chunkLodOffsets,
+    unsigned int lodFirst[LOD_NUM_BUCKETS], unsigned int lodCount[LOD_NUM_BUCKETS])
+{
+    ParallelLodCull job = {
+        .cull = {
+            .cull = cull,
+            .frustum = frustum,
+            .bounds = bounds,
+            .visible = visible,
+            .chunkCounts = chunkCounts,
+            .instances = instances,
+            .output = output,
+            .instanceSize = instanceSize,
+        },
+        .selector = selector,
+        .occlusion = occlusion,
+        .sort = sort,
+        .levels = levels,
+        .chunkLodCounts = chunkLodCounts,
+        .chunkLodOffsets = chunkLodOffsets,
+    };
+
+    unsigned int numChunks = cullNumChunks(bounds->count);
+    parallelFor(numChunks, cullLodChunkJob, &job);
+
+    if (sort) {
+        unsigned int bucketFirst[DEPTH_SORT_RADIX + 1];
+        unsigned int numVisible = depthSortInstances(sort, chunkCounts, numChunks, instances, output, instanceSize,
+            bucketFirst);
+        for (unsigned int lod = 0; lod < LOD_NUM_BUCKETS; lod++) {
+            lodFirst[lod] = bucketFirst[lod];
+            lodCount[lod] = bucketFirst[lod + 1] - bucketFirst[lod];
+        }
+        return numVisible;
+    }
+
+    unsigned int numVisible = 0;
+    for (unsigned int lod = 0; lod < LOD_NUM_BUCKETS; lod++) {
+        lodFirst[lod] = numVisible;
+        for (unsigned int c = 0; c < numChunks; c++) {
+            chunkLodOffsets[c * LOD_NUM_BUCKETS + lod] = numVisible;
+            numVisible += chunkLodCounts[c * LOD_NUM_BUCKETS + lod];
+        }
+        lodCount[lod] = numVisible - lodFirst[lod];
+    }
+
+    parallelFor(numChunks, scatterLodChunkJob, &job);
+
+    return numVisible;
+}
+
+// Two RGBA8 renderings of the same instances compared in two ways: pixels
+// covered in only one of them are silhouette changes, and colors are compared
+// as averages over LOD_DIFF_BLOCK squares, so billboards whose texels do not
+// line up with the mesh are judged by what they look like rather than per texel.
+// Pixels equal to `background` in both images are not covered.
+#define LOD_DIFF_BLOCK 4
+
+typedef struct {
+    unsigned int numCovered, numSilhouette;
+    unsigned int numBlocks, numDifferentBlocks;  // blocks with a covered pixel, those differing by more than the threshold
+} LodImageDifference;
+
+void compareLodImages(const unsigned char *a, const unsigned char *b, unsigned int width, unsigned int height,
+    const unsigned char background[4], unsigned int threshold, LodImageDifference *difference)
+{
+    memset(difference, 0, sizeof(*difference));
+
+    for (unsigned int by = 0; by < height; by += LOD_DIFF_BLOCK) {
+        for (unsigned int bx = 0; bx < width; bx += LOD_DIFF_BLOCK) {
+            unsigned int sumA[3] = {0, 0, 0}, sumB[3] = {0, 0, 0}, numPixels = 0, numCovered = 0;
+
+            for (unsigned int y = by; y < by + LOD_DIFF_BLOCK && y < height; y++) {
+                for (unsigned int x = bx; x < bx + LOD_DIFF_BLOCK && x < width; x++) {
+                    const unsigned char *pa = a + ((size_t) y * width + x) * 4, *pb = b + ((size_t) y * width + x) * 4;
+                    bool coveredA = memcmp(pa, background, 3) != 0, coveredB = memcmp(pb, background, 3) != 0;
+                    numCovered += coveredA || coveredB;
+                    difference->numSilhouette += coveredA != coveredB;
+                    for (int c = 0; c < 3; c++) {
+                        sumA[c] += pa[c];
+                        sumB[c] += pb[c];
+                    }
+                    numPixels++;
+                }
+            }
+
+            if (numCovered == 0) {
+                continue;
+            }
+            difference->numCovered += numCovered;
+            difference->numBlocks++;
+            for (int c = 0; c < 3; c++) {
+                if ((unsigned int) abs((int) sumA[c] - (int) sumB[c]) > threshold * numPixels) {
+                    difference->numDifferentBlocks++;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+#endif // _LOD_H_
@@ -3,6 +3,7 @@
 #include <math.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
@@ -13,21 +14,70 @@
 #include "mesh.h"
 #include "model.h"
 #include "light_cube_vertices.h"
+#include "bench.h"
+#include "gpu_cull.h"
+#include "instance_format.h"
+#include "instance_ring.h"
+#include "orbit.h"
+#include "belt.h"
+#include "collision.h"
+#include "lod.h"
+#include "impostor.h"
+#include "pipeline_stats.h"
+#include "display.h"
+#include "trace.h"
+#include "flythrough.h"
+#include "gpu_profiler.h"
+#include "text_overlay.h"
 
 #define SCR_WIDTH 800
 #define SCR_HEIGHT 600
 
+// --check-lod compares the rocks at full detail against the chosen levels on this frame
+#define LOD_CHECK_FRAME 30
+#define LOD_CHECK_THRESHOLD 24    // channel difference a block may have and still count as equal
+#define LOD_CHECK_MAX_SILHOUETTE 0.01
+#define LOD_CHECK_MAX_DIFFERENCE 0.03
+
+#define NEAR_PLANE 0.1f
+#define FAR_PLANE 100.0f
+#define CAMERA_RADIUS 0.2f  // sphere the camera collides with the rocks as, twice the near plane
+
+// the faces of planet.obj come within 99% of its bounding sphere, the occluder stays inside them
+#define PLANET_OCCLUDER_INSET 0.98f
+#define PLANET_OCCLUDER_SUBDIVISIONS 2
+
+// --benchmark flies over the planet, along the belt and through it
+const FlythroughKey benchmarkKeys[] = {
+    {{0.0f, 15.0f, 80.0f}, {0.0f, 0.0f, 0.0f}},
+    {{45.0f, 4.0f, 45.0f}, {20.0f, 0.0f, 10.0f}},
+    {{56.0f, 0.5f, 5.0f}, {45.0f, 0.0f, -25.0f}},
+    {{35.0f, 1.0f, -38.0f}, {0.0f, 0.0f, -50.0f}},
+    {{-10.0f, 0.0f, -50.0f}, {-40.0f, 0.0f, -30.0f}},
+    {{-40.0f, 8.0f, -25.0f}, {0.0f, -3.0f, 0.0f}},
+    {{-62.0f, 2.0f, 10.0f}, {-45.0f, 0.0f, 35.0f}},
+    {{-30.0f, 25.0f, 60.0f}, {0.0f, 0.0f, 0.0f}},
+};
+
 Camera camera;
+DisplayBackend display;
 
 float lastX = SCR_WIDTH / 2.0f;
 float lastY = SCR_HEIGHT / 2.0f;
 bool firstMouse = true;
+bool traceKeyDown = false;
 
 float deltaTime = 0.0f;	// Time between current frame and last frame
 float lastFrame = 0.0f; // Time of last frame
 
 vec3 lightPos = {1.2f, 1.0f, 2.0f};
 
+// G switches the asteroid culling between the CPU and the GPU path
+bool gpuCull = false;
+bool gpuCullKeyDown = false;
+
+int viewportHeight = SCR_HEIGHT;  // for the screen space error of the rock levels
+
 void error_callback (int error, const char *description)
 {
     printf("%s\n", description);
@@ -36,6 +86,7 @@ void error_callback (int error, const char *description)
 void framebuffer_size_callback (GLFWwindow *window, int width, int height)
 {
     glViewport(0, 0, width, height);
+    viewportHeight = height;
 }
 
 void mouse_callback (GLFWwindow *window, double xpos, double ypos)
@@ -62,6 +113,7 @@ void scroll_callback (GLFWwindow *window, double xoffset, double yoffset)
 
 void processInput (GLFWwindow *window)
 {
+    TRACE_FUNCTION();
     if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS) {
         processKeyboard(&camera, FORWARD, deltaTime);
     }
@@ -74,62 +126,353 @@ void processInput (GLFWwindow *window)
     if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS) {
         processKeyboard(&camera, RIGHT, deltaTime);
     }
+    bool gKeyDown = glfwGetKey(window, GLFW_KEY_G) == GLFW_PRESS;
+    if (gKeyDown && !gpuCullKeyDown) {
+        gpuCull = !gpuCull;
+        printf("asteroid culling on the %s\n", gpuCull ? "GPU" : "CPU");
+    }
+    gpuCullKeyDown = gKeyDown;
+    bool f12KeyDown = TRACE_ENABLED && glfwGetKey(window, GLFW_KEY_F12) == GLFW_PRESS;
+    if (f12KeyDown && !traceKeyDown) {
+        TRACE_WRITE(TRACE_OUTPUT);
+    }
+    traceKeyDown = f12KeyDown;
     if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS) {
         glfwSetWindowShouldClose(window, GLFW_TRUE);
     }
 }
 
-GLFWwindow* createWindow ()
+// What the CPU path draws the rocks of a frame with, the buckets come from cullInstancesLodParallel()
+typedef struct {
+    Model *model;
+    unsigned int program, vao;
+    ProgramReflection *uniforms;
+    GLint fadeLocation;
+    Impostors *impostors;  // NULL when there are none, the far buckets are then empty
+    unsigned int instanceBuffer;
+} RockRenderer;
+
+// One instanced draw per level and rock mesh, each reading its own bucket of the
+// ring segment, plus one for the impostor quads. The fading instances follow the
+// bucket of the selector's fadeLod, so that draw takes them along, and they
+// start the range the impostor draw reads. With `fullDetail` every instance is
+// an opaque level 0 mesh. Returns the number of triangles submitted, two per quad.
+unsigned long drawRocks (RockRenderer *renderer, size_t ringOffset, const unsigned int *lodFirst,
+    const unsigned int *lodCount, const LodSelector *selector, bool fullDetail)
 {
-    glfwSetErrorCallback(error_callback);
+    Model *rock = renderer->model;
+    unsigned long numTriangles = 0;
 
-    if (glfwInit() == GLFW_FALSE) {
-        printf("Failed to initialize GLFW\n");
-        exit(EXIT_FAILURE);
+    glUseProgram(renderer->program);
+    if (fullDetail) {
+        glUniform2f(renderer->fadeLocation, LOD_NO_IMPOSTORS, LOD_NO_IMPOSTORS * LOD_IMPOSTOR_FADE);
     }
+    else {
+        glUniform2f(renderer->fadeLocation, selector->impostorStart, selector->impostorEnd);
+    }
+    glBindVertexArray(renderer->vao);
+    // texture_diffuse1 samples unit 0, see bindMaterialSamplers()
+    glActiveTexture(GL_TEXTURE0 + materialTextureUnit(TEXTURE_DIFFUSE, 0));
+    glBindTexture(GL_TEXTURE_2D, rock->meshes[0].textures[0].id);
+
+    for (unsigned int lod = 0; lod < rock->numLods; lod++) {
+        unsigned int count = lodCount[lod];
+        if (lod == selector->fadeLod) {
+            count += lodCount[LOD_BUCKET_FADE] + (fullDetail ? lodCount[LOD_BUCKET_IMPOSTOR] : 0);
+        }
+        if (count == 0) {
+            continue;
+        }
+        setupInstanceAttributes(renderer->instanceBuffer, ringOffset + lodFirst[lod] * sizeof(CompactInstance));
+        unsigned int level = fullDetail ? 0 : lod;
+        for (unsigned int i = 0; i < rock->numMeshes; i++) {
+            Mesh *mesh = &rock->meshes[i];
+            glUniform3fv(renderer->uniforms->positionScale, 1, mesh->positionScale);
+            glUniform3fv(renderer->uniforms->positionOffset, 1, mesh->positionOffset);
+            glDrawElementsInstancedBaseVertex(
+                GL_TRIANGLES, mesh->lodNumIndices[level], mesh->indexType,
+                meshLodIndexOffset(mesh, level), count, meshBaseVertex(mesh)
+            );
+            numTriangles += (unsigned long) count * (mesh->lodNumIndices[level] / 3);
+        }
+    }
+    glBindVertexArray(0);
 
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-
-    GLFWwindow *window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "LearnOpenGL", NULL, NULL);
-    if (window == NULL) {
-        printf("Failed to create GLFW window\n");
-        glfwTerminate();
-        exit(EXIT_FAILURE);
+    if (renderer->impostors && !fullDetail) {
+        unsigned int numQuads = lodCount[LOD_BUCKET_FADE] + lodCount[LOD_BUCKET_IMPOSTOR];
+        drawImpostors(renderer->impostors, renderer->instanceBuffer,
+            ringOffset + lodFirst[LOD_BUCKET_FADE] * sizeof(CompactInstance), numQuads);
+        numTriangles += 2ul * numQuads;
     }
-    glfwMakeContextCurrent(window);
 
-    if (!gladLoadGLLoader((GLADloadproc) glfwGetProcAddress)) {
-        printf("Failed to initialize GLAD\n");
-        exit(EXIT_FAILURE);
+    return numTriangles;
+}
+
+// Renders the rocks alone twice, at full detail and at the selected levels, and
+// compares the two images. Returns whether they are within the limit.
+bool checkLodDifference (RockRenderer *renderer, size_t ringOffset, const unsigned int *lodFirst,
+    const unsigned int *lodCount, const LodSelector *selector, float tolerance)
+{
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    unsigned int numPixels = viewport[2] * viewport[3];
+
+    unsigned char *images[2];
+    for (int pass = 0; pass < 2; pass++) {
+        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        drawRocks(renderer, ringOffset, lodFirst, lodCount, selector, pass == 0);
+
+        images[pass] = malloc(numPixels * 4);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(viewport[0], viewport[1], viewport[2], viewport[3], GL_RGBA, GL_UNSIGNED_BYTE, images[pass]);
     }
 
-    glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
-    glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+    const unsigned char background[4] = {0, 0, 0, 255};
+    LodImageDifference difference;
+    compareLodImages(images[0], images[1], viewport[2], viewport[3], background, LOD_CHECK_THRESHOLD, &difference);
+    double silhouette = difference.numCovered ? (double) difference.numSilhouette / difference.numCovered : 0.0;
+    double color = difference.numBlocks ? (double) difference.numDifferentBlocks / difference.numBlocks : 0.0;
+    bool passed = silhouette <= LOD_CHECK_MAX_SILHOUETTE && color <= LOD_CHECK_MAX_DIFFERENCE;
+    printf("lod check at a %.2f pixel tolerance%s: silhouette of %.3f%% of %u covered pixels changed (limit %.1f%%), "
+        "%.3f%% of %u blocks differ by more than %d (limit %.1f%%), %s\n", tolerance,
+        renderer->impostors ? " with impostors" : "", silhouette * 100.0, difference.numCovered,
+        LOD_CHECK_MAX_SILHOUETTE * 100.0, color * 100.0, difference.numBlocks, LOD_CHECK_THRESHOLD,
+        LOD_CHECK_MAX_DIFFERENCE * 100.0, passed ? "passed" : "FAILED");
+
+    free(images[0]);
+    free(images[1]);
+    return passed;
+}
+
+GLFWwindow* createWindow (const DisplayOptions *options)
+{
+    glfwSetErrorCallback(error_callback);
+    openDisplay(&display, options, SCR_WIDTH, SCR_HEIGHT);
 
-    glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
-    glfwSetCursorPosCallback(window, mouse_callback);
-    glfwSetScrollCallback(window, scroll_callback);
+    GLFWwindow *window = display.window;
+    if (window) {
+        glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+
+        glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+        glfwSetCursorPosCallback(window, mouse_callback);
+        glfwSetScrollCallback(window, scroll_callback);
+    }
 
     return window;
 }
 
 int main (int argc, char *argv[])
 {
+    bool benchStartup = false;
+    bool benchTexCache = false;
+    bool benchCull = false;
+    bool benchCullThreads = false;
+    bool benchOrbits = false;
+    bool benchBelt = false;
+    bool benchCollide = false;
+    bool frustumCull = true;
+    bool animate = true;
+    bool lodRocks = true;
+    bool checkLod = false;
+    float lodTolerance = 1.0f;  // pixels of simplification error a rock may show
+    bool impostors = true;
+    bool collide = false;
+    bool occlusion = true;
+    bool depthSort = true;
+    float impostorPixels = 32.0f;  // rocks smaller than this on screen fade to billboards
+    unsigned int amount = 100000;
+    uint64_t seed = 1;  // the same belt on every run
+    const char *benchmarkOutput = NULL;
+    unsigned int modelFlags = MODEL_LOAD_MMAP | MODEL_OPTIMIZE | MODEL_PACK_VERTICES;
+    DisplayOptions displayOptions = {0};
+    GpuProfilerOptions profilerOptions = {0};
+
+    for (int i = 1; i < argc; i++) {
+        if (parseDisplayOption(&displayOptions, argc, argv, &i) || parseGpuProfilerOption(&profilerOptions, argc, argv, &i)) {
+            continue;
+        }
+        if (strcmp(argv[i], "--bench-startup") == 0) {
+            benchStartup = true;
+        }
+        else if (strcmp(argv[i], "--bench-texcache") == 0) {
+            benchTexCache = true;
+        }
+        else if (strcmp(argv[i], "--bench-cull") == 0) {
+            benchCull = true;
+        }
+        else if (strcmp(argv[i], "--bench-cull-threads") == 0) {
+            benchCullThreads = true;
+        }
+        else if (strcmp(argv[i], "--bench-orbits") == 0) {
+            benchOrbits = true;
+        }
+        else if (strcmp(argv[i], "--gpu-cull") == 0) {
+            gpuCull = true;
+        }
+        else if (strcmp(argv[i], "--bench-belt") == 0) {
+            benchBelt = true;
+        }
+        else if (strcmp(argv[i], "--benchmark") == 0) {
+            benchmarkOutput = BENCHMARK_DEFAULT_OUTPUT;
+            if (i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0) {
+                benchmarkOutput = argv[++i];
+            }
+        }
+        else if (strcmp(argv[i], "--bench-collide") == 0) {
+            benchCollide = true;
+        }
+        else if ((strcmp(argv[i], "--count") == 0 || strcmp(argv[i], "--rocks") == 0) && i + 1 < argc) {
+            amount = strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = strtoull(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--no-cull") == 0) {
+            frustumCull = false;
+        }
+        else if (strcmp(argv[i], "--no-animate") == 0) {
+            animate = false;
+        }
+        else if (strcmp(argv[i], "--no-lod") == 0) {
+            lodRocks = false;
+        }
+        else if (strcmp(argv[i], "--lod-tolerance") == 0 && i + 1 < argc) {
+            lodTolerance = strtof(argv[++i], NULL);
+        }
+        else if (strcmp(argv[i], "--check-lod") == 0) {
+            checkLod = true;
+        }
+        else if (strcmp(argv[i], "--collide") == 0) {
+            collide = true;
+        }
+        else if (strcmp(argv[i], "--no-occlusion") == 0) {
+            occlusion = false;
+        }
+        else if (strcmp(argv[i], "--no-sort") == 0) {
+            depthSort = false;
+        }
+        else if (strcmp(argv[i], "--no-impostors") == 0) {
+            impostors = false;
+        }
+        else if (strcmp(argv[i], "--impostor-pixels") == 0 && i + 1 < argc) {
+            impostorPixels = strtof(argv[++i], NULL);
+        }
+        else if (strcmp(argv[i], "--no-mmap") == 0) {
+            modelFlags &= ~MODEL_LOAD_MMAP;
+        }
+        else if (strcmp(argv[i], "--no-cache") == 0) {
+            modelFlags |= MODEL_NO_CACHE;
+        }
+        else if (strcmp(argv[i], "--no-optimize") == 0) {
+            modelFlags &= ~MODEL_OPTIMIZE;
+        }
+        else if (strcmp(argv[i], "--no-pack") == 0) {
+            modelFlags &= ~MODEL_PACK_VERTICES;
+        }
+        else {
+            printf("Unknown option %s\n", argv[i]);
+            printf("Usage: %s [--bench-startup] [--bench-texcache] [--bench-cull] [--bench-cull-threads] [--bench-orbits] [--bench-belt] [--bench-collide] [--benchmark [file]] [--gpu-cull] [--no-cull] [--no-animate] [--collide] [--no-occlusion] [--no-sort] [--no-lod] [--lod-tolerance PIXELS] [--check-lod] [--no-impostors] [--impostor-pixels PIXELS] [--count N] [--seed N] [--no-mmap] [--no-cache] [--no-optimize] [--no-pack] %s %s\n", argv[0], GPU_PROFILER_USAGE, DISPLAY_USAGE);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (benchmarkOutput && displayOptions.numFrames == 0) {
+        // one frame past the timed ones ends the last frame time
+        displayOptions.numFrames = BENCHMARK_WARMUP_FRAMES + BENCHMARK_FRAMES + 1;
+    }
+
+    if (benchTexCache) {
+        // CPU only, no window needed
+        for (unsigned int numUnique = 10; numUnique <= 1000; numUnique *= 10) {
+            benchTextureCache(numUnique, 100000);
+        }
+        return EXIT_SUCCESS;
+    }
+
+    if (benchCull) {
+        benchFrustumCull(100000, 100);
+        benchFrustumCull(1000000, 20);
+        benchFrustumCull(10000000, 5);
+        return EXIT_SUCCESS;
+    }
+
+    initJobSystem(getNumCores() - 1);
+
+    if (benchCullThreads) {
+        benchFrustumCullThreads(1000000, 20);
+        benchFrustumCullThreads(10000000, 5);
+        shutdownJobSystem();
+        return EXIT_SUCCESS;
+    }
+
+    if (benchOrbits) {
+        benchOrbitUpdate(100000, 100);
+        benchOrbitUpdate(1000000, 20);
+        shutdownJobSystem();
+        return EXIT_SUCCESS;
+    }
+
+    if (benchBelt) {
+        benchBeltGeneration(seed, 10000000, 3);
+        shutdownJobSystem();
+        return EXIT_SUCCESS;
+    }
+
+    if (benchCollide) {
+        // rock.obj is bounded by a sphere of about 2.5 at scale 1
+        benchCollisions(10000, 2.5f, 20);
+        benchCollisions(100000, 2.5f, 5);
+        benchCollisions(1000000, 2.5f, 2);
+        shutdownJobSystem();
+        return EXIT_SUCCESS;
+    }
+
     initCamera(&camera);
-    GLFWwindow *window = createWindow();
+    GLFWwindow *window = createWindow(&displayOptions);
 
     glEnable(GL_DEPTH_TEST);
 
     // tell stb_image.h to flip loaded texture's on the y-axis (before loading model).
     stbi_set_flip_vertically_on_load(true);
 
-    unsigned int program = createProgram("asteroids/shader.vert", "asteroids/shader.frag");
-    unsigned int asteroidsProgram = createProgram("asteroids/asteroids_shader.vert", "asteroids/shader.frag");
+    if (benchStartup) {
+        benchModelStartup("resources/planet/planet.obj", modelFlags, 5);
+        benchModelStartup("resources/rock/rock.obj", modelFlags, 5);
+        printGeometryArenaStats();
+        closeDisplay(&display);
+        shutdownJobSystem();
+        return EXIT_SUCCESS;
+    }
+
+    const char *vertexDefines = modelFlags & MODEL_PACK_VERTICES ? PACKED_VERTICES_DEFINE : NULL;
+    unsigned int program = createProgramVariant("asteroids/shader.vert", "asteroids/shader.frag", vertexDefines);
+    char asteroidsDefines[128];
+    snprintf(asteroidsDefines, sizeof(asteroidsDefines), "%s#define IMPOSTOR_FADE\n", vertexDefines ? vertexDefines : "");
+    unsigned int asteroidsProgram = createProgramVariant("asteroids/asteroids_shader.vert", "asteroids/shader.frag", asteroidsDefines);
     unsigned int lightProgram = createProgram("asteroids/light_shader.vert", "asteroids/light_shader.frag");
-    Model planet = createModel("resources/planet/planet.obj");
-    Model rock = createModel("resources/rock/rock.obj");
+    bindMaterialSamplers(program);
+    bindMaterialSamplers(asteroidsProgram);
+
+    // every uniform is resolved here, the render loop does no lookups by name
+    ProgramReflection *programUniforms = getProgramReflection(program);
+    ProgramReflection *asteroidsUniforms = getProgramReflection(asteroidsProgram);
+    ProgramReflection *lightUniforms = getProgramReflection(lightProgram);
+    GLint viewPosLocation = uniformLocation(program, "viewPos");
+    GLint lightPositionLocation = uniformLocation(program, "light.position");
+    GLint lightAmbientLocation = uniformLocation(program, "light.ambient");
+    GLint lightDiffuseLocation = uniformLocation(program, "light.diffuse");
+    GLint lightSpecularLocation = uniformLocation(program, "light.specular");
+    GLint asteroidsCameraPosLocation = uniformLocation(asteroidsProgram, "cameraPos");
+    GLint asteroidsFadeLocation = uniformLocation(asteroidsProgram, "impostorFade");
+    printMemoryUsage("before loading models");
+    Model planet = createModel("resources/planet/planet.obj", modelFlags);
+    // only the rocks are small enough on screen to use coarser levels
+    Model rock = createModel("resources/rock/rock.obj", lodRocks ? modelFlags | MODEL_LOD : modelFlags);
+    printMemoryUsage("after loading models");
+    printModelMemory(&planet, "resources/planet/planet.obj");
+    printModelMemory(&rock, "resources/rock/rock.obj");
+    printModelLods(&rock, "resources/rock/rock.obj");
 
     // configure light cube
     unsigned int VBO, lightCubeVAO;
@@ -144,77 +487,155 @@ int main (int argc, char *argv[])
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void *) 0);
     glEnableVertexAttribArray(0);
 
-    unsigned int amount = 100000;
-    mat4 *modelMatrices = calloc(amount, sizeof(mat4));
-    srand(glfwGetTime()); // initialize random seed
-    float radius = 50.0;
-    float offset = 2.5f;
-    for (unsigned int i = 0; i < amount; i++)
-    {
-        mat4 model;
-        glm_mat4_identity(model);
-        // 1. translation: displace along circle with 'radius' in range [-offset, offset]
-        float angle = (float) i / (float) amount * 360.0f;
-        float displacement = (rand() % (int) (2 * offset * 100)) / 100.0f - offset;
-        float x = sin(angle) * radius + displacement;
-        displacement = (rand() % (int) (2 * offset * 100)) / 100.0f - offset;
-        float y = displacement * 0.4f; // keep height of field smaller compared to width of x and z
-        displacement = (rand() % (int) (2 * offset * 100)) / 100.0f - offset;
-        float z = cos(angle) * radius + displacement;
-        vec3 t = {x, y, z};
-        glm_translate(model, t);
-
-        // 2. scale: scale between 0.05 and 0.25f
-        float scale = (rand() % 20) / 100.0f + 0.05;
-        vec3 s = {scale, scale, scale};
-        glm_scale(model, s);
-
-        // 3. rotation: add random rotation around a (semi)randomly picked rotation axis vector
-        float rotAngle = (rand() % 360);
-        vec3 r = {0.4f, 0.6f, 0.8f};
-        glm_rotate(model, rotAngle, r);
-
-        // 4. now add to list of matrices
-        memcpy(modelMatrices[i], model, sizeof(model));
-    }
-
-    // vertex buffer object
-    unsigned int buffer;
-    glGenBuffers(1, &buffer);
-    glBindBuffer(GL_ARRAY_BUFFER, buffer);
-    glBufferData(GL_ARRAY_BUFFER, amount * sizeof(mat4), modelMatrices, GL_STATIC_DRAW);
-
-    for (unsigned int i = 0; i < rock.numMeshes; i++) {
-        unsigned int VAO = rock.meshes[i].VAO;
-        glBindVertexArray(VAO);
-        // vertex attributes
-        size_t vec4Size = sizeof(vec4);
-        glEnableVertexAttribArray(3);
-        glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, 4 * vec4Size, (void *) 0);
-        glEnableVertexAttribArray(4);
-        glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, 4 * vec4Size, (void *) (1 * vec4Size));
-        glEnableVertexAttribArray(5);
-        glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, 4 * vec4Size, (void *) (2 * vec4Size));
-        glEnableVertexAttribArray(6);
-        glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, 4 * vec4Size, (void *) (3 * vec4Size));
-
-        glVertexAttribDivisor(3, 1);
-        glVertexAttribDivisor(4, 1);
-        glVertexAttribDivisor(5, 1);
-        glVertexAttribDivisor(6, 1);
+    // every rock circles the planet at its own radius and spins around a shared axis,
+    // the instances are rebuilt from these each frame
+    Orbits rockOrbits;
+    vec3 spinAxis = {0.4f, 0.6f, 0.8f};
+    initOrbits(&rockOrbits, amount, spinAxis);
+    BeltParams belt;
+    initBeltParams(&belt, seed, amount);
+    generateBeltParallel(&belt, &rockOrbits);
+    const char *orbitKernel;
+    OrbitFunction updateOrbits = selectOrbitFunction(&orbitKernel);
+
+    // world space bounding sphere of every instance, centered on the instance
+    // position so moving it is all the orbit update has to do
+    float rockBoundsRadius = glm_vec3_norm(rock.boundsCenter) + rock.boundsRadius;
+    SphereBounds rockBounds;
+    initSphereBounds(&rockBounds, amount);
+    float rockMaxRadius = 0.0f;
+    for (unsigned int i = 0; i < amount; i++) {
+        vec3 center = {0.0f, 0.0f, 0.0f};
+        setSphereBounds(&rockBounds, i, center, rockOrbits.scale[i] * rockBoundsRadius);
+        rockMaxRadius = fmaxf(rockMaxRadius, rockBounds.radius[i]);
+    }
+    // with --collide the rocks collide with each other and push the camera out of the way
+    CollisionGrid rockGrid;
+    initCollisionGrid(&rockGrid, amount, rockMaxRadius);
+    const char *contactKernel;
+    ContactFunction findSphereContacts = selectContactFunction(&contactKernel);
+
+    // the CPU path drops the rocks behind the planet, rasterized as a sphere just inside it
+    OccluderMesh planetOccluder;
+    initOccluderSphere(&planetOccluder, planet.boundsCenter, planet.boundsRadius * PLANET_OCCLUDER_INSET,
+        PLANET_OCCLUDER_SUBDIVISIONS);
+    OcclusionBuffer planetOcclusion;
+    initOcclusionBuffer(&planetOcclusion, planetOccluder.numTriangles);
+
+    // the CPU path submits the rocks of every level front to back, so early depth testing rejects the hidden ones
+    DepthSort rockSort;
+    initDepthSort(&rockSort, rockBounds.capacity);
+    PipelineStats rockFragments;
+    initPipelineStats(&rockFragments);
+    // this frame's instances, the CPU culling path compacts them into the ring
+    CompactInstance *rockInstances = calloc(amount ? amount : 1, sizeof(CompactInstance));
+    unsigned int *visibleRocks = malloc(rockBounds.capacity * sizeof(unsigned int));
+    unsigned int *cullChunkCounts = malloc(cullNumChunks(amount) * sizeof(unsigned int));
+    unsigned char *rockLevels = malloc(rockBounds.capacity);
+    unsigned int *lodChunkCounts = malloc(cullNumChunks(amount) * LOD_NUM_BUCKETS * sizeof(unsigned int));
+    unsigned int *lodChunkOffsets = malloc(cullNumChunks(amount) * LOD_NUM_BUCKETS * sizeof(unsigned int));
+    const char *cullKernel;
+    CullFunction cullSpheres = selectCullFunction(&cullKernel);
+
+    // every path writes the instances of a frame to the next segment of the ring
+    InstanceRing rockRing;
+    initInstanceRing(&rockRing, amount * sizeof(CompactInstance));
+
+    // the rock geometry lives in the shared arena, add the instances on a VAO of our own
+    unsigned int rockVAO = createInstancedVertexArray(rock.meshes[0].arena, rockRing.buffer);
+    glUseProgram(asteroidsProgram);
+    glUniform1f(uniformLocation(asteroidsProgram, "boundsRadius"), rockBoundsRadius);
+
+    // the far rocks are quads showing views of the rock baked here, which needs its texture
+    Impostors rockImpostors;
+    if (impostors) {
+        finishTextureUploads();
+        initImpostors(&rockImpostors, &rock, rockBoundsRadius, asteroidsProgram, asteroidsUniforms, rockVAO,
+            asteroidsCameraPosLocation, asteroidsFadeLocation);
+    }
+    RockRenderer rockRenderer = {
+        .model = &rock,
+        .program = asteroidsProgram,
+        .vao = rockVAO,
+        .uniforms = asteroidsUniforms,
+        .fadeLocation = asteroidsFadeLocation,
+        .impostors = impostors ? &rockImpostors : NULL,
+        .instanceBuffer = rockRing.buffer,
+    };
+
+    // the GPU path culls straight from the ring
+    GpuCull rockGpuCull;
+    initGpuCull(&rockGpuCull, &rock, rockBoundsRadius, amount);
+
+    // frame time statistics per culling path, the first frames include texture uploads and are skipped
+    unsigned int numFrames = 0;
+    unsigned int numTimedFrames[2] = {0, 0};
+    double frameTimeTotal[2] = {0.0, 0.0};
+    double cullTimeTotal = 0.0;
+    double orbitTimeTotal = 0.0;
+    double collisionTimeTotal = 0.0;
+    double occlusionTimeTotal = 0.0;
+    double occludedRocksTotal = 0.0;
+    double rockContactsTotal = 0.0;
+    float startTime = benchmarkOutput ? 0.0f : displayTime(&display);
+    unsigned long visibleRocksTotal = 0;
+    unsigned int numCpuCulledFrames = 0;
+    double rockTrianglesTotal = 0.0;      // submitted by the CPU path
+    double rockFullTrianglesTotal = 0.0;  // the same instances at full detail
+    double rockImpostorsTotal = 0.0;
+    bool lodCheckPassed = true;
+
+    FlythroughPath flythrough = {
+        .keys = benchmarkKeys,
+        .numKeys = sizeof(benchmarkKeys) / sizeof(benchmarkKeys[0]),
+        .numFrames = BENCHMARK_FRAMES,
+    };
+    // --profile-gpu times the passes and shows their averages over the frame
+    GpuProfiler gpuProfiler;
+    initGpuProfiler(&gpuProfiler, &profilerOptions);
+    TextOverlay profileOverlay;
+    unsigned int textProgram = 0;
+    if (gpuProfiler.enabled) {
+        textProgram = createProgram("asteroids/text.vert", "asteroids/text.frag");
+        initTextOverlay(&profileOverlay, textProgram);
+    }
 
-        glBindVertexArray(0);
+    FrameStats frameStats;
+    if (benchmarkOutput) {
+        // every frame of the run sees the same textures
+        finishTextureUploads();
+        initFrameStats(&frameStats, display.frameLimit > BENCHMARK_WARMUP_FRAMES ?
+            display.frameLimit - BENCHMARK_WARMUP_FRAMES : 1);
     }
 
-    free(modelMatrices);
+    beginSteadyState();
+    double lastFrameStart = displayTime(&display);
 
-    while (!glfwWindowShouldClose(window))
+    while (!displayShouldClose(&display))
     {
-        float currentFrame = glfwGetTime();
+        TRACE_SCOPE("frame");
+        // the benchmark steps the simulation by frame, not by wall clock; the frame times stay wall clock
+        double frameStart = displayTime(&display);
+        float currentFrame = benchmarkOutput ? numFrames * BENCHMARK_TIME_STEP : frameStart;
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
+        if (benchmarkOutput) {
+            sampleFlythrough(&flythrough, numFrames, camera.cameraPos, camera.cameraFront);
+            if (numFrames >= BENCHMARK_WARMUP_FRAMES) {
+                beginFrameStats(&frameStats, frameStart);
+            }
+        }
+        if (++numFrames > 10) {
+            numTimedFrames[gpuCull]++;
+            frameTimeTotal[gpuCull] += frameStart - lastFrameStart;
+        }
+        lastFrameStart = frameStart;
 
-        processInput(window);
+        if (window && !benchmarkOutput) {
+            processInput(window);
+        }
+        processTextureUploads(0.002);
+        beginGpuProfilerFrame(&gpuProfiler);
 
         glClearColor(0.05f, 0.05f, 0.05f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -225,21 +646,21 @@ int main (int argc, char *argv[])
         //glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 
         // light properties
-        glUniform3fv(glGetUniformLocation(program, "viewPos"), 1, camera.cameraPos);
-        glUniform3fv(glGetUniformLocation(program, "light.position"), 1, lightPos);
+        glUniform3fv(viewPosLocation, 1, camera.cameraPos);
+        glUniform3fv(lightPositionLocation, 1, lightPos);
         vec3 lightAmbient = {0.2f, 0.2f, 0.2f};
         vec3 lightDiffuse = {0.5f, 0.5f, 0.5f};
         vec3 lightSpecular = {1.0f, 1.0f, 1.0f};
-        glUniform3fv(glGetUniformLocation(program, "light.ambient"), 1, lightAmbient);
-        glUniform3fv(glGetUniformLocation(program, "light.diffuse"), 1, lightDiffuse);
-        glUniform3fv(glGetUniformLocation(program, "light.specular"), 1, lightSpecular);
+        glUniform3fv(lightAmbientLocation, 1, lightAmbient);
+        glUniform3fv(lightDiffuseLocation, 1, lightDiffuse);
+        glUniform3fv(lightSpecularLocation, 1, lightSpecular);
 
         // view/projection transformations
         mat4 view, projection;
         getViewMatrix(&camera, view);
-        glm_perspective(glm_rad(camera.fov), (float) SCR_WIDTH / (float) SCR_HEIGHT, 0.1f, 100.0f, projection);
-        glUniformMatrix4fv(glGetUniformLocation(program, "view"), 1, GL_FALSE, (float *) view);
-        glUniformMatrix4fv(glGetUniformLocation(program, "projection"), 1, GL_FALSE, (float *) projection);
+        glm_perspective(glm_rad(camera.fov), (float) SCR_WIDTH / (float) SCR_HEIGHT, NEAR_PLANE, FAR_PLANE, projection);
+        glUniformMatrix4fv(programUniforms->view, 1, GL_FALSE, (float *) view);
+        glUniformMatrix4fv(programUniforms->projection, 1, GL_FALSE, (float *) projection);
 
         // render the loaded model
         mat4 modelMatrix;
@@ -248,39 +669,150 @@ int main (int argc, char *argv[])
         glm_translate(modelMatrix, auxTranslate);
         vec3 auxScale = {4.0f, 4.0f, 4.0f};
         glm_scale(modelMatrix, auxScale);
-        glUniformMatrix4fv(glGetUniformLocation(program, "model"), 1, GL_FALSE, (float *) modelMatrix);
+        glUniformMatrix4fv(programUniforms->model, 1, GL_FALSE, (float *) modelMatrix);
+        unsigned int scope = beginGpuScope(&gpuProfiler, "planet");
         drawModel(&planet, program);
+        endGpuScope(&gpuProfiler, scope);
+
+        // move the rocks along, cull the field and stream the surviving instances
+        float orbitTime = animate ? currentFrame - startTime : 0.0f;
+        unsigned int numVisibleRocks = amount;
+        unsigned int lodFirst[LOD_NUM_BUCKETS] = {0}, lodCount[LOD_NUM_BUCKETS] = {0};
+        LodSelector lodSelector;
+        Frustum frustum;
+        extractFrustum(projection, view, &frustum);
+        CompactInstance *ringInstances = mapInstanceRing(&rockRing);
+        if (frustumCull && !gpuCull) {
+            double orbitStart = displayTime(&display);
+            updateOrbitsParallel(updateOrbits, &rockOrbits, orbitTime, rockInstances, &rockBounds);
+            double cullStart = displayTime(&display);
+            orbitTimeTotal += cullStart - orbitStart;
+
+            OcclusionBuffer *occluders = NULL;
+            if (occlusion) {
+                rasterizeOccluders(&planetOcclusion, &planetOccluder, modelMatrix, view, projection);
+                occluders = &planetOcclusion;
+                occlusionTimeTotal += displayTime(&display) - cullStart;
+            }
+
+            DepthSort *sort = NULL;
+            if (depthSort) {
+                setDepthSortView(&rockSort, camera.cameraPos, camera.cameraFront, FAR_PLANE);
+                sort = &rockSort;
+            }
+
+            // the workers write the compacted instances straight into the mapped segment, bucketed by level
+            initLodSelector(&lodSelector, rock.lodErrors, rock.numLods, rockBoundsRadius, glm_rad(camera.fov),
+                viewportHeight, lodTolerance, impostors ? impostorPixels : 0.0f, camera.cameraPos);
+            numVisibleRocks = cullInstancesLodParallel(cullSpheres, &frustum, &rockBounds, &lodSelector, occluders, sort, rockInstances,
+                ringInstances, sizeof(CompactInstance), visibleRocks, rockLevels, cullChunkCounts,
+                lodChunkCounts, lodChunkOffsets, lodFirst, lodCount);
+            cullTimeTotal += displayTime(&display) - cullStart;
+            if (occlusion) {
+                occludedRocksTotal += atomic_load(&planetOcclusion.numOccluded);
+            }
+        }
+        else {
+            // every instance is read from the ring, no staging copy, and spheres only for the collisions
+            double orbitStart = displayTime(&display);
+            updateOrbitsParallel(updateOrbits, &rockOrbits, orbitTime, ringInstances, collide ? &rockBounds : NULL);
+            orbitTimeTotal += displayTime(&display) - orbitStart;
+            // without spheres there are no distances, everything is level 0
+            initLodSelector(&lodSelector, rock.lodErrors, 1, rockBoundsRadius, glm_rad(camera.fov),
+                viewportHeight, lodTolerance, 0.0f, camera.cameraPos);
+            lodCount[0] = amount;
+        }
+        unmapInstanceRing(&rockRing);
+        if (collide) {
+            // the camera moves out of the rocks it ran into before the next frame is drawn
+            double collisionStart = displayTime(&display);
+            buildCollisionGrid(&rockGrid, &rockBounds);
+            rockContactsTotal += findContacts(findSphereContacts, &rockGrid, &rockBounds);
+            vec3 push;
+            if (collideSphere(&rockGrid, camera.cameraPos, CAMERA_RADIUS, push) > 0) {
+                glm_vec3_add(camera.cameraPos, push, camera.cameraPos);
+            }
+            collisionTimeTotal += displayTime(&display) - collisionStart;
+        }
+        if (frustumCull && gpuCull) {
+            scope = beginGpuScope(&gpuProfiler, "gpu cull");
+            runGpuCull(&rockGpuCull, &frustum, rockRing.buffer, instanceRingOffset(&rockRing));
+            endGpuScope(&gpuProfiler, scope);
+        }
+        if (!(frustumCull && gpuCull)) {
+            // the GPU path never reads its count back, so only the CPU frames are counted
+            numCpuCulledFrames++;
+            visibleRocksTotal += numVisibleRocks;
+            rockFullTrianglesTotal += (double) numVisibleRocks * rock.lodTriangles[0];
+            rockImpostorsTotal += lodCount[LOD_BUCKET_FADE] + lodCount[LOD_BUCKET_IMPOSTOR];
+        }
 
         // draw meteorites
+        scope = beginGpuScope(&gpuProfiler, "rocks");
+        beginPipelineStats(&rockFragments);
         glUseProgram(asteroidsProgram);
-        glUniformMatrix4fv(glGetUniformLocation(asteroidsProgram, "view"), 1, GL_FALSE, (float *) view);
-        glUniformMatrix4fv(glGetUniformLocation(asteroidsProgram, "projection"), 1, GL_FALSE, (float *) projection);
-        glUniform1d(glGetUniformLocation(asteroidsProgram, "texture_diffuse1"), 0);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, rock.loadedTextures[0].id);
-        for (unsigned int i = 0; i < rock.numMeshes; i++) {
-            glBindVertexArray(rock.meshes[i].VAO);
-            glDrawElementsInstanced(
-                GL_TRIANGLES, rock.meshes[i].numIndices, GL_UNSIGNED_INT, 0, amount
-            );
-            glBindVertexArray(0);
+        glUniformMatrix4fv(asteroidsUniforms->view, 1, GL_FALSE, (float *) view);
+        glUniformMatrix4fv(asteroidsUniforms->projection, 1, GL_FALSE, (float *) projection);
+        glUniform3fv(asteroidsCameraPosLocation, 1, camera.cameraPos);
+        if (impostors) {
+            setImpostorView(&rockImpostors, view, projection, camera.cameraPos, lodSelector.impostorStart,
+                lodSelector.impostorEnd);
+        }
+        if (frustumCull && gpuCull) {
+            // the GPU path has no per instance levels, it draws everything at full detail
+            glUseProgram(asteroidsProgram);
+            glUniform2f(asteroidsFadeLocation, LOD_NO_IMPOSTORS, LOD_NO_IMPOSTORS * LOD_IMPOSTOR_FADE);
+            // texture_diffuse1 samples unit 0, see bindMaterialSamplers()
+            glActiveTexture(GL_TEXTURE0 + materialTextureUnit(TEXTURE_DIFFUSE, 0));
+            glBindTexture(GL_TEXTURE_2D, rock.meshes[0].textures[0].id);
+            bindGpuCulledInstances(&rockGpuCull);
+            for (unsigned int i = 0; i < rock.numMeshes; i++) {
+                glUniform3fv(asteroidsUniforms->positionScale, 1, rock.meshes[i].positionScale);
+                glUniform3fv(asteroidsUniforms->positionOffset, 1, rock.meshes[i].positionOffset);
+                drawGpuCulledMesh(&rockGpuCull, &rock.meshes[i], i);
+            }
+        }
+        else {
+            if (checkLod && numFrames == LOD_CHECK_FRAME) {
+                lodCheckPassed = checkLodDifference(&rockRenderer, instanceRingOffset(&rockRing), lodFirst, lodCount,
+                    &lodSelector, lodTolerance);
+                requestDisplayClose(&display);
+            }
+            rockTrianglesTotal += drawRocks(&rockRenderer, instanceRingOffset(&rockRing), lodFirst, lodCount, &lodSelector,
+                false);
         }
+        glBindVertexArray(0);
+        // the culling pass and the draws above are the last readers of the segment
+        fenceInstanceRing(&rockRing);
+        endPipelineStats(&rockFragments);
+        endGpuScope(&gpuProfiler, scope);
 
         // draw point light
+        scope = beginGpuScope(&gpuProfiler, "light cube");
         glUseProgram(lightProgram);
-        glUniformMatrix4fv(glGetUniformLocation(lightProgram, "view"), 1, GL_FALSE, (float *) view);
-        glUniformMatrix4fv(glGetUniformLocation(lightProgram, "projection"), 1, GL_FALSE, (float *) projection);
+        glUniformMatrix4fv(lightUniforms->view, 1, GL_FALSE, (float *) view);
+        glUniformMatrix4fv(lightUniforms->projection, 1, GL_FALSE, (float *) projection);
         glm_mat4_identity(modelMatrix);
         glm_translate(modelMatrix, lightPos);
         vec3 lightCubeSize = {0.2f, 0.2f, 0.2f};
         glm_scale(modelMatrix, lightCubeSize);
-        glUniformMatrix4fv(glGetUniformLocation(program, "model"), 1, GL_FALSE, (float *) modelMatrix);
+        glUniformMatrix4fv(lightUniforms->model, 1, GL_FALSE, (float *) modelMatrix);
 
         glBindVertexArray(lightCubeVAO);
         glDrawArrays(GL_TRIANGLES, 0, 36);
+        endGpuScope(&gpuProfiler, scope);
+
+        if (gpuProfiler.enabled) {
+            char profile[512];
+            formatGpuProfiler(&gpuProfiler, profile, sizeof(profile));
+            drawTextOverlay(&profileOverlay, profile, 8.0f, 8.0f, 2.0f, SCR_WIDTH, SCR_HEIGHT);
+        }
+        endGpuProfilerFrame(&gpuProfiler);
 
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+        if (benchmarkOutput) {
+            endFrameStats(&frameStats, displayTime(&display));
+        }
+        presentDisplay(&display);
     }
 
     //glDeleteVertexArrays(1, &cubeVAO);
@@ -289,7 +821,103 @@ int main (int argc, char *argv[])
     glDeleteProgram(program);
     glDeleteProgram(lightProgram);
 
-    glfwTerminate();
+    printTextureLoaderStats();
+    printTextureCacheStats();
+    printGeometryArenaStats();
+    printUniformQueryStats(numFrames);
+    printf("orbits: %u rocks updated with %s on %u threads %.3f ms per frame\n", amount, orbitKernel,
+        jobSystem.numThreads + 1, orbitTimeTotal * 1000.0 / (numFrames ? numFrames : 1));
+    if (collide) {
+        printf("collisions: %.0f rock contacts per frame, grid rebuild and %s query on %u threads %.3f ms per frame\n",
+            rockContactsTotal / (numFrames ? numFrames : 1), contactKernel, jobSystem.numThreads + 1,
+            collisionTimeTotal * 1000.0 / (numFrames ? numFrames : 1));
+    }
+    printInstanceRingStats(&rockRing);
+    printGpuProfilerStats(&gpuProfiler);
+    if (rockFragments.supported && rockFragments.numResults > 0) {
+        printf("rock fragments: %.0f shaded per frame, %s\n", rockFragments.fragmentsTotal / rockFragments.numResults,
+            depthSort && frustumCull && !gpuCull ? "sorted front to back" : "in index order");
+    }
+    if (numCpuCulledFrames > 0) {
+        printf("asteroids: %.0f of %u visible on average", (double) visibleRocksTotal / numCpuCulledFrames, amount);
+        if (frustumCull) {
+            printf(", %s cull and upload on %u threads %.3f ms per frame", cullKernel, jobSystem.numThreads + 1,
+                cullTimeTotal * 1000.0 / numCpuCulledFrames);
+        }
+        printf("\n");
+        if (occlusion && frustumCull) {
+            double occludedPerFrame = occludedRocksTotal / numCpuCulledFrames;
+            double inFrustumPerFrame = (double) visibleRocksTotal / numCpuCulledFrames + occludedPerFrame;
+            printf("occlusion: %.0f rocks per frame behind the planet, %.1f%% of those in the frustum, "
+                "%dx%d depth rasterized and reduced in %.3f ms per frame of the cull time\n", occludedPerFrame,
+                inFrustumPerFrame > 0.0 ? occludedPerFrame * 100.0 / inFrustumPerFrame : 0.0,
+                OCCLUSION_WIDTH, OCCLUSION_HEIGHT, occlusionTimeTotal * 1000.0 / numCpuCulledFrames);
+        }
+
+        // streamed through the ring by the CPU path and fetched once per rock mesh by the instanced draws
+        double visiblePerFrame = (double) visibleRocksTotal / numCpuCulledFrames;
+        double uploadBytes = visiblePerFrame * sizeof(CompactInstance);
+        double fetchBytes = visiblePerFrame * rock.numMeshes * sizeof(CompactInstance);
+        double scale = (double) sizeof(mat4) / sizeof(CompactInstance);
+        printf("instance data: %zu bytes per rock (%zu as mat4), %.2f MiB uploaded and %.2f MiB fetched per frame "
+            "(%.2f and %.2f MiB as mat4)\n", sizeof(CompactInstance), sizeof(mat4),
+            uploadBytes / 1048576.0, fetchBytes / 1048576.0, uploadBytes * scale / 1048576.0, fetchBytes * scale / 1048576.0);
+
+        printf("rock triangles: %.0f submitted per frame, %.0f at full detail (%.1f%%), %u levels at a %.2f pixel tolerance\n",
+            rockTrianglesTotal / numCpuCulledFrames, rockFullTrianglesTotal / numCpuCulledFrames,
+            rockFullTrianglesTotal > 0.0 ? rockTrianglesTotal * 100.0 / rockFullTrianglesTotal : 100.0,
+            rock.numLods, lodTolerance);
+        if (impostors) {
+            printf("rock impostors: %.0f quads per frame below %.1f pixels, %d views of %d pixels\n",
+                rockImpostorsTotal / numCpuCulledFrames, impostorPixels, IMPOSTOR_GRID * IMPOSTOR_GRID, IMPOSTOR_TILE);
+        }
+    }
+    for (int path = 0; path < 2; path++) {
+        if (numTimedFrames[path] > 0) {
+            printf("frames: %u, average frame time %.3f ms (%u rocks, %s vertices, %s culling)\n", numTimedFrames[path],
+                frameTimeTotal[path] * 1000.0 / numTimedFrames[path], amount, modelFlags & MODEL_PACK_VERTICES ? "packed" : "float",
+                !frustumCull ? "no" : path ? "GPU" : "CPU");
+        }
+    }
+
+    if (benchmarkOutput) {
+        char settings[256];
+        snprintf(settings, sizeof(settings), "\"rocks\": %u, \"seed\": %llu, \"culling\": \"%s\", "
+            "\"width\": %d, \"height\": %d, \"headless\": %s", amount, (unsigned long long) seed,
+            !frustumCull ? "none" : gpuCull ? "gpu" : "cpu", SCR_WIDTH, SCR_HEIGHT, display.headless ? "true" : "false");
+        writeFrameStatsJson(&frameStats, benchmarkOutput, "asteroids", settings);
+        freeFrameStats(&frameStats);
+    }
+
+    destroyGpuCull(&rockGpuCull);
+    destroyInstanceRing(&rockRing);
+    glDeleteVertexArrays(1, &rockVAO);
+    if (impostors) {
+        destroyImpostors(&rockImpostors);
+    }
+
+    free(rockInstances);
+    free(visibleRocks);
+    free(cullChunkCounts);
+    free(rockLevels);
+    free(lodChunkCounts);
+    free(lodChunkOffsets);
+    freeCollisionGrid(&rockGrid);
+    freeOcclusionBuffer(&planetOcclusion);
+    freeOccluderMesh(&planetOccluder);
+    freeDepthSort(&rockSort);
+    destroyPipelineStats(&rockFragments);
+    if (gpuProfiler.enabled) {
+        destroyTextOverlay(&profileOverlay);
+        glDeleteProgram(textProgram);
+    }
+    destroyGpuProfiler(&gpuProfiler);
+    freeSphereBounds(&rockBounds);
+    freeOrbits(&rockOrbits);
+
+    TRACE_WRITE(TRACE_OUTPUT);
+    closeDisplay(&display);
+    shutdownJobSystem();
 
-    return EXIT_SUCCESS;
+    return lodCheckPassed ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -0,0 +1,391 @@
+#ifndef _OCCLUSION_H_
+#define _OCCLUSION_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <math.h>
+#include <immintrin.h>
+
+#include <cglm/cglm.h>
+
+#include "jobs.h"
+
+// Software occlusion culling. A few large occluders are rasterized on the CPU
+// into a small depth buffer, which is reduced into a hierarchical Z pyramid
+// keeping the farthest depth of each texel. An instance is hidden when the
+// nearest depth of its bounding sphere is behind everything in its screen
+// rectangle, read from the pyramid level where the rectangle spans at most a
+// few texels.
+//
+// The triangles are binned into screen tiles and every tile is cleared and
+// rasterized by one job, four pixels at a time with SSE. Depths are NDC z,
+// which is affine in screen space, so each triangle interpolates it from one
+// plane. Occluder triangles crossing the near plane are dropped, dropping
+// occluders only ever keeps more instances.
+#define OCCLUSION_WIDTH 256    // 4:3 like the window, multiple of OCCLUSION_TILE_WIDTH
+#define OCCLUSION_HEIGHT 192
+#define OCCLUSION_TILE_WIDTH 64   // multiple of the 4 SSE lanes
+#define OCCLUSION_TILE_HEIGHT 32
+#define OCCLUSION_TILES_X (OCCLUSION_WIDTH / OCCLUSION_TILE_WIDTH)
+#define OCCLUSION_TILES_Y (OCCLUSION_HEIGHT / OCCLUSION_TILE_HEIGHT)
+#define OCCLUSION_MAX_LEVELS 10
+
+// Occluder triangles as three corners each, in model space
+typedef struct {
+    vec3 *corners;
+    unsigned int numTriangles;
+} OccluderMesh;
+
+static void subdivideOccluderTriangle(OccluderMesh *mesh, vec3 a, vec3 b, vec3 c, unsigned int depth)
+{
+    if (depth == 0) {
+        glm_vec3_copy(a, mesh->corners[mesh->numTriangles * 3]);
+        glm_vec3_copy(b, mesh->corners[mesh->numTriangles * 3 + 1]);
+        glm_vec3_copy(c, mesh->corners[mesh->numTriangles * 3 + 2]);
+        mesh->numTriangles++;
+        return;
+    }
+
+    vec3 ab, bc, ca;
+    glm_vec3_add(a, b, ab);
+    glm_vec3_add(b, c, bc);
+    glm_vec3_add(c, a, ca);
+    glm_vec3_normalize(ab);
+    glm_vec3_normalize(bc);
+    glm_vec3_normalize(ca);
+    subdivideOccluderTriangle(mesh, a, ab, ca, depth - 1);
+    subdivideOccluderTriangle(mesh, ab, b, bc, depth - 1);
+    subdivideOccluderTriangle(mesh, ca, bc, c, depth - 1);
+    subdivideOccluderTriangle(mesh, ab, bc, ca, depth - 1);
+}
+
+// Subdivided icosahedron with its corners on the sphere, so all of it lies
+// inside the sphere. 20 * 4^subdivisions triangles, counter clockwise from outside.
+void initOccluderSphere(OccluderMesh *mesh, vec3 center, float radius, unsigned int subdivisions)
+{
+    float t = (1.0f + sqrtf(5.0f)) * 0.5f;
+    vec3 corners[12] = {
+        {-1, t, 0}, {1, t, 0}, {-1, -t, 0}, {1, -t, 0},
+        {0, -1, t}, {0, 1, t}, {0, -1, -t}, {0, 1, -t},
+        {t, 0, -1}, {t, 0, 1}, {-t, 0, -1}, {-t, 0, 1},
+    };
+    unsigned int faces[20][3] = {
+        {0, 11, 5}, {0, 5, 1}, {0, 1, 7}, {0, 7, 10}, {0, 10, 11},
+        {1, 5, 9}, {5, 11, 4}, {11, 10, 2}, {10, 7, 6}, {7, 1, 8},
+        {3, 9, 4}, {3, 4, 2}, {3, 2, 6}, {3, 6, 8}, {3, 8, 9},
+        {4, 9, 5}, {2, 4, 11}, {6, 2, 10}, {8, 6, 7}, {9, 8, 1},
+    };
+    for (int i = 0; i < 12; i++) {
+        glm_vec3_normalize(corners[i]);
+    }
+
+    mesh->numTriangles = 0;
+    mesh->corners = malloc(20 * (1u << (2 * subdivisions)) * 3 * sizeof(vec3));
+    if (!mesh->corners) {
+        printf("ERROR::OCCLUSION::OUT_OF_MEMORY occluder\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int f = 0; f < 20; f++) {
+        subdivideOccluderTriangle(mesh, corners[faces[f][0]], corners[faces[f][1]], corners[faces[f][2]], subdivisions);
+    }
+    for (unsigned int i = 0; i < mesh->numTriangles * 3; i++) {
+        glm_vec3_scale(mesh->corners[i], radius, mesh->corners[i]);
+        glm_vec3_add(mesh->corners[i], center, mesh->corners[i]);
+    }
+}
+
+void freeOccluderMesh(OccluderMesh *mesh)
+{
+    free(mesh->corners);
+    memset(mesh, 0, sizeof(*mesh));
+}
+
+// A triangle in pixels with its depth plane and pixel bounds
+typedef struct {
+    float x[3], y[3];
+    float depthX, depthY, depth0;  // NDC z = depthX * x + depthY * y + depth0
+    int minX, minY, maxX, maxY;
+} OccluderTriangle;
+
+typedef struct {
+    float *depth;  // every level, row major from the bottom row
+    unsigned int levelOffset[OCCLUSION_MAX_LEVELS], levelWidth[OCCLUSION_MAX_LEVELS], levelHeight[OCCLUSION_MAX_LEVELS];
+    unsigned int numLevels;
+
+    OccluderTriangle *triangles;
+    unsigned int numTriangles, capacity;
+    unsigned int *tileTriangles;  // capacity entries per tile
+    unsigned int tileCounts[OCCLUSION_TILES_X * OCCLUSION_TILES_Y];
+
+    // the camera of the last rasterization
+    mat4 view;
+    float projectionX, projectionY, projectionZ, projectionW, near;
+
+    atomic_uint numOccluded;  // instances found hidden since the last rasterization
+} OcclusionBuffer;
+
+// Buffer for up to `capacity` occluder triangles
+void initOcclusionBuffer(OcclusionBuffer *buffer, unsigned int capacity)
+{
+    memset(buffer, 0, sizeof(*buffer));
+
+    unsigned int width = OCCLUSION_WIDTH, height = OCCLUSION_HEIGHT, size = 0;
+    while (buffer->numLevels < OCCLUSION_MAX_LEVELS) {
+        buffer->levelOffset[buffer->numLevels] = size;
+        buffer->levelWidth[buffer->numLevels] = width;
+        buffer->levelHeight[buffer->numLevels] = height;
+        buffer->numLevels++;
+        // rows of 4 floats keep level 0 aligned for SSE
+        size += (width * height + 3) & ~3u;
+        if (width == 1 && height == 1) {
+            break;
+        }
+        width = (width + 1) / 2;
+        height = (height + 1) / 2;
+    }
+
+    buffer->capacity = capacity;
+    buffer->depth = aligned_alloc(16, size * sizeof(float));
+    buffer->triangles = malloc((capacity ? capacity : 1) * sizeof(OccluderTriangle));
+    buffer->tileTriangles = malloc((capacity ? capacity : 1) * OCCLUSION_TILES_X * OCCLUSION_TILES_Y * sizeof(unsigned int));
+    if (!buffer->depth || !buffer->triangles || !buffer->tileTriangles) {
+        printf("ERROR::OCCLUSION::OUT_OF_MEMORY %u triangles\n", capacity);
+        exit(EXIT_FAILURE);
+    }
+}
+
+void freeOcclusionBuffer(OcclusionBuffer *buffer)
+{
+    free(buffer->depth);
+    free(buffer->triangles);
+    free(buffer->tileTriangles);
+    memset(buffer, 0, sizeof(*buffer));
+}
+
+// Clear one tile to the far plane and rasterize its triangles
+void rasterizeTileJob(void *data, unsigned int tile)
+{
+    OcclusionBuffer *buffer = data;
+    int tileX = tile % OCCLUSION_TILES_X * OCCLUSION_TILE_WIDTH;
+    int tileY = tile / OCCLUSION_TILES_X * OCCLUSION_TILE_HEIGHT;
+
+    __m128 far = _mm_set1_ps(1.0f);
+    for (int y = tileY; y < tileY + OCCLUSION_TILE_HEIGHT; y++) {
+        for (int x = tileX; x < tileX + OCCLUSION_TILE_WIDTH; x += 4) {
+            _mm_store_ps(buffer->depth + y * OCCLUSION_WIDTH + x, far);
+        }
+    }
+
+    const unsigned int *triangles = buffer->tileTriangles + tile * buffer->capacity;
+    __m128 laneOffsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+    for (unsigned int t = 0; t < buffer->tileCounts[tile]; t++) {
+        const OccluderTriangle *triangle = &buffer->triangles[triangles[t]];
+        int minX = triangle->minX > tileX ? triangle->minX & ~3 : tileX;
+        int maxX = triangle->maxX < tileX + OCCLUSION_TILE_WIDTH - 1 ? triangle->maxX : tileX + OCCLUSION_TILE_WIDTH - 1;
+        int minY = triangle->minY > tileY ? triangle->minY : tileY;
+        int maxY = triangle->maxY < tileY + OCCLUSION_TILE_HEIGHT - 1 ? triangle->maxY : tileY + OCCLUSION_TILE_HEIGHT - 1;
+
+        // edge k is inside where (x[k+1] - x[k]) * (py - y[k]) - (y[k+1] - y[k]) * (px - x[k]) >= 0
+        float stepX[3], rowOffset[3];
+        for (int k = 0; k < 3; k++) {
+            int next = (k + 1) % 3;
+            stepX[k] = -(triangle->y[next] - triangle->y[k]);
+            rowOffset[k] = (triangle->y[next] - triangle->y[k]) * triangle->x[k] - (triangle->x[next] - triangle->x[k]) * triangle->y[k];
+        }
+
+        for (int y = minY; y <= maxY; y++) {
+            float py = y + 0.5f;
+            __m128 edges[3], edgeSteps[3];
+            for (int k = 0; k < 3; k++) {
+                int next = (k + 1) % 3;
+                float row = rowOffset[k] + (triangle->x[next] - triangle->x[k]) * py;
+                edges[k] = _mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_set1_ps((float) minX), laneOffsets), _mm_set1_ps(stepX[k])),
+                    _mm_set1_ps(row));
+                edgeSteps[k] = _mm_set1_ps(stepX[k] * 4.0f);
+            }
+            __m128 depth = _mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_set1_ps((float) minX), laneOffsets),
+                _mm_set1_ps(triangle->depthX)), _mm_set1_ps(triangle->depthY * py + triangle->depth0));
+            __m128 depthStep = _mm_set1_ps(triangle->depthX * 4.0f);
+
+            float *row = buffer->depth + y * OCCLUSION_WIDTH;
+            for (int x = minX; x <= maxX; x += 4) {
+                __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(edges[0], _mm_setzero_ps()),
+                    _mm_cmpge_ps(edges[1], _mm_setzero_ps())), _mm_cmpge_ps(edges[2], _mm_setzero_ps()));
+                __m128 current = _mm_load_ps(row + x);
+                __m128 nearer = _mm_min_ps(current, depth);
+                _mm_store_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, current)));
+
+                for (int k = 0; k < 3; k++) {
+                    edges[k] = _mm_add_ps(edges[k], edgeSteps[k]);
+                }
+                depth = _mm_add_ps(depth, depthStep);
+            }
+        }
+    }
+}
+
+// Farthest depth of every 2x2 block of the level below
+void buildDepthPyramid(OcclusionBuffer *buffer)
+{
+    for (unsigned int level = 1; level < buffer->numLevels; level++) {
+        const float *source = buffer->depth + buffer->levelOffset[level - 1];
+        float *target = buffer->depth + buffer->levelOffset[level];
+        unsigned int sourceWidth = buffer->levelWidth[level - 1], sourceHeight = buffer->levelHeight[level - 1];
+
+        for (unsigned int y = 0; y < buffer->levelHeight[level]; y++) {
+            unsigned int y0 = 2 * y, y1 = 2 * y + 1 < sourceHeight ? 2 * y + 1 : 2 * y;
+            for (unsigned int x = 0; x < buffer->levelWidth[level]; x++) {
+                unsigned int x0 = 2 * x, x1 = 2 * x + 1 < sourceWidth ? 2 * x + 1 : 2 * x;
+                float a = fmaxf(source[y0 * sourceWidth + x0], source[y0 * sourceWidth + x1]);
+                float b = fmaxf(source[y1 * sourceWidth + x0], source[y1 * sourceWidth + x1]);
+                target[y * buffer->levelWidth[level] + x] = fmaxf(a, b);
+            }
+        }
+    }
+}
+
+// Rasterize `mesh` placed by `model` for the camera of `view` and the
+// perspective `projection`, then build the pyramid. Resets numOccluded.
+void rasterizeOccluders(OcclusionBuffer *buffer, const OccluderMesh *mesh, mat4 model, mat4 view, mat4 projection)
+{
+    mat4 modelView, transform;
+    glm_mat4_mul(view, model, modelView);
+    glm_mat4_mul(projection, modelView, transform);
+    glm_mat4_copy(view, buffer->view);
+    buffer->projectionX = projection[0][0];
+    buffer->projectionY = projection[1][1];
+    buffer->projectionZ = projection[2][2];
+    buffer->projectionW = projection[3][2];
+    buffer->near = buffer->projectionW / (buffer->projectionZ - 1.0f);
+    atomic_store_explicit(&buffer->numOccluded, 0, memory_order_relaxed);
+
+    buffer->numTriangles = 0;
+    memset(buffer->tileCounts, 0, sizeof(buffer->tileCounts));
+    unsigned int count = mesh->numTriangles < buffer->capacity ? mesh->numTriangles : buffer->capacity;
+    for (unsigned int i = 0; i < count; i++) {
+        OccluderTriangle *triangle = &buffer->triangles[buffer->numTriangles];
+        float z[3];
+        bool clipped = false;
+        for (int k = 0; k < 3; k++) {
+            vec4 corner = {mesh->corners[i * 3 + k][0], mesh->corners[i * 3 + k][1], mesh->corners[i * 3 + k][2], 1.0f}, clip;
+            glm_mat4_mulv(transform, corner, clip);
+            if (clip[3] <= buffer->near) {
+                clipped = true;
+                break;
+            }
+            triangle->x[k] = (clip[0] / clip[3] * 0.5f + 0.5f) * OCCLUSION_WIDTH;
+            triangle->y[k] = (clip[1] / clip[3] * 0.5f + 0.5f) * OCCLUSION_HEIGHT;
+            z[k] = clip[2] / clip[3];
+        }
+        if (clipped) {
+            continue;
+        }
+
+        // back faces and slivers cover nothing
+        float x1 = triangle->x[1] - triangle->x[0], y1 = triangle->y[1] - triangle->y[0];
+        float x2 = triangle->x[2] - triangle->x[0], y2 = triangle->y[2] - triangle->y[0];
+        float area = x1 * y2 - x2 * y1;
+        if (area <= 0.0f) {
+            continue;
+        }
+        float z1 = z[1] - z[0], z2 = z[2] - z[0];
+        triangle->depthX = (z1 * y2 - z2 * y1) / area;
+        triangle->depthY = (x1 * z2 - x2 * z1) / area;
+        triangle->depth0 = z[0] - triangle->depthX * triangle->x[0] - triangle->depthY * triangle->y[0];
+
+        float minX = fminf(triangle->x[0], fminf(triangle->x[1], triangle->x[2]));
+        float maxX = fmaxf(triangle->x[0], fmaxf(triangle->x[1], triangle->x[2]));
+        float minY = fminf(triangle->y[0], fminf(triangle->y[1], triangle->y[2]));
+        float maxY = fmaxf(triangle->y[0], fmaxf(triangle->y[1], triangle->y[2]));
+        triangle->minX = minX > 0.0f ? (int) minX : 0;
+        triangle->minY = minY > 0.0f ? (int) minY : 0;
+        triangle->maxX = maxX < OCCLUSION_WIDTH - 1 ? (int) maxX : OCCLUSION_WIDTH - 1;
+        triangle->maxY = maxY < OCCLUSION_HEIGHT - 1 ? (int) maxY : OCCLUSION_HEIGHT - 1;
+        if (triangle->minX > triangle->maxX || triangle->minY > triangle->maxY) {
+            continue;
+        }
+
+        for (int ty = triangle->minY / OCCLUSION_TILE_HEIGHT; ty <= triangle->maxY / OCCLUSION_TILE_HEIGHT; ty++) {
+            for (int tx = triangle->minX / OCCLUSION_TILE_WIDTH; tx <= triangle->maxX / OCCLUSION_TILE_WIDTH; tx++) {
+                unsigned int tile = ty * OCCLUSION_TILES_X + tx;
+                buffer->tileTriangles[tile * buffer->capacity + buffer->tileCounts[tile]++] = buffer->numTriangles;
+            }
+        }
+        buffer->numTriangles++;
+    }
+
+    parallelFor(OCCLUSION_TILES_X * OCCLUSION_TILES_Y, rasterizeTileJob, buffer);
+    buildDepthPyramid(buffer);
+}
+
+// Whether the world space sphere is hidden behind the occluders. The screen
+// rectangle bounds the view space box around the sphere, which is cheaper
+// than the exact ellipse and never smaller.
+static inline bool isSphereOccluded(const OcclusionBuffer *buffer, float x, float y, float z, float radius)
+{
+    const vec4 *view = buffer->view;
+    float viewX = view[0][0] * x + view[1][0] * y + view[2][0] * z + view[3][0];
+    float viewY = view[0][1] * x + view[1][1] * y + view[2][1] * z + view[3][1];
+    float viewZ = view[0][2] * x + view[1][2] * y + view[2][2] * z + view[3][2];
+
+    float nearest = -viewZ - radius, farthest = -viewZ + radius;
+    if (nearest <= buffer->near) {
+        return false;
+    }
+
+    float minX = buffer->projectionX * fminf((viewX - radius) / nearest, (viewX - radius) / farthest);
+    float maxX = buffer->projectionX * fmaxf((viewX + radius) / nearest, (viewX + radius) / farthest);
+    float minY = buffer->projectionY * fminf((viewY - radius) / nearest, (viewY - radius) / farthest);
+    float maxY = buffer->projectionY * fmaxf((viewY + radius) / nearest, (viewY + radius) / farthest);
+    int x0 = (int) floorf((minX * 0.5f + 0.5f) * OCCLUSION_WIDTH);
+    int x1 = (int) floorf((maxX * 0.5f + 0.5f) * OCCLUSION_WIDTH);
+    int y0 = (int) floorf((minY * 0.5f + 0.5f) * OCCLUSION_HEIGHT);
+    int y1 = (int) floorf((maxY * 0.5f + 0.5f) * OCCLUSION_HEIGHT);
+    if (x1 < 0 || y1 < 0 || x0 >= OCCLUSION_WIDTH || y0 >= OCCLUSION_HEIGHT) {
+        return false;
+    }
+    x0 = x0 > 0 ? x0 : 0;
+    y0 = y0 > 0 ? y0 : 0;
+    x1 = x1 < OCCLUSION_WIDTH - 1 ? x1 : OCCLUSION_WIDTH - 1;
+    y1 = y1 < OCCLUSION_HEIGHT - 1 ? y1 : OCCLUSION_HEIGHT - 1;
+
+    // the level where the rectangle covers at most 2x2 texels, or 3 where it straddles a boundary
+    unsigned int size = (unsigned int) (x1 - x0 > y1 - y0 ? x1 - x0 : y1 - y0);
+    unsigned int level = 0;
+    while (level + 1 < buffer->numLevels && size >> level > 1) {
+        level++;
+    }
+
+    float nearestDepth = (buffer->projectionZ * -nearest + buffer->projectionW) / nearest;
+    const float *depth = buffer->depth + buffer->levelOffset[level];
+    unsigned int width = buffer->levelWidth[level];
+    for (int ty = y0 >> level; ty <= y1 >> level; ty++) {
+        for (int tx = x0 >> level; tx <= x1 >> level; tx++) {
+            if (depth[ty * width + tx] >= nearestDepth) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Drop the hidden spheres from a list of visible ones, keeping the order.
+// Returns how many are left.
+unsigned int cullOccludedSpheres(OcclusionBuffer *buffer, const float *x, const float *y, const float *z,
+    const float *radius, unsigned int *visible, unsigned int count)
+{
+    unsigned int numVisible = 0;
+    for (unsigned int i = 0; i < count; i++) {
+        unsigned int s = visible[i];
+        if (!isSphereOccluded(buffer, x[s], y[s], z[s], radius[s])) {
+            visible[numVisible++] = s;
+        }
+    }
+    atomic_fetch_add_explicit(&buffer->numOccluded, count - numVisible, memory_order_relaxed);
+    return numVisible;
+}
+
+#endif // _OCCLUSION_H_
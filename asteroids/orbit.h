@@ -0,0 +1,334 @@
+#ifndef _ORBIT_H_
+#define _ORBIT_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <immintrin.h>
+
+#include <cglm/cglm.h>
+
+#include "jobs.h"
+#include "vertex_packing.h"
+#include "instance_format.h"
+#include "frustum_cull.h"
+
+// Circular orbits in the xz plane plus a spin around one shared axis, stored
+// as structure of arrays. Every frame the kernels below turn them into
+// CompactInstance records and move the cull spheres along.
+typedef struct {
+    float *radius, *angle, *angularSpeed, *height;  // orbit, angle at t = 0
+    float *scale;
+    float *spin, *spinSpeed;                        // around spinAxis, angle at t = 0
+    unsigned int count, capacity;
+    vec3 spinAxis;                                  // normalized
+} Orbits;
+
+#define ORBIT_LANES 8
+#define ORBIT_ALIGNMENT 32
+
+void initOrbits(Orbits *orbits, unsigned int count, vec3 spinAxis)
+{
+    orbits->count = count;
+    orbits->capacity = (count + ORBIT_LANES - 1) / ORBIT_LANES * ORBIT_LANES;
+    if (orbits->capacity == 0) {
+        orbits->capacity = ORBIT_LANES;
+    }
+    glm_vec3_normalize_to(spinAxis, orbits->spinAxis);
+
+    float **arrays[] = {&orbits->radius, &orbits->angle, &orbits->angularSpeed, &orbits->height,
+        &orbits->scale, &orbits->spin, &orbits->spinSpeed};
+    for (unsigned int a = 0; a < sizeof(arrays) / sizeof(arrays[0]); a++) {
+        *arrays[a] = aligned_alloc(ORBIT_ALIGNMENT, orbits->capacity * sizeof(float));
+        if (!*arrays[a]) {
+            printf("ERROR::ORBIT::OUT_OF_MEMORY %u orbits\n", count);
+            exit(EXIT_FAILURE);
+        }
+        memset(*arrays[a], 0, orbits->capacity * sizeof(float));
+    }
+}
+
+// Orbit through `position` at t = 0, `angularSpeed` and `spinSpeed` in radians per second
+void setOrbit(Orbits *orbits, unsigned int i, vec3 position, float scale, float spin,
+    float angularSpeed, float spinSpeed)
+{
+    orbits->radius[i] = sqrtf(position[0] * position[0] + position[2] * position[2]);
+    orbits->angle[i] = atan2f(position[0], position[2]);
+    orbits->angularSpeed[i] = angularSpeed;
+    orbits->height[i] = position[1];
+    orbits->scale[i] = scale;
+    orbits->spin[i] = spin;
+    orbits->spinSpeed[i] = spinSpeed;
+}
+
+void freeOrbits(Orbits *orbits)
+{
+    free(orbits->radius);
+    free(orbits->angle);
+    free(orbits->angularSpeed);
+    free(orbits->height);
+    free(orbits->scale);
+    free(orbits->spin);
+    free(orbits->spinSpeed);
+    memset(orbits, 0, sizeof(*orbits));
+}
+
+// An update kernel writes instances [first, end) at time `t` to `instances`
+// (indexed from 0 at `first`) and, when `bounds` is not NULL, moves the centers
+// of their spheres. `first` must be a multiple of ORBIT_LANES.
+typedef void (*OrbitFunction)(const Orbits *orbits, float t, unsigned int first, unsigned int end,
+    CompactInstance *instances, SphereBounds *bounds);
+
+void updateOrbitScalar(const Orbits *orbits, float t, unsigned int i, CompactInstance *instance, SphereBounds *bounds)
+{
+    float angle = orbits->angle[i] + orbits->angularSpeed[i] * t;
+    float halfSpin = 0.5f * (orbits->spin[i] + orbits->spinSpeed[i] * t);
+    float s = sinf(halfSpin);
+
+    instance->position[0] = sinf(angle) * orbits->radius[i];
+    instance->position[1] = orbits->height[i];
+    instance->position[2] = cosf(angle) * orbits->radius[i];
+    instance->scale = orbits->scale[i];
+    for (int c = 0; c < 3; c++) {
+        instance->rotation[c] = packSnorm16(orbits->spinAxis[c] * s);
+    }
+    instance->rotation[3] = packSnorm16(cosf(halfSpin));
+
+    if (bounds) {
+        bounds->x[i] = instance->position[0];
+        bounds->y[i] = instance->position[1];
+        bounds->z[i] = instance->position[2];
+    }
+}
+
+void updateOrbitsScalar(const Orbits *orbits, float t, unsigned int first, unsigned int end,
+    CompactInstance *instances, SphereBounds *bounds)
+{
+    for (unsigned int i = first; i < end; i++) {
+        updateOrbitScalar(orbits, t, i, &instances[i - first], bounds);
+    }
+}
+
+// Cephes style single precision sin and cos: reduce by multiples of pi/2, a
+// polynomial on [-pi/4, pi/4], then pick and negate by quadrant. pi/2 is split
+// in three parts, the first two short enough that multiples of them are exact,
+// which keeps the reduction good for the few thousand radians the orbits reach.
+#define ORBIT_2_OVER_PI 0.636619772f
+#define ORBIT_PI_2_A 1.5703125f
+#define ORBIT_PI_2_B 4.837512969970703125e-4f
+#define ORBIT_PI_2_C 7.54978995489188216e-8f
+#define ORBIT_SIN_1 -1.6666654611e-1f
+#define ORBIT_SIN_2 8.3321608736e-3f
+#define ORBIT_SIN_3 -1.9515295891e-4f
+#define ORBIT_COS_1 4.166664568298827e-2f
+#define ORBIT_COS_2 -1.388731625493765e-3f
+#define ORBIT_COS_3 2.443315711809948e-5f
+
+void sinCos4(__m128 x, __m128 *sine, __m128 *cosine)
+{
+    __m128i quadrant = _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(ORBIT_2_OVER_PI)));
+    __m128 j = _mm_cvtepi32_ps(quadrant);
+    __m128 r = _mm_sub_ps(x, _mm_mul_ps(j, _mm_set1_ps(ORBIT_PI_2_A)));
+    r = _mm_sub_ps(r, _mm_mul_ps(j, _mm_set1_ps(ORBIT_PI_2_B)));
+    r = _mm_sub_ps(r, _mm_mul_ps(j, _mm_set1_ps(ORBIT_PI_2_C)));
+    __m128 r2 = _mm_mul_ps(r, r);
+
+    __m128 s = _mm_add_ps(_mm_set1_ps(ORBIT_SIN_2), _mm_mul_ps(r2, _mm_set1_ps(ORBIT_SIN_3)));
+    s = _mm_add_ps(_mm_set1_ps(ORBIT_SIN_1), _mm_mul_ps(r2, s));
+    s = _mm_add_ps(r, _mm_mul_ps(_mm_mul_ps(r, r2), s));
+
+    __m128 c = _mm_add_ps(_mm_set1_ps(ORBIT_COS_2), _mm_mul_ps(r2, _mm_set1_ps(ORBIT_COS_3)));
+    c = _mm_add_ps(_mm_set1_ps(ORBIT_COS_1), _mm_mul_ps(r2, c));
+    c = _mm_add_ps(_mm_sub_ps(_mm_set1_ps(1.0f), _mm_mul_ps(_mm_set1_ps(0.5f), r2)), _mm_mul_ps(_mm_mul_ps(r2, r2), c));
+
+    // odd quadrants swap sin and cos, quadrants 2-3 negate sin, 1-2 negate cos
+    __m128 swap = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(quadrant, _mm_set1_epi32(1)), _mm_set1_epi32(1)));
+    __m128 sinSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(quadrant, _mm_set1_epi32(2)), 30));
+    __m128 cosSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(_mm_add_epi32(quadrant, _mm_set1_epi32(1)), _mm_set1_epi32(2)), 30));
+
+    *sine = _mm_xor_ps(_mm_or_ps(_mm_and_ps(swap, c), _mm_andnot_ps(swap, s)), sinSign);
+    *cosine = _mm_xor_ps(_mm_or_ps(_mm_and_ps(swap, s), _mm_andnot_ps(swap, c)), cosSign);
+}
+
+// Four instances from SoA registers to CompactInstance records. Inlined so the
+// AVX2 kernel gets a VEX encoded copy, calling legacy SSE code from it with
+// dirty upper halves costs a state transition every time.
+static inline __attribute__((always_inline))
+void storeInstances4(CompactInstance *out, __m128 x, __m128 y, __m128 z, __m128 scale,
+    __m128 qx, __m128 qy, __m128 qz, __m128 qw)
+{
+    _MM_TRANSPOSE4_PS(x, y, z, scale);
+    _mm_storeu_ps(out[0].position, x);
+    _mm_storeu_ps(out[1].position, y);
+    _mm_storeu_ps(out[2].position, z);
+    _mm_storeu_ps(out[3].position, scale);
+
+    // round to nearest like packSnorm16(), the inputs are already in [-1, 1]
+    __m128 snorm = _mm_set1_ps(32767.0f);
+    _MM_TRANSPOSE4_PS(qx, qy, qz, qw);
+    __m128i rotation01 = _mm_packs_epi32(_mm_cvtps_epi32(_mm_mul_ps(qx, snorm)), _mm_cvtps_epi32(_mm_mul_ps(qy, snorm)));
+    __m128i rotation23 = _mm_packs_epi32(_mm_cvtps_epi32(_mm_mul_ps(qz, snorm)), _mm_cvtps_epi32(_mm_mul_ps(qw, snorm)));
+    _mm_storel_epi64((__m128i *) out[0].rotation, rotation01);
+    _mm_storel_epi64((__m128i *) out[1].rotation, _mm_unpackhi_epi64(rotation01, rotation01));
+    _mm_storel_epi64((__m128i *) out[2].rotation, rotation23);
+    _mm_storel_epi64((__m128i *) out[3].rotation, _mm_unpackhi_epi64(rotation23, rotation23));
+}
+
+void updateOrbitsSSE(const Orbits *orbits, float t, unsigned int first, unsigned int end,
+    CompactInstance *instances, SphereBounds *bounds)
+{
+    __m128 time = _mm_set1_ps(t);
+    __m128 axisX = _mm_set1_ps(orbits->spinAxis[0]);
+    __m128 axisY = _mm_set1_ps(orbits->spinAxis[1]);
+    __m128 axisZ = _mm_set1_ps(orbits->spinAxis[2]);
+
+    unsigned int i = first;
+    for (; i + 4 <= end; i += 4) {
+        __m128 angle = _mm_add_ps(_mm_load_ps(orbits->angle + i), _mm_mul_ps(_mm_load_ps(orbits->angularSpeed + i), time));
+        __m128 halfSpin = _mm_mul_ps(_mm_set1_ps(0.5f),
+            _mm_add_ps(_mm_load_ps(orbits->spin + i), _mm_mul_ps(_mm_load_ps(orbits->spinSpeed + i), time)));
+
+        __m128 s, c, spinSin, spinCos;
+        sinCos4(angle, &s, &c);
+        sinCos4(halfSpin, &spinSin, &spinCos);
+
+        __m128 radius = _mm_load_ps(orbits->radius + i);
+        __m128 x = _mm_mul_ps(s, radius);
+        __m128 y = _mm_load_ps(orbits->height + i);
+        __m128 z = _mm_mul_ps(c, radius);
+
+        if (bounds) {
+            _mm_store_ps(bounds->x + i, x);
+            _mm_store_ps(bounds->y + i, y);
+            _mm_store_ps(bounds->z + i, z);
+        }
+        storeInstances4(&instances[i - first], x, y, z, _mm_load_ps(orbits->scale + i),
+            _mm_mul_ps(axisX, spinSin), _mm_mul_ps(axisY, spinSin), _mm_mul_ps(axisZ, spinSin), spinCos);
+    }
+
+    for (; i < end; i++) {
+        updateOrbitScalar(orbits, t, i, &instances[i - first], bounds);
+    }
+}
+
+__attribute__((target("avx2")))
+void sinCos8(__m256 x, __m256 *sine, __m256 *cosine)
+{
+    __m256i quadrant = _mm256_cvtps_epi32(_mm256_mul_ps(x, _mm256_set1_ps(ORBIT_2_OVER_PI)));
+    __m256 j = _mm256_cvtepi32_ps(quadrant);
+    __m256 r = _mm256_sub_ps(x, _mm256_mul_ps(j, _mm256_set1_ps(ORBIT_PI_2_A)));
+    r = _mm256_sub_ps(r, _mm256_mul_ps(j, _mm256_set1_ps(ORBIT_PI_2_B)));
+    r = _mm256_sub_ps(r, _mm256_mul_ps(j, _mm256_set1_ps(ORBIT_PI_2_C)));
+    __m256 r2 = _mm256_mul_ps(r, r);
+
+    __m256 s = _mm256_add_ps(_mm256_set1_ps(ORBIT_SIN_2), _mm256_mul_ps(r2, _mm256_set1_ps(ORBIT_SIN_3)));
+    s = _mm256_add_ps(_mm256_set1_ps(ORBIT_SIN_1), _mm256_mul_ps(r2, s));
+    s = _mm256_add_ps(r, _mm256_mul_ps(_mm256_mul_ps(r, r2), s));
+
+    __m256 c = _mm256_add_ps(_mm256_set1_ps(ORBIT_COS_2), _mm256_mul_ps(r2, _mm256_set1_ps(ORBIT_COS_3)));
+    c = _mm256_add_ps(_mm256_set1_ps(ORBIT_COS_1), _mm256_mul_ps(r2, c));
+    c = _mm256_add_ps(_mm256_sub_ps(_mm256_set1_ps(1.0f), _mm256_mul_ps(_mm256_set1_ps(0.5f), r2)), _mm256_mul_ps(_mm256_mul_ps(r2, r2), c));
+
+    __m256 swap = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(quadrant, _mm256_set1_epi32(1)), _mm256_set1_epi32(1)));
+    __m256 sinSign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(quadrant, _mm256_set1_epi32(2)), 30));
+    __m256 cosSign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(_mm256_add_epi32(quadrant, _mm256_set1_epi32(1)), _mm256_set1_epi32(2)), 30));
+
+    *sine = _mm256_xor_ps(_mm256_blendv_ps(s, c, swap), sinSign);
+    *cosine = _mm256_xor_ps(_mm256_blendv_ps(c, s, swap), cosSign);
+}
+
+__attribute__((target("avx2")))
+void updateOrbitsAVX2(const Orbits *orbits, float t, unsigned int first, unsigned int end,
+    CompactInstance *instances, SphereBounds *bounds)
+{
+    __m256 time = _mm256_set1_ps(t);
+    __m256 axisX = _mm256_set1_ps(orbits->spinAxis[0]);
+    __m256 axisY = _mm256_set1_ps(orbits->spinAxis[1]);
+    __m256 axisZ = _mm256_set1_ps(orbits->spinAxis[2]);
+
+    unsigned int i = first;
+    for (; i + 8 <= end; i += 8) {
+        __m256 angle = _mm256_add_ps(_mm256_load_ps(orbits->angle + i), _mm256_mul_ps(_mm256_load_ps(orbits->angularSpeed + i), time));
+        __m256 halfSpin = _mm256_mul_ps(_mm256_set1_ps(0.5f),
+            _mm256_add_ps(_mm256_load_ps(orbits->spin + i), _mm256_mul_ps(_mm256_load_ps(orbits->spinSpeed + i), time)));
+
+        __m256 s, c, spinSin, spinCos;
+        sinCos8(angle, &s, &c);
+        sinCos8(halfSpin, &spinSin, &spinCos);
+
+        __m256 radius = _mm256_load_ps(orbits->radius + i);
+        __m256 x = _mm256_mul_ps(s, radius);
+        __m256 y = _mm256_load_ps(orbits->height + i);
+        __m256 z = _mm256_mul_ps(c, radius);
+        __m256 scale = _mm256_load_ps(orbits->scale + i);
+        __m256 qx = _mm256_mul_ps(axisX, spinSin);
+        __m256 qy = _mm256_mul_ps(axisY, spinSin);
+        __m256 qz = _mm256_mul_ps(axisZ, spinSin);
+
+        if (bounds) {
+            _mm256_store_ps(bounds->x + i, x);
+            _mm256_store_ps(bounds->y + i, y);
+            _mm256_store_ps(bounds->z + i, z);
+        }
+
+        // the AoS records are written four at a time
+        for (int half = 0; half < 2; half++) {
+            #define ORBIT_HALF(v) (half ? _mm256_extractf128_ps((v), 1) : _mm256_castps256_ps128(v))
+            storeInstances4(&instances[i - first + 4 * half], ORBIT_HALF(x), ORBIT_HALF(y), ORBIT_HALF(z), ORBIT_HALF(scale),
+                ORBIT_HALF(qx), ORBIT_HALF(qy), ORBIT_HALF(qz), ORBIT_HALF(spinCos));
+            #undef ORBIT_HALF
+        }
+    }
+
+    for (; i < end; i++) {
+        updateOrbitScalar(orbits, t, i, &instances[i - first], bounds);
+    }
+}
+
+OrbitFunction selectOrbitFunction(const char **name)
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        *name = "avx2";
+        return updateOrbitsAVX2;
+    }
+    *name = "sse";
+    return updateOrbitsSSE;
+}
+
+// Parallel update in chunks of ORBIT_CHUNK_SIZE instances on the job system
+#define ORBIT_CHUNK_SIZE 16384  // multiple of ORBIT_LANES
+
+typedef struct {
+    OrbitFunction update;
+    const Orbits *orbits;
+    float t;
+    CompactInstance *instances;
+    SphereBounds *bounds;
+} ParallelOrbits;
+
+void updateOrbitsJob(void *data, unsigned int chunk)
+{
+    ParallelOrbits *job = data;
+    unsigned int first = chunk * ORBIT_CHUNK_SIZE;
+    unsigned int end = first + ORBIT_CHUNK_SIZE < job->orbits->count ? first + ORBIT_CHUNK_SIZE : job->orbits->count;
+
+    job->update(job->orbits, job->t, first, end, job->instances + first, job->bounds);
+}
+
+void updateOrbitsParallel(OrbitFunction update, const Orbits *orbits, float t,
+    CompactInstance *instances, SphereBounds *bounds)
+{
+    ParallelOrbits job = {
+        .update = update,
+        .orbits = orbits,
+        .t = t,
+        .instances = instances,
+        .bounds = bounds,
+    };
+
+    parallelFor((orbits->count + ORBIT_CHUNK_SIZE - 1) / ORBIT_CHUNK_SIZE, updateOrbitsJob, &job);
+}
+
+#endif // _ORBIT_H_
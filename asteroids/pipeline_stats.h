@@ -0,0 +1,74 @@
+#ifndef _PIPELINE_STATS_H_
+#define _PIPELINE_STATS_H_
+
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include <glad/glad.h>
+
+#include "gpu_cull.h"
+
+// Fragment shader invocations of a span of draws, counted with pipeline
+// statistics queries (GL 4.6 or ARB_pipeline_statistics_query). A query is
+// read back PIPELINE_STATS_LATENCY frames after it was issued, when the GPU
+// is long done with it, so the counts never stall the frame.
+#ifndef GL_FRAGMENT_SHADER_INVOCATIONS_ARB
+#define GL_FRAGMENT_SHADER_INVOCATIONS_ARB 0x82F4
+#endif
+
+#define PIPELINE_STATS_LATENCY 3
+
+typedef struct {
+    bool supported;
+    unsigned int queries[PIPELINE_STATS_LATENCY];
+    unsigned int next, numPending;
+
+    double fragmentsTotal;
+    unsigned int numResults;
+} PipelineStats;
+
+void initPipelineStats(PipelineStats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->supported = hasGLVersion(4, 6) || hasGLExtension("GL_ARB_pipeline_statistics_query");
+    if (stats->supported) {
+        glGenQueries(PIPELINE_STATS_LATENCY, stats->queries);
+    }
+}
+
+void beginPipelineStats(PipelineStats *stats)
+{
+    if (!stats->supported) {
+        return;
+    }
+    // the oldest query reuses its object, collect it first
+    if (stats->numPending == PIPELINE_STATS_LATENCY) {
+        GLuint64 fragments = 0;
+        glGetQueryObjectui64v(stats->queries[stats->next], GL_QUERY_RESULT, &fragments);
+        stats->fragmentsTotal += fragments;
+        stats->numResults++;
+        stats->numPending--;
+    }
+    glBeginQuery(GL_FRAGMENT_SHADER_INVOCATIONS_ARB, stats->queries[stats->next]);
+}
+
+void endPipelineStats(PipelineStats *stats)
+{
+    if (!stats->supported) {
+        return;
+    }
+    glEndQuery(GL_FRAGMENT_SHADER_INVOCATIONS_ARB);
+    stats->next = (stats->next + 1) % PIPELINE_STATS_LATENCY;
+    stats->numPending++;
+}
+
+void destroyPipelineStats(PipelineStats *stats)
+{
+    if (stats->supported) {
+        glDeleteQueries(PIPELINE_STATS_LATENCY, stats->queries);
+    }
+    memset(stats, 0, sizeof(*stats));
+}
+
+#endif // _PIPELINE_STATS_H_
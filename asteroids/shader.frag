@@ -5,7 +5,22 @@ in vec2 TexCoords;
 
 uniform sampler2D texture_diffuse1;
 
+#ifdef IMPOSTOR_FADE
+flat in float Fade;
+
+// screen door threshold, impostor.frag keeps exactly the pixels dropped here
+float dither()
+{
+    return fract(52.9829189 * fract(dot(gl_FragCoord.xy, vec2(0.06711056, 0.00583715))));
+}
+#endif
+
 void main()
 {
+#ifdef IMPOSTOR_FADE
+    if (dither() < Fade) {
+        discard;
+    }
+#endif
     FragColor = texture(texture_diffuse1, TexCoords);
 }
\ No newline at end of file
@@ -11,9 +11,18 @@ uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 
+#ifdef PACKED_VERTICES
+// positions are quantized to the mesh bounds, see packMeshVertices()
+uniform vec3 positionScale;
+uniform vec3 positionOffset;
+#define POSITION (aPos * positionScale + positionOffset)
+#else
+#define POSITION aPos
+#endif
+
 void main()
 {
-    FragPos = vec3(model * vec4(aPos, 1.0));
+    FragPos = vec3(model * vec4(POSITION, 1.0));
     Normal = mat3(transpose(inverse(model))) * aNormal;
     TexCoords = aTexCoords;
 
@@ -0,0 +1,174 @@
+#ifndef _TEXTURE_CACHE_H_
+#define _TEXTURE_CACHE_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <limits.h>
+
+#include <glad/glad.h>
+
+#include "hash.h"
+#include "texture_loader.h"
+
+// Process-wide texture cache shared by every model. A texture is looked up by
+// the hash of its path; on a miss the canonical path is tried too, so the same
+// image reached through another path still maps to a single GL texture. A hash
+// match only counts when the stored path is the same string. The file itself is only ever read by the decode job. Entries are refcounted and
+// the GL texture is deleted when the last reference is released.
+// Only used from the GL thread.
+
+typedef struct {
+    unsigned int id;
+    unsigned int refCount;
+    char *canonicalPath;
+    char **aliases;  // other requested spellings of the path
+    unsigned int numAliases;
+} TextureRecord;
+
+typedef struct {
+    TextureRecord *records;
+    unsigned int numRecords, capacity;
+    unsigned int *freeRecords;  // slots of released textures, reused first
+    unsigned int numFreeRecords;
+
+    HashMap byPath;  // path hash (as requested and canonical) -> record, colliding paths kept apart
+    HashMap byId;    // GL texture name -> record
+
+    unsigned int (*load)(const char *path);  // loadTextureAsync() when NULL
+    unsigned int hits, misses;
+} TextureCache;
+
+TextureCache textureCache;
+
+bool textureHasPath(const TextureRecord *entry, const char *path)
+{
+    if (strcmp(entry->canonicalPath, path) == 0) {
+        return true;
+    }
+    for (unsigned int i = 0; i < entry->numAliases; i++) {
+        if (strcmp(entry->aliases[i], path) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool findTexture(const char *path, unsigned int *record)
+{
+    unsigned int position = 0;
+    uint64_t hash = hashString(path);
+    while (hashMapNext(&textureCache.byPath, hash, &position, record)) {
+        if (textureHasPath(&textureCache.records[*record], path)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void freeTextureRecordPaths(TextureRecord *entry)
+{
+    free(entry->canonicalPath);
+    for (unsigned int i = 0; i < entry->numAliases; i++) {
+        free(entry->aliases[i]);
+    }
+    free(entry->aliases);
+}
+
+unsigned int addTexture(const char *canonicalPath, unsigned int id)
+{
+    unsigned int record;
+
+    if (textureCache.numFreeRecords > 0) {
+        record = textureCache.freeRecords[--textureCache.numFreeRecords];
+    }
+    else {
+        if (textureCache.numRecords == textureCache.capacity) {
+            textureCache.capacity = textureCache.capacity ? textureCache.capacity * 2 : 64;
+            textureCache.records = realloc(textureCache.records, textureCache.capacity * sizeof(TextureRecord));
+            textureCache.freeRecords = realloc(textureCache.freeRecords, textureCache.capacity * sizeof(unsigned int));
+        }
+        record = textureCache.numRecords++;
+    }
+
+    TextureRecord entry = {
+        .id = id,
+        .refCount = 0,
+        .canonicalPath = strdup(canonicalPath),
+    };
+    textureCache.records[record] = entry;
+
+    hashMapAdd(&textureCache.byPath, hashString(canonicalPath), record);
+    hashMapPut(&textureCache.byId, id, record);
+
+    return record;
+}
+
+// Get a reference to the texture at `path`, loading it on first use
+unsigned int acquireTexture(const char *path)
+{
+    unsigned int record;
+
+    if (findTexture(path, &record)) {
+        textureCache.hits++;
+    }
+    else {
+        textureCache.misses++;
+
+        char canonicalPath[PATH_MAX];
+        if (!realpath(path, canonicalPath)) {
+            snprintf(canonicalPath, sizeof(canonicalPath), "%s", path); // let the loader report it
+        }
+
+        // the same file through a different path shares the texture
+        if (!findTexture(canonicalPath, &record)) {
+            unsigned int id = textureCache.load ? textureCache.load(canonicalPath) : loadTextureAsync(canonicalPath);
+            record = addTexture(canonicalPath, id);
+        }
+
+        // remember the requested spelling so the next lookup is a single probe
+        TextureRecord *entry = &textureCache.records[record];
+        if (!textureHasPath(entry, path)) {
+            entry->aliases = realloc(entry->aliases, (entry->numAliases + 1) * sizeof(char *));
+            entry->aliases[entry->numAliases++] = strdup(path);
+            hashMapAdd(&textureCache.byPath, hashString(path), record);
+        }
+    }
+
+    textureCache.records[record].refCount++;
+
+    return textureCache.records[record].id;
+}
+
+void releaseTexture(unsigned int id)
+{
+    unsigned int record;
+    if (!hashMapGet(&textureCache.byId, id, &record)) {
+        return;
+    }
+
+    TextureRecord *entry = &textureCache.records[record];
+    if (--entry->refCount > 0) {
+        return;
+    }
+
+    // pending uploads still reference the texture name
+    finishTextureUploads();
+    glDeleteTextures(1, &entry->id);
+
+    hashMapRemoveValue(&textureCache.byPath, record);
+    hashMapRemoveValue(&textureCache.byId, record);
+    freeTextureRecordPaths(entry);
+    memset(entry, 0, sizeof(*entry));
+    textureCache.freeRecords[textureCache.numFreeRecords++] = record;
+}
+
+void printTextureCacheStats()
+{
+    unsigned int live = textureCache.numRecords - textureCache.numFreeRecords;
+
+    printf("texture cache: %u textures, %u hits, %u misses\n", live, textureCache.hits, textureCache.misses);
+}
+
+#endif // _TEXTURE_CACHE_H_
@@ -0,0 +1,75 @@
+#ifndef _VERTEX_FORMAT_H_
+#define _VERTEX_FORMAT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <glad/glad.h>
+#include <cglm/cglm.h>
+
+typedef struct {
+    vec3 position;
+    vec3 normal;
+    vec2 texCoords;
+} Vertex;
+
+// 16 byte GPU layout of VERTEX_FORMAT_PACKED, built from Vertex at upload time
+typedef struct {
+    uint16_t position[4];   // unorm16 inside the mesh bounds, w is padding
+    uint32_t normal;        // snorm 10:10:10:2
+    uint16_t texCoords[2];  // half float
+} PackedVertex;
+
+typedef enum {
+    VERTEX_FORMAT_FLOAT,   // Vertex as is, 32 bytes
+    VERTEX_FORMAT_PACKED,  // PackedVertex, needs a shader built with PACKED_VERTICES
+    VERTEX_FORMAT_COUNT,
+} VertexFormat;
+
+#define PACKED_VERTICES_DEFINE "#define PACKED_VERTICES\n"
+
+size_t vertexFormatSize(VertexFormat format)
+{
+    return format == VERTEX_FORMAT_PACKED ? sizeof(PackedVertex) : sizeof(Vertex);
+}
+
+size_t indexTypeSize(GLenum type)
+{
+    return type == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(unsigned int);
+}
+
+// Smallest index type for the mesh. GL_UNSIGNED_BYTE is left out on purpose,
+// several drivers convert byte indices on the CPU at draw time.
+GLenum chooseIndexType(unsigned int numVertices)
+{
+    return numVertices <= 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+}
+
+// Point attributes 0-2 of the bound VAO at the bound GL_ARRAY_BUFFER
+void setupVertexAttributes(VertexFormat format)
+{
+    if (format == VERTEX_FORMAT_PACKED) {
+        // vertex positions
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedVertex), (void *) 0);
+        // vertex normals
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(PackedVertex), (void *) offsetof(PackedVertex, normal));
+        // vertex texture coords
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedVertex), (void *) offsetof(PackedVertex, texCoords));
+    }
+    else {
+        // vertex positions
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *) 0);
+        // vertex normals
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *) offsetof(Vertex, normal));
+        // vertex texture coords
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *) offsetof(Vertex, texCoords));
+    }
+}
+
+#endif // _VERTEX_FORMAT_H_
@@ -0,0 +1,256 @@
+#ifndef _DISPLAY_H_
+#define _DISPLAY_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+// keep Xlib out, its Display would clash and the headless path needs no X11
+#define EGL_NO_X11
+#define MESA_EGL_NO_X11_HEADERS
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+// Where the frames go. By default a GLFW window; with --headless an EGL
+// context without any window system (surfaceless, or a pbuffer where that is
+// missing) that renders into a framebuffer object and stops after a fixed
+// number of frames. Mesa's llvmpipe runs it on machines without display or GPU.
+#define HEADLESS_FRAMES 300
+#define DISPLAY_USAGE "[--headless] [--frames N]"
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+typedef struct {
+    bool headless;
+    unsigned int numFrames;  // stop after this many, 0 runs until the window closes
+} DisplayOptions;
+
+typedef struct {
+    GLFWwindow *window;  // NULL when headless
+    bool headless;
+    bool shouldClose;
+    int width, height;
+    unsigned int numFrames, frameLimit;
+    struct timespec start;
+
+    EGLDisplay eglDisplay;
+    EGLContext context;
+    EGLSurface surface;  // EGL_NO_SURFACE when surfaceless
+    GLuint framebuffer, colorBuffer, depthBuffer;
+} DisplayBackend;
+
+// Consume argv[*i] if it is a display option, returns whether it was one
+bool parseDisplayOption(DisplayOptions *options, int argc, char *argv[], int *i)
+{
+    if (strcmp(argv[*i], "--headless") == 0) {
+        options->headless = true;
+    }
+    else if (strcmp(argv[*i], "--frames") == 0 && *i + 1 < argc) {
+        options->numFrames = strtoul(argv[++*i], NULL, 10);
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+// Seconds since the display was opened
+double displayTime(const DisplayBackend *display)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) (now.tv_sec - display->start.tv_sec) + (now.tv_nsec - display->start.tv_nsec) * 1e-9;
+}
+
+static bool hasEGLExtension(const char *extensions, const char *name)
+{
+    size_t length = strlen(name);
+    for (const char *at = extensions; at && (at = strstr(at, name)) != NULL; at += length) {
+        if ((at == extensions || at[-1] == ' ') && (at[length] == ' ' || at[length] == '\0')) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void openHeadlessDisplay(DisplayBackend *display)
+{
+    // the surfaceless platform needs neither X11 nor a DRM device
+    const char *clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+    display->eglDisplay = EGL_NO_DISPLAY;
+    if (getPlatformDisplay && hasEGLExtension(clientExtensions, "EGL_MESA_platform_surfaceless")) {
+        display->eglDisplay = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    }
+    if (display->eglDisplay == EGL_NO_DISPLAY) {
+        display->eglDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    }
+    if (display->eglDisplay == EGL_NO_DISPLAY || !eglInitialize(display->eglDisplay, NULL, NULL)) {
+        printf("Failed to initialize EGL\n");
+        exit(EXIT_FAILURE);
+    }
+
+    const EGLint configAttributes[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE,
+    };
+    EGLConfig config;
+    EGLint numConfigs = 0;
+    if (!eglChooseConfig(display->eglDisplay, configAttributes, &config, 1, &numConfigs) || numConfigs == 0 ||
+        !eglBindAPI(EGL_OPENGL_API)) {
+        printf("Failed to find an EGL config for desktop OpenGL\n");
+        exit(EXIT_FAILURE);
+    }
+
+    const EGLint contextAttributes[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 3,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE,
+    };
+    display->context = eglCreateContext(display->eglDisplay, config, EGL_NO_CONTEXT, contextAttributes);
+    if (display->context == EGL_NO_CONTEXT) {
+        printf("Failed to create EGL context\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // the frames go to the framebuffer object either way, the pbuffer only makes the context current
+    display->surface = EGL_NO_SURFACE;
+    if (!hasEGLExtension(eglQueryString(display->eglDisplay, EGL_EXTENSIONS), "EGL_KHR_surfaceless_context")) {
+        const EGLint surfaceAttributes[] = {EGL_WIDTH, display->width, EGL_HEIGHT, display->height, EGL_NONE};
+        display->surface = eglCreatePbufferSurface(display->eglDisplay, config, surfaceAttributes);
+    }
+    if (!eglMakeCurrent(display->eglDisplay, display->surface, display->surface, display->context)) {
+        printf("Failed to make the EGL context current\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (!gladLoadGLLoader((GLADloadproc) eglGetProcAddress)) {
+        printf("Failed to initialize GLAD\n");
+        exit(EXIT_FAILURE);
+    }
+
+    glGenFramebuffers(1, &display->framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, display->framebuffer);
+    glGenRenderbuffers(1, &display->colorBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, display->colorBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, display->width, display->height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, display->colorBuffer);
+    glGenRenderbuffers(1, &display->depthBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, display->depthBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, display->width, display->height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, display->depthBuffer);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        printf("ERROR::DISPLAY::FRAMEBUFFER_INCOMPLETE\n");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("headless: %dx%d on %s, %u frames\n", display->width, display->height,
+        (const char *) glGetString(GL_RENDERER), display->frameLimit);
+}
+
+static void openWindowDisplay(DisplayBackend *display)
+{
+    if (glfwInit() == GLFW_FALSE) {
+        printf("Failed to initialize GLFW\n");
+        exit(EXIT_FAILURE);
+    }
+
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+
+    display->window = glfwCreateWindow(display->width, display->height, "LearnOpenGL", NULL, NULL);
+    if (display->window == NULL) {
+        printf("Failed to create GLFW window\n");
+        glfwTerminate();
+        exit(EXIT_FAILURE);
+    }
+    glfwMakeContextCurrent(display->window);
+
+    if (!gladLoadGLLoader((GLADloadproc) glfwGetProcAddress)) {
+        printf("Failed to initialize GLAD\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Create the context, load GL and set the viewport. The window callbacks are left to the caller.
+void openDisplay(DisplayBackend *display, const DisplayOptions *options, int width, int height)
+{
+    memset(display, 0, sizeof(*display));
+    display->headless = options->headless;
+    display->width = width;
+    display->height = height;
+    display->frameLimit = options->numFrames ? options->numFrames : options->headless ? HEADLESS_FRAMES : 0;
+
+    if (display->headless) {
+        openHeadlessDisplay(display);
+    }
+    else {
+        openWindowDisplay(display);
+    }
+
+    glViewport(0, 0, width, height);
+    clock_gettime(CLOCK_MONOTONIC, &display->start);
+}
+
+bool displayShouldClose(const DisplayBackend *display)
+{
+    if (display->shouldClose || (display->frameLimit && display->numFrames >= display->frameLimit)) {
+        return true;
+    }
+    return display->window && glfwWindowShouldClose(display->window);
+}
+
+void requestDisplayClose(DisplayBackend *display)
+{
+    display->shouldClose = true;
+    if (display->window) {
+        glfwSetWindowShouldClose(display->window, GLFW_TRUE);
+    }
+}
+
+// End the frame: swap and poll the window, or when headless wait for the GPU
+// in place of the swap so that the frame times include its work
+void presentDisplay(DisplayBackend *display)
+{
+    display->numFrames++;
+    if (display->window) {
+        glfwSwapBuffers(display->window);
+        glfwPollEvents();
+    }
+    else {
+        glFinish();
+    }
+}
+
+void closeDisplay(DisplayBackend *display)
+{
+    if (display->headless) {
+        double seconds = displayTime(display);
+        printf("headless: %u frames in %.3f s, %.3f ms per frame\n", display->numFrames, seconds,
+            display->numFrames ? seconds * 1000.0 / display->numFrames : 0.0);
+        glDeleteRenderbuffers(1, &display->colorBuffer);
+        glDeleteRenderbuffers(1, &display->depthBuffer);
+        glDeleteFramebuffers(1, &display->framebuffer);
+        eglMakeCurrent(display->eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if (display->surface != EGL_NO_SURFACE) {
+            eglDestroySurface(display->eglDisplay, display->surface);
+        }
+        eglDestroyContext(display->eglDisplay, display->context);
+        eglTerminate(display->eglDisplay);
+    }
+    else {
+        glfwTerminate();
+    }
+}
+
+#endif // _DISPLAY_H_
@@ -10,14 +10,20 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
+#include "display.h"
+#include "trace.h"
+
 #define SCR_WIDTH 800
 #define SCR_HEIGHT 600
 
+DisplayBackend display;
+
 vec3 cameraPos = {0.0f, 0.0f, 3.0f};
 vec3 cameraFront = {0.0f, 0.0f, -1.0f};
 vec3 cameraUp = {0.0f, 1.0f, 0.0f};
 
 bool firstMouse = true;
+bool traceKeyDown = false;
 float yaw   = -90.0f; // yaw is initialized to -90.0 degrees since a yaw of 0.0 results in a direction vector pointing to the right so we initially rotate a bit to the left.
 float pitch =  0.0f;
 float lastX = SCR_WIDTH / 2, lastY = SCR_HEIGHT / 2;
@@ -38,6 +44,7 @@ void framebuffer_size_callback (GLFWwindow* window, int width, int height)
 
 void processInput (GLFWwindow *window)
 {
+    TRACE_FUNCTION();
     float cameraSpeed = 2.5f * deltaTime;
     vec3 tmp, tmp2;
 
@@ -61,6 +68,11 @@ void processInput (GLFWwindow *window)
         glm_vec3_scale(tmp, cameraSpeed, tmp2);
         glm_vec3_add(cameraPos, tmp2, cameraPos);
     }
+    bool f12KeyDown = TRACE_ENABLED && glfwGetKey(window, GLFW_KEY_F12) == GLFW_PRESS;
+    if (f12KeyDown && !traceKeyDown) {
+        TRACE_WRITE(TRACE_OUTPUT);
+    }
+    traceKeyDown = f12KeyDown;
     if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS) {
         glfwSetWindowShouldClose(window, GLFW_TRUE);
     }
@@ -107,39 +119,20 @@ void scroll_callback (GLFWwindow* window, double xoffset, double yoffset)
     }
 }
 
-GLFWwindow* createWindow ()
+GLFWwindow* createWindow (const DisplayOptions *options)
 {
     glfwSetErrorCallback(error_callback);
+    openDisplay(&display, options, SCR_WIDTH, SCR_HEIGHT);
 
-    if (glfwInit() == GLFW_FALSE) {
-        printf("Failed to initialize GLFW\n");
-        exit(EXIT_FAILURE);
-    }
-
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-
-    GLFWwindow* window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "LearnOpenGL", NULL, NULL);
-    if (window == NULL) {
-        printf("Failed to create GLFW window\n");
-        glfwTerminate();
-        exit(EXIT_FAILURE);
-    }
-    glfwMakeContextCurrent(window);
+    GLFWwindow *window = display.window;
+    if (window) {
+        glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
 
-    if (!gladLoadGLLoader((GLADloadproc) glfwGetProcAddress)) {
-        printf("Failed to initialize GLAD\n");
-        exit(EXIT_FAILURE);
+        glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+        glfwSetCursorPosCallback(window, mouse_callback);
+        glfwSetScrollCallback(window, scroll_callback);
     }
 
-    glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
-    glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
-
-    glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
-    glfwSetCursorPosCallback(window, mouse_callback);
-    glfwSetScrollCallback(window, scroll_callback);
-
     return window;
 }
 
@@ -189,6 +182,7 @@ unsigned int createShader (const char *shaderPath, GLuint shaderType)
 
 unsigned int createProgram (const char *vertexShaderPath, const char *fragmentShaderPath)
 {
+    TRACE_FUNCTION();
     char infoLog[512];
     int success;
 
@@ -243,7 +237,16 @@ unsigned int createTexture (const char *imagePath)
 
 int main (int argc, char *argv[])
 {
-    GLFWwindow *window = createWindow();
+    DisplayOptions displayOptions = {0};
+    for (int i = 1; i < argc; i++) {
+        if (!parseDisplayOption(&displayOptions, argc, argv, &i)) {
+            printf("Unknown option %s\n", argv[i]);
+            printf("Usage: %s %s\n", argv[0], DISPLAY_USAGE);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    GLFWwindow *window = createWindow(&displayOptions);
 
     unsigned int shaderProgram = createProgram("getting_started/shader.vert", "getting_started/shader.frag");
 
@@ -364,13 +367,16 @@ int main (int argc, char *argv[])
 
     glEnable(GL_DEPTH_TEST);
 
-    while (!glfwWindowShouldClose(window))
+    while (!displayShouldClose(&display))
     {
-        float currentFrame = glfwGetTime();
+        TRACE_SCOPE("frame");
+        float currentFrame = displayTime(&display);
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
 
-        processInput(window);
+        if (window) {
+            processInput(window);
+        }
 
         glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -408,8 +414,7 @@ int main (int argc, char *argv[])
             glDrawArrays(GL_TRIANGLES, 0, 36);
         }
 
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+        presentDisplay(&display);
     }
 
     glDeleteVertexArrays(1, &VAO);
@@ -417,7 +422,8 @@ int main (int argc, char *argv[])
     glDeleteBuffers(1, &EBO);
     glDeleteProgram(shaderProgram);
 
-    glfwTerminate();
+    TRACE_WRITE(TRACE_OUTPUT);
+    closeDisplay(&display);
 
     return EXIT_SUCCESS;
 }
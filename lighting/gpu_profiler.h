@@ -0,0 +1,238 @@
+#ifndef _GPU_PROFILER_H_
+#define _GPU_PROFILER_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include <glad/glad.h>
+
+// GPU time of named scopes (the passes of a frame). Every scope is a pair of
+// GL_TIMESTAMP queries, so scopes may nest and a GL_TIME_ELAPSED query can
+// run around them. The queries of a frame are read back
+// GPU_PROFILER_LATENCY frames later, when the GPU is long done with them, so
+// profiling never stalls the pipeline. Averages are over the last
+// GPU_PROFILER_WINDOW frames.
+#define GPU_PROFILER_MAX_SCOPES 16   // distinct names
+#define GPU_PROFILER_MAX_SPANS 32    // scopes entered per frame
+#define GPU_PROFILER_LATENCY 4
+#define GPU_PROFILER_WINDOW 64
+#define GPU_PROFILER_NO_SPAN ((unsigned int) -1)
+#define GPU_PROFILER_USAGE "[--profile-gpu] [--profile-csv FILE]"
+
+typedef struct {
+    bool enabled;
+    const char *csvPath;  // NULL for no CSV
+} GpuProfilerOptions;
+
+typedef struct {
+    const char *name;
+    double frameTime;  // ms, summed over the spans of the frame being collected
+    double window[GPU_PROFILER_WINDOW];
+    double windowSum;
+    double total;
+    unsigned int numSamples;
+} GpuScope;
+
+typedef struct {
+    GLuint queries[GPU_PROFILER_MAX_SPANS * 2];  // begin and end per span
+    unsigned char scopes[GPU_PROFILER_MAX_SPANS];
+    unsigned int numSpans;
+    unsigned long frameNumber;
+} GpuProfilerFrame;
+
+typedef struct {
+    bool enabled;
+    GpuScope scopes[GPU_PROFILER_MAX_SCOPES];
+    unsigned int numScopes;
+
+    GpuProfilerFrame frames[GPU_PROFILER_LATENCY];
+    unsigned int current, numPending;
+    unsigned long frameNumber;
+    unsigned int numFrames;  // collected
+
+    FILE *csv;
+} GpuProfiler;
+
+// Consume argv[*i] if it is a profiler option, returns whether it was one
+bool parseGpuProfilerOption(GpuProfilerOptions *options, int argc, char *argv[], int *i)
+{
+    if (strcmp(argv[*i], "--profile-gpu") == 0) {
+        options->enabled = true;
+    }
+    else if (strcmp(argv[*i], "--profile-csv") == 0 && *i + 1 < argc) {
+        options->enabled = true;
+        options->csvPath = argv[++*i];
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+void initGpuProfiler(GpuProfiler *profiler, const GpuProfilerOptions *options)
+{
+    memset(profiler, 0, sizeof(*profiler));
+    profiler->enabled = options->enabled;
+    if (!profiler->enabled) {
+        return;
+    }
+    for (unsigned int i = 0; i < GPU_PROFILER_LATENCY; i++) {
+        glGenQueries(GPU_PROFILER_MAX_SPANS * 2, profiler->frames[i].queries);
+    }
+    if (options->csvPath) {
+        profiler->csv = fopen(options->csvPath, "w");
+        if (!profiler->csv) {
+            printf("ERROR::GPU_PROFILER::CANNOT_WRITE %s\n", options->csvPath);
+            exit(EXIT_FAILURE);
+        }
+        fprintf(profiler->csv, "frame,scope,gpu_ms\n");
+    }
+}
+
+static void collectGpuProfilerFrame(GpuProfiler *profiler)
+{
+    unsigned int oldest = (profiler->current + GPU_PROFILER_LATENCY - profiler->numPending) % GPU_PROFILER_LATENCY;
+    GpuProfilerFrame *frame = &profiler->frames[oldest];
+
+    for (unsigned int i = 0; i < frame->numSpans; i++) {
+        GLuint64 begin = 0, end = 0;
+        glGetQueryObjectui64v(frame->queries[i * 2], GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(frame->queries[i * 2 + 1], GL_QUERY_RESULT, &end);
+        profiler->scopes[frame->scopes[i]].frameTime += end > begin ? (end - begin) * 1e-6 : 0.0;
+    }
+
+    // a scope that was not entered took no time that frame
+    unsigned int slot = profiler->numFrames % GPU_PROFILER_WINDOW;
+    for (unsigned int s = 0; s < profiler->numScopes; s++) {
+        GpuScope *scope = &profiler->scopes[s];
+        if (profiler->numFrames >= GPU_PROFILER_WINDOW) {
+            scope->windowSum -= scope->window[slot];
+        }
+        scope->window[slot] = scope->frameTime;
+        scope->windowSum += scope->frameTime;
+        scope->total += scope->frameTime;
+        scope->numSamples++;
+        if (profiler->csv) {
+            fprintf(profiler->csv, "%lu,%s,%.4f\n", frame->frameNumber, scope->name, scope->frameTime);
+        }
+        scope->frameTime = 0.0;
+    }
+    profiler->numFrames++;
+    profiler->numPending--;
+}
+
+void beginGpuProfilerFrame(GpuProfiler *profiler)
+{
+    if (!profiler->enabled) {
+        return;
+    }
+    if (profiler->numPending == GPU_PROFILER_LATENCY) {
+        collectGpuProfilerFrame(profiler);
+    }
+    profiler->frames[profiler->current].numSpans = 0;
+    profiler->frames[profiler->current].frameNumber = profiler->frameNumber;
+}
+
+void endGpuProfilerFrame(GpuProfiler *profiler)
+{
+    if (!profiler->enabled) {
+        return;
+    }
+    profiler->current = (profiler->current + 1) % GPU_PROFILER_LATENCY;
+    profiler->numPending++;
+    profiler->frameNumber++;
+}
+
+// Start timing `name`, a string that outlives the profiler. Returns the span to pass to endGpuScope().
+unsigned int beginGpuScope(GpuProfiler *profiler, const char *name)
+{
+    GpuProfilerFrame *frame = &profiler->frames[profiler->current];
+    if (!profiler->enabled || frame->numSpans == GPU_PROFILER_MAX_SPANS) {
+        return GPU_PROFILER_NO_SPAN;
+    }
+
+    unsigned int scope = 0;
+    while (scope < profiler->numScopes && strcmp(profiler->scopes[scope].name, name) != 0) {
+        scope++;
+    }
+    if (scope == profiler->numScopes) {
+        if (scope == GPU_PROFILER_MAX_SCOPES) {
+            return GPU_PROFILER_NO_SPAN;
+        }
+        profiler->scopes[scope].name = name;
+        profiler->numScopes++;
+    }
+
+    unsigned int span = frame->numSpans++;
+    frame->scopes[span] = scope;
+    glQueryCounter(frame->queries[span * 2], GL_TIMESTAMP);
+    return span;
+}
+
+void endGpuScope(GpuProfiler *profiler, unsigned int span)
+{
+    if (span == GPU_PROFILER_NO_SPAN) {
+        return;
+    }
+    glQueryCounter(profiler->frames[profiler->current].queries[span * 2 + 1], GL_TIMESTAMP);
+}
+
+// Milliseconds per frame of scope `s` over the last GPU_PROFILER_WINDOW frames
+double gpuScopeAverage(const GpuProfiler *profiler, unsigned int s)
+{
+    const GpuScope *scope = &profiler->scopes[s];
+    unsigned int count = scope->numSamples < GPU_PROFILER_WINDOW ? scope->numSamples : GPU_PROFILER_WINDOW;
+    return count ? scope->windowSum / count : 0.0;
+}
+
+// One line per scope with its rolling average, for the overlay
+void formatGpuProfiler(const GpuProfiler *profiler, char *text, size_t size)
+{
+    size_t length = snprintf(text, size, "GPU ms, last %d frames\n", GPU_PROFILER_WINDOW);
+    double sum = 0.0;
+    for (unsigned int s = 0; s < profiler->numScopes && length < size; s++) {
+        double average = gpuScopeAverage(profiler, s);
+        sum += average;
+        length += snprintf(text + length, size - length, "%-12s %7.3f\n", profiler->scopes[s].name, average);
+    }
+    if (length < size) {
+        snprintf(text + length, size - length, "%-12s %7.3f\n", "total", sum);
+    }
+}
+
+// Collect the frames still in flight, then print the average of every scope over the whole run
+void printGpuProfilerStats(GpuProfiler *profiler)
+{
+    if (!profiler->enabled) {
+        return;
+    }
+    while (profiler->numPending > 0) {
+        collectGpuProfilerFrame(profiler);
+    }
+    if (profiler->numFrames == 0) {
+        return;
+    }
+    printf("gpu profile:");
+    for (unsigned int s = 0; s < profiler->numScopes; s++) {
+        const GpuScope *scope = &profiler->scopes[s];
+        printf("%s %s %.3f ms", s ? "," : "", scope->name, scope->total / (scope->numSamples ? scope->numSamples : 1));
+    }
+    printf(" per frame over %u frames\n", profiler->numFrames);
+}
+
+void destroyGpuProfiler(GpuProfiler *profiler)
+{
+    if (profiler->enabled) {
+        for (unsigned int i = 0; i < GPU_PROFILER_LATENCY; i++) {
+            glDeleteQueries(GPU_PROFILER_MAX_SPANS * 2, profiler->frames[i].queries);
+        }
+        if (profiler->csv) {
+            fclose(profiler->csv);
+        }
+    }
+    memset(profiler, 0, sizeof(*profiler));
+}
+
+#endif // _GPU_PROFILER_H_
@@ -10,14 +10,25 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
+#include "jobs.h"
+#include "texture_loader.h"
+#include "shader.h"
+#include "display.h"
+#include "trace.h"
+#include "gpu_profiler.h"
+#include "text_overlay.h"
+
 #define SCR_WIDTH 800
 #define SCR_HEIGHT 600
 
+DisplayBackend display;
+
 vec3 cameraPos = {0.0f, 0.0f, 3.0f};
 vec3 cameraFront = {0.0f, 0.0f, -1.0f};
 vec3 cameraUp = {0.0f, 1.0f, 0.0f};
 
 bool firstMouse = true;
+bool traceKeyDown = false;
 float yaw   = -90.0f; // yaw is initialized to -90.0 degrees since a yaw of 0.0 results in a direction vector pointing to the right so we initially rotate a bit to the left.
 float pitch =  0.0f;
 float lastX = SCR_WIDTH / 2, lastY = SCR_HEIGHT / 2;
@@ -40,6 +51,7 @@ void framebuffer_size_callback (GLFWwindow* window, int width, int height)
 
 void processInput (GLFWwindow *window)
 {
+    TRACE_FUNCTION();
     float cameraSpeed = 2.5f * deltaTime;
     vec3 tmp, tmp2;
 
@@ -63,6 +75,11 @@ void processInput (GLFWwindow *window)
         glm_vec3_scale(tmp, cameraSpeed, tmp2);
         glm_vec3_add(cameraPos, tmp2, cameraPos);
     }
+    bool f12KeyDown = TRACE_ENABLED && glfwGetKey(window, GLFW_KEY_F12) == GLFW_PRESS;
+    if (f12KeyDown && !traceKeyDown) {
+        TRACE_WRITE(TRACE_OUTPUT);
+    }
+    traceKeyDown = f12KeyDown;
     if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS) {
         glfwSetWindowShouldClose(window, GLFW_TRUE);
     }
@@ -109,157 +126,79 @@ void scroll_callback (GLFWwindow* window, double xoffset, double yoffset)
     }
 }
 
-GLFWwindow* createWindow ()
+GLFWwindow* createWindow (const DisplayOptions *options)
 {
     glfwSetErrorCallback(error_callback);
+    openDisplay(&display, options, SCR_WIDTH, SCR_HEIGHT);
 
-    if (glfwInit() == GLFW_FALSE) {
-        printf("Failed to initialize GLFW\n");
-        exit(EXIT_FAILURE);
-    }
-
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-
-    GLFWwindow* window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "LearnOpenGL", NULL, NULL);
-    if (window == NULL) {
-        printf("Failed to create GLFW window\n");
-        glfwTerminate();
-        exit(EXIT_FAILURE);
-    }
-    glfwMakeContextCurrent(window);
+    GLFWwindow *window = display.window;
+    if (window) {
+        glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
 
-    if (!gladLoadGLLoader((GLADloadproc) glfwGetProcAddress)) {
-        printf("Failed to initialize GLAD\n");
-        exit(EXIT_FAILURE);
+        glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+        glfwSetCursorPosCallback(window, mouse_callback);
+        glfwSetScrollCallback(window, scroll_callback);
     }
 
-    glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
-    glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
-
-    glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
-    glfwSetCursorPosCallback(window, mouse_callback);
-    glfwSetScrollCallback(window, scroll_callback);
-
     return window;
 }
 
-char * read_file (const char *path)
-{
-    FILE *f = fopen(path, "r");
-    if (!f) {
-        printf("Error opening file %s\n", path);
-        exit(EXIT_FAILURE);
-    }
-
-    fseek(f, 0, SEEK_END);
-    long length = ftell(f);
-    fseek(f, 0, SEEK_SET);
-
-    char *buffer = malloc(length + 1);
-    size_t read = fread(buffer, 1, length, f);
-    fclose(f);
+// Locations of the members of one light struct in lighting.frag, -1 for members
+// the light type does not have
+typedef struct {
+    GLint position, direction;
+    GLint ambient, diffuse, specular;
+    GLint constant, linear, quadratic;
+    GLint cutOff, outerCutOff;
+} LightUniforms;
 
-    buffer[read] = '\0';
-
-    return buffer;
-}
-
-unsigned int createShader (const char *shaderPath, GLuint shaderType)
+GLint lightMemberLocation (unsigned int program, const char *light, const char *member)
 {
-    char infoLog[512];
-    int success;
-
-    unsigned int shader = glCreateShader(shaderType);
-    const char *shaderSource = read_file(shaderPath);
-
-    glShaderSource(shader, 1, &shaderSource, NULL);
-    glCompileShader(shader);
-
-    glGetProgramiv(shader, GL_COMPILE_STATUS, &success);
-    if (!success) {
-        glGetShaderInfoLog(shader, sizeof(infoLog), NULL, infoLog);
-        printf("ERROR::SHADER::COMPILATION_FAILED\n%s\n%s\n", shaderPath, infoLog);
-        exit(EXIT_FAILURE);
-    }
-
-    free((void *) shaderSource);
-
-    return shader;
+    char name[128];
+    snprintf(name, sizeof(name), "%s.%s", light, member);
+    return uniformLocation(program, name);
 }
 
-unsigned int createProgram (const char *vertexShaderPath, const char *fragmentShaderPath)
+LightUniforms getLightUniforms (unsigned int program, const char *light)
 {
-    char infoLog[512];
-    int success;
-
-    unsigned int vertexShader = createShader(vertexShaderPath, GL_VERTEX_SHADER);
-    unsigned int fragmentShader = createShader(fragmentShaderPath, GL_FRAGMENT_SHADER);
-
-    unsigned int shaderProgram = glCreateProgram();
-    glAttachShader(shaderProgram, vertexShader);
-    glAttachShader(shaderProgram, fragmentShader);
-    glLinkProgram(shaderProgram);
-
-    glGetProgramiv(shaderProgram, GL_LINK_STATUS, &success);
-    if (!success) {
-        glGetProgramInfoLog(shaderProgram, sizeof(infoLog), NULL, infoLog);
-        printf("ERROR::SHADER::PROGRAM::LINKING_FAILED\n%s\n", infoLog);
-        exit(EXIT_FAILURE);
-    }
-
-    glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
-
-    return shaderProgram;
+    LightUniforms uniforms = {
+        .position = lightMemberLocation(program, light, "position"),
+        .direction = lightMemberLocation(program, light, "direction"),
+        .ambient = lightMemberLocation(program, light, "ambient"),
+        .diffuse = lightMemberLocation(program, light, "diffuse"),
+        .specular = lightMemberLocation(program, light, "specular"),
+        .constant = lightMemberLocation(program, light, "constant"),
+        .linear = lightMemberLocation(program, light, "linear"),
+        .quadratic = lightMemberLocation(program, light, "quadratic"),
+        .cutOff = lightMemberLocation(program, light, "cutOff"),
+        .outerCutOff = lightMemberLocation(program, light, "outerCutOff"),
+    };
+    return uniforms;
 }
 
+#define NUM_POINT_LIGHTS 4
+
 unsigned int createTexture (const char *imagePath)
 {
-    unsigned int texture;
-
-    glGenTextures(1, &texture);
-    glBindTexture(GL_TEXTURE_2D, texture);
-    // set the texture wrapping/filtering options (on the currently bound texture object)
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    // load and generate the texture
-    int width, height, nrChannels;
-    unsigned char *data = stbi_load(imagePath, &width, &height, &nrChannels, 0);
-    if (!data)
-    {
-        printf("Failed to load texture %s\n", imagePath);
-        exit(EXIT_FAILURE);
-    }
-
-    GLenum format;
-    if (nrChannels == 1) {
-        format = GL_RED;
-    }
-    else if (nrChannels == 3) {
-        format = GL_RGB;
-    }
-    else if (nrChannels == 4) {
-        format = GL_RGBA;
-    }
-    else {
-        printf("Unknown number of channels in %s: %d\n", imagePath, nrChannels);
-        exit(EXIT_FAILURE);
-    }
-
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-    glGenerateMipmap(GL_TEXTURE_2D);
-    stbi_image_free(data);
-
-    return texture;
+    // decoded on a worker thread, the returned texture shows a placeholder until uploaded
+    return loadTextureAsync(imagePath);
 }
 
 int main (int argc, char *argv[])
 {
-    GLFWwindow *window = createWindow();
+    DisplayOptions displayOptions = {0};
+    GpuProfilerOptions profilerOptions = {0};
+    for (int i = 1; i < argc; i++) {
+        if (!parseDisplayOption(&displayOptions, argc, argv, &i) && !parseGpuProfilerOption(&profilerOptions, argc, argv, &i)) {
+            printf("Unknown option %s\n", argv[i]);
+            printf("Usage: %s %s %s\n", argv[0], GPU_PROFILER_USAGE, DISPLAY_USAGE);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    initJobSystem(getNumCores() - 1);
+
+    GLFWwindow *window = createWindow(&displayOptions);
 
     glEnable(GL_DEPTH_TEST);
 
@@ -346,17 +285,50 @@ int main (int argc, char *argv[])
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void *) 0);
     glEnableVertexAttribArray(0);
 
+    // every uniform is resolved here, the render loop does no lookups by name
+    ProgramReflection *lightingUniforms = getProgramReflection(lightingShader);
+    ProgramReflection *lampUniforms = getProgramReflection(lampShader);
+    GLint materialShininessLocation = uniformLocation(lightingShader, "material.shininess");
+    LightUniforms dirLight = getLightUniforms(lightingShader, "dirLight");
+    LightUniforms spotLight = getLightUniforms(lightingShader, "spotLight");
+    LightUniforms pointLights[NUM_POINT_LIGHTS];
+    for (unsigned int i = 0; i < NUM_POINT_LIGHTS; i++) {
+        char light[32];
+        snprintf(light, sizeof(light), "pointLights[%u]", i);
+        pointLights[i] = getLightUniforms(lightingShader, light);
+    }
+
+    // sampler units are program state, set once
     glUseProgram(lightingShader);
-    glUniform1i(glGetUniformLocation(lightingShader, "material.diffuse"), 0);
-    glUniform1i(glGetUniformLocation(lightingShader, "material.specular"), 1);
+    glUniform1i(uniformLocation(lightingShader, "material.diffuse"), 0);
+    glUniform1i(uniformLocation(lightingShader, "material.specular"), 1);
+
+    // --profile-gpu times the passes and shows their averages over the frame
+    GpuProfiler gpuProfiler;
+    initGpuProfiler(&gpuProfiler, &profilerOptions);
+    TextOverlay profileOverlay;
+    unsigned int textProgram = 0;
+    if (gpuProfiler.enabled) {
+        textProgram = createProgram("lighting/text.vert", "lighting/text.frag");
+        initTextOverlay(&profileOverlay, textProgram);
+    }
+
+    unsigned int numFrames = 0;
+    beginSteadyState();
 
-    while (!glfwWindowShouldClose(window))
+    while (!displayShouldClose(&display))
     {
-        float currentFrame = glfwGetTime();
+        TRACE_SCOPE("frame");
+        float currentFrame = displayTime(&display);
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
+        numFrames++;
 
-        processInput(window);
+        if (window) {
+            processInput(window);
+        }
+        processTextureUploads(0.002);
+        beginGpuProfilerFrame(&gpuProfiler);
 
         glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -364,7 +336,7 @@ int main (int argc, char *argv[])
         // draw the cube
         glUseProgram(lightingShader);
         float materialShininess = 32.0f;
-        glUniform1f(glGetUniformLocation(lightingShader, "material.shininess"), materialShininess);
+        glUniform1f(materialShininessLocation, materialShininess);
 
         // Bind texture units for diffuse and specular maps
         glActiveTexture(GL_TEXTURE0);
@@ -374,71 +346,48 @@ int main (int argc, char *argv[])
 
         // directional light
         vec3 dirLightDirection = {-0.2f, -1.0f, -0.3f};
-        glUniform3fv(glGetUniformLocation(lightingShader, "dirLight.direction"), 1, dirLightDirection);
+        glUniform3fv(dirLight.direction, 1, dirLightDirection);
         vec3 dirLightAmbient = {0.05f, 0.05f, 0.05f};
-        glUniform3fv(glGetUniformLocation(lightingShader, "dirLight.ambient"), 1, dirLightAmbient);
+        glUniform3fv(dirLight.ambient, 1, dirLightAmbient);
         vec3 dirLightDiffuse = {0.4f, 0.4f, 0.4f};
-        glUniform3fv(glGetUniformLocation(lightingShader, "dirLight.diffuse"), 1, dirLightDiffuse);
+        glUniform3fv(dirLight.diffuse, 1, dirLightDiffuse);
         vec3 dirLightSpecular = {0.5f, 0.5f, 0.5f};
-        glUniform3fv(glGetUniformLocation(lightingShader, "dirLight.specular"), 1, dirLightSpecular);
+        glUniform3fv(dirLight.specular, 1, dirLightSpecular);
 
         // point lights
         vec3 pointLightAmbient = {0.05f, 0.05f, 0.05f};
         vec3 pointLightDiffuse = {0.05f, 0.05f, 0.05f};
         vec3 pointLightSpecular = {1.0f, 1.0f, 1.0f};
-        vec3 pointLightPositions[] = {
+        vec3 pointLightPositions[NUM_POINT_LIGHTS] = {
             { 0.7f,  0.2f,  2.0f},
             { 2.3f, -3.3f, -4.0f},
             {-4.0f,  2.0f, -12.0f},
             { 0.0f,  0.0f, -3.0f},
         };
-        // point light 1
-        glUniform3fv(glGetUniformLocation(lightingShader, "pointLights[0].position"), 1, pointLightPositions[0]);
-        glUniform3fv(glGetUniformLocation(lightingShader, "pointLights[0].ambient"), 1, pointLightAmbient);
-        glUniform3fv(glGetUniformLocation(lightingShader, "pointLights[0].diffuse"), 1, pointLightDiffuse);
-        glUniform3fv(glGetUniformLocation(lightingShader, "pointLights[0].specular"), 1, pointLightSpecular);
-        glUniform1f(glGetUniformLocation(lightingShader, "pointLights[0].constant"), 1.0f);
-        glUniform1f(glGetUniformLocation(lightingShader, "pointLights[0].linear"), 0.09f);
-        glUniform1f(glGetUniformLocation(lightingShader, "pointLights[0].quadratic"), 0.032f);
-        // point light 2
-        glUniform3fv(glGetUniformLocation(lightingShader, "pointLights[1].position"), 1, pointLightPositions[1]);
-        glUniform3fv(glGetUniformLocation(lightingShader, "pointLights[1].ambient"), 1, pointLightAmbient);
-        glUniform3fv(glGetUniformLocation(lightingShader, "pointLights[1].diffuse"), 1, pointLightDiffuse);
-        glUniform3fv(glGetUniformLocation(lightingShader, "pointLights[1].specular"), 1, pointLightSpecular);
-        glUniform1f(glGetUniformLocation(lightingShader, "pointLights[1].constant"), 1.0f);
-        glUniform1f(glGetUniformLocation(lightingShader, "pointLights[1].linear"), 0.09f);
-        glUniform1f(glGetUniformLocation(lightingShader, "pointLights[1].quadratic"), 0.032f);
-        // point light 3
-        glUniform3fv(glGetUniformLocation(lightingShader, "pointLights[2].position"), 1, pointLightPositions[2]);
-        glUniform3fv(glGetUniformLocation(lightingShader, "pointLights[2].ambient"), 1, pointLightAmbient);
-        glUniform3fv(glGetUniformLocation(lightingShader, "pointLights[2].diffuse"), 1, pointLightDiffuse);
-        glUniform3fv(glGetUniformLocation(lightingShader, "pointLights[2].specular"), 1, pointLightSpecular);
-        glUniform1f(glGetUniformLocation(lightingShader, "pointLights[2].constant"), 1.0f);
-        glUniform1f(glGetUniformLocation(lightingShader, "pointLights[2].linear"), 0.09f);
-        glUniform1f(glGetUniformLocation(lightingShader, "pointLights[2].quadratic"), 0.032f);
-        // point light 4
-        glUniform3fv(glGetUniformLocation(lightingShader, "pointLights[3].position"), 1, pointLightPositions[3]);
-        glUniform3fv(glGetUniformLocation(lightingShader, "pointLights[3].ambient"), 1, pointLightAmbient);
-        glUniform3fv(glGetUniformLocation(lightingShader, "pointLights[3].diffuse"), 1, pointLightDiffuse);
-        glUniform3fv(glGetUniformLocation(lightingShader, "pointLights[3].specular"), 1, pointLightSpecular);
-        glUniform1f(glGetUniformLocation(lightingShader, "pointLights[3].constant"), 1.0f);
-        glUniform1f(glGetUniformLocation(lightingShader, "pointLights[3].linear"), 0.09f);
-        glUniform1f(glGetUniformLocation(lightingShader, "pointLights[3].quadratic"), 0.032f);
+        for (unsigned int i = 0; i < NUM_POINT_LIGHTS; i++) {
+            glUniform3fv(pointLights[i].position, 1, pointLightPositions[i]);
+            glUniform3fv(pointLights[i].ambient, 1, pointLightAmbient);
+            glUniform3fv(pointLights[i].diffuse, 1, pointLightDiffuse);
+            glUniform3fv(pointLights[i].specular, 1, pointLightSpecular);
+            glUniform1f(pointLights[i].constant, 1.0f);
+            glUniform1f(pointLights[i].linear, 0.09f);
+            glUniform1f(pointLights[i].quadratic, 0.032f);
+        }
 
         // spot light
-        glUniform3fv(glGetUniformLocation(lightingShader, "spotLight.position"), 1, cameraPos);
-        glUniform3fv(glGetUniformLocation(lightingShader, "spotLight.direction"), 1, cameraFront);
+        glUniform3fv(spotLight.position, 1, cameraPos);
+        glUniform3fv(spotLight.direction, 1, cameraFront);
         vec3 spotLightAmbient = {0.0f, 0.0f, 0.0f};
-        glUniform3fv(glGetUniformLocation(lightingShader, "spotLight.ambient"), 1, spotLightAmbient);
+        glUniform3fv(spotLight.ambient, 1, spotLightAmbient);
         vec3 spotLightDiffuse = {1.0f, 1.0f, 1.0f};
-        glUniform3fv(glGetUniformLocation(lightingShader, "spotLight.diffuse"), 1, spotLightDiffuse);
+        glUniform3fv(spotLight.diffuse, 1, spotLightDiffuse);
         vec3 spotLightSpecular = {1.0f, 1.0f, 1.0f};
-        glUniform3fv(glGetUniformLocation(lightingShader, "spotLight.specular"), 1, spotLightSpecular);
-        glUniform1f(glGetUniformLocation(lightingShader, "spotLight.constant"), 1.0f);
-        glUniform1f(glGetUniformLocation(lightingShader, "spotLight.linear"), 0.09f);
-        glUniform1f(glGetUniformLocation(lightingShader, "spotLight.quadratic"), 0.032f);
-        glUniform1f(glGetUniformLocation(lightingShader, "spotLight.cutOff"), cos(glm_rad(12.5f)));
-        glUniform1f(glGetUniformLocation(lightingShader, "spotLight.outerCutOff"), cos(glm_rad(15.0f)));
+        glUniform3fv(spotLight.specular, 1, spotLightSpecular);
+        glUniform1f(spotLight.constant, 1.0f);
+        glUniform1f(spotLight.linear, 0.09f);
+        glUniform1f(spotLight.quadratic, 0.032f);
+        glUniform1f(spotLight.cutOff, cos(glm_rad(12.5f)));
+        glUniform1f(spotLight.outerCutOff, cos(glm_rad(15.0f)));
 
         // transformations
         mat4 view, projection;
@@ -447,8 +396,8 @@ int main (int argc, char *argv[])
         glm_lookat(cameraPos, center, cameraUp, view);
         glm_perspective(glm_rad(fov), (float) SCR_WIDTH / (float) SCR_HEIGHT, 0.1f, 100.0f, projection);
 
-        glUniformMatrix4fv(glGetUniformLocation(lightingShader, "view"), 1, GL_FALSE, (float *) view);
-        glUniformMatrix4fv(glGetUniformLocation(lightingShader, "projection"), 1, GL_FALSE, (float *) projection);
+        glUniformMatrix4fv(lightingUniforms->view, 1, GL_FALSE, (float *) view);
+        glUniformMatrix4fv(lightingUniforms->projection, 1, GL_FALSE, (float *) projection);
 
         vec3 cubePositions[] = {
             { 0.0f,  0.0f,  0.0f},
@@ -463,6 +412,7 @@ int main (int argc, char *argv[])
             {-1.3f,  1.0f, -1.5f},
         };
 
+        unsigned int scope = beginGpuScope(&gpuProfiler, "cubes");
         glBindVertexArray(cubeVAO);
         for (unsigned int i = 0; i < 10; i++) {
             mat4 model;
@@ -471,30 +421,40 @@ int main (int argc, char *argv[])
             float angle = 20.0f * i;
             vec3 axis = {1.0f, 0.3f, 0.5f};
             glm_rotate(model, glm_rad(angle), axis);
-            glUniformMatrix4fv(glGetUniformLocation(lightingShader, "model"), 1, GL_FALSE, (float *) model);
+            glUniformMatrix4fv(lightingUniforms->model, 1, GL_FALSE, (float *) model);
 
             glDrawArrays(GL_TRIANGLES, 0, 36);
         }
 
+        endGpuScope(&gpuProfiler, scope);
+
         // draw the lamp object
+        scope = beginGpuScope(&gpuProfiler, "lamps");
         glUseProgram(lampShader);
-        glUniformMatrix4fv(glGetUniformLocation(lampShader, "view"), 1, GL_FALSE, (float *) view);
-        glUniformMatrix4fv(glGetUniformLocation(lampShader, "projection"), 1, GL_FALSE, (float *) projection);
+        glUniformMatrix4fv(lampUniforms->view, 1, GL_FALSE, (float *) view);
+        glUniformMatrix4fv(lampUniforms->projection, 1, GL_FALSE, (float *) projection);
 
-        for (unsigned int i = 0; i < 4; i++) {
+        for (unsigned int i = 0; i < NUM_POINT_LIGHTS; i++) {
             mat4 model;
             glm_mat4_identity(model);
             glm_translate(model, pointLightPositions[i]);
             vec3 scale = {0.2f, 0.2f, 0.2f};
             glm_scale(model, scale);
-            glUniformMatrix4fv(glGetUniformLocation(lampShader, "model"), 1, GL_FALSE, (float *) model);
+            glUniformMatrix4fv(lampUniforms->model, 1, GL_FALSE, (float *) model);
 
             glBindVertexArray(lightVAO);
             glDrawArrays(GL_TRIANGLES, 0, 36);
         }
+        endGpuScope(&gpuProfiler, scope);
+
+        if (gpuProfiler.enabled) {
+            char profile[512];
+            formatGpuProfiler(&gpuProfiler, profile, sizeof(profile));
+            drawTextOverlay(&profileOverlay, profile, 8.0f, 8.0f, 2.0f, SCR_WIDTH, SCR_HEIGHT);
+        }
+        endGpuProfilerFrame(&gpuProfiler);
 
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+        presentDisplay(&display);
     }
 
     glDeleteVertexArrays(1, &cubeVAO);
@@ -503,7 +463,18 @@ int main (int argc, char *argv[])
     glDeleteProgram(lightingShader);
     glDeleteProgram(lampShader);
 
-    glfwTerminate();
+    printTextureLoaderStats();
+    printUniformQueryStats(numFrames);
+    printGpuProfilerStats(&gpuProfiler);
+    if (gpuProfiler.enabled) {
+        destroyTextOverlay(&profileOverlay);
+        glDeleteProgram(textProgram);
+    }
+    destroyGpuProfiler(&gpuProfiler);
+
+    TRACE_WRITE(TRACE_OUTPUT);
+    closeDisplay(&display);
+    shutdownJobSystem();
 
     return EXIT_SUCCESS;
 }
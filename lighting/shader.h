@@ -0,0 +1,282 @@
+#ifndef _SHADER_H_
+#define _SHADER_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glad/glad.h>
+
+#include "trace.h"
+
+// Every glGetUniformLocation() below this header goes through a counter, so the
+// render loops can show they resolve nothing by name once they are running
+unsigned long uniformLocationQueries = 0;
+unsigned long uniformLocationQueriesAtSteadyState = 0;
+
+GLint countedGetUniformLocation (GLuint program, const GLchar *name)
+{
+    uniformLocationQueries++;
+    return glad_glGetUniformLocation(program, name);
+}
+
+#undef glGetUniformLocation
+#define glGetUniformLocation countedGetUniformLocation
+
+// Active uniforms of a linked program, queried once by reflectProgram()
+typedef struct {
+    char *name;
+    GLint location;
+    GLenum type;
+} ProgramUniform;
+
+typedef struct {
+    unsigned int program;
+
+    ProgramUniform *uniforms;
+    unsigned int numUniforms;
+
+    // uniforms set by the mesh and model code, -1 when the program does not use them
+    GLint model, view, projection;
+    GLint positionScale, positionOffset;
+} ProgramReflection;
+
+#define MAX_PROGRAMS 32
+
+ProgramReflection programReflections[MAX_PROGRAMS];
+unsigned int numProgramReflections = 0;
+
+char * read_file (const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        printf("Error opening file %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    fseek(f, 0, SEEK_END);
+    long length = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    char *buffer = malloc(length + 1);
+    size_t read = fread(buffer, 1, length, f);
+    fclose(f);
+
+    buffer[read] = '\0';
+
+    return buffer;
+}
+
+// Compile a shader with `defines` (e.g. "#define PACKED_VERTICES\n") inserted
+// right after the #version line, used to build variants of the same source
+unsigned int createShaderVariant (const char *shaderPath, GLuint shaderType, const char *defines)
+{
+    char infoLog[512];
+    int success;
+
+    unsigned int shader = glCreateShader(shaderType);
+    const char *shaderSource = read_file(shaderPath);
+
+    // #version has to stay the first line
+    const char *body = shaderSource;
+    if (strncmp(body, "#version", 8) == 0) {
+        body = strchr(body, '\n');
+        body = body ? body + 1 : shaderSource + strlen(shaderSource);
+    }
+    const char *sources[3] = {shaderSource, defines ? defines : "", body};
+    int lengths[3] = {body - shaderSource, -1, -1};
+
+    glShaderSource(shader, 3, sources, lengths);
+    glCompileShader(shader);
+
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+    if (!success) {
+        glGetShaderInfoLog(shader, sizeof(infoLog), NULL, infoLog);
+        printf("ERROR::SHADER::COMPILATION_FAILED\n%s\n%s\n", shaderPath, infoLog);
+        exit(EXIT_FAILURE);
+    }
+
+    free((void *) shaderSource);
+
+    return shader;
+}
+
+unsigned int createShader (const char *shaderPath, GLuint shaderType)
+{
+    return createShaderVariant(shaderPath, shaderType, NULL);
+}
+
+// Location of a uniform by name from the reflection data, -1 if it is not active.
+// Meant for load time: resolve once, keep the GLint.
+GLint uniformLocation (unsigned int program, const char *name)
+{
+    for (unsigned int p = 0; p < numProgramReflections; p++) {
+        ProgramReflection *reflection = &programReflections[p];
+        if (reflection->program != program) {
+            continue;
+        }
+
+        for (unsigned int i = 0; i < reflection->numUniforms; i++) {
+            if (strcmp(reflection->uniforms[i].name, name) == 0) {
+                return reflection->uniforms[i].location;
+            }
+        }
+        return -1;
+    }
+
+    printf("ERROR::SHADER::PROGRAM::NOT_REFLECTED %u\n", program);
+    exit(EXIT_FAILURE);
+}
+
+// Record every active uniform of a freshly linked program. Arrays get one entry
+// per element ("lights[1]"), members of struct arrays are reported by GL one by one.
+void reflectProgram (unsigned int program)
+{
+    if (numProgramReflections == MAX_PROGRAMS) {
+        printf("ERROR::SHADER::PROGRAM::TOO_MANY_PROGRAMS\n");
+        exit(EXIT_FAILURE);
+    }
+
+    ProgramReflection *reflection = &programReflections[numProgramReflections++];
+    memset(reflection, 0, sizeof(*reflection));
+    reflection->program = program;
+
+    int numActive = 0, maxNameLength = 0;
+    glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &numActive);
+    glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxNameLength);
+
+    char *name = malloc(maxNameLength + 16);
+    for (int i = 0; i < numActive; i++) {
+        GLint size;
+        GLenum type;
+        glGetActiveUniform(program, i, maxNameLength, NULL, &size, &type, name);
+
+        // arrays are reported as "name[0]" with their size
+        char *bracket = strstr(name, "[0]");
+        if (bracket && bracket[3] == '\0') {
+            *bracket = '\0';
+        }
+        else {
+            bracket = NULL;
+            size = 1;
+        }
+
+        reflection->uniforms = realloc(reflection->uniforms, (reflection->numUniforms + size) * sizeof(ProgramUniform));
+        for (int element = 0; element < size; element++) {
+            char elementName[512];
+            if (bracket) {
+                snprintf(elementName, sizeof(elementName), "%s[%d]", name, element);
+            }
+            else {
+                snprintf(elementName, sizeof(elementName), "%s", name);
+            }
+
+            ProgramUniform uniform = {
+                .name = strdup(elementName),
+                .location = glGetUniformLocation(program, elementName),
+                .type = type,
+            };
+            reflection->uniforms[reflection->numUniforms++] = uniform;
+        }
+    }
+    free(name);
+
+    reflection->model = uniformLocation(program, "model");
+    reflection->view = uniformLocation(program, "view");
+    reflection->projection = uniformLocation(program, "projection");
+    reflection->positionScale = uniformLocation(program, "positionScale");
+    reflection->positionOffset = uniformLocation(program, "positionOffset");
+}
+
+ProgramReflection * getProgramReflection (unsigned int program)
+{
+    for (unsigned int p = 0; p < numProgramReflections; p++) {
+        if (programReflections[p].program == program) {
+            return &programReflections[p];
+        }
+    }
+
+    printf("ERROR::SHADER::PROGRAM::NOT_REFLECTED %u\n", program);
+    exit(EXIT_FAILURE);
+}
+
+// Call once loading is done; printUniformQueryStats() then reports what the frames did
+void beginSteadyState ()
+{
+    uniformLocationQueriesAtSteadyState = uniformLocationQueries;
+}
+
+void printUniformQueryStats (unsigned int numFrames)
+{
+    printf("glGetUniformLocation: %lu calls while loading, %lu calls in %u frames\n",
+        uniformLocationQueriesAtSteadyState, uniformLocationQueries - uniformLocationQueriesAtSteadyState, numFrames);
+}
+
+unsigned int createProgramVariant (const char *vertexShaderPath, const char *fragmentShaderPath, const char *defines)
+{
+    TRACE_FUNCTION();
+    char infoLog[512];
+    int success;
+
+    unsigned int vertexShader = createShaderVariant(vertexShaderPath, GL_VERTEX_SHADER, defines);
+    unsigned int fragmentShader = createShaderVariant(fragmentShaderPath, GL_FRAGMENT_SHADER, defines);
+
+    unsigned int shaderProgram = glCreateProgram();
+    glAttachShader(shaderProgram, vertexShader);
+    glAttachShader(shaderProgram, fragmentShader);
+    glLinkProgram(shaderProgram);
+
+    glGetProgramiv(shaderProgram, GL_LINK_STATUS, &success);
+    if (!success) {
+        glGetProgramInfoLog(shaderProgram, sizeof(infoLog), NULL, infoLog);
+        printf("ERROR::SHADER::PROGRAM::LINKING_FAILED\n%s\n", infoLog);
+        exit(EXIT_FAILURE);
+    }
+
+    glDeleteShader(vertexShader);
+    glDeleteShader(fragmentShader);
+
+    reflectProgram(shaderProgram);
+
+    return shaderProgram;
+}
+
+unsigned int createProgram (const char *vertexShaderPath, const char *fragmentShaderPath)
+{
+    return createProgramVariant(vertexShaderPath, fragmentShaderPath, NULL);
+}
+
+// Vertex + geometry program whose outputs are captured with transform feedback
+// instead of being rasterized. `varyings` are written interleaved to buffer 0.
+unsigned int createTransformFeedbackProgram (const char *vertexShaderPath, const char *geometryShaderPath,
+    const char **varyings, unsigned int numVaryings)
+{
+    char infoLog[512];
+    int success;
+
+    unsigned int vertexShader = createShader(vertexShaderPath, GL_VERTEX_SHADER);
+    unsigned int geometryShader = createShader(geometryShaderPath, GL_GEOMETRY_SHADER);
+
+    unsigned int shaderProgram = glCreateProgram();
+    glAttachShader(shaderProgram, vertexShader);
+    glAttachShader(shaderProgram, geometryShader);
+    // has to be known before linking
+    glTransformFeedbackVaryings(shaderProgram, numVaryings, varyings, GL_INTERLEAVED_ATTRIBS);
+    glLinkProgram(shaderProgram);
+
+    glGetProgramiv(shaderProgram, GL_LINK_STATUS, &success);
+    if (!success) {
+        glGetProgramInfoLog(shaderProgram, sizeof(infoLog), NULL, infoLog);
+        printf("ERROR::SHADER::PROGRAM::LINKING_FAILED\n%s\n", infoLog);
+        exit(EXIT_FAILURE);
+    }
+
+    glDeleteShader(vertexShader);
+    glDeleteShader(geometryShader);
+
+    reflectProgram(shaderProgram);
+
+    return shaderProgram;
+}
+
+#endif // _SHADER_H_
@@ -0,0 +1,213 @@
+#ifndef _TEXTURE_LOADER_H_
+#define _TEXTURE_LOADER_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <glad/glad.h>
+
+#ifndef STBI_INCLUDE_STB_IMAGE_H // the includer may already have pulled in the implementation
+#include "stb_image.h"
+#endif
+#include "jobs.h"
+
+// Asynchronous texture loading. loadTextureAsync() hands out the GL texture
+// name right away, backed by a 1x1 placeholder, and queues the image decode on
+// the job system. Decoded images wait in a queue until the GL thread uploads
+// them in processTextureUploads(), which re-specifies the storage of the same
+// texture name, so every Texture copy already handed out sees the real image.
+
+typedef struct {
+    unsigned int texture;
+    char path[PATH_MAX];
+
+    unsigned char *data;
+    int width, height, nrChannels;
+    double decodeTime;
+} TextureRequest;
+
+typedef struct {
+    pthread_mutex_t mutex;
+
+    // decoded images waiting for the GL thread
+    TextureRequest **ready;
+    unsigned int numReady, capacity;
+
+    // requested but not uploaded yet (only touched on the GL thread)
+    unsigned int numPending;
+
+    // counters
+    unsigned int numRequested, numUploaded, maxQueueDepth;
+    double decodeTime, uploadTime;
+} TextureLoader;
+
+TextureLoader textureLoader = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+double textureLoaderClock ()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void decodeTextureJob (void *data, unsigned int index)
+{
+    TextureRequest *request = data;
+    (void) index;
+
+    double start = textureLoaderClock();
+    request->data = stbi_load(request->path, &request->width, &request->height, &request->nrChannels, 0);
+    request->decodeTime = textureLoaderClock() - start;
+
+    pthread_mutex_lock(&textureLoader.mutex);
+    if (textureLoader.numReady == textureLoader.capacity) {
+        textureLoader.capacity = textureLoader.capacity ? textureLoader.capacity * 2 : 16;
+        textureLoader.ready = realloc(textureLoader.ready, textureLoader.capacity * sizeof(TextureRequest *));
+    }
+    textureLoader.ready[textureLoader.numReady++] = request;
+    pthread_mutex_unlock(&textureLoader.mutex);
+}
+
+unsigned int loadTextureAsync (const char *filename)
+{
+    unsigned int texture;
+
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    // set the texture wrapping/filtering options (on the currently bound texture object)
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    // neutral grey placeholder until the real image is uploaded
+    unsigned char placeholder[4] = {128, 128, 128, 255};
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholder);
+
+    TextureRequest *request = calloc(1, sizeof(TextureRequest));
+    request->texture = texture;
+    snprintf(request->path, sizeof(request->path), "%s", filename);
+
+    textureLoader.numRequested++;
+    if (++textureLoader.numPending > textureLoader.maxQueueDepth) {
+        textureLoader.maxQueueDepth = textureLoader.numPending;
+    }
+
+    submitJob(decodeTextureJob, request, 0, NULL);
+
+    return texture;
+}
+
+void uploadTexture (TextureRequest *request)
+{
+    if (!request->data)
+    {
+        printf("Failed to load texture %s\n", request->path);
+        exit(EXIT_FAILURE);
+    }
+
+    // images with alpha keep it, the rest are stored as RGB
+    GLenum format;
+    GLint internalFormat = GL_RGB;
+    if (request->nrChannels == 1) {
+        format = GL_RED;
+    }
+    else if (request->nrChannels == 3) {
+        format = GL_RGB;
+    }
+    else if (request->nrChannels == 4) {
+        format = GL_RGBA;
+        internalFormat = GL_RGBA;
+    }
+    else {
+        printf("Unknown number of channels in %s: %d\n", request->path, request->nrChannels);
+        exit(EXIT_FAILURE);
+    }
+
+    double start = textureLoaderClock();
+    glBindTexture(GL_TEXTURE_2D, request->texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, request->width, request->height, 0, format, GL_UNSIGNED_BYTE, request->data);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    textureLoader.uploadTime += textureLoaderClock() - start;
+    textureLoader.decodeTime += request->decodeTime;
+    textureLoader.numUploaded++;
+    textureLoader.numPending--;
+
+    stbi_image_free(request->data);
+    free(request);
+}
+
+// Upload decoded textures on the GL thread, stopping once `budget` seconds
+// have been spent (at least one texture is uploaded per call)
+void processTextureUploads (double budget)
+{
+    if (textureLoader.numPending == 0) {
+        return;
+    }
+
+    double start = textureLoaderClock();
+
+    for (;;) {
+        TextureRequest *request = NULL;
+
+        pthread_mutex_lock(&textureLoader.mutex);
+        if (textureLoader.numReady > 0) {
+            request = textureLoader.ready[0];
+            memmove(textureLoader.ready, &textureLoader.ready[1], --textureLoader.numReady * sizeof(TextureRequest *));
+        }
+        pthread_mutex_unlock(&textureLoader.mutex);
+
+        if (!request) {
+            break;
+        }
+
+        uploadTexture(request);
+
+        if (textureLoaderClock() - start > budget) {
+            break;
+        }
+    }
+}
+
+// Block until every requested texture is decoded and uploaded
+void finishTextureUploads ()
+{
+    while (textureLoader.numPending > 0) {
+        processTextureUploads(1e9);
+
+        if (textureLoader.numPending > 0) {
+            // help decoding instead of sleeping
+            Job job;
+            if (tryPopJob(&job)) {
+                runJob(&job);
+            }
+            else {
+                sched_yield();
+            }
+        }
+    }
+}
+
+void printTextureLoaderStats ()
+{
+    pthread_mutex_lock(&textureLoader.mutex);
+    unsigned int numReady = textureLoader.numReady;
+    pthread_mutex_unlock(&textureLoader.mutex);
+
+    printf("textures: %u requested, %u uploaded, %u pending (%u decoded), max queue depth %u\n",
+        textureLoader.numRequested, textureLoader.numUploaded, textureLoader.numPending, numReady,
+        textureLoader.maxQueueDepth);
+    if (textureLoader.numUploaded > 0) {
+        printf("textures: decode %.2f ms total (%.2f ms avg), upload %.2f ms total (%.2f ms avg)\n",
+            textureLoader.decodeTime * 1000.0, textureLoader.decodeTime * 1000.0 / textureLoader.numUploaded,
+            textureLoader.uploadTime * 1000.0, textureLoader.uploadTime * 1000.0 / textureLoader.numUploaded);
+    }
+}
+
+#endif // _TEXTURE_LOADER_H_
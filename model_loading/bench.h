@@ -0,0 +1,193 @@
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "model.h"
+
+// Monotonic wall clock in seconds, usable before (or without) GLFW
+double benchNow ()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Print current and peak resident set size, in KiB
+void printMemoryUsage (const char *label)
+{
+    long pages = 0, residentPages = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f) {
+        if (fscanf(f, "%ld %ld", &pages, &residentPages) != 2) {
+            residentPages = 0;
+        }
+        fclose(f);
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    printf("%s: RSS %ld KiB, peak RSS %ld KiB\n", label,
+        residentPages * (sysconf(_SC_PAGESIZE) / 1024), usage.ru_maxrss);
+}
+
+// Compare a cold import (Assimp + cache write) against a warm start served
+// from the binary mesh cache. Both runs include texture decode and GL upload.
+void benchModelStartup (const char *path, unsigned int flags, unsigned int iterations)
+{
+    char cachePath[PATH_MAX];
+    getMeshCachePath(path, cachePath, sizeof(cachePath));
+
+    double coldTotal = 0.0, warmTotal = 0.0;
+
+    for (unsigned int i = 0; i < iterations; i++) {
+        remove(cachePath);
+
+        double start = benchNow();
+        Model cold = createModel(path, flags);
+        finishTextureUploads();
+        coldTotal += benchNow() - start;
+        destroyModel(&cold);
+
+        start = benchNow();
+        Model warm = createModel(path, flags);
+        finishTextureUploads();
+        warmTotal += benchNow() - start;
+        destroyModel(&warm);
+    }
+
+    printf("%-32s cold import: %8.2f ms  cache hit: %8.2f ms  speedup: %.2fx\n", path,
+        coldTotal * 1000.0 / iterations, warmTotal * 1000.0 / iterations, coldTotal / warmTotal);
+}
+
+// Time the parallel CPU half of the import (vertex conversion, index flattening,
+// material lookup) with 1..N threads. The Assimp import is done once up front
+// and the GL upload is left out, so only the part that scales is measured.
+void benchModelThreads (const char *path, unsigned int iterations)
+{
+    const struct aiScene *scene = aiImportFile(path, MODEL_IMPORT_FLAGS);
+    if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
+        printf("ERROR::ASSIMP::%s\n", aiGetErrorString());
+        exit(EXIT_FAILURE);
+    }
+
+    unsigned int maxThreads = getNumCores();
+    unsigned int numMeshes = 0;
+    double serial = 0.0;
+
+    for (unsigned int threads = 1; threads <= maxThreads; threads++) {
+        shutdownJobSystem();
+        initJobSystem(threads - 1); // the calling thread runs jobs too
+
+        double start = benchNow();
+        for (unsigned int i = 0; i < iterations; i++) {
+            Model model = { 0 };
+            processScene(&model, scene);
+
+            numMeshes = model.numMeshes;
+            for (unsigned int m = 0; m < model.numMeshes; m++) {
+                releaseMeshData(&model.meshes[m]);
+                freeMeshTextures(&model.meshes[m]);
+            }
+            free(model.meshes);
+        }
+        double elapsed = (benchNow() - start) / iterations;
+
+        if (threads == 1) {
+            serial = elapsed;
+        }
+        printf("%s (%u meshes) %2u threads: %8.3f ms  speedup: %.2fx\n", path, numMeshes, threads,
+            elapsed * 1000.0, serial / elapsed);
+    }
+
+    aiReleaseImport(scene);
+}
+
+// The per-model texture list the cache replaced: a linear strcmp scan over
+// fixed size records, grown one element at a time
+typedef struct {
+    unsigned int id;
+    char type[50];
+    char path[PATH_MAX];
+} LegacyTexture;
+
+// Stands in for loadTextureAsync(), hands out fake texture names
+unsigned int benchTextureId;
+
+unsigned int benchLoadTexture (const char *path)
+{
+    (void) path;
+    return ++benchTextureId;
+}
+
+// Lookup cost of `numRefs` texture references spread over `numUnique` paths,
+// linear scan against acquireTexture(), whose misses include the realpath().
+// Fake texture names are used so no GL context or image file is needed.
+void benchTextureCache (unsigned int numUnique, unsigned int numRefs)
+{
+    char (*paths)[64] = malloc(numUnique * sizeof(*paths));
+    for (unsigned int i = 0; i < numUnique; i++) {
+        snprintf(paths[i], sizeof(paths[i]), "resources/textures/texture_%05u.png", i);
+    }
+
+    // linear scan
+    LegacyTexture *loaded = NULL;
+    unsigned int numLoaded = 0;
+    unsigned long checksum = 0;
+
+    double start = benchNow();
+    for (unsigned int r = 0; r < numRefs; r++) {
+        const char *path = paths[(r * 7919u) % numUnique];
+
+        unsigned int found = numLoaded;
+        for (unsigned int j = 0; j < numLoaded; j++) {
+            if (strcmp(loaded[j].path, path) == 0) {
+                found = j;
+                break;
+            }
+        }
+        if (found == numLoaded) {
+            loaded = realloc(loaded, (numLoaded + 1) * sizeof(LegacyTexture));
+            loaded[numLoaded].id = numLoaded + 1;
+            snprintf(loaded[numLoaded].type, sizeof(loaded[numLoaded].type), "texture_diffuse");
+            snprintf(loaded[numLoaded].path, sizeof(loaded[numLoaded].path), "%s", path);
+            numLoaded++;
+        }
+        checksum += loaded[found].id;
+    }
+    double linear = benchNow() - start;
+    free(loaded);
+
+    // acquireTexture() with its miss path, on a scratch cache so the real one is
+    // left alone and with the GL load stubbed out like the scan's above
+    TextureCache saved = textureCache;
+    memset(&textureCache, 0, sizeof(textureCache));
+    textureCache.load = benchLoadTexture;
+    benchTextureId = 0;
+
+    start = benchNow();
+    for (unsigned int r = 0; r < numRefs; r++) {
+        checksum -= acquireTexture(paths[(r * 7919u) % numUnique]);
+    }
+    double hashed = benchNow() - start;
+
+    for (unsigned int i = 0; i < textureCache.numRecords; i++) {
+        freeTextureRecordPaths(&textureCache.records[i]);
+    }
+    free(textureCache.records);
+    free(textureCache.freeRecords);
+    freeHashMap(&textureCache.byPath);
+    freeHashMap(&textureCache.byId);
+    textureCache = saved;
+    free(paths);
+
+    printf("texture lookup, %u refs over %5u textures: linear %8.3f ms  hashed %8.3f ms  speedup: %.1fx%s\n",
+        numRefs, numUnique, linear * 1000.0, hashed * 1000.0, linear / hashed,
+        checksum == 0 ? "" : " (MISMATCH)");
+}
+
+#endif // _BENCH_H_
@@ -0,0 +1,216 @@
+#ifndef _FLYTHROUGH_H_
+#define _FLYTHROUGH_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glad/glad.h>
+#include <cglm/cglm.h>
+
+// --benchmark: the camera follows a fixed path for a fixed number of frames
+// and the frame, CPU and GPU times are written out as JSON. The path and the
+// simulation are sampled by frame number with a fixed time step, never by
+// wall clock, so every run renders the same frames and runs of different
+// commits can be compared.
+#define BENCHMARK_FRAMES 600         // timed frames, one lap of the path
+#define BENCHMARK_WARMUP_FRAMES 10   // drawn before timing starts
+#define BENCHMARK_TIME_STEP (1.0f / 60.0f)
+#define BENCHMARK_DEFAULT_OUTPUT "benchmark.json"
+
+// GPU times are read back this many frames late, so the queries never stall
+#define FRAME_TIMER_LATENCY 4
+
+typedef struct {
+    vec3 position;
+    vec3 target;  // looked at
+} FlythroughKey;
+
+// A closed Catmull-Rom spline through the keys, one lap in `numFrames` frames
+typedef struct {
+    const FlythroughKey *keys;
+    unsigned int numKeys;
+    unsigned int numFrames;
+} FlythroughPath;
+
+static void catmullRom(const float *p0, const float *p1, const float *p2, const float *p3, float t, vec3 out)
+{
+    float t2 = t * t, t3 = t2 * t;
+    for (int i = 0; i < 3; i++) {
+        out[i] = 0.5f * (2.0f * p1[i] + (p2[i] - p0[i]) * t + (2.0f * p0[i] - 5.0f * p1[i] + 4.0f * p2[i] - p3[i]) * t2 +
+            (3.0f * p1[i] - p0[i] - 3.0f * p2[i] + p3[i]) * t3);
+    }
+}
+
+// Camera position and unit front vector on `frame`
+void sampleFlythrough(const FlythroughPath *path, unsigned int frame, vec3 position, vec3 front)
+{
+    unsigned int n = path->numKeys;
+    float along = (float) (frame % path->numFrames) / path->numFrames * n;
+    unsigned int k = (unsigned int) along;
+    float t = along - k;
+    const FlythroughKey *k0 = &path->keys[(k + n - 1) % n], *k1 = &path->keys[k % n];
+    const FlythroughKey *k2 = &path->keys[(k + 1) % n], *k3 = &path->keys[(k + 2) % n];
+
+    vec3 target;
+    catmullRom(k0->position, k1->position, k2->position, k3->position, t, position);
+    catmullRom(k0->target, k1->target, k2->target, k3->target, t, target);
+    glm_vec3_sub(target, position, front);
+    glm_vec3_normalize(front);
+}
+
+// Per frame times in seconds. The frame time runs from one frame start to the
+// next, so it includes the swap; the CPU time ends when the frame is
+// submitted; the GPU time is a GL_TIME_ELAPSED query around the frame.
+typedef struct {
+    double *frameTimes, *cpuTimes, *gpuTimes;
+    unsigned int capacity, numFrames;
+
+    double frameStart;
+    bool started;
+
+    GLuint queries[FRAME_TIMER_LATENCY];
+    unsigned int queryFrames[FRAME_TIMER_LATENCY];
+    unsigned int next, numPending;
+} FrameStats;
+
+void initFrameStats(FrameStats *stats, unsigned int capacity)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->capacity = capacity ? capacity : 1;
+    stats->frameTimes = calloc(stats->capacity, sizeof(double));
+    stats->cpuTimes = calloc(stats->capacity, sizeof(double));
+    stats->gpuTimes = calloc(stats->capacity, sizeof(double));
+    if (!stats->frameTimes || !stats->cpuTimes || !stats->gpuTimes) {
+        printf("ERROR::FRAME_STATS::OUT_OF_MEMORY %u frames\n", capacity);
+        exit(EXIT_FAILURE);
+    }
+    glGenQueries(FRAME_TIMER_LATENCY, stats->queries);
+}
+
+static void collectFrameTimer(FrameStats *stats)
+{
+    unsigned int oldest = (stats->next + FRAME_TIMER_LATENCY - stats->numPending) % FRAME_TIMER_LATENCY;
+    GLuint64 elapsed = 0;
+    glGetQueryObjectui64v(stats->queries[oldest], GL_QUERY_RESULT, &elapsed);
+    stats->gpuTimes[stats->queryFrames[oldest]] = elapsed * 1e-9;
+    stats->numPending--;
+}
+
+// Start a frame at time `now`, the previous frame ends here
+void beginFrameStats(FrameStats *stats, double now)
+{
+    if (stats->started && stats->numFrames < stats->capacity) {
+        stats->frameTimes[stats->numFrames++] = now - stats->frameStart;
+    }
+    stats->frameStart = now;
+    stats->started = stats->numFrames < stats->capacity;
+    if (!stats->started) {
+        return;
+    }
+
+    if (stats->numPending == FRAME_TIMER_LATENCY) {
+        collectFrameTimer(stats);
+    }
+    stats->queryFrames[stats->next] = stats->numFrames;
+    glBeginQuery(GL_TIME_ELAPSED, stats->queries[stats->next]);
+}
+
+// The frame is submitted at time `now`, call before the swap
+void endFrameStats(FrameStats *stats, double now)
+{
+    if (!stats->started) {
+        return;
+    }
+    glEndQuery(GL_TIME_ELAPSED);
+    stats->next = (stats->next + 1) % FRAME_TIMER_LATENCY;
+    stats->numPending++;
+    stats->cpuTimes[stats->numFrames] = now - stats->frameStart;
+}
+
+typedef struct {
+    double min, avg, p50, p95, p99, max;
+} FrameTimeSummary;
+
+static int compareDoubles(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+// Nearest rank percentiles of `count` times, in milliseconds
+void summarizeFrameTimes(const double *times, unsigned int count, FrameTimeSummary *summary)
+{
+    memset(summary, 0, sizeof(*summary));
+    if (count == 0) {
+        return;
+    }
+    double *sorted = malloc(count * sizeof(double));
+    memcpy(sorted, times, count * sizeof(double));
+    qsort(sorted, count, sizeof(double), compareDoubles);
+
+    double total = 0.0;
+    for (unsigned int i = 0; i < count; i++) {
+        total += sorted[i];
+    }
+    summary->min = sorted[0] * 1000.0;
+    summary->avg = total / count * 1000.0;
+    summary->p50 = sorted[(count - 1) * 50 / 100] * 1000.0;
+    summary->p95 = sorted[(count - 1) * 95 / 100] * 1000.0;
+    summary->p99 = sorted[(count - 1) * 99 / 100] * 1000.0;
+    summary->max = sorted[count - 1] * 1000.0;
+    free(sorted);
+}
+
+static void writeFrameTimeSummary(FILE *f, const char *name, const double *times, unsigned int count, bool last)
+{
+    FrameTimeSummary s;
+    summarizeFrameTimes(times, count, &s);
+    fprintf(f, "  \"%s\": {\"min\": %.4f, \"avg\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f}%s\n",
+        name, s.min, s.avg, s.p50, s.p95, s.p99, s.max, last ? "" : ",");
+    printf("benchmark: %s min %.3f avg %.3f p50 %.3f p95 %.3f p99 %.3f max %.3f ms\n", name, s.min, s.avg, s.p50,
+        s.p95, s.p99, s.max);
+}
+
+// Wait for the outstanding GPU times and write the summary to `path`.
+// `settings` is extra JSON members describing the run, "" for none.
+void writeFrameStatsJson(FrameStats *stats, const char *path, const char *executable, const char *settings)
+{
+    while (stats->numPending > 0) {
+        collectFrameTimer(stats);
+    }
+    // the last frame started has no end yet, the frames with a frame time are complete
+    unsigned int count = stats->numFrames;
+
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        printf("ERROR::FRAME_STATS::CANNOT_WRITE %s\n", path);
+        return;
+    }
+    fprintf(f, "{\n");
+    fprintf(f, "  \"executable\": \"%s\",\n", executable);
+    fprintf(f, "  \"renderer\": \"%s\",\n", (const char *) glGetString(GL_RENDERER));
+    fprintf(f, "  \"frames\": %u,\n", count);
+    fprintf(f, "  \"warmup_frames\": %d,\n", BENCHMARK_WARMUP_FRAMES);
+    fprintf(f, "  \"time_step\": %.6f,\n", BENCHMARK_TIME_STEP);
+    if (settings && settings[0]) {
+        fprintf(f, "  %s,\n", settings);
+    }
+    writeFrameTimeSummary(f, "frame_ms", stats->frameTimes, count, false);
+    writeFrameTimeSummary(f, "cpu_ms", stats->cpuTimes, count, false);
+    writeFrameTimeSummary(f, "gpu_ms", stats->gpuTimes, count, true);
+    fprintf(f, "}\n");
+    fclose(f);
+    printf("benchmark: %u frames written to %s\n", count, path);
+}
+
+void freeFrameStats(FrameStats *stats)
+{
+    glDeleteQueries(FRAME_TIMER_LATENCY, stats->queries);
+    free(stats->frameTimes);
+    free(stats->cpuTimes);
+    free(stats->gpuTimes);
+    memset(stats, 0, sizeof(*stats));
+}
+
+#endif // _FLYTHROUGH_H_
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
 #include <math.h>
 
 #include <glad/glad.h>
@@ -11,15 +12,24 @@
 #include "mesh.h"
 #include "model.h"
 #include "light_cube_vertices.h"
+#include "bench.h"
+#include "display.h"
+#include "trace.h"
+#include "flythrough.h"
+#include "gpu_profiler.h"
+#include "text_overlay.h"
 
 #define SCR_WIDTH 800
 #define SCR_HEIGHT 600
 
+DisplayBackend display;
+
 vec3 cameraPos = {0.0f, 0.0f, 3.0f};
 vec3 cameraFront = {0.0f, 0.0f, -1.0f};
 vec3 cameraUp = {0.0f, 1.0f, 0.0f};
 
 bool firstMouse = true;
+bool traceKeyDown = false;
 float yaw   = -90.0f; // yaw is initialized to -90.0 degrees since a yaw of 0.0 results in a direction vector pointing to the right so we initially rotate a bit to the left.
 float pitch =  0.0f;
 float lastX = SCR_WIDTH / 2, lastY = SCR_HEIGHT / 2;
@@ -30,6 +40,16 @@ float lastFrame = 0.0f; // Time of last frame
 
 vec3 lightPos = {1.2f, 1.0f, 2.0f};
 
+// --benchmark circles the model, close up and from afar
+const FlythroughKey benchmarkKeys[] = {
+    {{0.0f, 0.5f, 6.0f}, {0.0f, 0.0f, 0.0f}},
+    {{4.0f, 2.0f, 3.0f}, {0.0f, 0.5f, 0.0f}},
+    {{3.0f, 0.0f, -2.5f}, {0.0f, 0.0f, 0.0f}},
+    {{0.0f, -1.5f, -4.0f}, {0.0f, 0.0f, 0.0f}},
+    {{-2.5f, 1.0f, -1.5f}, {0.0f, 1.0f, 0.0f}},
+    {{-6.0f, 3.0f, 4.0f}, {0.0f, 0.0f, 0.0f}},
+};
+
 void error_callback (int error, const char* description)
 {
     printf("%s\n", description);
@@ -42,6 +62,7 @@ void framebuffer_size_callback (GLFWwindow* window, int width, int height)
 
 void processInput (GLFWwindow *window)
 {
+    TRACE_FUNCTION();
     float cameraSpeed = 2.5f * deltaTime;
     vec3 tmp, tmp2;
 
@@ -65,6 +86,11 @@ void processInput (GLFWwindow *window)
         glm_vec3_scale(tmp, cameraSpeed, tmp2);
         glm_vec3_add(cameraPos, tmp2, cameraPos);
     }
+    bool f12KeyDown = TRACE_ENABLED && glfwGetKey(window, GLFW_KEY_F12) == GLFW_PRESS;
+    if (f12KeyDown && !traceKeyDown) {
+        TRACE_WRITE(TRACE_OUTPUT);
+    }
+    traceKeyDown = f12KeyDown;
     if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS) {
         glfwSetWindowShouldClose(window, GLFW_TRUE);
     }
@@ -111,54 +137,104 @@ void scroll_callback (GLFWwindow* window, double xoffset, double yoffset)
     }
 }
 
-GLFWwindow* createWindow ()
+GLFWwindow* createWindow (const DisplayOptions *options)
 {
     glfwSetErrorCallback(error_callback);
+    openDisplay(&display, options, SCR_WIDTH, SCR_HEIGHT);
 
-    if (glfwInit() == GLFW_FALSE) {
-        printf("Failed to initialize GLFW\n");
-        exit(EXIT_FAILURE);
+    GLFWwindow *window = display.window;
+    if (window) {
+        glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+
+        glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+        glfwSetCursorPosCallback(window, mouse_callback);
+        glfwSetScrollCallback(window, scroll_callback);
     }
 
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    return window;
+}
 
-    GLFWwindow* window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "LearnOpenGL", NULL, NULL);
-    if (window == NULL) {
-        printf("Failed to create GLFW window\n");
-        glfwTerminate();
-        exit(EXIT_FAILURE);
+int main (int argc, char *argv[])
+{
+    unsigned int modelFlags = MODEL_LOAD_MMAP | MODEL_OPTIMIZE | MODEL_PACK_VERTICES;
+    const char *benchThreadsPath = NULL;
+    const char *benchmarkOutput = NULL;
+    DisplayOptions displayOptions = {0};
+    GpuProfilerOptions profilerOptions = {0};
+
+    for (int i = 1; i < argc; i++) {
+        if (parseDisplayOption(&displayOptions, argc, argv, &i) || parseGpuProfilerOption(&profilerOptions, argc, argv, &i)) {
+            continue;
+        }
+        if (strcmp(argv[i], "--no-mmap") == 0) {
+            modelFlags &= ~MODEL_LOAD_MMAP;
+        }
+        else if (strcmp(argv[i], "--no-cache") == 0) {
+            modelFlags |= MODEL_NO_CACHE;
+        }
+        else if (strcmp(argv[i], "--no-optimize") == 0) {
+            modelFlags &= ~MODEL_OPTIMIZE;
+        }
+        else if (strcmp(argv[i], "--no-pack") == 0) {
+            modelFlags &= ~MODEL_PACK_VERTICES;
+        }
+        else if (strcmp(argv[i], "--bench-threads") == 0) {
+            benchThreadsPath = "resources/backpack/backpack.obj";
+            if (i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0) {
+                benchThreadsPath = argv[++i];
+            }
+        }
+        else if (strcmp(argv[i], "--benchmark") == 0) {
+            benchmarkOutput = BENCHMARK_DEFAULT_OUTPUT;
+            if (i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0) {
+                benchmarkOutput = argv[++i];
+            }
+        }
+        else {
+            printf("Unknown option %s\n", argv[i]);
+            printf("Usage: %s [--no-mmap] [--no-cache] [--no-optimize] [--no-pack] [--bench-threads [model]] [--benchmark [file]] %s %s\n", argv[0], GPU_PROFILER_USAGE, DISPLAY_USAGE);
+            exit(EXIT_FAILURE);
+        }
     }
-    glfwMakeContextCurrent(window);
 
-    if (!gladLoadGLLoader((GLADloadproc) glfwGetProcAddress)) {
-        printf("Failed to initialize GLAD\n");
-        exit(EXIT_FAILURE);
+    if (benchmarkOutput && displayOptions.numFrames == 0) {
+        // one frame past the timed ones ends the last frame time
+        displayOptions.numFrames = BENCHMARK_WARMUP_FRAMES + BENCHMARK_FRAMES + 1;
     }
 
-    glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
-    glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
-
-    glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
-    glfwSetCursorPosCallback(window, mouse_callback);
-    glfwSetScrollCallback(window, scroll_callback);
+    initJobSystem(getNumCores() - 1);
 
-    return window;
-}
+    if (benchThreadsPath) {
+        // CPU only, no window needed
+        benchModelThreads(benchThreadsPath, 10);
+        shutdownJobSystem();
+        return EXIT_SUCCESS;
+    }
 
-int main (int argc, char *argv[])
-{
-    GLFWwindow *window = createWindow();
+    GLFWwindow *window = createWindow(&displayOptions);
 
     glEnable(GL_DEPTH_TEST);
 
     // tell stb_image.h to flip loaded texture's on the y-axis (before loading model).
     stbi_set_flip_vertically_on_load(true);
 
-    unsigned int program = createProgram("model_loading/shader.vert", "model_loading/shader.frag");
+    const char *vertexDefines = modelFlags & MODEL_PACK_VERTICES ? PACKED_VERTICES_DEFINE : NULL;
+    unsigned int program = createProgramVariant("model_loading/shader.vert", "model_loading/shader.frag", vertexDefines);
     unsigned int lightProgram = createProgram("model_loading/light_shader.vert", "model_loading/light_shader.frag");
-    Model model = createModel("resources/backpack/backpack.obj");
+    bindMaterialSamplers(program);
+
+    // every uniform is resolved here, the render loop does no lookups by name
+    ProgramReflection *programUniforms = getProgramReflection(program);
+    ProgramReflection *lightUniforms = getProgramReflection(lightProgram);
+    GLint viewPosLocation = uniformLocation(program, "viewPos");
+    GLint lightPositionLocation = uniformLocation(program, "light.position");
+    GLint lightAmbientLocation = uniformLocation(program, "light.ambient");
+    GLint lightDiffuseLocation = uniformLocation(program, "light.diffuse");
+    GLint lightSpecularLocation = uniformLocation(program, "light.specular");
+    printMemoryUsage("before loading model");
+    Model model = createModel("resources/backpack/backpack.obj", modelFlags);
+    printMemoryUsage("after loading model");
+    printModelMemory(&model, "resources/backpack/backpack.obj");
 
     // configure light cube
     unsigned int VBO, lightCubeVAO;
@@ -176,13 +252,52 @@ int main (int argc, char *argv[])
     glBindBuffer(GL_ARRAY_BUFFER, VBO);
     glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
 
-    while (!glfwWindowShouldClose(window))
+    FlythroughPath flythrough = {
+        .keys = benchmarkKeys,
+        .numKeys = sizeof(benchmarkKeys) / sizeof(benchmarkKeys[0]),
+        .numFrames = BENCHMARK_FRAMES,
+    };
+    // --profile-gpu times the passes and shows their averages over the frame
+    GpuProfiler gpuProfiler;
+    initGpuProfiler(&gpuProfiler, &profilerOptions);
+    TextOverlay profileOverlay;
+    unsigned int textProgram = 0;
+    if (gpuProfiler.enabled) {
+        textProgram = createProgram("model_loading/text.vert", "model_loading/text.frag");
+        initTextOverlay(&profileOverlay, textProgram);
+    }
+
+    FrameStats frameStats;
+    if (benchmarkOutput) {
+        // every frame of the run sees the same textures
+        finishTextureUploads();
+        initFrameStats(&frameStats, display.frameLimit > BENCHMARK_WARMUP_FRAMES ?
+            display.frameLimit - BENCHMARK_WARMUP_FRAMES : 1);
+    }
+
+    unsigned int numFrames = 0;
+    beginSteadyState();
+
+    while (!displayShouldClose(&display))
     {
-        float currentFrame = glfwGetTime();
+        TRACE_SCOPE("frame");
+        // the benchmark steps by frame, not by wall clock
+        float currentFrame = benchmarkOutput ? numFrames * BENCHMARK_TIME_STEP : displayTime(&display);
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
-
-        processInput(window);
+        if (benchmarkOutput) {
+            sampleFlythrough(&flythrough, numFrames, cameraPos, cameraFront);
+            if (numFrames >= BENCHMARK_WARMUP_FRAMES) {
+                beginFrameStats(&frameStats, displayTime(&display));
+            }
+        }
+        numFrames++;
+
+        if (window && !benchmarkOutput) {
+            processInput(window);
+        }
+        processTextureUploads(0.002);
+        beginGpuProfilerFrame(&gpuProfiler);
 
         glClearColor(0.05f, 0.05f, 0.05f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -193,14 +308,14 @@ int main (int argc, char *argv[])
         //glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 
         // light properties
-        glUniform3fv(glGetUniformLocation(program, "viewPos"), 1, cameraPos);
-        glUniform3fv(glGetUniformLocation(program, "light.position"), 1, lightPos);
+        glUniform3fv(viewPosLocation, 1, cameraPos);
+        glUniform3fv(lightPositionLocation, 1, lightPos);
         vec3 lightAmbient = {0.2f, 0.2f, 0.2f};
         vec3 lightDiffuse = {0.5f, 0.5f, 0.5f};
         vec3 lightSpecular = {1.0f, 1.0f, 1.0f};
-        glUniform3fv(glGetUniformLocation(program, "light.ambient"), 1, lightAmbient);
-        glUniform3fv(glGetUniformLocation(program, "light.diffuse"), 1, lightDiffuse);
-        glUniform3fv(glGetUniformLocation(program, "light.specular"), 1, lightSpecular);
+        glUniform3fv(lightAmbientLocation, 1, lightAmbient);
+        glUniform3fv(lightDiffuseLocation, 1, lightDiffuse);
+        glUniform3fv(lightSpecularLocation, 1, lightSpecular);
 
         // view/projection transformations
         mat4 view, projection;
@@ -208,8 +323,8 @@ int main (int argc, char *argv[])
         glm_vec3_add(cameraPos, cameraFront, center);
         glm_lookat(cameraPos, center, cameraUp, view);
         glm_perspective(glm_rad(fov), (float) SCR_WIDTH / (float) SCR_HEIGHT, 0.1f, 100.0f, projection);
-        glUniformMatrix4fv(glGetUniformLocation(program, "view"), 1, GL_FALSE, (float *) view);
-        glUniformMatrix4fv(glGetUniformLocation(program, "projection"), 1, GL_FALSE, (float *) projection);
+        glUniformMatrix4fv(programUniforms->view, 1, GL_FALSE, (float *) view);
+        glUniformMatrix4fv(programUniforms->projection, 1, GL_FALSE, (float *) projection);
 
         // render the loaded model
         mat4 modelMatrix;
@@ -218,24 +333,37 @@ int main (int argc, char *argv[])
         glm_translate(modelMatrix, auxTranslate);
         vec3 auxScale = {1.0f, 1.0f, 1.0f};
         glm_scale(modelMatrix, auxScale);
-        glUniformMatrix4fv(glGetUniformLocation(program, "model"), 1, GL_FALSE, (float *) modelMatrix);
+        glUniformMatrix4fv(programUniforms->model, 1, GL_FALSE, (float *) modelMatrix);
+        unsigned int scope = beginGpuScope(&gpuProfiler, "model");
         drawModel(&model, program);
+        endGpuScope(&gpuProfiler, scope);
 
         // draw point light
+        scope = beginGpuScope(&gpuProfiler, "light cube");
         glUseProgram(lightProgram);
-        glUniformMatrix4fv(glGetUniformLocation(lightProgram, "view"), 1, GL_FALSE, (float *) view);
-        glUniformMatrix4fv(glGetUniformLocation(lightProgram, "projection"), 1, GL_FALSE, (float *) projection);
+        glUniformMatrix4fv(lightUniforms->view, 1, GL_FALSE, (float *) view);
+        glUniformMatrix4fv(lightUniforms->projection, 1, GL_FALSE, (float *) projection);
         glm_mat4_identity(modelMatrix);
         glm_translate(modelMatrix, lightPos);
         vec3 lightCubeSize = {0.2f, 0.2f, 0.2f};
         glm_scale(modelMatrix, lightCubeSize);
-        glUniformMatrix4fv(glGetUniformLocation(program, "model"), 1, GL_FALSE, (float *) modelMatrix);
+        glUniformMatrix4fv(lightUniforms->model, 1, GL_FALSE, (float *) modelMatrix);
 
         glBindVertexArray(lightCubeVAO);
         glDrawArrays(GL_TRIANGLES, 0, 36);
-
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+        endGpuScope(&gpuProfiler, scope);
+
+        if (gpuProfiler.enabled) {
+            char profile[512];
+            formatGpuProfiler(&gpuProfiler, profile, sizeof(profile));
+            drawTextOverlay(&profileOverlay, profile, 8.0f, 8.0f, 2.0f, SCR_WIDTH, SCR_HEIGHT);
+        }
+        endGpuProfilerFrame(&gpuProfiler);
+
+        if (benchmarkOutput) {
+            endFrameStats(&frameStats, displayTime(&display));
+        }
+        presentDisplay(&display);
     }
 
     //glDeleteVertexArrays(1, &cubeVAO);
@@ -244,7 +372,29 @@ int main (int argc, char *argv[])
     glDeleteProgram(program);
     glDeleteProgram(lightProgram);
 
-    glfwTerminate();
+    printTextureLoaderStats();
+    printTextureCacheStats();
+    printGeometryArenaStats();
+    printUniformQueryStats(numFrames);
+    printGpuProfilerStats(&gpuProfiler);
+    if (gpuProfiler.enabled) {
+        destroyTextOverlay(&profileOverlay);
+        glDeleteProgram(textProgram);
+    }
+    destroyGpuProfiler(&gpuProfiler);
+
+    if (benchmarkOutput) {
+        char settings[256];
+        snprintf(settings, sizeof(settings), "\"model\": \"%s\", \"vertices\": \"%s\", \"width\": %d, \"height\": %d, "
+            "\"headless\": %s", "resources/backpack/backpack.obj", modelFlags & MODEL_PACK_VERTICES ? "packed" : "float",
+            SCR_WIDTH, SCR_HEIGHT, display.headless ? "true" : "false");
+        writeFrameStatsJson(&frameStats, benchmarkOutput, "model_loading", settings);
+        freeFrameStats(&frameStats);
+    }
+
+    TRACE_WRITE(TRACE_OUTPUT);
+    closeDisplay(&display);
+    shutdownJobSystem();
 
     return EXIT_SUCCESS;
 }
@@ -2,20 +2,43 @@
 #define _MESH_H_
 
 #include <limits.h>
+#include <stdint.h>
 
 #include <glad/glad.h>
 #include <cglm/cglm.h>
 
-typedef struct {
-    vec3 position;
-    vec3 normal;
-    vec2 texCoords;
-} Vertex;
+#include "vertex_packing.h"
+#include "vertex_format.h"
+#include "geometry_arena.h"
+#include "shader.h"
+#include "trace.h"
+
+typedef enum {
+    TEXTURE_DIFFUSE,
+    TEXTURE_SPECULAR,
+    TEXTURE_NORMAL,
+    TEXTURE_HEIGHT,
+    TEXTURE_TYPE_COUNT,
+} TextureType;
+
+// sampler names in the shaders are <name><N>, optionally inside a "material" struct
+const char *textureTypeNames[TEXTURE_TYPE_COUNT] = {
+    "texture_diffuse",
+    "texture_specular",
+    "texture_normal",
+    "texture_height",
+};
+
+// Every sampler gets a fixed texture unit, the N-th texture of a type is bound
+// to unit type * MATERIAL_TEXTURES_PER_TYPE + N
+#define MATERIAL_TEXTURES_PER_TYPE 4
+
+#define MESH_MAX_LODS 4
 
 typedef struct {
     unsigned int id;
-    char type[50];
-    char path[PATH_MAX];  // we store the path of the texture to compare with other textures
+    TextureType type;
+    char *path;  // as referenced by the material, relative to the model directory
 } Texture;
 
 typedef struct {
@@ -25,35 +48,175 @@ typedef struct {
 
     unsigned int numVertices, numIndices, numTextures;
 
+    // packed positions decode as position * positionScale + positionOffset
+    VertexFormat vertexFormat;
+    vec3 positionScale, positionOffset;
+
+    // GL_UNSIGNED_SHORT whenever every index fits, GL_UNSIGNED_INT otherwise
+    GLenum indexType;
+
+    // levels of detail drawing the same vertices, level 0 is `indices` and the
+    // coarser ones follow it in the index buffer, see generateMeshLods()
+    unsigned int numLods;  // 0 until uploaded without any, then 1
+    unsigned int lodFirstIndex[MESH_MAX_LODS], lodNumIndices[MESH_MAX_LODS];
+    float lodErrors[MESH_MAX_LODS];  // largest deviation from level 0, in model units
+    unsigned int *lodIndices;        // levels 1.. until they are uploaded
+
+    // either own buffers, or a range of a shared arena (VAO, VBO and EBO stay 0)
     unsigned int VAO, VBO, EBO;
+    GeometryArena *arena;
+    unsigned int geometry;
 } Mesh;
 
+// Quantize the vertices against the mesh bounds, filling in the dequantization constants
+PackedVertex * packMeshVertices(Mesh *mesh)
+{
+    vec3 boundsMin = {INFINITY, INFINITY, INFINITY}, boundsMax = {-INFINITY, -INFINITY, -INFINITY};
+    for (unsigned int i = 0; i < mesh->numVertices; i++) {
+        glm_vec3_minv(boundsMin, mesh->vertices[i].position, boundsMin);
+        glm_vec3_maxv(boundsMax, mesh->vertices[i].position, boundsMax);
+    }
+
+    vec3 inverseScale;
+    for (int c = 0; c < 3; c++) {
+        float extent = mesh->numVertices ? boundsMax[c] - boundsMin[c] : 0.0f;
+        mesh->positionOffset[c] = mesh->numVertices ? boundsMin[c] : 0.0f;
+        mesh->positionScale[c] = extent;
+        inverseScale[c] = extent > 0.0f ? 1.0f / extent : 0.0f;
+    }
+
+    PackedVertex *packed = malloc((mesh->numVertices ? mesh->numVertices : 1) * sizeof(PackedVertex));
+    for (unsigned int i = 0; i < mesh->numVertices; i++) {
+        Vertex *vertex = &mesh->vertices[i];
+
+        for (int c = 0; c < 3; c++) {
+            packed[i].position[c] = packUnorm16((vertex->position[c] - mesh->positionOffset[c]) * inverseScale[c]);
+        }
+        packed[i].position[3] = 0;
+        packed[i].normal = packSnorm1010102(vertex->normal);
+        packed[i].texCoords[0] = packHalf(vertex->texCoords[0]);
+        packed[i].texCoords[1] = packHalf(vertex->texCoords[1]);
+    }
+
+    return packed;
+}
+
+// Indices of all levels of detail together
+unsigned int meshTotalIndices(Mesh *mesh)
+{
+    return mesh->numLods > 1 ? mesh->lodFirstIndex[mesh->numLods - 1] + mesh->lodNumIndices[mesh->numLods - 1] : mesh->numIndices;
+}
+
+// Vertex and index data in the formats the mesh is uploaded with. The pointers
+// either alias the mesh arrays or are temporary copies, see freeMeshUploadData().
+void prepareMeshUploadData(Mesh *mesh, const void **vertexData, const void **indexData)
+{
+    if (mesh->numLods <= 1) {
+        mesh->numLods = 1;
+        mesh->lodFirstIndex[0] = 0;
+        mesh->lodNumIndices[0] = mesh->numIndices;
+        mesh->lodErrors[0] = 0.0f;
+    }
+
+    if (mesh->vertexFormat == VERTEX_FORMAT_PACKED) {
+        *vertexData = packMeshVertices(mesh);
+    }
+    else {
+        glm_vec3_one(mesh->positionScale);
+        glm_vec3_zero(mesh->positionOffset);
+        *vertexData = mesh->vertices;
+    }
+
+    // the coarser levels go right behind level 0
+    unsigned int numIndices = meshTotalIndices(mesh);
+    mesh->indexType = chooseIndexType(mesh->numVertices);
+    if (mesh->indexType == GL_UNSIGNED_SHORT) {
+        uint16_t *indices = malloc((numIndices ? numIndices : 1) * sizeof(uint16_t));
+        for (unsigned int i = 0; i < numIndices; i++) {
+            indices[i] = i < mesh->numIndices ? mesh->indices[i] : mesh->lodIndices[i - mesh->numIndices];
+        }
+        *indexData = indices;
+    }
+    else if (numIndices > mesh->numIndices) {
+        unsigned int *indices = malloc(numIndices * sizeof(unsigned int));
+        memcpy(indices, mesh->indices, mesh->numIndices * sizeof(unsigned int));
+        memcpy(indices + mesh->numIndices, mesh->lodIndices, (numIndices - mesh->numIndices) * sizeof(unsigned int));
+        *indexData = indices;
+    }
+    else {
+        *indexData = mesh->indices;
+    }
+}
+
+void freeMeshUploadData(Mesh *mesh, const void *vertexData, const void *indexData)
+{
+    if (vertexData != mesh->vertices) {
+        free((void *) vertexData);
+    }
+    if (indexData != mesh->indices) {
+        free((void *) indexData);
+    }
+}
+
 void setupMesh(Mesh *mesh)
 {
+    const void *vertexData, *indexData;
+    prepareMeshUploadData(mesh, &vertexData, &indexData);
+
     glGenVertexArrays(1, &mesh->VAO);
     glGenBuffers(1, &mesh->VBO);
     glGenBuffers(1, &mesh->EBO);
 
     glBindVertexArray(mesh->VAO);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh->VBO);
 
-    glBufferData(GL_ARRAY_BUFFER, mesh->numVertices * sizeof(Vertex), mesh->vertices, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, mesh->VBO);
+    glBufferData(GL_ARRAY_BUFFER, mesh->numVertices * vertexFormatSize(mesh->vertexFormat),
+                 vertexData, GL_STATIC_DRAW);
 
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh->numIndices * sizeof(unsigned int), 
-                 mesh->indices, GL_STATIC_DRAW);
-
-    // vertex positions
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *) 0);
-    // vertex normals
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *) offsetof(Vertex, normal));
-    // vertex texture coords
-    glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *) offsetof(Vertex, texCoords));
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, meshTotalIndices(mesh) * indexTypeSize(mesh->indexType), 
+                 indexData, GL_STATIC_DRAW);
+
+    setupVertexAttributes(mesh->vertexFormat);
 
     glBindVertexArray(0);
+
+    freeMeshUploadData(mesh, vertexData, indexData);
+}
+
+// Upload into the shared arena of the mesh vertex format instead of own buffers
+void setupMeshInArena(Mesh *mesh)
+{
+    const void *vertexData, *indexData;
+    prepareMeshUploadData(mesh, &vertexData, &indexData);
+
+    mesh->arena = getGeometryArena(mesh->vertexFormat);
+    mesh->geometry = uploadGeometry(mesh->arena, vertexData, mesh->numVertices,
+        indexData, meshTotalIndices(mesh) * indexTypeSize(mesh->indexType));
+
+    freeMeshUploadData(mesh, vertexData, indexData);
+}
+
+unsigned int meshVertexArray(Mesh *mesh)
+{
+    return mesh->arena ? mesh->arena->VAO : mesh->VAO;
+}
+
+GLint meshBaseVertex(Mesh *mesh)
+{
+    return mesh->arena ? mesh->arena->allocations[mesh->geometry].firstVertex : 0;
+}
+
+// Offset of the first index in the element buffer, as the draw call pointer argument
+void * meshIndexOffset(Mesh *mesh)
+{
+    return (void *) (uintptr_t) (mesh->arena ? mesh->arena->allocations[mesh->geometry].indexOffset : 0);
+}
+
+// First index of level of detail `lod`, as the draw call pointer argument
+void * meshLodIndexOffset(Mesh *mesh, unsigned int lod)
+{
+    return (char *) meshIndexOffset(mesh) + mesh->lodFirstIndex[lod] * indexTypeSize(mesh->indexType);
 }
 
 Mesh createMesh(Vertex *vertices, unsigned int numVertices, unsigned int *indices,
@@ -74,37 +237,105 @@ Mesh createMesh(Vertex *vertices, unsigned int numVertices, unsigned int *indice
     return mesh;
 }
 
-void drawMesh(Mesh *mesh, unsigned int shader)
+unsigned int materialTextureUnit(TextureType type, unsigned int n)
 {
-    unsigned int diffuseNr = 1;
-    unsigned int specularNr = 1;
+    return type * MATERIAL_TEXTURES_PER_TYPE + n;
+}
 
-    for (unsigned int i = 0; i < mesh->numTextures; i++) {
-        glActiveTexture(GL_TEXTURE0 + i); // activate proper texture unit before binding
-        // retrieve texture number (the N in diffuse_textureN)
-        char number[50], uniform[100];
-        char *name = mesh->textures[i].type;
-        if (strcmp(name, "texture_diffuse") == 0) {
-            sprintf(number, "%d", diffuseNr++);
-        }
-        else if (strcmp(name, "texture_specular") == 0) {
-            sprintf(number, "%d", specularNr++);
+// Point the material samplers of `program` at their fixed units. Sampler values
+// are program state, so this runs once after linking and never per draw.
+void bindMaterialSamplers(unsigned int program)
+{
+    glUseProgram(program);
+
+    for (unsigned int type = 0; type < TEXTURE_TYPE_COUNT; type++) {
+        for (unsigned int n = 0; n < MATERIAL_TEXTURES_PER_TYPE; n++) {
+            char name[64], structName[80];
+            snprintf(name, sizeof(name), "%s%u", textureTypeNames[type], n + 1);
+            snprintf(structName, sizeof(structName), "material.%s", name);
+
+            GLint location = uniformLocation(program, name);
+            if (location < 0) {
+                location = uniformLocation(program, structName);
+            }
+            glUniform1i(location, materialTextureUnit(type, n));
         }
-        else {
-            printf("Texture type not supported\n");
-            exit(EXIT_FAILURE);
+    }
+
+    glUseProgram(0);
+}
+
+// Bind the textures of the mesh and set its per mesh uniforms
+void bindMeshMaterial(Mesh *mesh, unsigned int shader)
+{
+    unsigned int numPerType[TEXTURE_TYPE_COUNT] = {0};
+
+    for (unsigned int i = 0; i < mesh->numTextures; i++) {
+        TextureType type = mesh->textures[i].type;
+        unsigned int n = numPerType[type]++;
+        if (n >= MATERIAL_TEXTURES_PER_TYPE) {
+            continue;
         }
 
-        sprintf(uniform, "material.%s%s", name, number);
-        glUniform1f(glGetUniformLocation(shader, uniform), i);
+        glActiveTexture(GL_TEXTURE0 + materialTextureUnit(type, n));
         glBindTexture(GL_TEXTURE_2D, mesh->textures[i].id);
     }
     glActiveTexture(GL_TEXTURE0);
 
+    // identity for float vertices, so shaders built either way can be used
+    ProgramReflection *reflection = getProgramReflection(shader);
+    glUniform3fv(reflection->positionScale, 1, mesh->positionScale);
+    glUniform3fv(reflection->positionOffset, 1, mesh->positionOffset);
+}
+
+void drawMesh(Mesh *mesh, unsigned int shader)
+{
+    TRACE_FUNCTION();
+    bindMeshMaterial(mesh, shader);
+
     // draw mesh
-    glBindVertexArray(mesh->VAO);
-    glDrawElements(GL_TRIANGLES, mesh->numIndices, GL_UNSIGNED_INT, 0);
+    glBindVertexArray(meshVertexArray(mesh));
+    glDrawElementsBaseVertex(GL_TRIANGLES, mesh->numIndices, mesh->indexType, meshIndexOffset(mesh), meshBaseVertex(mesh));
     glBindVertexArray(0);
 }
 
+// Drop the CPU copy of the geometry once it lives in GL buffers
+void releaseMeshData(Mesh *mesh)
+{
+    free(mesh->vertices);
+    free(mesh->indices);
+    free(mesh->lodIndices);
+    mesh->vertices = NULL;
+    mesh->indices = NULL;
+    mesh->lodIndices = NULL;
+}
+
+void freeMeshTextures(Mesh *mesh)
+{
+    for (unsigned int i = 0; i < mesh->numTextures; i++) {
+        free(mesh->textures[i].path);
+    }
+    free(mesh->textures);
+    mesh->textures = NULL;
+    mesh->numTextures = 0;
+}
+
+void destroyMesh(Mesh *mesh)
+{
+    if (mesh->arena) {
+        freeGeometry(mesh->arena, mesh->geometry);
+        mesh->arena = NULL;
+    }
+    else {
+        glDeleteVertexArrays(1, &mesh->VAO);
+        glDeleteBuffers(1, &mesh->VBO);
+        glDeleteBuffers(1, &mesh->EBO);
+    }
+
+    free(mesh->vertices);
+    free(mesh->indices);
+    free(mesh->lodIndices);
+    freeMeshTextures(mesh);
+}
+
 #endif // _MESH_H_
@@ -0,0 +1,364 @@
+#ifndef _MESH_CACHE_H_
+#define _MESH_CACHE_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/mman.h>
+
+#include "mesh.h"
+#include "hash.h"
+
+// Binary cache written next to the source asset (e.g. planet.obj.meshcache).
+// Layout: header, then for every mesh a MeshCacheMesh record followed by its
+// texture references, vertices and indices, and with more than one level of
+// detail a MeshCacheLods record and the indices of levels 1... Every block is
+// padded to 4 bytes.
+#define MESH_CACHE_MAGIC 0x4843534du // "MSCH"
+#define MESH_CACHE_VERSION 3
+#define MESH_CACHE_EXTENSION ".meshcache"
+#define MESH_CACHE_MAX_TYPE_LENGTH 64
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t sourceHash;  // hashFile() of the source asset
+    uint64_t sourceSize;
+    uint32_t numMeshes;
+    uint32_t options;     // processing options baked into the geometry, must match to be used
+} MeshCacheHeader;
+
+typedef struct {
+    uint32_t numVertices;
+    uint32_t numIndices;
+    uint32_t numTextures;
+    uint32_t numLods;  // 0 or 1 without levels of detail
+} MeshCacheMesh;
+
+typedef struct {
+    uint32_t numIndices[MESH_MAX_LODS];  // [0] is the record's numIndices
+    float errors[MESH_MAX_LODS];
+} MeshCacheLods;
+
+typedef struct {
+    uint16_t typeLength;
+    uint16_t pathLength;
+    // followed by the type and path characters (not null terminated)
+} MeshCacheTexture;
+
+typedef struct {
+    const char *type;
+    const char *path;
+    unsigned int typeLength, pathLength;
+} MeshCacheTextureRef;
+
+typedef struct {
+    const Vertex *vertices;
+    const unsigned int *indices;
+    MeshCacheTextureRef *textures;
+
+    unsigned int numVertices, numIndices, numTextures;
+
+    // levels 1.. follow each other in lodIndices
+    unsigned int numLods;
+    unsigned int lodNumIndices[MESH_MAX_LODS];
+    float lodErrors[MESH_MAX_LODS];
+    const unsigned int *lodIndices;
+} MeshCacheEntry;
+
+typedef struct {
+    unsigned char *data;
+    size_t size;
+    bool mapped;  // data is a read-only mapping of the file instead of a heap copy
+
+    MeshCacheEntry *entries;
+    MeshCacheTextureRef *textureRefs;
+    unsigned int numEntries;
+} MeshCache;
+
+void getMeshCachePath(const char *sourcePath, char *cachePath, size_t size)
+{
+    snprintf(cachePath, size, "%s%s", sourcePath, MESH_CACHE_EXTENSION);
+}
+
+size_t meshCachePadding(size_t size)
+{
+    return (4 - (size & 3)) & 3;
+}
+
+bool writeMeshCacheBlock(FILE *f, const void *data, size_t size)
+{
+    static const char zeros[4] = {0};
+
+    if (size && fwrite(data, 1, size, f) != size) {
+        return false;
+    }
+
+    size_t padding = meshCachePadding(size);
+    return padding == 0 || fwrite(zeros, 1, padding, f) == padding;
+}
+
+bool writeMeshCache(const char *cachePath, uint64_t sourceHash, uint64_t sourceSize, unsigned int options,
+    Mesh *meshes, unsigned int numMeshes)
+{
+    // write to a temporary file first so a crash never leaves a truncated cache behind
+    char tmpPath[PATH_MAX];
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", cachePath);
+
+    FILE *f = fopen(tmpPath, "wb");
+    if (!f) {
+        printf("Failed to write mesh cache %s\n", cachePath);
+        return false;
+    }
+
+    MeshCacheHeader header = {
+        .magic = MESH_CACHE_MAGIC,
+        .version = MESH_CACHE_VERSION,
+        .sourceHash = sourceHash,
+        .sourceSize = sourceSize,
+        .numMeshes = numMeshes,
+        .options = options,
+    };
+    bool ok = writeMeshCacheBlock(f, &header, sizeof(header));
+
+    for (unsigned int i = 0; ok && i < numMeshes; i++) {
+        Mesh *mesh = &meshes[i];
+        MeshCacheMesh record = {
+            .numVertices = mesh->numVertices,
+            .numIndices = mesh->numIndices,
+            .numTextures = mesh->numTextures,
+            .numLods = mesh->numLods,
+        };
+        ok = writeMeshCacheBlock(f, &record, sizeof(record));
+
+        for (unsigned int t = 0; ok && t < mesh->numTextures; t++) {
+            Texture *texture = &mesh->textures[t];
+            MeshCacheTexture ref = {
+                .typeLength = strlen(textureTypeNames[texture->type]),
+                .pathLength = strlen(texture->path),
+            };
+            if (ref.typeLength >= MESH_CACHE_MAX_TYPE_LENGTH || ref.pathLength >= PATH_MAX) {
+                ok = false;
+                break;
+            }
+
+            // type and path are packed back to back, the pair is padded as a single block
+            char strings[MESH_CACHE_MAX_TYPE_LENGTH + PATH_MAX];
+            memcpy(strings, textureTypeNames[texture->type], ref.typeLength);
+            memcpy(&strings[ref.typeLength], texture->path, ref.pathLength);
+
+            ok = writeMeshCacheBlock(f, &ref, sizeof(ref)) &&
+                 writeMeshCacheBlock(f, strings, ref.typeLength + ref.pathLength);
+        }
+
+        ok = ok &&
+             writeMeshCacheBlock(f, mesh->vertices, mesh->numVertices * sizeof(Vertex)) &&
+             writeMeshCacheBlock(f, mesh->indices, mesh->numIndices * sizeof(unsigned int));
+
+        if (ok && mesh->numLods > 1) {
+            MeshCacheLods lods = {0};
+            size_t numLodIndices = 0;
+            for (unsigned int lod = 0; lod < mesh->numLods; lod++) {
+                lods.numIndices[lod] = mesh->lodNumIndices[lod];
+                lods.errors[lod] = mesh->lodErrors[lod];
+                numLodIndices += lod ? mesh->lodNumIndices[lod] : 0;
+            }
+            ok = writeMeshCacheBlock(f, &lods, sizeof(lods)) &&
+                 writeMeshCacheBlock(f, mesh->lodIndices, numLodIndices * sizeof(unsigned int));
+        }
+    }
+
+    if (fclose(f) != 0) {
+        ok = false;
+    }
+
+    if (!ok || rename(tmpPath, cachePath) != 0) {
+        printf("Failed to write mesh cache %s\n", cachePath);
+        remove(tmpPath);
+        return false;
+    }
+
+    return true;
+}
+
+// Returns a pointer to the next `size` bytes of the cache and advances past them
+// (and their padding), or NULL if the file is truncated.
+const void * readMeshCacheBlock(MeshCache *cache, size_t *offset, size_t size)
+{
+    size_t padded = size + meshCachePadding(size);
+
+    if (padded < size || padded > cache->size - *offset) {
+        return NULL;
+    }
+
+    const void *block = &cache->data[*offset];
+    *offset += padded;
+
+    return block;
+}
+
+void closeMeshCache(MeshCache *cache)
+{
+    if (cache->mapped) {
+        munmap(cache->data, cache->size);
+    }
+    else {
+        free(cache->data);
+    }
+    free(cache->entries);
+    free(cache->textureRefs);
+    memset(cache, 0, sizeof(*cache));
+}
+
+// Parse and validate the whole cache file up front, so callers never see a
+// partially loaded model. Any mismatch (version, source hash, options, truncation,
+// counts or indices out of range) makes
+// the cache a miss and the caller falls back to a full import.
+// With `map` set the file is memory mapped and the entries point straight into
+// the mapping, so vertex and index data never pass through the heap.
+bool openMeshCache(MeshCache *cache, const char *cachePath, uint64_t sourceHash, uint64_t sourceSize,
+    unsigned int options, bool map)
+{
+    memset(cache, 0, sizeof(*cache));
+
+    FILE *f = fopen(cachePath, "rb");
+    if (!f) {
+        return false;
+    }
+
+    fseek(f, 0, SEEK_END);
+    long length = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    if (length < (long) sizeof(MeshCacheHeader)) {
+        fclose(f);
+        return false;
+    }
+
+    if (map) {
+        void *data = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+        fclose(f);
+        if (data == MAP_FAILED) {
+            return false;
+        }
+
+        // the whole blob is about to be streamed into glBufferData
+        madvise(data, length, MADV_WILLNEED);
+        cache->data = data;
+        cache->size = length;
+        cache->mapped = true;
+    }
+    else {
+        cache->data = malloc(length);
+        if (!cache->data) {
+            fclose(f);
+            return false;
+        }
+        cache->size = fread(cache->data, 1, length, f);
+        fclose(f);
+    }
+
+    size_t offset = 0;
+    const MeshCacheHeader *header = readMeshCacheBlock(cache, &offset, sizeof(MeshCacheHeader));
+    if (!header || header->magic != MESH_CACHE_MAGIC || header->version != MESH_CACHE_VERSION ||
+        header->sourceHash != sourceHash || header->sourceSize != sourceSize || header->options != options ||
+        header->numMeshes > cache->size / sizeof(MeshCacheMesh)) {
+        closeMeshCache(cache);
+        return false;
+    }
+
+    cache->numEntries = header->numMeshes;
+    cache->entries = calloc(cache->numEntries ? cache->numEntries : 1, sizeof(MeshCacheEntry));
+    if (!cache->entries) {
+        closeMeshCache(cache);
+        return false;
+    }
+
+    unsigned int numTextureRefs = 0;
+    for (unsigned int i = 0; i < cache->numEntries; i++) {
+        MeshCacheEntry *entry = &cache->entries[i];
+        const MeshCacheMesh *record = readMeshCacheBlock(cache, &offset, sizeof(MeshCacheMesh));
+        // every count must fit in what is left of the file before anything is sized by it
+        size_t remaining = record ? cache->size - offset : 0;
+        if (!record || record->numTextures > remaining / sizeof(MeshCacheTexture) ||
+            record->numVertices > remaining / sizeof(Vertex) || record->numIndices > remaining / sizeof(unsigned int)) {
+            closeMeshCache(cache);
+            return false;
+        }
+
+        entry->numVertices = record->numVertices;
+        entry->numIndices = record->numIndices;
+        entry->numTextures = record->numTextures;
+
+        MeshCacheTextureRef *textureRefs = realloc(cache->textureRefs,
+            ((size_t) numTextureRefs + entry->numTextures + 1) * sizeof(MeshCacheTextureRef));
+        if (!textureRefs) {
+            closeMeshCache(cache);
+            return false;
+        }
+        cache->textureRefs = textureRefs;
+        for (unsigned int t = 0; t < entry->numTextures; t++) {
+            const MeshCacheTexture *ref = readMeshCacheBlock(cache, &offset, sizeof(MeshCacheTexture));
+            const char *strings = ref ? readMeshCacheBlock(cache, &offset, ref->typeLength + ref->pathLength) : NULL;
+            if (!strings || ref->typeLength >= MESH_CACHE_MAX_TYPE_LENGTH || ref->pathLength >= PATH_MAX) {
+                closeMeshCache(cache);
+                return false;
+            }
+
+            MeshCacheTextureRef *textureRef = &cache->textureRefs[numTextureRefs + t];
+            textureRef->type = strings;
+            textureRef->typeLength = ref->typeLength;
+            textureRef->path = &strings[ref->typeLength];
+            textureRef->pathLength = ref->pathLength;
+        }
+        numTextureRefs += entry->numTextures;
+
+        entry->vertices = readMeshCacheBlock(cache, &offset, (size_t) entry->numVertices * sizeof(Vertex));
+        entry->indices = readMeshCacheBlock(cache, &offset, (size_t) entry->numIndices * sizeof(unsigned int));
+        if (!entry->vertices || !entry->indices || record->numLods > MESH_MAX_LODS) {
+            closeMeshCache(cache);
+            return false;
+        }
+
+        entry->numLods = record->numLods > 1 ? record->numLods : 1;
+        entry->lodNumIndices[0] = entry->numIndices;
+        size_t numLodIndices = 0;
+        if (entry->numLods > 1) {
+            const MeshCacheLods *lods = readMeshCacheBlock(cache, &offset, sizeof(MeshCacheLods));
+            for (unsigned int lod = 1; lods && lod < entry->numLods; lod++) {
+                entry->lodNumIndices[lod] = lods->numIndices[lod];
+                entry->lodErrors[lod] = lods->errors[lod];
+                numLodIndices += lods->numIndices[lod];
+            }
+            // the block read bounds the total, the sum of 32-bit counts cannot wrap a size_t
+            entry->lodIndices = lods ? readMeshCacheBlock(cache, &offset, numLodIndices * sizeof(unsigned int)) : NULL;
+            if (!entry->lodIndices) {
+                closeMeshCache(cache);
+                return false;
+            }
+        }
+
+        // an out of range index would reach the draws straight from the file
+        for (size_t j = 0; j < entry->numIndices + numLodIndices; j++) {
+            unsigned int index = j < entry->numIndices ? entry->indices[j] : entry->lodIndices[j - entry->numIndices];
+            if (index >= entry->numVertices) {
+                closeMeshCache(cache);
+                return false;
+            }
+        }
+    }
+
+    // texture refs were reallocated while parsing, resolve the per-mesh pointers last
+    numTextureRefs = 0;
+    for (unsigned int i = 0; i < cache->numEntries; i++) {
+        cache->entries[i].textures = &cache->textureRefs[numTextureRefs];
+        numTextureRefs += cache->entries[i].numTextures;
+    }
+
+    return true;
+}
+
+#endif // _MESH_CACHE_H_
@@ -0,0 +1,383 @@
+#ifndef _MESH_OPTIMIZE_H_
+#define _MESH_OPTIMIZE_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <cglm/cglm.h>
+
+#include "mesh.h"
+#include "hash.h"
+
+// Post-import optimization of indexed triangle meshes:
+//  - weldVertices() merges bit identical vertices (Assimp emits one vertex per face corner)
+//  - optimizeVertexCache() reorders triangles for the post-transform cache (Tipsify,
+//    Sander et al. 2007) and splits them into clusters where the cache gets flushed
+//  - optimizeOverdraw() sorts those clusters so outward facing ones on the hull draw first
+//  - optimizeVertexFetch() lays the vertices out in the order the indices first touch them
+// Everything runs on the CPU copy and is safe to call from job threads.
+
+#define VERTEX_CACHE_SIZE 16  // FIFO entries assumed by the optimizer and the analysis
+
+typedef struct {
+    unsigned int numTriangles;
+    unsigned int numVertices;     // vertices referenced by the index buffer
+    unsigned int numTransformed;  // vertex shader invocations with a FIFO post-transform cache
+} VertexCacheStats;
+
+// Simulate a FIFO post-transform cache of `cacheSize` entries over the index buffer
+VertexCacheStats analyzeVertexCache(const unsigned int *indices, unsigned int numIndices,
+    unsigned int numVertices, unsigned int cacheSize)
+{
+    VertexCacheStats stats = { .numTriangles = numIndices / 3 };
+
+    // a vertex is in the cache while fewer than cacheSize misses happened since it was loaded
+    unsigned int *loadedAt = malloc((numVertices ? numVertices : 1) * sizeof(unsigned int));
+    memset(loadedAt, 0xff, numVertices * sizeof(unsigned int));
+
+    for (unsigned int i = 0; i < numIndices; i++) {
+        unsigned int v = indices[i];
+
+        if (loadedAt[v] == ~0u) {
+            stats.numVertices++;
+        }
+        if (loadedAt[v] == ~0u || stats.numTransformed - loadedAt[v] >= cacheSize) {
+            loadedAt[v] = stats.numTransformed++;
+        }
+    }
+
+    free(loadedAt);
+
+    return stats;
+}
+
+void addVertexCacheStats(VertexCacheStats *total, VertexCacheStats stats)
+{
+    total->numTriangles += stats.numTriangles;
+    total->numVertices += stats.numVertices;
+    total->numTransformed += stats.numTransformed;
+}
+
+// Average cache miss ratio: transformed vertices per triangle, 0.5 is ideal, 3 is no reuse
+float vertexCacheACMR(VertexCacheStats stats)
+{
+    return stats.numTriangles ? (float) stats.numTransformed / stats.numTriangles : 0.0f;
+}
+
+// Average transform to vertex ratio: 1 is ideal
+float vertexCacheATVR(VertexCacheStats stats)
+{
+    return stats.numVertices ? (float) stats.numTransformed / stats.numVertices : 0.0f;
+}
+
+// Merge vertices whose attributes are bit identical. Returns the new vertex count,
+// `vertices` is compacted in place and `indices` is remapped.
+unsigned int weldVertices(Vertex *vertices, unsigned int numVertices, unsigned int *indices, unsigned int numIndices)
+{
+    unsigned int *remap = malloc((numVertices ? numVertices : 1) * sizeof(unsigned int));
+    HashMap unique = { 0 };
+    unsigned int numUnique = 0;
+
+    for (unsigned int i = 0; i < numVertices; i++) {
+        uint64_t hash = hashBytes(HASH_SEED, &vertices[i], sizeof(Vertex));
+
+        unsigned int existing;
+        if (hashMapGet(&unique, hash, &existing) && memcmp(&vertices[existing], &vertices[i], sizeof(Vertex)) == 0) {
+            remap[i] = existing;
+            continue;
+        }
+
+        // on a (very unlikely) hash collision the vertex is simply kept
+        vertices[numUnique] = vertices[i];
+        remap[i] = numUnique;
+        hashMapPut(&unique, hash, numUnique);
+        numUnique++;
+    }
+
+    for (unsigned int i = 0; i < numIndices; i++) {
+        indices[i] = remap[indices[i]];
+    }
+
+    freeHashMap(&unique);
+    free(remap);
+
+    return numUnique;
+}
+
+typedef struct {
+    unsigned int *offsets;    // triangles of vertex v are triangles[offsets[v] .. offsets[v + 1])
+    unsigned int *triangles;
+} VertexTriangleAdjacency;
+
+VertexTriangleAdjacency buildVertexTriangleAdjacency(const unsigned int *indices, unsigned int numIndices,
+    unsigned int numVertices)
+{
+    VertexTriangleAdjacency adjacency;
+    adjacency.offsets = calloc(numVertices + 1, sizeof(unsigned int));
+    adjacency.triangles = malloc((numIndices ? numIndices : 1) * sizeof(unsigned int));
+
+    for (unsigned int i = 0; i < numIndices; i++) {
+        adjacency.offsets[indices[i] + 1]++;
+    }
+    for (unsigned int v = 0; v < numVertices; v++) {
+        adjacency.offsets[v + 1] += adjacency.offsets[v];
+    }
+
+    unsigned int *fill = malloc((numVertices ? numVertices : 1) * sizeof(unsigned int));
+    memcpy(fill, adjacency.offsets, numVertices * sizeof(unsigned int));
+    for (unsigned int i = 0; i < numIndices; i++) {
+        adjacency.triangles[fill[indices[i]]++] = i / 3;
+    }
+    free(fill);
+
+    return adjacency;
+}
+
+void freeVertexTriangleAdjacency(VertexTriangleAdjacency *adjacency)
+{
+    free(adjacency->offsets);
+    free(adjacency->triangles);
+}
+
+// Reorder the triangles of `indices` in place for a post-transform cache of
+// `cacheSize` entries. On return clusters[0 .. *numClusters] holds the first
+// triangle of every cluster plus the total triangle count, a new cluster starts
+// whenever the fanning vertex has to be picked outside the cache.
+void optimizeVertexCache(unsigned int *indices, unsigned int numIndices, unsigned int numVertices,
+    unsigned int cacheSize, unsigned int **clusters, unsigned int *numClusters)
+{
+    unsigned int numTriangles = numIndices / 3;
+
+    VertexTriangleAdjacency adjacency = buildVertexTriangleAdjacency(indices, numIndices, numVertices);
+
+    unsigned int *liveTriangles = malloc((numVertices ? numVertices : 1) * sizeof(unsigned int));
+    unsigned int *cacheTime = calloc(numVertices ? numVertices : 1, sizeof(unsigned int));
+    unsigned int *deadEnd = malloc((numIndices ? numIndices : 1) * sizeof(unsigned int));
+    bool *emitted = calloc(numTriangles ? numTriangles : 1, sizeof(bool));
+    unsigned int *output = malloc((numIndices ? numIndices : 1) * sizeof(unsigned int));
+
+    for (unsigned int v = 0; v < numVertices; v++) {
+        liveTriangles[v] = adjacency.offsets[v + 1] - adjacency.offsets[v];
+    }
+
+    *clusters = malloc((numTriangles + 1) * sizeof(unsigned int));
+    *numClusters = 0;
+
+    unsigned int numDeadEnd = 0, numOutput = 0;
+    unsigned int time = cacheSize + 1, cursor = 0;
+    int fanning = numVertices && numTriangles ? 0 : -1;
+    bool newCluster = true;
+
+    while (fanning >= 0) {
+        if (newCluster && numOutput < numIndices) {
+            (*clusters)[(*numClusters)++] = numOutput / 3;
+        }
+
+        // emit every remaining triangle around the fanning vertex
+        unsigned int candidatesBegin = numDeadEnd;
+        for (unsigned int a = adjacency.offsets[fanning]; a < adjacency.offsets[fanning + 1]; a++) {
+            unsigned int t = adjacency.triangles[a];
+            if (emitted[t]) {
+                continue;
+            }
+
+            for (unsigned int k = 0; k < 3; k++) {
+                unsigned int v = indices[t * 3 + k];
+                output[numOutput++] = v;
+                deadEnd[numDeadEnd++] = v;
+                liveTriangles[v]--;
+                if (time - cacheTime[v] > cacheSize) {
+                    cacheTime[v] = time++;
+                }
+            }
+            emitted[t] = true;
+        }
+
+        // next fanning vertex: the candidate with live triangles that stays in
+        // the cache longest once its remaining fan has been emitted
+        int best = -1, bestPriority = -1;
+        for (unsigned int c = candidatesBegin; c < numDeadEnd; c++) {
+            unsigned int v = deadEnd[c];
+            if (liveTriangles[v] == 0) {
+                continue;
+            }
+
+            int priority = 0;
+            if (time - cacheTime[v] + 2 * liveTriangles[v] <= cacheSize) {
+                priority = time - cacheTime[v];
+            }
+            if (priority > bestPriority) {
+                best = v;
+                bestPriority = priority;
+            }
+        }
+
+        newCluster = best < 0;
+        if (best < 0) {
+            // dead end: back track through recently used vertices, then scan in input order
+            while (numDeadEnd > 0 && best < 0) {
+                unsigned int v = deadEnd[--numDeadEnd];
+                if (liveTriangles[v] > 0) {
+                    best = v;
+                }
+            }
+            while (cursor < numVertices && best < 0) {
+                if (liveTriangles[cursor] > 0) {
+                    best = cursor;
+                }
+                cursor++;
+            }
+        }
+
+        fanning = best;
+    }
+
+    (*clusters)[*numClusters] = numTriangles;
+    memcpy(indices, output, numOutput * sizeof(unsigned int));
+
+    free(output);
+    free(emitted);
+    free(deadEnd);
+    free(cacheTime);
+    free(liveTriangles);
+    freeVertexTriangleAdjacency(&adjacency);
+}
+
+typedef struct {
+    float sortKey;
+    unsigned int first, count;  // in triangles
+} OverdrawCluster;
+
+int compareOverdrawClusters(const void *a, const void *b)
+{
+    const OverdrawCluster *ca = a, *cb = b;
+    return (ca->sortKey < cb->sortKey) - (ca->sortKey > cb->sortKey); // descending
+}
+
+// Reorder the clusters produced by optimizeVertexCache() so clusters far out
+// along their own normal come first. Those are the most likely to occlude the
+// rest of the mesh from any viewpoint, so later fragments fail the depth test.
+// Triangles inside a cluster keep their order, the cache efficiency is preserved.
+void optimizeOverdraw(unsigned int *indices, unsigned int numIndices, const Vertex *vertices,
+    const unsigned int *clusters, unsigned int numClusters)
+{
+    if (numClusters < 2) {
+        return;
+    }
+
+    // area weighted mesh centroid
+    vec3 meshCentroid = {0.0f, 0.0f, 0.0f};
+    float meshArea = 0.0f;
+    for (unsigned int i = 0; i + 2 < numIndices; i += 3) {
+        vec3 e1, e2, n, center;
+        glm_vec3_sub((float *) vertices[indices[i + 1]].position, (float *) vertices[indices[i]].position, e1);
+        glm_vec3_sub((float *) vertices[indices[i + 2]].position, (float *) vertices[indices[i]].position, e2);
+        glm_vec3_cross(e1, e2, n);
+        float area = glm_vec3_norm(n);
+
+        glm_vec3_add((float *) vertices[indices[i]].position, (float *) vertices[indices[i + 1]].position, center);
+        glm_vec3_add(center, (float *) vertices[indices[i + 2]].position, center);
+        glm_vec3_muladds(center, area / 3.0f, meshCentroid);
+        meshArea += area;
+    }
+    if (meshArea > 0.0f) {
+        glm_vec3_scale(meshCentroid, 1.0f / meshArea, meshCentroid);
+    }
+
+    OverdrawCluster *sorted = malloc(numClusters * sizeof(OverdrawCluster));
+    for (unsigned int c = 0; c < numClusters; c++) {
+        vec3 centroid = {0.0f, 0.0f, 0.0f}, normal = {0.0f, 0.0f, 0.0f};
+        float area = 0.0f;
+
+        for (unsigned int t = clusters[c]; t < clusters[c + 1]; t++) {
+            const unsigned int *tri = &indices[t * 3];
+            vec3 e1, e2, n, center;
+            glm_vec3_sub((float *) vertices[tri[1]].position, (float *) vertices[tri[0]].position, e1);
+            glm_vec3_sub((float *) vertices[tri[2]].position, (float *) vertices[tri[0]].position, e2);
+            glm_vec3_cross(e1, e2, n);
+            float triangleArea = glm_vec3_norm(n);
+
+            glm_vec3_add((float *) vertices[tri[0]].position, (float *) vertices[tri[1]].position, center);
+            glm_vec3_add(center, (float *) vertices[tri[2]].position, center);
+            glm_vec3_muladds(center, triangleArea / 3.0f, centroid);
+            glm_vec3_add(normal, n, normal);
+            area += triangleArea;
+        }
+        if (area > 0.0f) {
+            glm_vec3_scale(centroid, 1.0f / area, centroid);
+        }
+        glm_vec3_normalize(normal);
+
+        vec3 offset;
+        glm_vec3_sub(centroid, meshCentroid, offset);
+
+        OverdrawCluster cluster = {
+            .sortKey = glm_vec3_dot(offset, normal),
+            .first = clusters[c],
+            .count = clusters[c + 1] - clusters[c],
+        };
+        sorted[c] = cluster;
+    }
+
+    qsort(sorted, numClusters, sizeof(OverdrawCluster), compareOverdrawClusters);
+
+    unsigned int *output = malloc(numIndices * sizeof(unsigned int));
+    unsigned int numOutput = 0;
+    for (unsigned int c = 0; c < numClusters; c++) {
+        memcpy(&output[numOutput], &indices[sorted[c].first * 3], sorted[c].count * 3 * sizeof(unsigned int));
+        numOutput += sorted[c].count * 3;
+    }
+    memcpy(indices, output, numOutput * sizeof(unsigned int));
+
+    free(output);
+    free(sorted);
+}
+
+// Renumber vertices in the order the index buffer first references them, so the
+// vertex fetch walks memory mostly forward. Unreferenced vertices are dropped,
+// returns the new vertex count.
+unsigned int optimizeVertexFetch(Vertex *vertices, unsigned int numVertices, unsigned int *indices, unsigned int numIndices)
+{
+    unsigned int *remap = malloc((numVertices ? numVertices : 1) * sizeof(unsigned int));
+    memset(remap, 0xff, numVertices * sizeof(unsigned int));
+    Vertex *reordered = malloc((numVertices ? numVertices : 1) * sizeof(Vertex));
+    unsigned int numReordered = 0;
+
+    for (unsigned int i = 0; i < numIndices; i++) {
+        unsigned int v = indices[i];
+        if (remap[v] == ~0u) {
+            remap[v] = numReordered;
+            reordered[numReordered++] = vertices[v];
+        }
+        indices[i] = remap[v];
+    }
+
+    memcpy(vertices, reordered, numReordered * sizeof(Vertex));
+
+    free(reordered);
+    free(remap);
+
+    return numReordered;
+}
+
+// Run the whole pass on a triangulated mesh. `before` and `after` receive the
+// cache statistics of the index buffer as imported and as optimized.
+void optimizeMesh(Mesh *mesh, VertexCacheStats *before, VertexCacheStats *after)
+{
+    *before = analyzeVertexCache(mesh->indices, mesh->numIndices, mesh->numVertices, VERTEX_CACHE_SIZE);
+
+    mesh->numVertices = weldVertices(mesh->vertices, mesh->numVertices, mesh->indices, mesh->numIndices);
+
+    unsigned int *clusters, numClusters;
+    optimizeVertexCache(mesh->indices, mesh->numIndices, mesh->numVertices, VERTEX_CACHE_SIZE, &clusters, &numClusters);
+    optimizeOverdraw(mesh->indices, mesh->numIndices, mesh->vertices, clusters, numClusters);
+    free(clusters);
+
+    mesh->numVertices = optimizeVertexFetch(mesh->vertices, mesh->numVertices, mesh->indices, mesh->numIndices);
+
+    *after = analyzeVertexCache(mesh->indices, mesh->numIndices, mesh->numVertices, VERTEX_CACHE_SIZE);
+}
+
+#endif // _MESH_OPTIMIZE_H_
@@ -0,0 +1,505 @@
+#ifndef _MESH_SIMPLIFY_H_
+#define _MESH_SIMPLIFY_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+#include <cglm/cglm.h>
+
+#include "mesh.h"
+#include "hash.h"
+#include "mesh_optimize.h"
+
+// Quadric error metric edge collapse (Garland and Heckbert 1997) on indexed
+// triangle meshes. Vertices are never moved or created, an edge collapses onto
+// one of its ends, so a simplified index buffer can be drawn with the vertex
+// buffer of the full mesh. Vertices sharing a position (UV seams) are
+// collapsed together, seam and border vertices only slide along their seam or
+// border, and everything else there is locked.
+
+#define SIMPLIFY_EDGE_WEIGHT 10.0f   // open edge quadrics against plane quadrics
+#define SIMPLIFY_MIN_FLIP_COS 0.25f  // a collapse may turn a triangle by at most ~75 degrees
+
+typedef enum {
+    SIMPLIFY_MANIFOLD,  // collapses anywhere
+    SIMPLIFY_BORDER,    // open edge of the surface, collapses along it
+    SIMPLIFY_SEAM,      // two vertices on one position, collapses along the seam
+    SIMPLIFY_LOCKED,
+} SimplifyVertexKind;
+
+// Sum of squared distances to weighted planes, A = sum n n^T, b = sum d n, c = sum d^2
+typedef struct {
+    float a00, a11, a22, a01, a02, a12;
+    float b0, b1, b2;
+    float c;
+    float weight;
+} Quadric;
+
+void addPlaneQuadric(Quadric *q, vec3 normal, float distance, float weight)
+{
+    q->a00 += weight * normal[0] * normal[0];
+    q->a11 += weight * normal[1] * normal[1];
+    q->a22 += weight * normal[2] * normal[2];
+    q->a01 += weight * normal[0] * normal[1];
+    q->a02 += weight * normal[0] * normal[2];
+    q->a12 += weight * normal[1] * normal[2];
+    q->b0 += weight * normal[0] * distance;
+    q->b1 += weight * normal[1] * distance;
+    q->b2 += weight * normal[2] * distance;
+    q->c += weight * distance * distance;
+    q->weight += weight;
+}
+
+void addQuadric(Quadric *q, const Quadric *other)
+{
+    q->a00 += other->a00;
+    q->a11 += other->a11;
+    q->a22 += other->a22;
+    q->a01 += other->a01;
+    q->a02 += other->a02;
+    q->a12 += other->a12;
+    q->b0 += other->b0;
+    q->b1 += other->b1;
+    q->b2 += other->b2;
+    q->c += other->c;
+    q->weight += other->weight;
+}
+
+// Weighted mean squared distance of `p` to the planes of the quadric
+float quadricError(const Quadric *q, const float *p)
+{
+    float x = p[0], y = p[1], z = p[2];
+    float error = q->a00 * x * x + q->a11 * y * y + q->a22 * z * z
+        + 2.0f * (q->a01 * x * y + q->a02 * x * z + q->a12 * y * z)
+        + 2.0f * (q->b0 * x + q->b1 * y + q->b2 * z) + q->c;
+    return q->weight > 0.0f ? fabsf(error) / q->weight : 0.0f;
+}
+
+typedef struct {
+    unsigned int from, to;  // vertices, `from` moves onto the position of `to`
+    float error;
+} SimplifyCollapse;
+
+int compareCollapses(const void *a, const void *b)
+{
+    float ea = ((const SimplifyCollapse *) a)->error, eb = ((const SimplifyCollapse *) b)->error;
+    return (ea > eb) - (ea < eb);
+}
+
+uint64_t simplifyEdgeKey(unsigned int a, unsigned int b)
+{
+    uint64_t edge = (uint64_t) a << 32 | b;
+    return hashBytes(HASH_SEED, &edge, sizeof(edge));
+}
+
+bool simplifyHasEdge(HashMap *edges, unsigned int a, unsigned int b)
+{
+    unsigned int unused;
+    return hashMapGet(edges, simplifyEdgeKey(a, b), &unused);
+}
+
+// Working state of one simplifyMesh() call. Vertex positions are identified by
+// `positions[v]`, the first vertex with the same bits, everything per position
+// is indexed by that vertex.
+typedef struct {
+    const Vertex *vertices;
+    unsigned int numVertices;
+    unsigned int *positions;
+
+    // rebuilt for every pass from the current indices
+    HashMap edges;          // directed triangle edges between vertices
+    HashMap positionEdges;  // the same between positions
+    unsigned char *kind;    // SimplifyVertexKind per position
+    unsigned int *wedges;   // up to two referenced vertices per position
+    unsigned int *numWedges;
+} Simplifier;
+
+// The other referenced vertex at the position of seam vertex `v`
+unsigned int otherWedge(Simplifier *s, unsigned int v)
+{
+    unsigned int p = s->positions[v];
+    return s->wedges[2 * p] == v ? s->wedges[2 * p + 1] : s->wedges[2 * p];
+}
+
+void classifyVertices(Simplifier *s, const unsigned int *indices, unsigned int numIndices)
+{
+    freeHashMap(&s->edges);
+    freeHashMap(&s->positionEdges);
+    for (unsigned int i = 0; i < numIndices; i++) {
+        unsigned int a = indices[i], b = indices[i - i % 3 + (i + 1) % 3];
+        hashMapPut(&s->edges, simplifyEdgeKey(a, b), i);
+        hashMapPut(&s->positionEdges, simplifyEdgeKey(s->positions[a], s->positions[b]), i);
+    }
+
+    // referenced vertices per position
+    unsigned int *numOpenOut = calloc(s->numVertices, sizeof(unsigned int));
+    unsigned int *numOpenIn = calloc(s->numVertices, sizeof(unsigned int));
+    bool *openInPositions = calloc(s->numVertices, sizeof(bool));
+    bool *referenced = calloc(s->numVertices, sizeof(bool));
+    memset(s->numWedges, 0, s->numVertices * sizeof(unsigned int));
+
+    for (unsigned int i = 0; i < numIndices; i++) {
+        unsigned int a = indices[i], b = indices[i - i % 3 + (i + 1) % 3];
+        referenced[a] = true;
+        if (!simplifyHasEdge(&s->edges, b, a)) {
+            numOpenOut[a]++;
+            numOpenIn[b]++;
+            // open between vertices but closed between positions is a seam, open in both a border
+            if (!simplifyHasEdge(&s->positionEdges, s->positions[b], s->positions[a])) {
+                openInPositions[s->positions[a]] = openInPositions[s->positions[b]] = true;
+            }
+        }
+    }
+    for (unsigned int v = 0; v < s->numVertices; v++) {
+        if (referenced[v]) {
+            unsigned int p = s->positions[v];
+            if (s->numWedges[p] < 2) {
+                s->wedges[2 * p + s->numWedges[p]] = v;
+            }
+            s->numWedges[p]++;
+        }
+    }
+
+    for (unsigned int p = 0; p < s->numVertices; p++) {
+        s->kind[p] = SIMPLIFY_LOCKED;
+        if (s->positions[p] != p || s->numWedges[p] == 0) {
+            continue;
+        }
+
+        unsigned int v = s->wedges[2 * p];
+        if (s->numWedges[p] == 1) {
+            if (numOpenOut[v] == 0 && numOpenIn[v] == 0) {
+                s->kind[p] = SIMPLIFY_MANIFOLD;
+            }
+            else if (numOpenOut[v] == 1 && numOpenIn[v] == 1) {
+                s->kind[p] = SIMPLIFY_BORDER;
+            }
+        }
+        else if (s->numWedges[p] == 2 && !openInPositions[p]) {
+            unsigned int w = s->wedges[2 * p + 1];
+            if (numOpenOut[v] == 1 && numOpenIn[v] == 1 && numOpenOut[w] == 1 && numOpenIn[w] == 1) {
+                s->kind[p] = SIMPLIFY_SEAM;
+            }
+        }
+    }
+
+    free(numOpenOut);
+    free(numOpenIn);
+    free(openInPositions);
+    free(referenced);
+}
+
+// Whether `from` may collapse onto `to` along the triangle edge between them
+bool canCollapse(Simplifier *s, unsigned int from, unsigned int to)
+{
+    unsigned int p = s->positions[from], q = s->positions[to];
+    if (p == q) {
+        return false;
+    }
+
+    switch (s->kind[p]) {
+    case SIMPLIFY_MANIFOLD:
+        return true;
+    case SIMPLIFY_BORDER:
+        // only along the border, onto the next border vertex or where it ends
+        return (s->kind[q] == SIMPLIFY_BORDER || s->kind[q] == SIMPLIFY_LOCKED) &&
+            !(simplifyHasEdge(&s->positionEdges, p, q) && simplifyHasEdge(&s->positionEdges, q, p));
+    case SIMPLIFY_SEAM:
+        // likewise along the seam, the other side is matched up by findSeamTarget()
+        return (s->kind[q] == SIMPLIFY_SEAM || s->kind[q] == SIMPLIFY_LOCKED) &&
+            !(simplifyHasEdge(&s->edges, from, to) && simplifyHasEdge(&s->edges, to, from));
+    default:
+        return false;
+    }
+}
+
+// The vertex at position `q` sharing a triangle with `from`, which the other
+// side of a seam collapse moves onto. False if the seam does not continue there.
+bool findSeamTarget(Simplifier *s, const unsigned int *indices, VertexTriangleAdjacency *adjacency,
+    unsigned int from, unsigned int q, unsigned int *to)
+{
+    unsigned int p = s->positions[from];
+    for (unsigned int i = adjacency->offsets[p]; i < adjacency->offsets[p + 1]; i++) {
+        const unsigned int *triangle = &indices[adjacency->triangles[i] * 3];
+        if (triangle[0] != from && triangle[1] != from && triangle[2] != from) {
+            continue;
+        }
+        for (int c = 0; c < 3; c++) {
+            if (s->positions[triangle[c]] == q) {
+                *to = triangle[c];
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void triangleNormal(const float *a, const float *b, const float *c, vec3 normal)
+{
+    vec3 ab, ac;
+    glm_vec3_sub((float *) b, (float *) a, ab);
+    glm_vec3_sub((float *) c, (float *) a, ac);
+    glm_vec3_cross(ab, ac, normal);
+}
+
+// Plane quadrics of every triangle weighted by area, plus planes through the
+// open edges perpendicular to their triangle so borders and seams keep their shape
+void computeQuadrics(Simplifier *s, const unsigned int *indices, unsigned int numIndices, Quadric *quadrics)
+{
+    memset(quadrics, 0, s->numVertices * sizeof(Quadric));
+
+    for (unsigned int t = 0; t + 2 < numIndices; t += 3) {
+        const float *p[3];
+        for (int c = 0; c < 3; c++) {
+            p[c] = s->vertices[s->positions[indices[t + c]]].position;
+        }
+
+        vec3 normal;
+        triangleNormal(p[0], p[1], p[2], normal);
+        float area = glm_vec3_norm(normal);
+        if (area == 0.0f) {
+            continue;
+        }
+        glm_vec3_scale(normal, 1.0f / area, normal);
+        float distance = -glm_vec3_dot(normal, (float *) p[0]);
+        for (int c = 0; c < 3; c++) {
+            addPlaneQuadric(&quadrics[s->positions[indices[t + c]]], normal, distance, area);
+        }
+
+        for (int c = 0; c < 3; c++) {
+            unsigned int a = indices[t + c], b = indices[t + (c + 1) % 3];
+            if (simplifyHasEdge(&s->edges, b, a)) {
+                continue;
+            }
+
+            vec3 edge, edgeNormal;
+            glm_vec3_sub((float *) p[(c + 1) % 3], (float *) p[c], edge);
+            float length2 = glm_vec3_norm2(edge);
+            glm_vec3_cross(edge, normal, edgeNormal);
+            glm_vec3_normalize(edgeNormal);
+            float edgeDistance = -glm_vec3_dot(edgeNormal, (float *) p[c]);
+            addPlaneQuadric(&quadrics[s->positions[a]], edgeNormal, edgeDistance, length2 * SIMPLIFY_EDGE_WEIGHT);
+            addPlaneQuadric(&quadrics[s->positions[b]], edgeNormal, edgeDistance, length2 * SIMPLIFY_EDGE_WEIGHT);
+        }
+    }
+}
+
+// Whether moving position `p` onto `q` keeps every remaining triangle around p
+// facing the same way. Counts the triangles the collapse removes.
+bool collapseKeepsOrientation(Simplifier *s, const unsigned int *indices, VertexTriangleAdjacency *adjacency,
+    unsigned int p, unsigned int q, unsigned int *numRemoved)
+{
+    *numRemoved = 0;
+    for (unsigned int i = adjacency->offsets[p]; i < adjacency->offsets[p + 1]; i++) {
+        const unsigned int *triangle = &indices[adjacency->triangles[i] * 3];
+        unsigned int corners[3];
+        bool removed = false;
+        for (int c = 0; c < 3; c++) {
+            corners[c] = s->positions[triangle[c]];
+            removed = removed || corners[c] == q;
+        }
+        if (removed) {
+            (*numRemoved)++;
+            continue;
+        }
+
+        const float *before[3], *after[3];
+        for (int c = 0; c < 3; c++) {
+            before[c] = s->vertices[corners[c]].position;
+            after[c] = corners[c] == p ? s->vertices[q].position : before[c];
+        }
+        vec3 normalBefore, normalAfter;
+        triangleNormal(before[0], before[1], before[2], normalBefore);
+        triangleNormal(after[0], after[1], after[2], normalAfter);
+        float lengths = glm_vec3_norm(normalBefore) * glm_vec3_norm(normalAfter);
+        if (glm_vec3_dot(normalBefore, normalAfter) < SIMPLIFY_MIN_FLIP_COS * lengths) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Simplify `indices` towards `targetIndices` indices and write the result to
+// `out`, which may be `indices` itself. Returns the number of indices written and
+// the largest collapse error as a model space distance in `error`.
+unsigned int simplifyMesh(const Vertex *vertices, unsigned int numVertices, const unsigned int *indices,
+    unsigned int numIndices, unsigned int targetIndices, unsigned int *out, float *error)
+{
+    Simplifier s = {
+        .vertices = vertices,
+        .numVertices = numVertices,
+        .positions = malloc((numVertices ? numVertices : 1) * sizeof(unsigned int)),
+        .kind = malloc(numVertices ? numVertices : 1),
+        .wedges = malloc((numVertices ? numVertices : 1) * 2 * sizeof(unsigned int)),
+        .numWedges = malloc((numVertices ? numVertices : 1) * sizeof(unsigned int)),
+    };
+
+    // vertices with bit identical positions, like weldVertices() does for whole vertices
+    HashMap unique = { 0 };
+    for (unsigned int v = 0; v < numVertices; v++) {
+        uint64_t hash = hashBytes(HASH_SEED, vertices[v].position, sizeof(vec3));
+        unsigned int existing;
+        if (hashMapGet(&unique, hash, &existing) && memcmp(vertices[existing].position, vertices[v].position, sizeof(vec3)) == 0) {
+            s.positions[v] = existing;
+        }
+        else {
+            s.positions[v] = v;
+            hashMapPut(&unique, hash, v);
+        }
+    }
+    freeHashMap(&unique);
+
+    if (out != indices) {
+        memcpy(out, indices, numIndices * sizeof(unsigned int));
+    }
+    targetIndices -= targetIndices % 3;
+
+    Quadric *quadrics = malloc((numVertices ? numVertices : 1) * sizeof(Quadric));
+    unsigned int *collapseTo = malloc((numVertices ? numVertices : 1) * sizeof(unsigned int));
+    bool *locked = malloc(numVertices ? numVertices : 1);
+    unsigned int *positionIndices = malloc((numIndices ? numIndices : 1) * sizeof(unsigned int));
+    SimplifyCollapse *collapses = malloc((numIndices ? numIndices : 1) * 2 * sizeof(SimplifyCollapse));
+    float maxError = 0.0f;
+
+    classifyVertices(&s, out, numIndices);
+    computeQuadrics(&s, out, numIndices, quadrics);
+
+    // every pass collapses a batch of the cheapest edges that do not touch each other
+    while (numIndices > targetIndices) {
+        unsigned int numCollapses = 0;
+        for (unsigned int i = 0; i < numIndices; i++) {
+            unsigned int a = out[i], b = out[i - i % 3 + (i + 1) % 3];
+            unsigned int ends[2][2] = {{a, b}, {b, a}};
+            for (int e = 0; e < 2; e++) {
+                if (canCollapse(&s, ends[e][0], ends[e][1])) {
+                    SimplifyCollapse collapse = {
+                        .from = ends[e][0],
+                        .to = ends[e][1],
+                        .error = quadricError(&quadrics[s.positions[ends[e][0]]], vertices[ends[e][1]].position),
+                    };
+                    collapses[numCollapses++] = collapse;
+                }
+            }
+        }
+        qsort(collapses, numCollapses, sizeof(SimplifyCollapse), compareCollapses);
+
+        for (unsigned int i = 0; i < numIndices; i++) {
+            positionIndices[i] = s.positions[out[i]];
+        }
+        VertexTriangleAdjacency adjacency = buildVertexTriangleAdjacency(positionIndices, numIndices, numVertices);
+
+        for (unsigned int v = 0; v < numVertices; v++) {
+            collapseTo[v] = v;
+        }
+        memset(locked, 0, numVertices);
+
+        unsigned int numRemoved = 0, numApplied = 0;
+        for (unsigned int c = 0; c < numCollapses && numIndices - numRemoved * 3 > targetIndices; c++) {
+            SimplifyCollapse *collapse = &collapses[c];
+            unsigned int p = s.positions[collapse->from], q = s.positions[collapse->to];
+            unsigned int removed, seamFrom = 0, seamTo = 0;
+            if (locked[p] || locked[q] ||
+                !collapseKeepsOrientation(&s, out, &adjacency, p, q, &removed)) {
+                continue;
+            }
+            if (s.kind[p] == SIMPLIFY_SEAM) {
+                seamFrom = otherWedge(&s, collapse->from);
+                if (!findSeamTarget(&s, out, &adjacency, seamFrom, q, &seamTo)) {
+                    continue;
+                }
+                collapseTo[seamFrom] = seamTo;
+            }
+            collapseTo[collapse->from] = collapse->to;
+            addQuadric(&quadrics[q], &quadrics[p]);
+
+            // the one ring of p changes shape, its orientation checks are stale for this pass
+            for (unsigned int i = adjacency.offsets[p]; i < adjacency.offsets[p + 1]; i++) {
+                for (int k = 0; k < 3; k++) {
+                    locked[positionIndices[adjacency.triangles[i] * 3 + k]] = true;
+                }
+            }
+            locked[p] = locked[q] = true;
+
+            maxError = collapse->error > maxError ? collapse->error : maxError;
+            numRemoved += removed;
+            numApplied++;
+        }
+        freeVertexTriangleAdjacency(&adjacency);
+
+        if (numApplied == 0) {
+            break;
+        }
+
+        // apply the batch and drop the triangles that lost an edge
+        unsigned int numKept = 0;
+        for (unsigned int t = 0; t + 2 < numIndices; t += 3) {
+            unsigned int a = collapseTo[out[t]], b = collapseTo[out[t + 1]], c = collapseTo[out[t + 2]];
+            unsigned int pa = s.positions[a], pb = s.positions[b], pc = s.positions[c];
+            if (pa != pb && pb != pc && pa != pc) {
+                out[numKept++] = a;
+                out[numKept++] = b;
+                out[numKept++] = c;
+            }
+        }
+        numIndices = numKept;
+
+        classifyVertices(&s, out, numIndices);
+    }
+
+    *error = sqrtf(maxError);
+
+    free(quadrics);
+    free(collapseTo);
+    free(locked);
+    free(positionIndices);
+    free(collapses);
+    freeHashMap(&s.edges);
+    freeHashMap(&s.positionEdges);
+    free(s.positions);
+    free(s.kind);
+    free(s.wedges);
+    free(s.numWedges);
+
+    return numIndices;
+}
+
+// Append numLods - 1 coarser levels to the mesh, each with half the triangles
+// of the one before, simplified from the full mesh and ordered for the vertex
+// cache. They are uploaded behind level 0 by the next setupMesh*() call.
+void generateMeshLods(Mesh *mesh, unsigned int numLods)
+{
+    numLods = numLods < MESH_MAX_LODS ? numLods : MESH_MAX_LODS;
+    numLods = numLods ? numLods : 1;
+
+    mesh->numLods = numLods;
+    mesh->lodFirstIndex[0] = 0;
+    mesh->lodNumIndices[0] = mesh->numIndices;
+    mesh->lodErrors[0] = 0.0f;
+
+    free(mesh->lodIndices);
+    mesh->lodIndices = NULL;
+    unsigned int *level = malloc((mesh->numIndices ? mesh->numIndices : 1) * sizeof(unsigned int));
+
+    unsigned int numLodIndices = 0;
+    for (unsigned int lod = 1; lod < numLods; lod++) {
+        unsigned int count = simplifyMesh(mesh->vertices, mesh->numVertices, mesh->indices, mesh->numIndices,
+            mesh->numIndices >> lod, level, &mesh->lodErrors[lod]);
+
+        unsigned int *clusters, numClusters;
+        optimizeVertexCache(level, count, mesh->numVertices, VERTEX_CACHE_SIZE, &clusters, &numClusters);
+        free(clusters);
+
+        mesh->lodIndices = realloc(mesh->lodIndices, (numLodIndices + count + 1) * sizeof(unsigned int));
+        memcpy(mesh->lodIndices + numLodIndices, level, count * sizeof(unsigned int));
+        mesh->lodFirstIndex[lod] = mesh->numIndices + numLodIndices;
+        mesh->lodNumIndices[lod] = count;
+        numLodIndices += count;
+    }
+
+    free(level);
+}
+
+#endif // _MESH_SIMPLIFY_H_
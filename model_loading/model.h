@@ -15,107 +15,166 @@
 #include "stb_image.h"
 
 #include "mesh.h"
+#include "mesh_cache.h"
+#include "mesh_optimize.h"
+#include "mesh_simplify.h"
+#include "jobs.h"
+#include "texture_loader.h"
+#include "texture_cache.h"
+#include "trace.h"
+
+// createModel() flags
+#define MODEL_LOAD_MMAP (1 << 0)  // upload straight from the mapped mesh cache, keep no CPU copy of the geometry
+#define MODEL_NO_CACHE  (1 << 1)  // always import through Assimp, neither read nor write the mesh cache
+#define MODEL_OPTIMIZE  (1 << 2)  // weld vertices and reorder them for the vertex cache, overdraw and fetch
+#define MODEL_PACK_VERTICES (1 << 3)  // upload VERTEX_FORMAT_PACKED vertices, draw with a PACKED_VERTICES shader
+#define MODEL_LOD (1 << 4)  // simplify every mesh into MODEL_LOD_LEVELS levels of detail at import time
+
+#define MODEL_LOD_LEVELS 4  // including the full mesh, at most MESH_MAX_LODS
+
+// flags that change the imported geometry, a mesh cache is only used if they match
+#define MODEL_CACHE_OPTIONS (MODEL_OPTIMIZE | MODEL_LOD)
+
+#define MODEL_IMPORT_FLAGS (aiProcess_Triangulate | aiProcess_FlipUVs)
 
 typedef struct {
     Mesh *meshes;
     unsigned int numMeshes;
     char *directory;
+    unsigned int flags;
 
-    Texture *loadedTextures;
-    unsigned int numLoadedTextures;
+    // vertex cache statistics of all meshes as imported and after MODEL_OPTIMIZE
+    VertexCacheStats importedCacheStats, optimizedCacheStats;
+
+    // bounding sphere of all meshes in model space
+    vec3 boundsCenter;
+    float boundsRadius;
+
+    // levels of detail every mesh has, with the largest error and the triangles of all meshes per level
+    unsigned int numLods;
+    float lodErrors[MESH_MAX_LODS];
+    unsigned int lodTriangles[MESH_MAX_LODS];
 } Model;
 
-void drawModel(Model *model, unsigned int shader)
+#define MODEL_MAX_BATCH 64  // meshes per glMultiDrawElementsBaseVertex call
+
+// Whether two meshes can share a draw call: same buffers, textures and per mesh uniforms
+bool sameMeshMaterial(Mesh *a, Mesh *b)
 {
-    for (unsigned int i = 0; i < model->numMeshes; i++) {
-        drawMesh(&model->meshes[i], shader);
+    if (meshVertexArray(a) != meshVertexArray(b) || a->indexType != b->indexType ||
+        a->numTextures != b->numTextures ||
+        !glm_vec3_eqv(a->positionScale, b->positionScale) || !glm_vec3_eqv(a->positionOffset, b->positionOffset)) {
+        return false;
+    }
+
+    for (unsigned int t = 0; t < a->numTextures; t++) {
+        if (a->textures[t].id != b->textures[t].id || a->textures[t].type != b->textures[t].type) {
+            return false;
+        }
     }
+
+    return true;
 }
 
-unsigned int TextureFromFile(char *imagePath, char *directory)
+// Meshes live in the shared geometry arena, so the VAO is bound once and every
+// run of meshes with the same material goes out as a single multi-draw
+void drawModel(Model *model, unsigned int shader)
 {
-    char filename[PATH_MAX];
-    snprintf(filename, sizeof(filename), "%s/%s", directory, imagePath);
+    TRACE_FUNCTION();
+    GLsizei counts[MODEL_MAX_BATCH];
+    const void *offsets[MODEL_MAX_BATCH];
+    GLint baseVertices[MODEL_MAX_BATCH];
+    unsigned int boundVAO = 0;
+
+    for (unsigned int i = 0; i < model->numMeshes;) {
+        Mesh *first = &model->meshes[i];
+
+        bindMeshMaterial(first, shader);
+        if (meshVertexArray(first) != boundVAO) {
+            boundVAO = meshVertexArray(first);
+            glBindVertexArray(boundVAO);
+        }
 
-    unsigned int texture;
-
-    glGenTextures(1, &texture);
-    glBindTexture(GL_TEXTURE_2D, texture);
-    // set the texture wrapping/filtering options (on the currently bound texture object)
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    // load and generate the texture
-    int width, height, nrChannels;
-    unsigned char *data = stbi_load(filename, &width, &height, &nrChannels, 0);
-    if (!data)
-    {
-        printf("Failed to load texture %s\n", imagePath);
-        exit(EXIT_FAILURE);
-    }
+        unsigned int numDraws = 0;
+        do {
+            Mesh *mesh = &model->meshes[i++];
+            counts[numDraws] = mesh->numIndices;
+            offsets[numDraws] = meshIndexOffset(mesh);
+            baseVertices[numDraws] = meshBaseVertex(mesh);
+            numDraws++;
+        } while (i < model->numMeshes && numDraws < MODEL_MAX_BATCH && sameMeshMaterial(first, &model->meshes[i]));
 
-    GLenum format;
-    if (nrChannels == 1) {
-        format = GL_RED;
-    }
-    else if (nrChannels == 3) {
-        format = GL_RGB;
-    }
-    else if (nrChannels == 4) {
-        format = GL_RGBA;
-    }
-    else {
-        printf("Unknown number of channels in %s: %d\n", imagePath, nrChannels);
-        exit(EXIT_FAILURE);
+        glMultiDrawElementsBaseVertex(GL_TRIANGLES, counts, first->indexType, offsets, numDraws, baseVertices);
     }
 
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-    glGenerateMipmap(GL_TEXTURE_2D);
-    stbi_image_free(data);
-
-    return texture;
+    glBindVertexArray(0);
 }
 
-void loadMaterialTextures(Model *model, struct aiMaterial *mat, enum aiTextureType type,
-    const char *typeName, Texture **textures, unsigned int *numTextures)
+unsigned int TextureFromFile(char *imagePath, char *directory)
 {
-    *numTextures = aiGetMaterialTextureCount(mat, type);
-    *textures = malloc(*numTextures * sizeof(Texture));
+    TRACE_FUNCTION();
+    char filename[PATH_MAX];
+    snprintf(filename, sizeof(filename), "%s/%s", directory, imagePath);
 
-    for (unsigned int i = 0; i < *numTextures; i++) {
-        struct aiString path;
-        aiReturn ret = aiGetMaterialTexture(mat, type, i, &path, NULL, NULL, NULL, NULL, NULL, NULL);
-        if (ret != aiReturn_SUCCESS) {
-            printf("Error loading material textures\n");
-            exit(EXIT_FAILURE);
-        }
+    // shared with every other model through the texture cache
+    return acquireTexture(filename);
+}
 
-        Texture texture;
-        // check if texture is already loaded
-        bool loaded = false;
-        for (unsigned int t = 0; t < model->numLoadedTextures; t++) {
-            Texture *loadedTex = &model->loadedTextures[t];
-            if (strcmp(loadedTex->path, path.data) == 0) {
-                texture = *loadedTex;
-                loaded = true;
-                break;
+// Material texture slots imported for every mesh, in the order they end up in Mesh.textures
+struct {
+    enum aiTextureType type;
+    TextureType textureType;
+} materialTextureTypes[] = {
+    {aiTextureType_DIFFUSE, TEXTURE_DIFFUSE},
+    {aiTextureType_SPECULAR, TEXTURE_SPECULAR},
+};
+
+// Collect the texture references of a material. Only the type and path are
+// filled in, the GL texture is resolved later by uploadModel() on the context thread.
+void loadMaterialTextures(struct aiMaterial *mat, Texture **textures, unsigned int *numTextures)
+{
+    unsigned int numTypes = sizeof(materialTextureTypes) / sizeof(materialTextureTypes[0]);
+
+    *numTextures = 0;
+    for (unsigned int t = 0; t < numTypes; t++) {
+        *numTextures += aiGetMaterialTextureCount(mat, materialTextureTypes[t].type);
+    }
+    *textures = calloc(*numTextures ? *numTextures : 1, sizeof(Texture));
+
+    unsigned int n = 0;
+    for (unsigned int t = 0; t < numTypes; t++) {
+        unsigned int count = aiGetMaterialTextureCount(mat, materialTextureTypes[t].type);
+        for (unsigned int i = 0; i < count; i++, n++) {
+            struct aiString path;
+            aiReturn ret = aiGetMaterialTexture(mat, materialTextureTypes[t].type, i, &path,
+                NULL, NULL, NULL, NULL, NULL, NULL);
+            if (ret != aiReturn_SUCCESS) {
+                printf("Error loading material textures\n");
+                exit(EXIT_FAILURE);
             }
-        }
 
-        if (!loaded) {
-            texture.id = TextureFromFile(path.data, model->directory);
-            strcpy(texture.type, typeName);
-            strcpy(texture.path, path.data);
-            model->loadedTextures = realloc(model->loadedTextures, ++model->numLoadedTextures * sizeof(Texture));
-            model->loadedTextures[model->numLoadedTextures - 1] = texture;
+            (*textures)[n].type = materialTextureTypes[t].textureType;
+            (*textures)[n].path = strdup(path.data);
         }
+    }
+}
 
-        *textures[i] = texture;
+// Map a type name read back from the mesh cache to its enum, TEXTURE_TYPE_COUNT if unknown
+TextureType findTextureType(const char *type, unsigned int length)
+{
+    for (unsigned int t = 0; t < TEXTURE_TYPE_COUNT; t++) {
+        const char *name = textureTypeNames[t];
+        if (strlen(name) == length && strncmp(name, type, length) == 0) {
+            return t;
+        }
     }
+
+    return TEXTURE_TYPE_COUNT;
 }
 
-Mesh processMesh(Model *model, struct aiMesh *mesh, const struct aiScene *scene)
+// CPU half of the import: convert vertices, flatten faces into indices and look
+// up the material. Touches no GL state, so meshes can be processed in parallel.
+void processMesh(struct aiMesh *mesh, const struct aiScene *scene, Mesh *out)
 {
     // process vertices
     Vertex *vertices = malloc(mesh->mNumVertices * sizeof(Vertex));
@@ -123,18 +182,22 @@ Mesh processMesh(Model *model, struct aiMesh *mesh, const struct aiScene *scene)
 
     for (unsigned int i = 0; i < mesh->mNumVertices; i++) {
         // process vertex positions, normals and texture coordinates
-        Vertex vertex = {
-            .position = {mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z},
-            .normal = {mesh->mNormals[i].x, mesh->mNormals[i].y, mesh->mNormals[i].z},
-            .texCoords = {0.0f, 0.0f},
-        };
+        Vertex *vertex = &vertices[i];
+        vertex->position[0] = mesh->mVertices[i].x;
+        vertex->position[1] = mesh->mVertices[i].y;
+        vertex->position[2] = mesh->mVertices[i].z;
+        vertex->normal[0] = mesh->mNormals[i].x;
+        vertex->normal[1] = mesh->mNormals[i].y;
+        vertex->normal[2] = mesh->mNormals[i].z;
 
         if (mesh->mTextureCoords[0]) { // does the mesh contain texture coordinates?
-            vec2 texCoords = {mesh->mTextureCoords[0][i].x, mesh->mTextureCoords[0][i].y};
-            memcpy(vertex.texCoords, texCoords, sizeof(texCoords));
-        };
-
-        memcpy(&vertices[i], &vertex, sizeof(vertex));
+            vertex->texCoords[0] = mesh->mTextureCoords[0][i].x;
+            vertex->texCoords[1] = mesh->mTextureCoords[0][i].y;
+        }
+        else {
+            vertex->texCoords[0] = 0.0f;
+            vertex->texCoords[1] = 0.0f;
+        }
     }
 
     // process indices
@@ -142,93 +205,446 @@ Mesh processMesh(Model *model, struct aiMesh *mesh, const struct aiScene *scene)
     unsigned int numIndices = 0;
 
     for (unsigned int i = 0; i < mesh->mNumFaces; i++) {
-        struct aiFace face = mesh->mFaces[i];
-        numIndices += face.mNumIndices;
+        numIndices += mesh->mFaces[i].mNumIndices;
     }
     unsigned int *indices = malloc(numIndices * sizeof(unsigned int));
     unsigned int idx = 0;
     // copy indices
     for (unsigned int i = 0; i < mesh->mNumFaces; i++) {
-        struct aiFace face = mesh->mFaces[i];
-        for (unsigned int j = 0; j < face.mNumIndices; j++, idx++) {
-            memcpy(&indices[idx], &face.mIndices[j], sizeof(unsigned int));
-        }
+        struct aiFace *face = &mesh->mFaces[i];
+        memcpy(&indices[idx], face->mIndices, face->mNumIndices * sizeof(unsigned int));
+        idx += face->mNumIndices;
     }
 
     // process material
     Texture *textures = NULL;
     unsigned int numTextures = 0;
-    if (mesh->mMaterialIndex >= 0) {
-        struct aiMaterial *material = scene->mMaterials[mesh->mMaterialIndex];
-        // load diffuse maps
-        Texture *diffuseMaps;
-        unsigned int numDiffuseMaps;
-        loadMaterialTextures(model, material, aiTextureType_DIFFUSE,
-            "texture_diffuse", &diffuseMaps, &numDiffuseMaps);
+    if (mesh->mMaterialIndex < scene->mNumMaterials) {
+        loadMaterialTextures(scene->mMaterials[mesh->mMaterialIndex], &textures, &numTextures);
+    }
 
-        // load specular maps
-        Texture *specularMaps;
-        unsigned int numSpecularMaps;
-        loadMaterialTextures(model, material, aiTextureType_SPECULAR,
-            "texture_specular", &specularMaps, &numSpecularMaps);
+    Mesh result = {
+        .vertices = vertices,
+        .indices = indices,
+        .textures = textures,
 
-        // add to the mesh
-        numTextures = numDiffuseMaps + numSpecularMaps;
-        textures = malloc(numTextures * sizeof(Texture));
-        memcpy(textures, diffuseMaps, numDiffuseMaps * sizeof(Texture));
-        memcpy(&textures[numDiffuseMaps], specularMaps, numSpecularMaps * sizeof(Texture));
+        .numVertices = numVertices,
+        .numIndices = numIndices,
+        .numTextures = numTextures,
+    };
+    *out = result;
+}
+
+// Flatten the node hierarchy into the depth first order meshes are stored in Model.meshes
+void processNode(struct aiNode *node, const struct aiScene *scene, struct aiMesh ***meshes, unsigned int *numMeshes)
+{
+    *meshes = realloc(*meshes, (*numMeshes + node->mNumMeshes + 1) * sizeof(struct aiMesh *));
+
+    // collect all the node's meshes (if any)
+    for (unsigned int i = 0; i < node->mNumMeshes; i++) {
+        (*meshes)[(*numMeshes)++] = scene->mMeshes[node->mMeshes[i]];
+    }
+    // then do the same for each of its children
+    for (unsigned int i = 0; i < node->mNumChildren; i++) {
+        processNode(node->mChildren[i], scene, meshes, numMeshes);
+    }
+}
+
+typedef struct {
+    struct aiMesh **meshes;
+    const struct aiScene *scene;
+    Mesh *out;
+
+    bool optimize, lod;
+    VertexCacheStats *before, *after;
+} ProcessMeshesJob;
+
+void processMeshJob(void *data, unsigned int index)
+{
+    ProcessMeshesJob *job = data;
+    Mesh *mesh = &job->out[index];
+
+    processMesh(job->meshes[index], job->scene, mesh);
+
+    // point and line primitives survive aiProcess_Triangulate, leave those meshes alone
+    if (mesh->numIndices != job->meshes[index]->mNumFaces * 3) {
+        return;
+    }
+    if (job->optimize) {
+        optimizeMesh(mesh, &job->before[index], &job->after[index]);
+    }
+    // the levels are stored in the mesh cache, warm starts never simplify
+    if (job->lod) {
+        generateMeshLods(mesh, MODEL_LOD_LEVELS);
+    }
+}
+
+// Run the CPU half of the import for every mesh on the job system. Each job
+// writes its own slot, so Model.meshes keeps the order of a serial traversal.
+void processScene(Model *model, const struct aiScene *scene)
+{
+    struct aiMesh **meshes = NULL;
+    unsigned int numMeshes = 0;
+    processNode(scene->mRootNode, scene, &meshes, &numMeshes);
+
+    model->numMeshes = numMeshes;
+    model->meshes = calloc(numMeshes ? numMeshes : 1, sizeof(Mesh));
+
+    ProcessMeshesJob job = {
+        .meshes = meshes,
+        .scene = scene,
+        .out = model->meshes,
+
+        .optimize = model->flags & MODEL_OPTIMIZE,
+        .lod = model->flags & MODEL_LOD,
+        .before = calloc(numMeshes ? numMeshes : 1, sizeof(VertexCacheStats)),
+        .after = calloc(numMeshes ? numMeshes : 1, sizeof(VertexCacheStats)),
+    };
+    parallelFor(numMeshes, processMeshJob, &job);
+
+    memset(&model->importedCacheStats, 0, sizeof(VertexCacheStats));
+    memset(&model->optimizedCacheStats, 0, sizeof(VertexCacheStats));
+    for (unsigned int i = 0; i < numMeshes; i++) {
+        addVertexCacheStats(&model->importedCacheStats, job.before[i]);
+        addVertexCacheStats(&model->optimizedCacheStats, job.after[i]);
     }
 
-    return createMesh(vertices, numVertices, indices, numIndices, textures, numTextures);
+    free(job.before);
+    free(job.after);
+    free(meshes);
 }
 
-void processNode(Model *model, struct aiNode *node, const struct aiScene *scene);
+void printModelCacheStats(Model *model, const char *path)
+{
+    VertexCacheStats before = model->importedCacheStats, after = model->optimizedCacheStats;
+
+    printf("%s: %u triangles, ACMR %.3f -> %.3f, ATVR %.3f -> %.3f (%u entry FIFO)\n", path, after.numTriangles,
+        vertexCacheACMR(before), vertexCacheACMR(after), vertexCacheATVR(before), vertexCacheATVR(after),
+        VERTEX_CACHE_SIZE);
+}
+
+// Sphere around the box of all vertices, needs the CPU copy of the geometry
+void computeModelBounds(Model *model)
+{
+    vec3 boundsMin = {INFINITY, INFINITY, INFINITY}, boundsMax = {-INFINITY, -INFINITY, -INFINITY};
+    for (unsigned int i = 0; i < model->numMeshes; i++) {
+        Mesh *mesh = &model->meshes[i];
+        for (unsigned int v = 0; v < mesh->numVertices; v++) {
+            glm_vec3_minv(boundsMin, mesh->vertices[v].position, boundsMin);
+            glm_vec3_maxv(boundsMax, mesh->vertices[v].position, boundsMax);
+        }
+    }
+
+    if (boundsMin[0] > boundsMax[0]) {
+        glm_vec3_zero(model->boundsCenter);
+        model->boundsRadius = 0.0f;
+        return;
+    }
+
+    glm_vec3_add(boundsMin, boundsMax, model->boundsCenter);
+    glm_vec3_scale(model->boundsCenter, 0.5f, model->boundsCenter);
+
+    float radius2 = 0.0f;
+    for (unsigned int i = 0; i < model->numMeshes; i++) {
+        Mesh *mesh = &model->meshes[i];
+        for (unsigned int v = 0; v < mesh->numVertices; v++) {
+            float distance2 = glm_vec3_distance2(model->boundsCenter, mesh->vertices[v].position);
+            radius2 = distance2 > radius2 ? distance2 : radius2;
+        }
+    }
+    model->boundsRadius = sqrtf(radius2);
+}
+
+// Levels of detail shared by every mesh of the model, 1 without MODEL_LOD
+void summarizeModelLods(Model *model)
+{
+    model->numLods = MESH_MAX_LODS;
+    for (unsigned int i = 0; i < model->numMeshes; i++) {
+        unsigned int numLods = model->meshes[i].numLods;
+        model->numLods = numLods < model->numLods ? numLods : model->numLods;
+    }
+    model->numLods = model->numMeshes ? model->numLods : 1;
+
+    for (unsigned int lod = 0; lod < model->numLods; lod++) {
+        model->lodErrors[lod] = 0.0f;
+        model->lodTriangles[lod] = 0;
+        for (unsigned int i = 0; i < model->numMeshes; i++) {
+            Mesh *mesh = &model->meshes[i];
+            model->lodErrors[lod] = mesh->lodErrors[lod] > model->lodErrors[lod] ? mesh->lodErrors[lod] : model->lodErrors[lod];
+            model->lodTriangles[lod] += mesh->lodNumIndices[lod] / 3;
+        }
+    }
+}
 
-void processNode(Model *model, struct aiNode *node, const struct aiScene *scene)
+void printModelLods(Model *model, const char *path)
 {
-    unsigned int meshesOffset = model->numMeshes;
-    // alloc memory for meshes
-    model->numMeshes += node->mNumMeshes;
-    if (model->meshes == NULL) {
-        model->meshes = malloc(model->numMeshes * sizeof(Mesh));
+    printf("%s: %u levels of detail", path, model->numLods);
+    for (unsigned int lod = 0; lod < model->numLods; lod++) {
+        printf("%s %u triangles (error %.4f)", lod ? "," : "", model->lodTriangles[lod], model->lodErrors[lod]);
+    }
+    printf("\n");
+}
+
+// GL half of the load, batched on the context thread: resolve textures and
+// copy every mesh into the shared geometry arena
+void uploadModel(Model *model)
+{
+    computeModelBounds(model);
+
+    for (unsigned int i = 0; i < model->numMeshes; i++) {
+        Mesh *mesh = &model->meshes[i];
+        mesh->vertexFormat = model->flags & MODEL_PACK_VERTICES ? VERTEX_FORMAT_PACKED : VERTEX_FORMAT_FLOAT;
+
+        for (unsigned int t = 0; t < mesh->numTextures; t++) {
+            mesh->textures[t].id = TextureFromFile(mesh->textures[t].path, model->directory);
+        }
+
+        setupMeshInArena(mesh);
+    }
+
+    summarizeModelLods(model);
+}
+
+// GPU memory taken by the vertex and index buffers, next to what full float vertices would take
+void printModelMemory(Model *model, const char *path)
+{
+    size_t floatBytes = 0, vertexBytes = 0, indexBytes = 0;
+
+    for (unsigned int i = 0; i < model->numMeshes; i++) {
+        Mesh *mesh = &model->meshes[i];
+        floatBytes += mesh->numVertices * sizeof(Vertex);
+        vertexBytes += mesh->numVertices * vertexFormatSize(mesh->vertexFormat);
+        indexBytes += mesh->numIndices * indexTypeSize(mesh->indexType);
+    }
+
+    printf("%s: vertices %zu KiB (%zu KiB as floats, %.0f%%), indices %zu KiB\n", path,
+        vertexBytes / 1024, floatBytes / 1024, floatBytes ? 100.0 * vertexBytes / floatBytes : 100.0, indexBytes / 1024);
+}
+
+// The levels only ever live in the index buffer once uploaded
+void releaseModelLodIndices(Model *model)
+{
+    for (unsigned int i = 0; i < model->numMeshes; i++) {
+        free(model->meshes[i].lodIndices);
+        model->meshes[i].lodIndices = NULL;
+    }
+}
+
+bool loadModelCache(Model *model, const char *cachePath, uint64_t sourceHash, uint64_t sourceSize)
+{
+    bool map = model->flags & MODEL_LOAD_MMAP;
+
+    MeshCache cache;
+    if (!openMeshCache(&cache, cachePath, sourceHash, sourceSize, model->flags & MODEL_CACHE_OPTIONS, map)) {
+        return false;
+    }
+
+    model->numMeshes = cache.numEntries;
+    model->meshes = calloc(model->numMeshes ? model->numMeshes : 1, sizeof(Mesh));
+
+    for (unsigned int i = 0; i < cache.numEntries; i++) {
+        MeshCacheEntry *entry = &cache.entries[i];
+
+        Vertex *vertices;
+        unsigned int *indices;
+        if (map) {
+            // hand the mapped blob to glBufferData as is
+            vertices = (Vertex *) entry->vertices;
+            indices = (unsigned int *) entry->indices;
+        }
+        else {
+            vertices = malloc(entry->numVertices * sizeof(Vertex));
+            memcpy(vertices, entry->vertices, entry->numVertices * sizeof(Vertex));
+            indices = malloc(entry->numIndices * sizeof(unsigned int));
+            memcpy(indices, entry->indices, entry->numIndices * sizeof(unsigned int));
+        }
+
+        unsigned int *lodIndices;
+        size_t numLodIndices = 0;
+        for (unsigned int lod = 1; lod < entry->numLods; lod++) {
+            numLodIndices += entry->lodNumIndices[lod];
+        }
+        if (map || numLodIndices == 0) {
+            lodIndices = (unsigned int *) entry->lodIndices;
+        }
+        else {
+            lodIndices = malloc(numLodIndices * sizeof(unsigned int));
+            memcpy(lodIndices, entry->lodIndices, numLodIndices * sizeof(unsigned int));
+        }
+
+        Texture *textures = calloc(entry->numTextures ? entry->numTextures : 1, sizeof(Texture));
+        for (unsigned int t = 0; t < entry->numTextures; t++) {
+            MeshCacheTextureRef *ref = &entry->textures[t];
+            textures[t].type = findTextureType(ref->type, ref->typeLength);
+            textures[t].path = strndup(ref->path, ref->pathLength);
+        }
+
+        Mesh mesh = {
+            .vertices = vertices,
+            .indices = indices,
+            .textures = textures,
+
+            .numVertices = entry->numVertices,
+            .numIndices = entry->numIndices,
+            .numTextures = entry->numTextures,
+
+            .numLods = entry->numLods,
+            .lodIndices = lodIndices,
+        };
+        // levels 1.. follow level 0 in the index buffer
+        unsigned int firstIndex = 0;
+        for (unsigned int lod = 0; lod < entry->numLods; lod++) {
+            mesh.lodFirstIndex[lod] = firstIndex;
+            mesh.lodNumIndices[lod] = entry->lodNumIndices[lod];
+            mesh.lodErrors[lod] = entry->lodErrors[lod];
+            firstIndex += entry->lodNumIndices[lod];
+        }
+        model->meshes[i] = mesh;
+    }
+
+    // a texture type this build does not know means the cache is from another version
+    bool typesKnown = true;
+    for (unsigned int i = 0; i < model->numMeshes; i++) {
+        for (unsigned int t = 0; t < model->meshes[i].numTextures; t++) {
+            typesKnown = typesKnown && model->meshes[i].textures[t].type < TEXTURE_TYPE_COUNT;
+        }
+    }
+    if (!typesKnown) {
+        for (unsigned int i = 0; i < model->numMeshes; i++) {
+            if (!map) {
+                releaseMeshData(&model->meshes[i]);
+            }
+            freeMeshTextures(&model->meshes[i]);
+        }
+        free(model->meshes);
+        model->meshes = NULL;
+        model->numMeshes = 0;
+        closeMeshCache(&cache);
+        return false;
+    }
+
+    uploadModel(model);
+
+    if (map) {
+        // the data now lives in GL buffers, the pointers die with the mapping
+        for (unsigned int i = 0; i < model->numMeshes; i++) {
+            model->meshes[i].vertices = NULL;
+            model->meshes[i].indices = NULL;
+            model->meshes[i].lodIndices = NULL;
+        }
     }
     else {
-        model->meshes = realloc(model->meshes, model->numMeshes * sizeof(Mesh));
+        releaseModelLodIndices(model);
     }
 
-    // process all the node's meshes (if any)
-    for (unsigned int i = 0; i < node->mNumMeshes; i++) {
-        struct aiMesh *mesh = scene->mMeshes[node->mMeshes[i]];
-        model->meshes[meshesOffset + i] = processMesh(model, mesh, scene);
+    closeMeshCache(&cache);
+
+    return true;
+}
+
+// Hash of the model source plus the material libraries an .obj pulls in with
+// mtllib, since their materials and texture paths end up in the mesh cache too.
+// The .obj is read once, line by line, so its bytes hash as hashFile() would.
+bool hashModelSource(const char *path, const char *directory, uint64_t *hash, uint64_t *size)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return false;
     }
-    // then do the same for each of its children
-    for (unsigned int i = 0; i < node->mNumChildren; i++) {
-        processNode(model, node->mChildren[i], scene);
+
+    char libraries[1024] = "";
+    char line[64 * 1024];
+    bool lineStart = true;
+
+    *hash = HASH_SEED;
+    *size = 0;
+    while (fgets(line, sizeof(line), f)) {
+        size_t length = strlen(line);
+        *hash = hashBytes(*hash, line, length);
+        *size += length;
+
+        if (lineStart && strncmp(line, "mtllib", 6) == 0 && (line[6] == ' ' || line[6] == '\t')) {
+            // the names keep their line break, which separates them below
+            strncat(libraries, &line[7], sizeof(libraries) - strlen(libraries) - 1);
+        }
+        lineStart = length > 0 && line[length - 1] == '\n';
+    }
+    fclose(f);
+
+    for (char *save, *name = strtok_r(libraries, " \t\r\n", &save); name; name = strtok_r(NULL, " \t\r\n", &save)) {
+        char libraryPath[PATH_MAX];
+        snprintf(libraryPath, sizeof(libraryPath), "%s/%s", directory, name);
+
+        // a missing library still counts, so the cache notices when it appears
+        uint64_t libraryHash = 0, librarySize = 0;
+        hashFile(libraryPath, &libraryHash, &librarySize);
+        *hash = hashBytes(*hash, name, strlen(name));
+        *hash = hashBytes(*hash, &libraryHash, sizeof(libraryHash));
+        *size += librarySize;
     }
+
+    return true;
 }
 
 void loadModel(Model *model, const char *path)
 {
-    const struct aiScene *scene = aiImportFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
+    TRACE_FUNCTION();
+    char *canonicalPath = realpath(path, NULL);
+    if (!canonicalPath) {
+        printf("ERROR::MODEL::%s not found\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    model->directory = dirname(canonicalPath); // base path for textures
+
+    // hash the source so a stale cache is never used after the asset changes
+    uint64_t sourceHash = 0, sourceSize = 0;
+    bool hashed = !(model->flags & MODEL_NO_CACHE) && hashModelSource(path, model->directory, &sourceHash, &sourceSize);
+
+    char cachePath[PATH_MAX];
+    getMeshCachePath(path, cachePath, sizeof(cachePath));
+
+    if (hashed && loadModelCache(model, cachePath, sourceHash, sourceSize)) {
+        return;
+    }
+
+    const struct aiScene *scene = aiImportFile(path, MODEL_IMPORT_FLAGS);
 
     if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
         printf("ERROR::ASSIMP::%s\n", aiGetErrorString());
         exit(EXIT_FAILURE);
     }
 
-    char *canonicalPath = realpath(path, NULL);
-    model->directory = dirname(canonicalPath); // base path for textures
+    processScene(model, scene);
+    aiReleaseImport(scene);
+    uploadModel(model);
+
+    if (model->flags & MODEL_OPTIMIZE) {
+        printModelCacheStats(model, path);
+    }
 
-    processNode(model, scene->mRootNode, scene);
+    if (hashed) {
+        writeMeshCache(cachePath, sourceHash, sourceSize, model->flags & MODEL_CACHE_OPTIONS,
+            model->meshes, model->numMeshes);
+    }
+
+    if (model->flags & MODEL_LOAD_MMAP) {
+        // cold start: keep the process as lean as a warm one once the cache is written
+        for (unsigned int i = 0; i < model->numMeshes; i++) {
+            releaseMeshData(&model->meshes[i]);
+        }
+    }
+    else {
+        releaseModelLodIndices(model);
+    }
 }
 
-Model createModel(const char *path)
+Model createModel(const char *path, unsigned int flags)
 {
     Model model = {
         .meshes = NULL,
         .numMeshes = 0,
-        .loadedTextures = NULL,
-        .numLoadedTextures = 0,
+        .flags = flags,
     };
 
     loadModel(&model, path);
@@ -236,4 +652,24 @@ Model createModel(const char *path)
     return model;
 }
 
+void destroyModel(Model *model)
+{
+    // pending uploads still reference our texture names
+    finishTextureUploads();
+
+    for (unsigned int i = 0; i < model->numMeshes; i++) {
+        for (unsigned int t = 0; t < model->meshes[i].numTextures; t++) {
+            releaseTexture(model->meshes[i].textures[t].id);
+        }
+        destroyMesh(&model->meshes[i]);
+    }
+
+    // unloading leaves holes behind, close them once they dominate the free space
+    compactGeometryArenas(0.5f);
+
+    free(model->meshes);
+    free(model->directory);
+    memset(model, 0, sizeof(*model));
+}
+
 #endif // _MODEL_H_
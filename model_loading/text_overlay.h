@@ -0,0 +1,203 @@
+#ifndef _TEXT_OVERLAY_H_
+#define _TEXT_OVERLAY_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include <glad/glad.h>
+
+// Screen text in a 5x7 bitmap font, drawn over the frame on a dark panel.
+// The glyphs of ASCII 32 to 126 are one texture, each glyph five columns of
+// seven bits with the top row in bit 0.
+#define TEXT_FIRST_CHAR 32
+#define TEXT_NUM_CHARS 95
+#define TEXT_GLYPH_WIDTH 5
+#define TEXT_GLYPH_HEIGHT 7
+#define TEXT_CELL_WIDTH 6   // with the space to the next glyph
+#define TEXT_CELL_HEIGHT 9  // with the space to the next line
+#define TEXT_SOLID_CELL TEXT_NUM_CHARS  // an all set cell after the glyphs, for the panel
+#define TEXT_FLOATS_PER_VERTEX 8        // pixel position, texture coordinate, color
+
+static const unsigned char textFont[TEXT_NUM_CHARS * TEXT_GLYPH_WIDTH] = {
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x5f, 0x00, 0x00, 0x00, 0x07, 0x00, 0x07, 0x00, 0x14, 0x7f, 0x14, 0x7f, 0x14,  //   ! " #
+    0x24, 0x2a, 0x7f, 0x2a, 0x12, 0x23, 0x13, 0x08, 0x64, 0x62, 0x36, 0x49, 0x56, 0x20, 0x50, 0x00, 0x08, 0x07, 0x03, 0x00,  // $ % & '
+    0x00, 0x1c, 0x22, 0x41, 0x00, 0x00, 0x41, 0x22, 0x1c, 0x00, 0x2a, 0x1c, 0x7f, 0x1c, 0x2a, 0x08, 0x08, 0x3e, 0x08, 0x08,  // ( ) * +
+    0x00, 0x50, 0x30, 0x00, 0x00, 0x08, 0x08, 0x08, 0x08, 0x08, 0x00, 0x00, 0x60, 0x60, 0x00, 0x20, 0x10, 0x08, 0x04, 0x02,  // , - . /
+    0x3e, 0x51, 0x49, 0x45, 0x3e, 0x00, 0x42, 0x7f, 0x40, 0x00, 0x42, 0x61, 0x51, 0x49, 0x46, 0x21, 0x41, 0x49, 0x4d, 0x33,  // 0 1 2 3
+    0x18, 0x14, 0x12, 0x7f, 0x10, 0x27, 0x45, 0x45, 0x45, 0x39, 0x3c, 0x4a, 0x49, 0x49, 0x31, 0x41, 0x21, 0x11, 0x09, 0x07,  // 4 5 6 7
+    0x36, 0x49, 0x49, 0x49, 0x36, 0x46, 0x49, 0x49, 0x29, 0x1e, 0x00, 0x00, 0x14, 0x00, 0x00, 0x00, 0x40, 0x34, 0x00, 0x00,  // 8 9 : ;
+    0x00, 0x08, 0x14, 0x22, 0x41, 0x14, 0x14, 0x14, 0x14, 0x14, 0x00, 0x41, 0x22, 0x14, 0x08, 0x02, 0x01, 0x59, 0x09, 0x06,  // < = > ?
+    0x3e, 0x41, 0x5d, 0x59, 0x4e, 0x7c, 0x12, 0x11, 0x12, 0x7c, 0x7f, 0x49, 0x49, 0x49, 0x36, 0x3e, 0x41, 0x41, 0x41, 0x22,  // @ A B C
+    0x7f, 0x41, 0x41, 0x41, 0x3e, 0x7f, 0x49, 0x49, 0x49, 0x41, 0x7f, 0x09, 0x09, 0x09, 0x01, 0x3e, 0x41, 0x41, 0x51, 0x73,  // D E F G
+    0x7f, 0x08, 0x08, 0x08, 0x7f, 0x00, 0x41, 0x7f, 0x41, 0x00, 0x20, 0x40, 0x41, 0x3f, 0x01, 0x7f, 0x08, 0x14, 0x22, 0x41,  // H I J K
+    0x7f, 0x40, 0x40, 0x40, 0x40, 0x7f, 0x02, 0x1c, 0x02, 0x7f, 0x7f, 0x04, 0x08, 0x10, 0x7f, 0x3e, 0x41, 0x41, 0x41, 0x3e,  // L M N O
+    0x7f, 0x09, 0x09, 0x09, 0x06, 0x3e, 0x41, 0x51, 0x21, 0x5e, 0x7f, 0x09, 0x19, 0x29, 0x46, 0x26, 0x49, 0x49, 0x49, 0x32,  // P Q R S
+    0x03, 0x01, 0x7f, 0x01, 0x03, 0x3f, 0x40, 0x40, 0x40, 0x3f, 0x1f, 0x20, 0x40, 0x20, 0x1f, 0x3f, 0x40, 0x38, 0x40, 0x3f,  // T U V W
+    0x63, 0x14, 0x08, 0x14, 0x63, 0x03, 0x04, 0x78, 0x04, 0x03, 0x61, 0x59, 0x49, 0x4d, 0x43, 0x00, 0x7f, 0x41, 0x41, 0x41,  // X Y Z [
+    0x02, 0x04, 0x08, 0x10, 0x20, 0x00, 0x41, 0x41, 0x41, 0x7f, 0x04, 0x02, 0x01, 0x02, 0x04, 0x40, 0x40, 0x40, 0x40, 0x40,  // backslash ] ^ _
+    0x00, 0x03, 0x07, 0x08, 0x00, 0x20, 0x54, 0x54, 0x78, 0x40, 0x7f, 0x28, 0x44, 0x44, 0x38, 0x38, 0x44, 0x44, 0x44, 0x28,  // ` a b c
+    0x38, 0x44, 0x44, 0x28, 0x7f, 0x38, 0x54, 0x54, 0x54, 0x18, 0x00, 0x08, 0x7e, 0x09, 0x02, 0x0c, 0x52, 0x52, 0x52, 0x3e,  // d e f g
+    0x7f, 0x08, 0x04, 0x04, 0x78, 0x00, 0x44, 0x7d, 0x40, 0x00, 0x20, 0x40, 0x44, 0x3d, 0x00, 0x7f, 0x10, 0x28, 0x44, 0x00,  // h i j k
+    0x00, 0x41, 0x7f, 0x40, 0x00, 0x7c, 0x04, 0x78, 0x04, 0x78, 0x7c, 0x08, 0x04, 0x04, 0x78, 0x38, 0x44, 0x44, 0x44, 0x38,  // l m n o
+    0x7c, 0x14, 0x14, 0x14, 0x08, 0x08, 0x14, 0x14, 0x18, 0x7c, 0x7c, 0x08, 0x04, 0x04, 0x08, 0x48, 0x54, 0x54, 0x54, 0x24,  // p q r s
+    0x04, 0x04, 0x3f, 0x44, 0x24, 0x3c, 0x40, 0x40, 0x20, 0x7c, 0x1c, 0x20, 0x40, 0x20, 0x1c, 0x3c, 0x40, 0x30, 0x40, 0x3c,  // t u v w
+    0x44, 0x28, 0x10, 0x28, 0x44, 0x0c, 0x50, 0x50, 0x50, 0x3c, 0x44, 0x64, 0x54, 0x4c, 0x44, 0x00, 0x08, 0x36, 0x41, 0x00,  // x y z {
+    0x00, 0x00, 0x77, 0x00, 0x00, 0x00, 0x41, 0x36, 0x08, 0x00, 0x02, 0x01, 0x02, 0x04, 0x02,  // | } ~
+};
+
+typedef struct {
+    unsigned int program;
+    unsigned int texture;
+    unsigned int vao, vbo;
+    GLint screenSizeLocation;
+
+    float *vertices;
+    unsigned int capacity;  // characters
+} TextOverlay;
+
+// `program` is built from text.vert and text.frag
+void initTextOverlay(TextOverlay *overlay, unsigned int program)
+{
+    memset(overlay, 0, sizeof(*overlay));
+    overlay->program = program;
+    overlay->screenSizeLocation = glGetUniformLocation(program, "screenSize");
+    glUseProgram(program);
+    glUniform1i(glGetUniformLocation(program, "font"), 0);
+
+    unsigned int width = (TEXT_NUM_CHARS + 1) * TEXT_CELL_WIDTH, height = TEXT_CELL_HEIGHT;
+    unsigned char *texels = calloc(width * height, 1);
+    for (unsigned int c = 0; c < TEXT_NUM_CHARS; c++) {
+        for (unsigned int x = 0; x < TEXT_GLYPH_WIDTH; x++) {
+            unsigned char column = textFont[c * TEXT_GLYPH_WIDTH + x];
+            for (unsigned int y = 0; y < TEXT_GLYPH_HEIGHT; y++) {
+                texels[y * width + c * TEXT_CELL_WIDTH + x] = column >> y & 1 ? 255 : 0;
+            }
+        }
+    }
+    for (unsigned int y = 0; y < height; y++) {
+        memset(texels + y * width + TEXT_SOLID_CELL * TEXT_CELL_WIDTH, 255, TEXT_CELL_WIDTH);
+    }
+
+    glGenTextures(1, &overlay->texture);
+    glBindTexture(GL_TEXTURE_2D, overlay->texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, width, height, 0, GL_RED, GL_UNSIGNED_BYTE, texels);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    free(texels);
+
+    glGenVertexArrays(1, &overlay->vao);
+    glGenBuffers(1, &overlay->vbo);
+    glBindVertexArray(overlay->vao);
+    glBindBuffer(GL_ARRAY_BUFFER, overlay->vbo);
+    GLsizei stride = TEXT_FLOATS_PER_VERTEX * sizeof(float);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, stride, (void *) 0);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride, (void *) (2 * sizeof(float)));
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, stride, (void *) (4 * sizeof(float)));
+    glBindVertexArray(0);
+}
+
+// Two triangles covering pixels [x0, x1) x [y0, y1) with cell `cell` of the font texture
+static float *textQuad(float *v, float x0, float y0, float x1, float y1, unsigned int cell, const float color[4])
+{
+    float width = (TEXT_NUM_CHARS + 1) * TEXT_CELL_WIDTH;
+    float u0 = cell * TEXT_CELL_WIDTH / width, u1 = (cell * TEXT_CELL_WIDTH + TEXT_GLYPH_WIDTH) / width;
+    float v0 = 0.0f, v1 = (float) TEXT_GLYPH_HEIGHT / TEXT_CELL_HEIGHT;
+    const float corners[6][4] = {
+        {x0, y0, u0, v0}, {x1, y0, u1, v0}, {x1, y1, u1, v1},
+        {x0, y0, u0, v0}, {x1, y1, u1, v1}, {x0, y1, u0, v1},
+    };
+    for (int i = 0; i < 6; i++) {
+        memcpy(v, corners[i], 4 * sizeof(float));
+        memcpy(v + 4, color, 4 * sizeof(float));
+        v += TEXT_FLOATS_PER_VERTEX;
+    }
+    return v;
+}
+
+// Draw `text`, lines split at '\n', with its top left corner at pixel (x, y)
+// from the top left of a `screenWidth` x `screenHeight` viewport. Every font
+// pixel covers `scale` x `scale` screen pixels.
+void drawTextOverlay(TextOverlay *overlay, const char *text, float x, float y, float scale, int screenWidth,
+    int screenHeight)
+{
+    unsigned int length = strlen(text), numLines = 1, lineLength = 0, longestLine = 0;
+    for (unsigned int i = 0; i < length; i++) {
+        if (text[i] == '\n') {
+            numLines += i + 1 < length;
+            lineLength = 0;
+        }
+        else if (++lineLength > longestLine) {
+            longestLine = lineLength;
+        }
+    }
+
+    if (length + 1 > overlay->capacity) {
+        overlay->capacity = length + 1;
+        overlay->vertices = realloc(overlay->vertices, overlay->capacity * 6 * TEXT_FLOATS_PER_VERTEX * sizeof(float));
+    }
+
+    const float panel[4] = {0.0f, 0.0f, 0.0f, 0.6f}, white[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+    float cellWidth = TEXT_CELL_WIDTH * scale, cellHeight = TEXT_CELL_HEIGHT * scale, padding = 2.0f * scale;
+    float *v = textQuad(overlay->vertices, x, y, x + longestLine * cellWidth + 2.0f * padding,
+        y + numLines * cellHeight + 2.0f * padding, TEXT_SOLID_CELL, panel);
+
+    float penX = x + padding, penY = y + padding;
+    for (unsigned int i = 0; i < length; i++) {
+        unsigned char c = text[i];
+        if (c == '\n') {
+            penX = x + padding;
+            penY += cellHeight;
+            continue;
+        }
+        if (c > TEXT_FIRST_CHAR && c < TEXT_FIRST_CHAR + TEXT_NUM_CHARS) {
+            v = textQuad(v, penX, penY, penX + TEXT_GLYPH_WIDTH * scale, penY + TEXT_GLYPH_HEIGHT * scale,
+                c - TEXT_FIRST_CHAR, white);
+        }
+        penX += cellWidth;
+    }
+    unsigned int numVertices = (v - overlay->vertices) / TEXT_FLOATS_PER_VERTEX;
+
+    // over everything, blended, then back to the state the demos draw with
+    GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST), blend = glIsEnabled(GL_BLEND);
+    glDisable(GL_DEPTH_TEST);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    glUseProgram(overlay->program);
+    glUniform2f(overlay->screenSizeLocation, (float) screenWidth, (float) screenHeight);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, overlay->texture);
+    glBindVertexArray(overlay->vao);
+    glBindBuffer(GL_ARRAY_BUFFER, overlay->vbo);
+    glBufferData(GL_ARRAY_BUFFER, numVertices * TEXT_FLOATS_PER_VERTEX * sizeof(float), overlay->vertices,
+        GL_STREAM_DRAW);
+    glDrawArrays(GL_TRIANGLES, 0, numVertices);
+    glBindVertexArray(0);
+
+    if (depthTest) {
+        glEnable(GL_DEPTH_TEST);
+    }
+    if (!blend) {
+        glDisable(GL_BLEND);
+    }
+}
+
+void destroyTextOverlay(TextOverlay *overlay)
+{
+    glDeleteTextures(1, &overlay->texture);
+    glDeleteBuffers(1, &overlay->vbo);
+    glDeleteVertexArrays(1, &overlay->vao);
+    free(overlay->vertices);
+    memset(overlay, 0, sizeof(*overlay));
+}
+
+#endif // _TEXT_OVERLAY_H_
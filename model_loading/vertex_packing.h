@@ -0,0 +1,71 @@
+#ifndef _VERTEX_PACKING_H_
+#define _VERTEX_PACKING_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+// Scalar encoders for the packed vertex layout. Everything here decodes in the
+// fixed function vertex fetch (normalized integers, GL_INT_2_10_10_10_REV,
+// GL_HALF_FLOAT), the shader only has to undo the position quantization.
+
+// IEEE 754 binary16, round to nearest even, overflow saturates to infinity
+uint16_t packHalf(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    uint32_t sign = (bits >> 16) & 0x8000;
+    uint32_t magnitude = bits & 0x7fffffff;
+
+    if (magnitude >= 0x7f800000) { // inf or nan
+        return sign | 0x7c00 | (magnitude > 0x7f800000 ? 0x200 : 0);
+    }
+    if (magnitude >= 0x477ff000) { // rounds past the largest half
+        return sign | 0x7c00;
+    }
+    if (magnitude < 0x38800000) { // half denormal or zero
+        float denormal;
+        memcpy(&denormal, &magnitude, sizeof(denormal));
+        return sign | (uint16_t) lrintf(denormal * 16777216.0f); // 2^24
+    }
+
+    // rebias the exponent and round the 13 dropped mantissa bits
+    uint32_t half = (magnitude - 0x38000000) >> 13;
+    uint32_t rest = magnitude & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) {
+        half++;
+    }
+
+    return sign | half;
+}
+
+// [0, 1] to a normalized unsigned short
+uint16_t packUnorm16(float value)
+{
+    value = value < 0.0f ? 0.0f : value > 1.0f ? 1.0f : value;
+    return (uint16_t) lrintf(value * 65535.0f);
+}
+
+// [-1, 1] to a normalized signed short
+int16_t packSnorm16(float value)
+{
+    value = value < -1.0f ? -1.0f : value > 1.0f ? 1.0f : value;
+    return (int16_t) lrintf(value * 32767.0f);
+}
+
+// Unit vector to signed normalized 10:10:10:2 (GL_INT_2_10_10_10_REV), w = 0
+uint32_t packSnorm1010102(const float *v)
+{
+    uint32_t packed = 0;
+
+    for (int i = 0; i < 3; i++) {
+        float c = v[i] < -1.0f ? -1.0f : v[i] > 1.0f ? 1.0f : v[i];
+        int32_t q = (int32_t) lrintf(c * 511.0f);
+        packed |= ((uint32_t) q & 0x3ff) << (10 * i);
+    }
+
+    return packed;
+}
+
+#endif // _VERTEX_PACKING_H_
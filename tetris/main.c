@@ -20,6 +20,8 @@
 #include "model.h"
 #include "light_cube_vertices.h"
 #include "pieces.h"
+#include "display.h"
+#include "trace.h"
 
 #define SCR_WIDTH 800
 #define SCR_HEIGHT 600
@@ -28,10 +30,12 @@
 #define BOARD_COLS 12
 
 Camera camera;
+DisplayBackend display;
 
 float lastX = SCR_WIDTH / 2.0f;
 float lastY = SCR_HEIGHT / 2.0f;
 bool firstMouse = true;
+bool traceKeyDown = false;
 
 float deltaTime = 0.0f;	// Time between current frame and last frame
 float lastFrame = 0.0f; // Time of last frame
@@ -151,6 +155,7 @@ bool paintCollision ()
 
 void processInput (GLFWwindow *window)
 {
+    TRACE_FUNCTION();
     if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS) {
         processKeyboard(&camera, FORWARD, deltaTime);
     }
@@ -163,6 +168,11 @@ void processInput (GLFWwindow *window)
     if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS) {
         processKeyboard(&camera, RIGHT, deltaTime);
     }
+    bool f12KeyDown = TRACE_ENABLED && glfwGetKey(window, GLFW_KEY_F12) == GLFW_PRESS;
+    if (f12KeyDown && !traceKeyDown) {
+        TRACE_WRITE(TRACE_OUTPUT);
+    }
+    traceKeyDown = f12KeyDown;
     if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS) {
         glfwSetWindowShouldClose(window, GLFW_TRUE);
     }
@@ -247,38 +257,19 @@ void processInput (GLFWwindow *window)
     }
 }
 
-GLFWwindow* createWindow ()
+GLFWwindow* createWindow (const DisplayOptions *options)
 {
     glfwSetErrorCallback(error_callback);
+    openDisplay(&display, options, SCR_WIDTH, SCR_HEIGHT);
 
-    if (glfwInit() == GLFW_FALSE) {
-        printf("Failed to initialize GLFW\n");
-        exit(EXIT_FAILURE);
-    }
-
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    GLFWwindow *window = display.window;
+    if (window) {
+        glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
 
-    GLFWwindow *window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "LearnOpenGL", NULL, NULL);
-    if (window == NULL) {
-        printf("Failed to create GLFW window\n");
-        glfwTerminate();
-        exit(EXIT_FAILURE);
+        //glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+        glfwSetCursorPosCallback(window, mouse_callback);
+        glfwSetScrollCallback(window, scroll_callback);
     }
-    glfwMakeContextCurrent(window);
-
-    if (!gladLoadGLLoader((GLADloadproc) glfwGetProcAddress)) {
-        printf("Failed to initialize GLAD\n");
-        exit(EXIT_FAILURE);
-    }
-
-    glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
-    glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
-
-    //glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
-    glfwSetCursorPosCallback(window, mouse_callback);
-    glfwSetScrollCallback(window, scroll_callback);
 
     return window;
 }
@@ -417,6 +408,7 @@ void movePiecesDown (int start_row)
 
 void checkDeleteLines ()
 {
+    TRACE_FUNCTION();
     for (int row = BOARD_ROWS - 2; row >= 1; row--) {
         bool delete = true;
         for (int col = 1; col < BOARD_COLS - 1; col++) {
@@ -440,11 +432,20 @@ void checkDeleteLines ()
 
 int main (int argc, char *argv[])
 {
+    DisplayOptions displayOptions = {0};
+    for (int i = 1; i < argc; i++) {
+        if (!parseDisplayOption(&displayOptions, argc, argv, &i)) {
+            printf("Unknown option %s\n", argv[i]);
+            printf("Usage: %s %s\n", argv[0], DISPLAY_USAGE);
+            exit(EXIT_FAILURE);
+        }
+    }
+
     // Init random numbers
     srand ((unsigned int) time(NULL));
 
     initCamera(&camera);
-    GLFWwindow *window = createWindow();
+    GLFWwindow *window = createWindow(&displayOptions);
 
     /*
     ctx = igCreateContext(NULL);
@@ -482,13 +483,16 @@ int main (int argc, char *argv[])
     spawnPiece();
     float elapsedTime = 0.0f;
 
-    while (!glfwWindowShouldClose(window))
+    while (!displayShouldClose(&display))
     {
-        float currentFrame = glfwGetTime();
+        TRACE_SCOPE("frame");
+        float currentFrame = displayTime(&display);
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
 
-        processInput(window);
+        if (window) {
+            processInput(window);
+        }
 
         glClearColor(0.05f, 0.05f, 0.05f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -532,15 +536,15 @@ int main (int argc, char *argv[])
         renderBoard(lightProgram);
         renderPiece(lightProgram);
 
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+        presentDisplay(&display);
     }
 
     glDeleteVertexArrays(1, &lightCubeVAO);
     glDeleteBuffers(1, &VBO);
     glDeleteProgram(lightProgram);
 
-    glfwTerminate();
+    TRACE_WRITE(TRACE_OUTPUT);
+    closeDisplay(&display);
 
     return EXIT_SUCCESS;
 }
@@ -6,6 +6,8 @@
 #include <glad/glad.h>
 #include <cglm/cglm.h>
 
+#include "trace.h"
+
 typedef struct {
     vec3 position;
     vec3 normal;
@@ -77,6 +79,7 @@ Mesh createMesh(Vertex *vertices, unsigned int numVertices, unsigned int *indice
 
 void drawMesh(Mesh *mesh, unsigned int shader)
 {
+    TRACE_FUNCTION();
     unsigned int diffuseNr = 1;
     unsigned int specularNr = 1;
 
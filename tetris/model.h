@@ -15,6 +15,7 @@
 #include "stb_image.h"
 
 #include "mesh.h"
+#include "trace.h"
 
 typedef struct {
     Mesh *meshes;
@@ -27,6 +28,7 @@ typedef struct {
 
 void drawModel(Model *model, unsigned int shader)
 {
+    TRACE_FUNCTION();
     for (unsigned int i = 0; i < model->numMeshes; i++) {
         drawMesh(&model->meshes[i], shader);
     }
@@ -34,6 +36,7 @@ void drawModel(Model *model, unsigned int shader)
 
 unsigned int TextureFromFile(char *imagePath, char *directory)
 {
+    TRACE_FUNCTION();
     char filename[PATH_MAX];
     snprintf(filename, sizeof(filename), "%s/%s", directory, imagePath);
 
@@ -223,6 +226,7 @@ void processNode(Model *model, struct aiNode *node, const struct aiScene *scene)
 
 void loadModel(Model *model, const char *path)
 {
+    TRACE_FUNCTION();
     const struct aiScene *scene = aiImportFile(path, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
 
     if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
@@ -5,6 +5,8 @@
 
 #include <glad/glad.h>
 
+#include "trace.h"
+
 char * read_file (const char *path)
 {
     FILE *f = fopen(path, "r");
@@ -51,6 +53,7 @@ unsigned int createShader (const char *shaderPath, GLuint shaderType)
 
 unsigned int createProgram (const char *vertexShaderPath, const char *fragmentShaderPath)
 {
+    TRACE_FUNCTION();
     char infoLog[512];
     int success;
 
@@ -0,0 +1,151 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+// CPU timeline of named scopes, written as Chrome trace event JSON that
+// about:tracing and ui.perfetto.dev open. Only built in with -DTRACE
+// (cmake -DTRACE=ON); otherwise every macro expands to nothing.
+//
+//     TRACE_FUNCTION();            // times the rest of the enclosing function
+//     TRACE_SCOPE("upload");       // times the rest of the enclosing block
+//     TRACE_WRITE(TRACE_OUTPUT);   // dump what the buffers hold
+//
+// Every thread records into its own ring buffer, so recording takes no lock;
+// a ring keeps the last TRACE_BUFFER_EVENTS scopes of its thread.
+#ifndef TRACE_OUTPUT
+#define TRACE_OUTPUT "trace.json"
+#endif
+
+#ifdef TRACE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+
+#define TRACE_ENABLED 1
+#define TRACE_BUFFER_EVENTS (1 << 16)
+
+typedef struct {
+    const char *name;  // a string that outlives the trace
+    uint64_t start, end;  // ns
+} TraceEvent;
+
+typedef struct TraceBuffer {
+    TraceEvent events[TRACE_BUFFER_EVENTS];
+    atomic_ulong count;  // events ever recorded
+    unsigned int thread;
+    struct TraceBuffer *next;
+} TraceBuffer;
+
+typedef struct {
+    const char *name;
+    uint64_t start;
+} TraceSpan;
+
+_Thread_local TraceBuffer *traceBuffer;
+TraceBuffer *traceBuffers;
+unsigned int traceNumThreads;
+uint64_t traceEpoch;
+pthread_mutex_t traceMutex = PTHREAD_MUTEX_INITIALIZER;
+
+uint64_t traceTime()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000u + now.tv_nsec;
+}
+
+// Timestamps count from program start, before any span can begin
+__attribute__((constructor)) static void initTraceEpoch()
+{
+    traceEpoch = traceTime();
+}
+
+// First event of the calling thread, give it a buffer. Threads are numbered in
+// the order they first record.
+static TraceBuffer *createTraceBuffer()
+{
+    TraceBuffer *buffer = calloc(1, sizeof(TraceBuffer));
+    if (!buffer) {
+        printf("ERROR::TRACE::OUT_OF_MEMORY\n");
+        exit(EXIT_FAILURE);
+    }
+    pthread_mutex_lock(&traceMutex);
+    buffer->thread = ++traceNumThreads;
+    buffer->next = traceBuffers;
+    traceBuffers = buffer;
+    pthread_mutex_unlock(&traceMutex);
+    return traceBuffer = buffer;
+}
+
+TraceSpan beginTraceSpan(const char *name)
+{
+    return (TraceSpan) {name, traceTime()};
+}
+
+void endTraceSpan(TraceSpan *span)
+{
+    uint64_t end = traceTime();
+    TraceBuffer *buffer = traceBuffer ? traceBuffer : createTraceBuffer();
+    // only this thread writes the buffer, the release publishes the event to writeTrace()
+    unsigned long count = atomic_load_explicit(&buffer->count, memory_order_relaxed);
+    TraceEvent *event = &buffer->events[count % TRACE_BUFFER_EVENTS];
+    event->name = span->name;
+    event->start = span->start;
+    event->end = end;
+    atomic_store_explicit(&buffer->count, count + 1, memory_order_release);
+}
+
+// Write the events held by every thread to `path`. Threads may keep recording
+// meanwhile; an event overwritten while it is being written comes out mixed
+// with its successor, which is harmless for a rare dump.
+void writeTrace(const char *path)
+{
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        printf("ERROR::TRACE::CANNOT_WRITE %s\n", path);
+        return;
+    }
+
+    pthread_mutex_lock(&traceMutex);
+    unsigned long numEvents = 0;
+    fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    for (TraceBuffer *buffer = traceBuffers; buffer; buffer = buffer->next) {
+        fprintf(f, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, \"args\": {\"name\": \"thread %u\"}}",
+            buffer == traceBuffers ? "" : ",\n", buffer->thread, buffer->thread);
+
+        unsigned long count = atomic_load_explicit(&buffer->count, memory_order_acquire);
+        unsigned long first = count > TRACE_BUFFER_EVENTS ? count - TRACE_BUFFER_EVENTS : 0;
+        for (unsigned long i = first; i < count; i++) {
+            const TraceEvent *event = &buffer->events[i % TRACE_BUFFER_EVENTS];
+            fprintf(f, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f}",
+                event->name, buffer->thread, (event->start - traceEpoch) * 1e-3, (event->end - event->start) * 1e-3);
+        }
+        numEvents += count - first;
+    }
+    pthread_mutex_unlock(&traceMutex);
+
+    fprintf(f, "\n]}\n");
+    fclose(f);
+    printf("trace: %lu events written to %s\n", numEvents, path);
+}
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) \
+    TraceSpan TRACE_CONCAT(traceSpan, __LINE__) __attribute__((cleanup(endTraceSpan))) = beginTraceSpan(name)
+#define TRACE_FUNCTION() TRACE_SCOPE(__func__)
+#define TRACE_WRITE(path) writeTrace(path)
+
+#else
+
+#define TRACE_ENABLED 0
+#define TRACE_SCOPE(name) ((void) 0)
+#define TRACE_FUNCTION() ((void) 0)
+#define TRACE_WRITE(path) ((void) 0)
+
+#endif // TRACE
+
+#endif // _TRACE_H_